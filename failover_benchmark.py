@@ -0,0 +1,304 @@
+"""Failover benchmark for the GA pair.
+
+Starts a full local topology (primary GA on 127.0.0.1, secondary GA on
+127.0.0.2, plus the location 1 GC and actors on 127.0.0.1), drives steady
+load through the GC like a PS would, kills the primary GA with SIGKILL and
+restarts it at scripted times, and reports:
+
+  - time to the first successful request after the kill and after the restart
+  - technical errors and timeouts seen while each gap lasted
+  - operations lost or double-applied, from comparing the operation log of
+    each GA with what the load generator saw acknowledged
+
+Both GAs run with --embedded so each one owns its store; with the Postgres
+backend they would share the database on localhost:5434 and their logs
+could not be compared. Binaries are taken from build/ (make all).
+
+    python3 failover_benchmark.py --duration 60 --kill-at 15 --restart-at 35 --json result.json
+"""
+import argparse
+import json
+import os
+import random
+import shutil
+import signal
+import struct
+import subprocess
+import tempfile
+import threading
+import time
+from collections import Counter
+
+import zmq
+
+PRIMARY_IP = "127.0.0.1"
+SECONDARY_IP = "127.0.0.2"
+REQUEST_FORMAT = "=iib3x"
+REQUEST_SIZE = struct.calcsize(REQUEST_FORMAT)
+BUSINESS_ERRORS = [
+    "No available copies",
+    "No active loan found",
+    "Maximum renewal limit reached",
+    "Book does not exist",
+]
+BOOK_CODES = list(range(100001, 100021))
+
+
+class Topology:
+    def __init__(self, buildDir, workDir):
+        self.buildDir = os.path.abspath(buildDir)
+        self.runDir = os.path.join(workDir, "run")
+        self.logDir = os.path.join(workDir, "logs")
+        os.makedirs(self.runDir)
+        os.makedirs(self.logDir)
+        # Every binary reads ../.env and GA seeds its store from ../init.sql
+        with open(os.path.join(workDir, ".env"), "w") as envFile:
+            envFile.write(f"IP_SEDE_1={PRIMARY_IP}\nIP_SEDE_2={SECONDARY_IP}\n")
+        shutil.copy(os.path.join(os.path.dirname(os.path.abspath(__file__)), "init.sql"), workDir)
+        self.processes = {}
+
+    def start(self, name, binary, *arguments):
+        logFile = open(os.path.join(self.logDir, f"{name}.log"), "ab")
+        self.processes[name] = subprocess.Popen(
+            [os.path.join(self.buildDir, binary), *arguments],
+            cwd=self.runDir, stdout=logFile, stderr=subprocess.STDOUT, stdin=subprocess.DEVNULL)
+
+    def kill(self, name):
+        process = self.processes.pop(name, None)
+        if process and process.poll() is None:
+            process.send_signal(signal.SIGKILL)
+            process.wait()
+
+    def stopAll(self):
+        for name in list(self.processes):
+            self.kill(name)
+
+
+class LoadGenerator:
+    """Closed-loop workers sending loans, renewals and returns to the GC."""
+
+    def __init__(self, gcEndpoint, workers, rate, timeoutMs):
+        self.gcEndpoint = gcEndpoint
+        self.workers = workers
+        self.intervalSeconds = workers / rate
+        self.timeoutMs = timeoutMs
+        self.running = threading.Event()
+        self.resultsLock = threading.Lock()
+        self.results = []
+        self.threads = []
+
+    def start(self):
+        self.running.set()
+        for workerIndex in range(self.workers):
+            thread = threading.Thread(target=self.workerLoop, args=(workerIndex,), daemon=True)
+            thread.start()
+            self.threads.append(thread)
+
+    def stop(self):
+        self.running.clear()
+        for thread in self.threads:
+            thread.join()
+
+    def connect(self, context):
+        socket = context.socket(zmq.REQ)
+        socket.setsockopt(zmq.RCVTIMEO, self.timeoutMs)
+        socket.setsockopt(zmq.SNDTIMEO, self.timeoutMs)
+        socket.setsockopt(zmq.LINGER, 0)
+        socket.connect(self.gcEndpoint)
+        return socket
+
+    def workerLoop(self, workerIndex):
+        randomSource = random.Random(workerIndex)
+        context = zmq.Context()
+        socket = self.connect(context)
+        loanedBooks = []
+
+        while self.running.is_set():
+            cycleStart = time.time()
+            if loanedBooks and randomSource.random() < 0.5:
+                bookCode = randomSource.choice(loanedBooks)
+                requestType = 1 if randomSource.random() < 0.3 else 2
+            else:
+                bookCode = randomSource.choice(BOOK_CODES)
+                requestType = 0
+
+            sentAt = time.time()
+            try:
+                socket.send(struct.pack(REQUEST_FORMAT, requestType, bookCode, 0))
+                responseText = socket.recv().decode("utf-8", errors="ignore")
+                if any(error in responseText for error in BUSINESS_ERRORS):
+                    outcome = "business"
+                elif "Error" in responseText or "ERROR" in responseText or "error" in responseText:
+                    outcome = "error"
+                else:
+                    outcome = "ok"
+            except zmq.error.Again:
+                # A REQ socket that timed out cannot be reused
+                socket.close()
+                socket = self.connect(context)
+                outcome = "timeout"
+            repliedAt = time.time()
+
+            if outcome == "ok" and requestType == 0:
+                loanedBooks.append(bookCode)
+            elif outcome in ("ok", "business") and requestType == 2 and bookCode in loanedBooks:
+                loanedBooks.remove(bookCode)
+
+            with self.resultsLock:
+                self.results.append((sentAt, repliedAt, requestType, bookCode, outcome))
+            time.sleep(max(0.0, self.intervalSeconds - (time.time() - cycleStart)))
+
+        socket.close()
+        context.term()
+
+
+def readOperationLog(endpoint, timeoutMs=5000):
+    """Pulls every operation a GA still holds through its SYNC:<id> endpoint."""
+    context = zmq.Context()
+    operations = Counter()
+    cursor = 0
+    try:
+        while True:
+            socket = context.socket(zmq.REQ)
+            socket.setsockopt(zmq.RCVTIMEO, timeoutMs)
+            socket.setsockopt(zmq.LINGER, 0)
+            socket.connect(endpoint)
+            socket.send(f"SYNC:{cursor}".encode())
+            try:
+                response = socket.recv()
+            except zmq.error.Again:
+                return None
+            finally:
+                socket.close()
+            if response == b"NO_SYNC_NEEDED" or len(response) < 8:
+                return operations
+            cursor = struct.unpack_from("<q", response, 0)[0]
+            for offset in range(8, len(response) - REQUEST_SIZE + 1, REQUEST_SIZE):
+                requestType, bookCode, location = struct.unpack_from(REQUEST_FORMAT, response, offset)
+                operations[(requestType, bookCode, location)] += 1
+    finally:
+        context.term()
+
+
+def measureGap(results, eventTime):
+    if eventTime is None:
+        return None
+    afterEvent = [result for result in results if result[0] >= eventTime]
+    recovered = [result[1] for result in afterEvent if result[4] == "ok"]
+    recoveredAt = min(recovered) if recovered else None
+    gapEnd = recoveredAt if recoveredAt is not None else float("inf")
+    inGap = [result for result in results if result[1] >= eventTime and result[0] < gapEnd]
+    return {
+        "timeToFirstSuccessMs": round((recoveredAt - eventTime) * 1000, 1) if recoveredAt else None,
+        "errorsDuringGap": sum(1 for result in inGap if result[4] == "error"),
+        "timeoutsDuringGap": sum(1 for result in inGap if result[4] == "timeout"),
+    }
+
+
+def compareWithLog(results, loggedOperations):
+    if loggedOperations is None:
+        return None
+    acknowledged = Counter()
+    uncertain = Counter()
+    for _, _, requestType, bookCode, outcome in results:
+        if outcome == "ok":
+            acknowledged[(requestType, bookCode, 0)] += 1
+        elif outcome in ("error", "timeout"):
+            uncertain[(requestType, bookCode, 0)] += 1
+
+    lost = doubleApplied = appliedWithoutReply = 0
+    for key in set(acknowledged) | set(loggedOperations):
+        logged = loggedOperations[key]
+        lost += max(0, acknowledged[key] - logged)
+        extra = max(0, logged - acknowledged[key])
+        appliedWithoutReply += min(extra, uncertain[key])
+        doubleApplied += max(0, extra - uncertain[key])
+    return {
+        "loggedOperations": sum(loggedOperations.values()),
+        "lost": lost,
+        "doubleApplied": doubleApplied,
+        "appliedWithoutReply": appliedWithoutReply,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Failover benchmark for the GA pair")
+    parser.add_argument("--build-dir", default="build")
+    parser.add_argument("--duration", type=float, default=60.0)
+    parser.add_argument("--kill-at", type=float, default=15.0)
+    parser.add_argument("--restart-at", type=float, default=35.0, help="negative to leave the primary down")
+    parser.add_argument("--rate", type=float, default=50.0, help="requests per second across all workers")
+    parser.add_argument("--workers", type=int, default=4)
+    parser.add_argument("--timeout-ms", type=int, default=3000)
+    parser.add_argument("--settle", type=float, default=8.0, help="seconds to wait for replication before reading logs")
+    parser.add_argument("--json", help="write the report to this file")
+    parser.add_argument("--keep", action="store_true", help="keep the working directory and process logs")
+    arguments = parser.parse_args()
+
+    workDir = tempfile.mkdtemp(prefix="failover_bench_")
+    topology = Topology(arguments.build_dir, workDir)
+    load = LoadGenerator(f"tcp://{PRIMARY_IP}:5555", arguments.workers, arguments.rate, arguments.timeout_ms)
+    killTime = restartTime = None
+
+    try:
+        print(f"[Bench] Starting topology in {workDir}")
+        topology.start("ga2", "ga", "2", "--embedded")
+        time.sleep(1)
+        topology.start("ga1", "ga", "1", "--embedded")
+        for actorName, actorBinary in (("ap", "ap"), ("ar", "ar"), ("ad", "ad")):
+            topology.start(actorName, actorBinary, "1")
+        topology.start("gc", "gc", "1")
+        time.sleep(3)
+
+        print(f"[Bench] Load: {arguments.rate} req/s over {arguments.workers} workers for {arguments.duration} s")
+        startTime = time.time()
+        load.start()
+        while time.time() - startTime < arguments.duration:
+            elapsed = time.time() - startTime
+            if killTime is None and elapsed >= arguments.kill_at:
+                killTime = time.time()
+                topology.kill("ga1")
+                print(f"[Bench] Killed primary GA at {elapsed:.1f} s")
+            if killTime and restartTime is None and 0 <= arguments.restart_at <= elapsed:
+                restartTime = time.time()
+                topology.start("ga1", "ga", "1", "--embedded")
+                print(f"[Bench] Restarted primary GA at {elapsed:.1f} s")
+            time.sleep(0.05)
+        load.stop()
+
+        print(f"[Bench] Waiting {arguments.settle} s for replication to settle")
+        time.sleep(arguments.settle)
+        primaryLog = readOperationLog(f"tcp://{PRIMARY_IP}:5565") if restartTime else None
+        secondaryLog = readOperationLog(f"tcp://{SECONDARY_IP}:5563")
+    finally:
+        load.stop()
+        topology.stopAll()
+
+    results = sorted(load.results)
+    outcomes = Counter(result[4] for result in results)
+    latencies = sorted((result[1] - result[0]) * 1000 for result in results if result[4] == "ok")
+    report = {
+        "requests": len(results),
+        "outcomes": dict(outcomes),
+        "p50LatencyMs": round(latencies[len(latencies) // 2], 2) if latencies else None,
+        "p99LatencyMs": round(latencies[int(len(latencies) * 0.99)], 2) if latencies else None,
+        "afterKill": measureGap(results, killTime),
+        "afterRestart": measureGap(results, restartTime),
+        "primaryLog": compareWithLog(results, primaryLog),
+        "secondaryLog": compareWithLog(results, secondaryLog),
+        "logDivergence": sum(((primaryLog - secondaryLog) + (secondaryLog - primaryLog)).values())
+                         if primaryLog is not None and secondaryLog is not None else None,
+    }
+
+    print(json.dumps(report, indent=2))
+    if arguments.json:
+        with open(arguments.json, "w") as reportFile:
+            json.dump(report, reportFile, indent=2)
+    if arguments.keep:
+        print(f"[Bench] Process logs kept in {topology.logDir}")
+    else:
+        shutil.rmtree(workDir, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -24,10 +24,47 @@ CREATE TABLE IF NOT EXISTS operation_log (
     request_type INT NOT NULL,
     code INT NOT NULL,
     location INT NOT NULL,
-    timestamp TIMESTAMP DEFAULT NOW()
-);
+    timestamp TIMESTAMP DEFAULT NOW(),
+    -- 0 when this GA served the operation, otherwise the site it was replicated from and its id there
+    origin_site INT NOT NULL DEFAULT 0,
+    origin_id BIGINT NOT NULL DEFAULT 0
+) PARTITION BY RANGE (id);
+
+-- GA creates the following partitions ahead of the sequence and archives closed ones
+CREATE TABLE IF NOT EXISTS operation_log_p0 PARTITION OF operation_log FOR VALUES FROM (1) TO (100001);
+CREATE TABLE IF NOT EXISTS operation_log_p1 PARTITION OF operation_log FOR VALUES FROM (100001) TO (200001);
 
 CREATE INDEX idx_operation_log_timestamp ON operation_log(timestamp);
+CREATE INDEX idx_operation_log_origin ON operation_log(origin_site, id);
+
+CREATE TABLE IF NOT EXISTS applied_requests (
+    request_key VARCHAR(32) PRIMARY KEY,
+    result TEXT NOT NULL,
+    applied_at TIMESTAMP DEFAULT NOW()
+);
+
+-- Applied operations per book, site and day, kept by GA in the same transaction as each operation
+CREATE TABLE IF NOT EXISTS uso_diario (
+    dia DATE NOT NULL,
+    codigo INT NOT NULL,
+    sede INT NOT NULL,
+    prestamos BIGINT NOT NULL DEFAULT 0,
+    renovaciones BIGINT NOT NULL DEFAULT 0,
+    devoluciones BIGINT NOT NULL DEFAULT 0,
+    PRIMARY KEY (dia, codigo, sede)
+);
+
+-- Patrons waiting for a copy of a book at a site, in arrival order; a return there lends its copy to the oldest row
+CREATE TABLE IF NOT EXISTS reservas (
+    id BIGSERIAL PRIMARY KEY,
+    codigo INT NOT NULL,
+    sede INT NOT NULL,
+    patron VARCHAR(64) NOT NULL,
+    creado TIMESTAMP DEFAULT NOW(),
+    UNIQUE (codigo, sede, patron)
+);
+
+CREATE INDEX idx_reservas_cola ON reservas(codigo, sede, id);
 
 INSERT INTO libros (codigo, titulo, autor, ejemplares_sede1, ejemplares_sede2, ejemplares_totales_sede1, ejemplares_totales_sede2) VALUES
 (100001, 'Cien Años de Soledad', 'Gabriel García Márquez', 3, 4, 5, 5),
@@ -5,6 +5,15 @@ import random
 from locust import User, task, between, events
 from threading import Lock
 
+#Clients give up after this long, and say so in the request's deadline so the
+#system stops working on requests nobody is waiting for
+REQUEST_TIMEOUT_MS = 10000
+
+def requestDeadline():
+    #Low 24 bits of the wall-clock millisecond, as utils/deadline.cpp reads it; 0 is no deadline
+    deadline = (int(time.time() * 1000) + REQUEST_TIMEOUT_MS) & 0xFFFFFF
+    return (deadline or 1).to_bytes(3, 'little')
+
 class LibraryUserBase(User):
     abstract = True
     wait_time = between(0.1, 0.5)
@@ -29,8 +38,8 @@ class LibraryUserBase(User):
         
         self.context = zmq.Context()
         self.socket = self.context.socket(zmq.REQ)
-        self.socket.setsockopt(zmq.RCVTIMEO, 10000)
-        self.socket.setsockopt(zmq.SNDTIMEO, 10000)
+        self.socket.setsockopt(zmq.RCVTIMEO, REQUEST_TIMEOUT_MS)
+        self.socket.setsockopt(zmq.SNDTIMEO, REQUEST_TIMEOUT_MS)
         self.socket.connect(self.gcEndpoint)
         
         print(f"[Locust-{self.sedeName}] Connected to {self.gcEndpoint}")
@@ -52,7 +61,7 @@ class LibraryUserBase(User):
         requestName = f"{requestNames[requestType]}_{bookCode}_{self.sedeName}"
         
         try:
-            requestData = struct.pack('=iib3x', requestType, bookCode, self.locationId)
+            requestData = struct.pack('=B3sib3x', requestType, requestDeadline(), bookCode, self.locationId)
         except Exception as packError:
             print(f"[Locust-{self.sedeName}] Packing error: {packError}")
             events.request.fire(
@@ -85,7 +94,7 @@ class LibraryUserBase(User):
             ]
             
             isBusinessError = any(err in responseText for err in businessErrors)
-            isTechnicalError = "Error" in responseText and not isBusinessError
+            isTechnicalError = ("Error" in responseText or responseText.startswith("Expired")) and not isBusinessError
             isSuccess = not isTechnicalError and not ("Error en BD" in responseText)
             
             events.request.fire(
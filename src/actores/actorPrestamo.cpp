@@ -1,17 +1,32 @@
 #include <zmq.hpp>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <thread>
 #include <chrono>
 #include <atomic>
 #include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include "../../utils/structs.cpp"
+#include "../../utils/deadline.cpp"
+#include "../../utils/shardMap.cpp"
+#include "../../utils/gaRouter.cpp"
 
-std::atomic<bool> primaryGaAlive(true);
 std::atomic<bool> isRunning(true);
-std::mutex gaAddressMutex;
-std::string currentGaAddress;
+ShardRouter shardRouter("AP");
+int shardCount = 1;
+//Requests dropped on arrival because their deadline had passed
+std::uint64_t expiredRequestCount = 0;
+//A BULK batch is applied by GA in one transaction and needs far longer
+const int bulkGaTimeoutMs = 60000;
+//A checkout basket is one BULK-style transaction, slower than the single
+//operations the adaptive timeout learns from
+const int checkoutGaTimeoutMs = 5000;
 
 void obtainEnvData(std::vector<std::string> &environmentVariables){
     std::fstream configFile("../.env");
@@ -21,9 +36,9 @@ void obtainEnvData(std::vector<std::string> &environmentVariables){
     }
 }
 
-void monitorGaHeartbeat(zmq::context_t &context, const std::string &primaryIp, const std::string &secondaryIp){
+//One monitor per shard, watching the heartbeat of that shard's primary GA
+void monitorGaHeartbeat(zmq::context_t &context, std::string heartbeatEndpoint, GaRouter &gaRouter){
     zmq::socket_t heartbeatSocket(context, zmq::socket_type::sub);
-    std::string heartbeatEndpoint = "tcp://" + primaryIp + ":5562";
     heartbeatSocket.connect(heartbeatEndpoint);
     heartbeatSocket.set(zmq::sockopt::subscribe, "");
     heartbeatSocket.set(zmq::sockopt::rcvtimeo, 5000);
@@ -32,6 +47,7 @@ void monitorGaHeartbeat(zmq::context_t &context, const std::string &primaryIp, c
     
     int missedHeartbeatCount = 0;
     const int maxMissedHeartbeats = 3;
+    bool primaryGaAlive = true;
     
     while(isRunning){
         zmq::message_t heartbeatMessage;
@@ -40,21 +56,15 @@ void monitorGaHeartbeat(zmq::context_t &context, const std::string &primaryIp, c
         if(receiveResult && heartbeatMessage.size() > 0){
             missedHeartbeatCount = 0;
             if(!primaryGaAlive){
-                std::cout << "\n[AP-Recovery] Primary GA is back, switching\n\n";
-                {
-                    std::lock_guard<std::mutex> lock(gaAddressMutex);
-                    currentGaAddress = "tcp://" + primaryIp + ":5560";
-                }
+                std::cout << "\n[AP-Recovery] Primary GA at " << heartbeatEndpoint << " is back, switching\n\n";
+                gaRouter.setPrimaryReachable(true);
                 primaryGaAlive = true;
             }
         } else {
             missedHeartbeatCount++;
             if(missedHeartbeatCount >= maxMissedHeartbeats && primaryGaAlive){
-                std::cout << "\n[AP-Failover] Primary GA down, switching to secondary\n\n";
-                {
-                    std::lock_guard<std::mutex> lock(gaAddressMutex);
-                    currentGaAddress = "tcp://" + secondaryIp + ":5560";
-                }
+                std::cout << "\n[AP-Failover] Primary GA at " << heartbeatEndpoint << " down, switching to secondary\n\n";
+                gaRouter.setPrimaryReachable(false);
                 primaryGaAlive = false;
             }
         }
@@ -62,47 +72,286 @@ void monitorGaHeartbeat(zmq::context_t &context, const std::string &primaryIp, c
     std::cout << "[AP-Heartbeat] Monitor stopped\n";
 }
 
-std::string getCurrentGaAddress(){
-    std::lock_guard<std::mutex> lock(gaAddressMutex);
-    return currentGaAddress;
+//A BULK or CHECKOUT split by shard: the operations, one message per shard
+//with the ones it owns (empty when it owns none), and where each came from
+struct ShardSplit{
+    std::vector<Request> operations;
+    std::vector<zmq::message_t> messages;
+    std::vector<std::vector<std::uint32_t>> positions;
+};
+
+bool splitByShard(const zmq::message_t &packedMessage, std::int32_t maxOperations, ShardSplit &split){
+    Request header;
+    if(packedMessage.size() < sizeof(Request)){
+        return false;
+    }
+    memcpy(&header, packedMessage.data(), sizeof(Request));
+    if(header.code <= 0 || header.code > maxOperations || packedMessage.size() != sizeof(Request) * (std::size_t(header.code) + 1)){
+        return false;
+    }
+    split.operations.resize(std::size_t(header.code));
+    memcpy(split.operations.data(), static_cast<const char*>(packedMessage.data()) + sizeof(Request), split.operations.size() * sizeof(Request));
+
+    split.positions.assign(std::size_t(shardCount), std::vector<std::uint32_t>());
+    for(std::size_t position = 0; position < split.operations.size(); position++){
+        split.positions[shardOfBook(split.operations[position].code, shardCount)].push_back(std::uint32_t(position));
+    }
+    split.messages.clear();
+    for(int shard = 0; shard < shardCount; shard++){
+        const std::vector<std::uint32_t> &shardPositions = split.positions[shard];
+        split.messages.emplace_back(shardPositions.empty() ? 0 : sizeof(Request) * (shardPositions.size() + 1));
+        if(shardPositions.empty()){
+            continue;
+        }
+        Request shardHeader = header;
+        shardHeader.code = std::int32_t(shardPositions.size());
+        char *shardData = static_cast<char*>(split.messages.back().data());
+        memcpy(shardData, &shardHeader, sizeof(Request));
+        for(std::size_t index = 0; index < shardPositions.size(); index++){
+            memcpy(shardData + (index + 1) * sizeof(Request), &split.operations[shardPositions[index]], sizeof(Request));
+        }
+    }
+    return true;
 }
 
-std::string sendRequestWithFailover(zmq::message_t& requestMessage, zmq::context_t& context){
-    int maxRetryAttempts = 3;
-    int baseDelayMs = 200;
-    int maxDelayMs = 1000;
-    int socketTimeoutMs = 2000;
-    
-    for(int attemptNumber = 0; attemptNumber < maxRetryAttempts; attemptNumber++){
-        try {
-            zmq::socket_t gaSocket(context, zmq::socket_type::req);
-            gaSocket.set(zmq::sockopt::rcvtimeo, socketTimeoutMs);
-            gaSocket.set(zmq::sockopt::sndtimeo, socketTimeoutMs);
-            gaSocket.connect(getCurrentGaAddress());
-
-            zmq::message_t requestCopy(requestMessage.size());
-            memcpy(requestCopy.data(), requestMessage.data(), requestMessage.size());
-            gaSocket.send(requestCopy, zmq::send_flags::none);
-
-            zmq::message_t gaResponse;
-            zmq::recv_result_t receiveResult = gaSocket.recv(gaResponse, zmq::recv_flags::none);
-            gaSocket.close();
-            
-            if(receiveResult && gaResponse.size() > 0){
-                return std::string(static_cast<char*>(gaResponse.data()), gaResponse.size());
+//Sends every non-empty message to its shard at once and waits for all replies
+std::vector<std::string> sendToShards(std::vector<zmq::message_t> &shardMessages, zmq::context_t &context, int socketTimeoutMs){
+    std::vector<std::string> shardResponses(shardMessages.size());
+    std::vector<std::thread> senders;
+    for(std::size_t shard = 0; shard < shardMessages.size(); shard++){
+        if(shardMessages[shard].size() > 0){
+            senders.emplace_back([&, shard](){
+                shardResponses[shard] = shardRouter.shard(int(shard)).send(shardMessages[shard], context, socketTimeoutMs);
+            });
+        }
+    }
+    for(std::thread &sender : senders){
+        sender.join();
+    }
+    return shardResponses;
+}
+
+//Each shard resolves its part of the batch; outcomes go back to batch order,
+//a shard that did not answer leaves its operations FAILED and one that
+//dropped its part for the deadline marks them EXPIRED
+std::string sendBulkToShards(zmq::message_t &bulkMessage, zmq::context_t &context){
+    ShardSplit split;
+    if(!splitByShard(bulkMessage, maxBulkOperations, split)){
+        return "Error: Malformed bulk request";
+    }
+    std::vector<std::string> shardResponses = sendToShards(split.messages, context, bulkGaTimeoutMs);
+    std::string outcomes(split.operations.size(), char(BulkOutcome::FAILED));
+    bool anyAnswered = false;
+    for(int shard = 0; shard < shardCount; shard++){
+        const std::string &shardResponse = shardResponses[shard];
+        const std::vector<std::uint32_t> &shardPositions = split.positions[shard];
+        if(shardPositions.empty()){
+            continue;
+        }
+        if(shardResponse == expiredRequestResponse){
+            anyAnswered = true;
+            for(std::uint32_t position : shardPositions){
+                outcomes[position] = char(BulkOutcome::EXPIRED);
             }
-        } catch (const zmq::error_t& error) {
-            std::cerr << "[AP-Error] ZMQ error on attempt " << (attemptNumber + 1) << ": " << error.what() << "\n";
+            continue;
+        }
+        if(shardResponse.rfind("BULK:", 0) != 0 || shardResponse.size() - 5 != shardPositions.size()){
+            std::cout << "[AP-Shard] Shard " << shard + 1 << " did not apply its " << shardPositions.size() << " operations\n";
+            continue;
+        }
+        anyAnswered = true;
+        for(std::size_t index = 0; index < shardPositions.size(); index++){
+            outcomes[shardPositions[index]] = shardResponse[5 + index];
         }
+    }
+    return anyAnswered ? "BULK:" + outcomes : "ERROR";
+}
 
-        if(attemptNumber < maxRetryAttempts - 1){
-            int delayMs = std::min(baseDelayMs * (1 << attemptNumber), maxDelayMs);
-            std::cout << "[AP-Retry] Request failed, retrying in " << delayMs << " ms\n";
-            std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+//A basket of books on one shard goes there whole. Otherwise each shard
+//applies its items in its own transaction; all-or-nothing cannot hold across
+//separate transactions, so such a basket is refused before any is applied.
+std::string sendCheckoutToShards(zmq::message_t &checkoutMessage, zmq::context_t &context){
+    ShardSplit split;
+    if(!splitByShard(checkoutMessage, maxCheckoutItems, split)){
+        return "Error: Malformed checkout request";
+    }
+    Request checkoutHeader;
+    memcpy(&checkoutHeader, checkoutMessage.data(), sizeof(Request));
+    int involvedShards = 0;
+    int lastInvolvedShard = 0;
+    for(int shard = 0; shard < shardCount; shard++){
+        if(!split.positions[shard].empty()){
+            involvedShards++;
+            lastInvolvedShard = shard;
+        }
+    }
+    if(involvedShards == 1){
+        return shardRouter.shard(lastInvolvedShard).send(checkoutMessage, context, checkoutGaTimeoutMs);
+    }
+    if(checkoutHeader.checkoutMode == CheckoutMode::ALL_OR_NOTHING){
+        return "Error: An all-or-nothing checkout cannot mix books kept by different shards";
+    }
+    //Checked here as GA does, so no shard applies its part of a basket another refuses
+    for(const Request &item : split.operations){
+        if(int(item.requestType) > 2 || item.location != checkoutHeader.location){
+            return "Error: Checkout items must be loans, renewals or returns at the checkout's location";
+        }
+    }
+
+    std::vector<std::string> shardResponses = sendToShards(split.messages, context, checkoutGaTimeoutMs);
+    const char *itemTypeNames[] = {"LOAN", "RENEWAL", "RETURN"};
+    std::vector<std::string> itemLines(split.operations.size());
+    std::size_t appliedCount = 0;
+    bool anyAnswered = false;
+    for(int shard = 0; shard < shardCount; shard++){
+        const std::vector<std::uint32_t> &shardPositions = split.positions[shard];
+        if(shardPositions.empty()){
+            continue;
+        }
+        //Summary line, then one line per item in the order they were sent
+        std::vector<std::string> responseLines;
+        std::size_t lineStart = 0;
+        const std::string &shardResponse = shardResponses[shard];
+        while(lineStart <= shardResponse.size()){
+            std::size_t lineEnd = std::min(shardResponse.find('\n', lineStart), shardResponse.size());
+            responseLines.push_back(shardResponse.substr(lineStart, lineEnd - lineStart));
+            lineStart = lineEnd + 1;
+        }
+        std::size_t shardApplied = 0;
+        bool answered = std::sscanf(shardResponse.c_str(), "Checkout: %zu of", &shardApplied) == 1 &&
+                        responseLines.size() == shardPositions.size() + 1;
+        anyAnswered = anyAnswered || answered;
+        if(answered){
+            appliedCount += shardApplied;
+        }
+        for(std::size_t index = 0; index < shardPositions.size(); index++){
+            const Request &item = split.operations[shardPositions[index]];
+            itemLines[shardPositions[index]] = answered ? responseLines[index + 1] :
+                std::string(itemTypeNames[int(item.requestType)]) + " " + std::to_string(item.code) + ": " +
+                (shardResponse == "ERROR" ? "Error: Could not process checkout" : responseLines[0]);
         }
     }
-    std::cerr << "[AP-Error] All " << maxRetryAttempts << " attempts failed\n";
-    return "ERROR";
+    if(!anyAnswered){
+        return "ERROR";
+    }
+    std::string checkoutResult = "Checkout: " + std::to_string(appliedCount) + " of " + std::to_string(split.operations.size()) + " items applied";
+    for(const std::string &itemLine : itemLines){
+        checkoutResult += "\n" + itemLine;
+    }
+    return checkoutResult;
+}
+
+//Every shard ranks its own books and puts each result's score first; the
+//best of all of them are kept, in the order one index would have given
+std::string sendSearchToShards(zmq::message_t &searchMessage, zmq::context_t &context){
+    Request searchHeader;
+    memcpy(&searchHeader, searchMessage.data(), sizeof(Request));
+    std::vector<zmq::message_t> shardMessages;
+    //Every shard gets a reference to the same query
+    for(int shard = 0; shard < shardCount; shard++){
+        shardMessages.emplace_back();
+        shardMessages.back().copy(searchMessage);
+    }
+    std::vector<std::string> shardResponses = sendToShards(shardMessages, context, 0);
+
+    std::vector<std::pair<int, std::string>> scoredLines;
+    bool anyAnswered = false;
+    for(int shard = 0; shard < shardCount; shard++){
+        const std::string &shardResponse = shardResponses[shard];
+        if(shardResponse.rfind("Search results:", 0) != 0){
+            //GA's own errors (an empty query) are the same on every shard
+            if(shardResponse != "ERROR"){
+                return shardResponse;
+            }
+            std::cout << "[AP-Shard] Shard " << shard + 1 << " did not answer the search\n";
+            continue;
+        }
+        anyAnswered = true;
+        std::size_t lineStart = shardResponse.find('\n');
+        while(lineStart != std::string::npos){
+            std::size_t lineEnd = shardResponse.find('\n', lineStart + 1);
+            std::string line = shardResponse.substr(lineStart + 1, lineEnd == std::string::npos ? std::string::npos : lineEnd - lineStart - 1);
+            std::size_t scoreEnd = line.find(' ');
+            if(scoreEnd != std::string::npos){
+                scoredLines.emplace_back(std::atoi(line.c_str()), line.substr(scoreEnd + 1));
+            }
+            lineStart = lineEnd;
+        }
+    }
+    if(!anyAnswered){
+        return "ERROR";
+    }
+
+    std::size_t resultLimit = searchHeader.code > 0 ? std::min(std::size_t(searchHeader.code), maxSearchResults) : defaultSearchResults;
+    std::sort(scoredLines.begin(), scoredLines.end(),
+        [](const std::pair<int, std::string> &left, const std::pair<int, std::string> &right){
+            return left.first != right.first ? left.first > right.first : std::atoi(left.second.c_str()) < std::atoi(right.second.c_str());
+        });
+    scoredLines.resize(std::min(scoredLines.size(), resultLimit));
+    std::string searchResult = "Search results: " + std::to_string(scoredLines.size());
+    for(const std::pair<int, std::string> &scoredLine : scoredLines){
+        searchResult += "\n" + scoredLine.second;
+    }
+    return searchResult;
+}
+
+//Every shard tracks the loans of its own books; the counts are added and
+//the lists joined, shard by shard
+std::string sendOverdueToShards(zmq::message_t &overdueMessage, zmq::context_t &context){
+    std::vector<zmq::message_t> shardMessages;
+    for(int shard = 0; shard < shardCount; shard++){
+        shardMessages.emplace_back();
+        shardMessages.back().copy(overdueMessage);
+    }
+    std::vector<std::string> shardResponses = sendToShards(shardMessages, context, 0);
+
+    std::string countPrefix;
+    std::size_t overdueCount = 0;
+    std::string overdueLines;
+    for(int shard = 0; shard < shardCount; shard++){
+        const std::string &shardResponse = shardResponses[shard];
+        std::size_t countStart = shardResponse.find(": ");
+        if(shardResponse.rfind("Overdue loans at location", 0) != 0 || countStart == std::string::npos){
+            std::cout << "[AP-Shard] Shard " << shard + 1 << " did not answer the overdue query\n";
+            continue;
+        }
+        countPrefix = shardResponse.substr(0, countStart + 2);
+        overdueCount += std::size_t(std::atoi(shardResponse.c_str() + countStart + 2));
+        std::size_t linesStart = shardResponse.find('\n');
+        if(linesStart != std::string::npos){
+            overdueLines += shardResponse.substr(linesStart);
+        }
+    }
+    if(countPrefix.empty()){
+        return "ERROR";
+    }
+    return countPrefix + std::to_string(overdueCount) + overdueLines;
+}
+
+//socketTimeoutMs 0 lets the router derive the timeout from the GA's latency.
+//With shards, batches, baskets, searches and overdue queries span the books of several of them
+//and their replies are merged here; any other request is answered by one GA,
+//whose reply frame is handed back untouched.
+GaReply forwardRequestWithFailover(zmq::message_t& requestMessage, zmq::context_t& context, int socketTimeoutMs, zmq::message_t& reply){
+    Request parsedRequest;
+    memcpy(&parsedRequest, requestMessage.data(), sizeof(Request));
+    std::string mergedResponse;
+    if(shardCount > 1 && parsedRequest.requestType == RequestType::BULK){
+        mergedResponse = sendBulkToShards(requestMessage, context);
+    } else if(shardCount > 1 && parsedRequest.requestType == RequestType::CHECKOUT){
+        mergedResponse = sendCheckoutToShards(requestMessage, context);
+    } else if(shardCount > 1 && parsedRequest.requestType == RequestType::SEARCH){
+        mergedResponse = sendSearchToShards(requestMessage, context);
+    } else if(shardCount > 1 && parsedRequest.requestType == RequestType::OVERDUE){
+        mergedResponse = sendOverdueToShards(requestMessage, context);
+    } else {
+        return shardRouter.forward(requestMessage, context, socketTimeoutMs, reply);
+    }
+    if(mergedResponse == "ERROR"){
+        return GaReply::FAILED;
+    }
+    reply.rebuild(mergedResponse.data(), mergedResponse.size());
+    return GaReply::ANSWERED;
 }
 
 int main(int argc, char* argv[]){
@@ -112,15 +361,32 @@ int main(int argc, char* argv[]){
     if(argc == 1){
         std::cout << "[AP-Error] Cannot establish connection without IP\n";
         return 0;
-    } else if(argc == 2){
-        obtainEnvData(ipAddressList);
-        locationIndex = std::int8_t(std::stoi(argv[1])) - 1;
-        
-        if (locationIndex >= std::int8_t(ipAddressList.size())){
-            std::cout << "[AP-Error] This location does not exist\n";
-            return 0;
+    }
+    
+    bool siteLocal = false;
+    bool validArguments = true;
+    for(int argumentIndex = 2; argumentIndex < argc; argumentIndex++){
+        std::string argument = argv[argumentIndex];
+        if(argument == "--site-local"){
+            siteLocal = true;
+        } else if(argument == "--shards" && argumentIndex + 1 < argc){
+            validArguments = validArguments && parseShardCount(argv[++argumentIndex], shardCount);
+        } else {
+            validArguments = false;
         }
     }
+    if(!validArguments){
+        std::cout << "[AP-Error] Run format: ./ap #Location [--site-local] [--shards K]\n";
+        return 0;
+    }
+    
+    obtainEnvData(ipAddressList);
+    locationIndex = std::int8_t(std::stoi(argv[1])) - 1;
+    
+    if (locationIndex >= std::int8_t(ipAddressList.size())){
+        std::cout << "[AP-Error] This location does not exist\n";
+        return 0;
+    }
 
     std::cout << "========================================\n";
     std::cout << "    LOAN ACTOR (AP) - STARTING\n";
@@ -136,16 +402,26 @@ int main(int argc, char* argv[]){
     
     std::cout << "[AP] Listening on " << gcEndpoint << "\n";
 
-    {
-        std::lock_guard<std::mutex> lock(gaAddressMutex);
-        currentGaAddress = "tcp://" + ipAddressList[0] + ":5560";
-    }
+    //With --site-local this site's GA is the primary for its own operations
+    //and the other site's GA is the failover target
+    std::size_t primaryGaIndex = siteLocal ? std::size_t(locationIndex) : 0;
+    std::string &primaryGaIp = ipAddressList[primaryGaIndex];
+    std::string &secondaryGaIp = ipAddressList[1 - primaryGaIndex];
     
-    std::cout << "[AP] Primary GA: tcp://" << ipAddressList[0] << ":5560\n";
-    std::cout << "[AP] Secondary GA: tcp://" << ipAddressList[1] << ":5560\n";
+    shardRouter.configure(primaryGaIp, secondaryGaIp, shardCount);
+    
+    std::vector<std::thread> heartbeatThreads;
+    for(int shard = 0; shard < shardCount; shard++){
+        std::cout << "[AP] Primary GA: " << shardEndpoint(primaryGaIp, 5560, shard) << "\n";
+        std::cout << "[AP] Secondary GA: " << shardEndpoint(secondaryGaIp, 5560, shard) << "\n";
+        heartbeatThreads.emplace_back(monitorGaHeartbeat, std::ref(zmqContext), shardEndpoint(primaryGaIp, 5562, shard),
+                                      std::ref(shardRouter.shard(shard)));
+    }
     
-    std::thread heartbeatThread(monitorGaHeartbeat, std::ref(zmqContext), 
-                         std::ref(ipAddressList[0]), std::ref(ipAddressList[1]));
+    //Loans carry an idempotency key, so an attempt that timed out can be
+    //sent again without lending a second copy
+    RequestKeySource loanKeys("AP-" + std::to_string(int(locationIndex) + 1));
+    std::string keyedLoan;
     
     std::cout << "[AP] Ready to process LOAN requests\n\n";
 
@@ -160,22 +436,80 @@ int main(int argc, char* argv[]){
         Request parsedRequest;
         memcpy(&parsedRequest, gcRequest.data(), sizeof(Request));
         
+        //GC already dropped what expired in its queue; this catches what
+        //expired on the way here
+        if(isExpired(parsedRequest)){
+            std::cout << "[AP-Deadline] Dropped an expired request (" << ++expiredRequestCount << " so far)\n\n";
+            gcSocket.send(zmq::buffer(expiredRequestResponse), zmq::send_flags::none);
+            continue;
+        }
+        
+        bool isBulkRequest = parsedRequest.requestType == RequestType::BULK;
+        bool isSearchRequest = parsedRequest.requestType == RequestType::SEARCH;
+        bool isReserveRequest = parsedRequest.requestType == RequestType::RESERVE;
+        bool isCheckoutRequest = parsedRequest.requestType == RequestType::CHECKOUT;
+        bool isOverdueRequest = parsedRequest.requestType == RequestType::OVERDUE;
         std::cout << "[AP] Request received from GC:\n";
-        std::cout << "[AP] Type: LOAN\n";
-        std::cout << "[AP] Book code: " << parsedRequest.code << "\n";
+        if(isBulkRequest){
+            std::cout << "[AP] Type: BULK\n";
+            std::cout << "[AP] Operations: " << parsedRequest.code << "\n";
+        } else if(isSearchRequest){
+            std::cout << "[AP] Type: SEARCH\n";
+            std::cout << "[AP] Query: " << std::string(static_cast<char*>(gcRequest.data()) + sizeof(Request), gcRequest.size() - sizeof(Request)) << "\n";
+        } else if(isReserveRequest){
+            std::cout << "[AP] Type: RESERVE\n";
+            std::cout << "[AP] Book code: " << parsedRequest.code << "\n";
+            std::cout << "[AP] Patron: " << std::string(static_cast<char*>(gcRequest.data()) + sizeof(Request), gcRequest.size() - sizeof(Request)) << "\n";
+        } else if(isCheckoutRequest){
+            std::cout << "[AP] Type: CHECKOUT\n";
+            std::cout << "[AP] Items: " << parsedRequest.code
+                      << (parsedRequest.checkoutMode == CheckoutMode::ALL_OR_NOTHING ? " (all or nothing)" : "") << "\n";
+        } else if(isOverdueRequest){
+            std::cout << "[AP] Type: OVERDUE\n";
+        } else {
+            std::cout << "[AP] Type: LOAN\n";
+            std::cout << "[AP] Book code: " << parsedRequest.code << "\n";
+        }
         std::cout << "[AP] Location: " << int(parsedRequest.location) << "\n";
+        if(parsedRequest.requestType == RequestType::LOAN && gcRequest.size() == sizeof(Request)){
+            loanKeys.buildKeyedRequest(parsedRequest, keyedLoan);
+            gcRequest.rebuild(keyedLoan.data(), keyedLoan.size());
+        }
 
-        std::string gaResponse = sendRequestWithFailover(gcRequest, zmqContext);
+        zmq::message_t gaReply;
+        GaReply outcome = forwardRequestWithFailover(gcRequest, zmqContext,
+                                                     isBulkRequest ? bulkGaTimeoutMs : (isCheckoutRequest ? checkoutGaTimeoutMs : 0), gaReply);
         
-        if(gaResponse == "ERROR"){
-            gaResponse = "Error: Could not process loan operation";
+        if(outcome == GaReply::FAILED){
+            std::string failureResponse;
+            if(isSearchRequest){
+                failureResponse = "Error: Could not process search";
+            } else if(isReserveRequest){
+                failureResponse = "Error: Could not process reservation";
+            } else if(isCheckoutRequest){
+                failureResponse = "Error: Could not process checkout";
+            } else if(isOverdueRequest){
+                failureResponse = "Error: Could not process overdue query";
+            } else {
+                failureResponse = isBulkRequest ? "Error: Could not process bulk operation" : "Error: Could not process loan operation";
+            }
+            gaReply.rebuild(failureResponse.data(), failureResponse.size());
+        } else if(outcome == GaReply::EXPIRED){
+            gaReply.rebuild(expiredRequestResponse.data(), expiredRequestResponse.size());
         }
         
-        std::cout << "[AP] Sending response to GC: " << gaResponse << "\n\n";
-        gcSocket.send(zmq::buffer(gaResponse), zmq::send_flags::none);
+        std::string_view replyText = gaReply.to_string_view();
+        if(isBulkRequest && replyText.compare(0, 5, "BULK:") == 0){
+            std::cout << "[AP] Sending bulk results to GC (" << (replyText.size() - 5) << " operations)\n\n";
+        } else {
+            std::cout << "[AP] Sending response to GC: " << replyText << "\n\n";
+        }
+        gcSocket.send(gaReply, zmq::send_flags::none);
     }
     
     isRunning = false;
-    heartbeatThread.join();
+    for(std::thread &heartbeatThread : heartbeatThreads){
+        heartbeatThread.join();
+    }
     return 0;
 }
\ No newline at end of file
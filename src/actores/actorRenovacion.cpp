@@ -7,11 +7,21 @@
 #include <atomic>
 #include <mutex>
 #include "../../utils/structs.cpp"
+#include "../../utils/deadline.cpp"
+#include "../../utils/shardMap.cpp"
+#include "../../utils/gaRouter.cpp"
+#include "../../utils/journal.cpp"
 
-std::atomic<bool> primaryGaAlive(true);
 std::atomic<bool> isRunning(true);
-std::mutex gaAddressMutex;
-std::string currentGaAddress;
+ShardRouter shardRouter("AR");
+int shardCount = 1;
+//Requests dropped on arrival because their deadline had passed
+std::uint64_t expiredRequestCount = 0;
+//Store-and-forward mode: requests that cannot reach any GA are journaled
+//locally, acknowledged, and replayed in order once a GA answers again
+bool journalMode = false;
+RequestJournal requestJournal;
+const std::uint64_t journalCapacity = 100000;
 
 void obtainEnvData(std::vector<std::string> &environmentVariables){
     std::fstream configFile("../.env");
@@ -21,9 +31,9 @@ void obtainEnvData(std::vector<std::string> &environmentVariables){
     }
 }
 
-void monitorGaHeartbeat(zmq::context_t &context, const std::string &primaryIp, const std::string &secondaryIp){
+//One monitor per shard, watching the heartbeat of that shard's primary GA
+void monitorGaHeartbeat(zmq::context_t &context, std::string heartbeatEndpoint, GaRouter &gaRouter){
     zmq::socket_t heartbeatSocket(context, zmq::socket_type::sub);
-    std::string heartbeatEndpoint = "tcp://" + primaryIp + ":5562";
     heartbeatSocket.connect(heartbeatEndpoint);
     heartbeatSocket.set(zmq::sockopt::subscribe, "");
     heartbeatSocket.set(zmq::sockopt::rcvtimeo, 5000);
@@ -32,6 +42,7 @@ void monitorGaHeartbeat(zmq::context_t &context, const std::string &primaryIp, c
     
     int missedHeartbeatCount = 0;
     const int maxMissedHeartbeats = 3;
+    bool primaryGaAlive = true;
     
     while(isRunning){
         zmq::message_t heartbeatMessage;
@@ -40,21 +51,15 @@ void monitorGaHeartbeat(zmq::context_t &context, const std::string &primaryIp, c
         if(receiveResult && heartbeatMessage.size() > 0){
             missedHeartbeatCount = 0;
             if(!primaryGaAlive){
-                std::cout << "\n[AR-Recovery] Primary GA is back, switching\n\n";
-                {
-                    std::lock_guard<std::mutex> lock(gaAddressMutex);
-                    currentGaAddress = "tcp://" + primaryIp + ":5560";
-                }
+                std::cout << "\n[AR-Recovery] Primary GA at " << heartbeatEndpoint << " is back, switching\n\n";
+                gaRouter.setPrimaryReachable(true);
                 primaryGaAlive = true;
             }
         } else {
             missedHeartbeatCount++;
             if(missedHeartbeatCount >= maxMissedHeartbeats && primaryGaAlive){
-                std::cout << "\n[AR-Failover] Primary GA down, switching to secondary\n\n";
-                {
-                    std::lock_guard<std::mutex> lock(gaAddressMutex);
-                    currentGaAddress = "tcp://" + secondaryIp + ":5560";
-                }
+                std::cout << "\n[AR-Failover] Primary GA at " << heartbeatEndpoint << " down, switching to secondary\n\n";
+                gaRouter.setPrimaryReachable(false);
                 primaryGaAlive = false;
             }
         }
@@ -62,49 +67,6 @@ void monitorGaHeartbeat(zmq::context_t &context, const std::string &primaryIp, c
     std::cout << "[AR-Heartbeat] Monitor stopped\n";
 }
 
-std::string getCurrentGaAddress(){
-    std::lock_guard<std::mutex> lock(gaAddressMutex);
-    return currentGaAddress;
-}
-
-std::string sendRequestWithFailover(zmq::message_t& requestMessage, zmq::context_t& context){
-    int maxRetryAttempts = 3;
-    int baseDelayMs = 200;
-    int maxDelayMs = 1000;
-    int socketTimeoutMs = 2000;
-    
-    for(int attemptNumber = 0; attemptNumber < maxRetryAttempts; attemptNumber++){
-        try {
-            zmq::socket_t gaSocket(context, zmq::socket_type::req);
-            gaSocket.set(zmq::sockopt::rcvtimeo, socketTimeoutMs);
-            gaSocket.set(zmq::sockopt::sndtimeo, socketTimeoutMs);
-            gaSocket.connect(getCurrentGaAddress());
-
-            zmq::message_t requestCopy(requestMessage.size());
-            memcpy(requestCopy.data(), requestMessage.data(), requestMessage.size());
-            gaSocket.send(requestCopy, zmq::send_flags::none);
-
-            zmq::message_t gaResponse;
-            zmq::recv_result_t receiveResult = gaSocket.recv(gaResponse, zmq::recv_flags::none);
-            gaSocket.close();
-            
-            if(receiveResult && gaResponse.size() > 0){
-                return std::string(static_cast<char*>(gaResponse.data()), gaResponse.size());
-            }
-        } catch (const zmq::error_t& error) {
-            std::cerr << "[AR-Error] ZMQ error on attempt " << (attemptNumber + 1) << ": " << error.what() << "\n";
-        }
-
-        if(attemptNumber < maxRetryAttempts - 1){
-            int delayMs = std::min(baseDelayMs * (1 << attemptNumber), maxDelayMs);
-            std::cout << "[AR-Retry] Request failed, retrying in " << delayMs << " ms\n";
-            std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
-        }
-    }
-    std::cerr << "[AR-Error] All " << maxRetryAttempts << " attempts failed\n";
-    return "ERROR";
-}
-
 int main(int argc, char* argv[]){
     std::vector<std::string> ipAddressList;
     std::int8_t locationIndex;
@@ -112,15 +74,34 @@ int main(int argc, char* argv[]){
     if(argc == 1){
         std::cout << "[AR-Error] Cannot establish connection without IP\n";
         return 0;
-    } else if(argc == 2){
-        obtainEnvData(ipAddressList);
-        locationIndex = std::int8_t(std::stoi(argv[1])) - 1;
-        
-        if (locationIndex >= std::int8_t(ipAddressList.size())){
-            std::cout << "[AR-Error] This location does not exist\n";
-            return 0;
+    }
+    
+    bool siteLocal = false;
+    bool validArguments = true;
+    for(int argumentIndex = 2; argumentIndex < argc; argumentIndex++){
+        std::string argument = argv[argumentIndex];
+        if(argument == "--journal"){
+            journalMode = true;
+        } else if(argument == "--site-local"){
+            siteLocal = true;
+        } else if(argument == "--shards" && argumentIndex + 1 < argc){
+            validArguments = validArguments && parseShardCount(argv[++argumentIndex], shardCount);
+        } else {
+            validArguments = false;
         }
     }
+    if(!validArguments){
+        std::cout << "[AR-Error] Run format: ./ar #Location [--journal] [--site-local] [--shards K]\n";
+        return 0;
+    }
+    
+    obtainEnvData(ipAddressList);
+    locationIndex = std::int8_t(std::stoi(argv[1])) - 1;
+    
+    if (locationIndex >= std::int8_t(ipAddressList.size())){
+        std::cout << "[AR-Error] This location does not exist\n";
+        return 0;
+    }
 
     std::cout << "========================================\n";
     std::cout << "    RENEWAL ACTOR (AR) - STARTING\n";
@@ -136,16 +117,33 @@ int main(int argc, char* argv[]){
     
     std::cout << "[AR] Listening on " << gcEndpoint << "\n";
 
-    {
-        std::lock_guard<std::mutex> lock(gaAddressMutex);
-        currentGaAddress = "tcp://" + ipAddressList[0] + ":5560";
-    }
+    //With --site-local this site's GA is the primary for its own operations
+    //and the other site's GA is the failover target
+    std::size_t primaryGaIndex = siteLocal ? std::size_t(locationIndex) : 0;
+    std::string &primaryGaIp = ipAddressList[primaryGaIndex];
+    std::string &secondaryGaIp = ipAddressList[1 - primaryGaIndex];
+    
+    shardRouter.configure(primaryGaIp, secondaryGaIp, shardCount);
     
-    std::cout << "[AR] Primary GA: tcp://" << ipAddressList[0] << ":5560\n";
-    std::cout << "[AR] Secondary GA: tcp://" << ipAddressList[1] << ":5560\n";
+    std::vector<std::thread> heartbeatThreads;
+    for(int shard = 0; shard < shardCount; shard++){
+        std::cout << "[AR] Primary GA: " << shardEndpoint(primaryGaIp, 5560, shard) << "\n";
+        std::cout << "[AR] Secondary GA: " << shardEndpoint(secondaryGaIp, 5560, shard) << "\n";
+        heartbeatThreads.emplace_back(monitorGaHeartbeat, std::ref(zmqContext), shardEndpoint(primaryGaIp, 5562, shard),
+                                      std::ref(shardRouter.shard(shard)));
+    }
     
-    std::thread heartbeatThread(monitorGaHeartbeat, std::ref(zmqContext), 
-                         std::ref(ipAddressList[0]), std::ref(ipAddressList[1]));
+    std::thread journalThread;
+    if(journalMode){
+        std::string journalPath = "../journal_ar_" + std::to_string(int(locationIndex) + 1) + ".bin";
+        if(!requestJournal.open(journalPath, "AR-" + std::to_string(int(locationIndex) + 1), journalCapacity)){
+            std::cout << "[AR-Error] Could not open journal " << journalPath << "\n";
+            return 0;
+        }
+        std::cout << "[AR] Journal mode on " << journalPath << " (" << requestJournal.pendingCount() << " pending)\n";
+        journalThread = std::thread(drainJournal, std::ref(requestJournal), std::ref(shardRouter), std::ref(zmqContext),
+                                    std::ref(isRunning), "AR");
+    }
     
     std::cout << "[AR] Ready to process RENEWAL requests\n\n";
 
@@ -160,22 +158,32 @@ int main(int argc, char* argv[]){
         Request parsedRequest;
         memcpy(&parsedRequest, gcRequest.data(), sizeof(Request));
         
+        //GC already dropped what expired in its queue; this catches what
+        //expired on the way here
+        if(isExpired(parsedRequest)){
+            std::cout << "[AR-Deadline] Dropped an expired request (" << ++expiredRequestCount << " so far)\n\n";
+            gcSocket.send(zmq::buffer(expiredRequestResponse), zmq::send_flags::none);
+            continue;
+        }
+        
         std::cout << "[AR] Request received from GC:\n";
         std::cout << "[AR] Type: RENEWAL\n";
         std::cout << "[AR] Book code: " << parsedRequest.code << "\n";
         std::cout << "[AR] Location: " << int(parsedRequest.location) << "\n";
 
-        std::string gaResponse = sendRequestWithFailover(gcRequest, zmqContext);
+        zmq::message_t gaReply;
+        forwardJournaled(requestJournal, journalMode, shardRouter, zmqContext, gcRequest, parsedRequest, "renewal", gaReply);
         
-        if(gaResponse == "ERROR"){
-            gaResponse = "Error: Could not process renewal operation";
-        }
-        
-        std::cout << "[AR] Sending response to GC: " << gaResponse << "\n\n";
-        gcSocket.send(zmq::buffer(gaResponse), zmq::send_flags::none);
+        std::cout << "[AR] Sending response to GC: " << gaReply.to_string_view() << "\n\n";
+        gcSocket.send(gaReply, zmq::send_flags::none);
     }
     
     isRunning = false;
-    heartbeatThread.join();
+    for(std::thread &heartbeatThread : heartbeatThreads){
+        heartbeatThread.join();
+    }
+    if(journalThread.joinable()){
+        journalThread.join();
+    }
     return 0;
 }
\ No newline at end of file
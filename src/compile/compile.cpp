@@ -0,0 +1,73 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "../../utils/structs.cpp"
+#include "../../utils/requestFile.cpp"
+
+//Records written to the output per fwrite
+const std::size_t compileBatchRecords = 65536;
+
+//Turns a text request file into the packed wire-format records PS sends, so
+//a file replayed many times is parsed once. Malformed lines are dropped and
+//counted; the location of each request is kept, PS still filters by it.
+int main(int argc, char* argv[]){
+    if(argc != 3){
+        std::cerr << "[Compile-Error] Usage: ./compile <request file> <compiled file>\n";
+        return 1;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    RequestFileReader requestFile;
+    if(!requestFile.open(argv[1])){
+        std::cerr << "[Compile-Error] Cannot open " << argv[1] << "\n";
+        return 1;
+    }
+    if(requestFile.isCompiled()){
+        std::cerr << "[Compile-Error] " << argv[1] << " is already compiled\n";
+        return 1;
+    }
+    std::FILE *compiledFile = std::fopen(argv[2], "wb");
+    if(!compiledFile){
+        std::cerr << "[Compile-Error] Cannot create " << argv[2] << "\n";
+        return 1;
+    }
+
+    //The count is filled in once every line has been read
+    CompiledRequestHeader header{};
+    memcpy(header.magic, compiledRequestMagic, sizeof(header.magic));
+    bool written = std::fwrite(&header, sizeof(header), 1, compiledFile) == 1;
+
+    std::vector<Request> compiledBatch;
+    compiledBatch.reserve(compileBatchRecords);
+    std::uint64_t malformedLines = 0;
+    Request parsedRequest;
+    for(RequestLine line = requestFile.next(parsedRequest); line != RequestLine::END && written; line = requestFile.next(parsedRequest)){
+        if(line == RequestLine::MALFORMED){
+            malformedLines++;
+            continue;
+        }
+        compiledBatch.push_back(parsedRequest);
+        header.requestCount++;
+        if(compiledBatch.size() == compileBatchRecords){
+            written = std::fwrite(compiledBatch.data(), sizeof(Request), compiledBatch.size(), compiledFile) == compiledBatch.size();
+            compiledBatch.clear();
+        }
+    }
+    written = written && std::fwrite(compiledBatch.data(), sizeof(Request), compiledBatch.size(), compiledFile) == compiledBatch.size() &&
+              std::fseek(compiledFile, 0, SEEK_SET) == 0 &&
+              std::fwrite(&header, sizeof(header), 1, compiledFile) == 1;
+    written = std::fclose(compiledFile) == 0 && written;
+    if(!written){
+        std::remove(argv[2]);
+        std::cerr << "[Compile-Error] Could not write " << argv[2] << "\n";
+        return 1;
+    }
+
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "[Compile] " << header.requestCount << " requests written to " << argv[2] << " in " << elapsedMs << " ms\n";
+    std::cout << "[Compile] Malformed lines dropped: " << malformedLines << "\n";
+    return 0;
+}
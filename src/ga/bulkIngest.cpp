@@ -0,0 +1,428 @@
+#include <postgresql/libpq-fe.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <deque>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+
+struct BulkResult{
+    std::string outcomes;
+    std::int64_t firstOperationId = 0;
+    std::int64_t lastOperationId = 0;
+    //Set when an all-or-nothing batch had an operation fail and nothing was
+    //applied; outcomes still say what each operation would have done
+    bool rolledBack = false;
+    //Due date of the loans the batch made, as the store computed it
+    std::string loanDueDate;
+    //Copies the batch's returns lent to waiting patrons. Their loans are
+    //logged after the batch's own operations, past lastOperationId.
+    std::vector<ReservationHandOff> handOffs;
+};
+
+//Where a logged operation came from: site 0 means it was served here, any
+//other site means it was replicated from that site's GA, whose log id it keeps
+struct OperationOrigin{
+    int site = 0;
+    std::int64_t operationId = 0;
+    //Applied from a replication stream or a sync, from any site. A return
+    //among these never lends its copy to a waiting patron: the GA that served
+    //it did, and replicates that loan on its own.
+    bool replicated = false;
+};
+
+//State of one active loan while a bulk batch is resolved
+struct BulkLoan{
+    int stateId;
+    int bookId;
+    int bookCode;
+    int sede;
+    int renewals;
+    int renewalsAdded;
+    std::int64_t operationMicros;
+    std::string dueDate;
+    bool returned;
+    bool isNew;
+};
+
+struct BulkBook{
+    int bookId;
+    int availableCopies[2];
+};
+
+PGresult *runBulkQuery(PGconn *connection, const std::string &query){
+    PGresult *queryResult = PQexec(connection, query.c_str());
+    if(PQresultStatus(queryResult) != PGRES_TUPLES_OK){
+        std::string message = PQerrorMessage(connection);
+        PQclear(queryResult);
+        throw std::runtime_error(message);
+    }
+    return queryResult;
+}
+
+void runBulkCommand(PGconn *connection, const std::string &command){
+    PGresult *commandResult = PQexec(connection, command.c_str());
+    ExecStatusType status = PQresultStatus(commandResult);
+    PQclear(commandResult);
+    if(status != PGRES_COMMAND_OK && status != PGRES_TUPLES_OK){
+        throw std::runtime_error(PQerrorMessage(connection));
+    }
+}
+
+void copyIntoTable(PGconn *connection, const std::string &tableName, const std::string &rows){
+    PGresult *copyResult = PQexec(connection, ("COPY " + tableName + " FROM STDIN").c_str());
+    bool copyStarted = PQresultStatus(copyResult) == PGRES_COPY_IN;
+    PQclear(copyResult);
+    if(!copyStarted || PQputCopyData(connection, rows.data(), int(rows.size())) != 1 || PQputCopyEnd(connection, nullptr) != 1){
+        throw std::runtime_error(PQerrorMessage(connection));
+    }
+    copyResult = PQgetResult(connection);
+    bool copied = PQresultStatus(copyResult) == PGRES_COMMAND_OK;
+    PQclear(copyResult);
+    while((copyResult = PQgetResult(connection)) != nullptr){
+        PQclear(copyResult);
+    }
+    if(!copied){
+        throw std::runtime_error(PQerrorMessage(connection));
+    }
+}
+
+std::string addDays(const std::string &date, int days){
+    return days == 0 || date.empty() ? date : dateFromDayNumber(dayNumberFromDate(date) + days);
+}
+
+//Applies a whole batch of operations in one transaction. The batch is COPYed
+//into a staging table, the state of every book it touches is read with
+//set-based joins against that table, the operations are resolved in batch
+//order with the same rules as the single-operation handlers, and the results
+//are written back with one statement per table, usage rollups included.
+//A return lends its copy to the head of the book's waitlist, as the
+//single-operation handler does, unless the batch is a replicated one.
+//With allOrNothing a batch where any operation fails writes nothing.
+BulkResult processBulkRequest(const Request *operations, std::size_t operationCount, PGconn *connection, OverdueTracker &tracker,
+                              const OperationOrigin &origin, bool allOrNothing = false){
+    BulkResult bulkResult;
+    bulkResult.outcomes.assign(operationCount, char(BulkOutcome::FAILED));
+
+    runBulkCommand(connection, "BEGIN");
+    try {
+        runBulkCommand(connection, "CREATE TEMP TABLE bulk_staging (seq INT PRIMARY KEY, request_type INT, code INT, location INT) ON COMMIT DROP");
+        std::string stagingRows;
+        stagingRows.reserve(operationCount * 24);
+        for(std::size_t position = 0; position < operationCount; position++){
+            stagingRows += std::to_string(position) + "\t" + std::to_string(int(operations[position].requestType)) + "\t" +
+                           std::to_string(operations[position].code) + "\t" + std::to_string(int(operations[position].location)) + "\n";
+        }
+        copyIntoTable(connection, "bulk_staging", stagingRows);
+
+        std::unordered_map<int, BulkBook> booksByCode;
+        PGresult *bookRows = runBulkQuery(connection,
+            "SELECT l.id_libro, l.codigo, l.ejemplares_sede1, l.ejemplares_sede2 "
+            "FROM libros l "
+            "WHERE l.codigo IN (SELECT DISTINCT code FROM bulk_staging) "
+            "ORDER BY l.id_libro "
+            "FOR UPDATE");
+        for(int row = 0; row < PQntuples(bookRows); row++){
+            booksByCode[std::atoi(PQgetvalue(bookRows, row, 1))] = BulkBook{
+                std::atoi(PQgetvalue(bookRows, row, 0)),
+                {std::atoi(PQgetvalue(bookRows, row, 2)), std::atoi(PQgetvalue(bookRows, row, 3))}
+            };
+        }
+        PQclear(bookRows);
+
+        std::vector<BulkLoan> loans;
+        std::unordered_map<std::int64_t, std::vector<std::size_t>> loansByBookSede;
+        auto bookSedeKey = [](int bookCode, int sede){ return (std::int64_t(bookCode) << 8) | sede; };
+
+        PGresult *loanRows = runBulkQuery(connection,
+            "SELECT e.id_estado, e.id_libro, l.codigo, e.sede, e.renovaciones, "
+            "(EXTRACT(EPOCH FROM e.fecha_operacion) * 1000000)::bigint, e.fecha_devolucion_prevista "
+            "FROM estados e "
+            "JOIN libros l ON l.id_libro = e.id_libro "
+            "WHERE e.tipo_operacion = 'prestamo' "
+            "AND l.codigo IN (SELECT DISTINCT code FROM bulk_staging) "
+            "ORDER BY e.id_estado "
+            "FOR UPDATE OF e");
+        for(int row = 0; row < PQntuples(loanRows); row++){
+            int bookCode = std::atoi(PQgetvalue(loanRows, row, 2));
+            int sede = std::atoi(PQgetvalue(loanRows, row, 3));
+            loansByBookSede[bookSedeKey(bookCode, sede)].push_back(loans.size());
+            loans.push_back(BulkLoan{
+                std::atoi(PQgetvalue(loanRows, row, 0)), std::atoi(PQgetvalue(loanRows, row, 1)), bookCode, sede,
+                std::atoi(PQgetvalue(loanRows, row, 4)), 0, std::atoll(PQgetvalue(loanRows, row, 5)),
+                PQgetvalue(loanRows, row, 6), false, false
+            });
+        }
+        PQclear(loanRows);
+
+        //Latest fecha_operacion among returned rows per book, which is what the
+        //renewal handler's NOT EXISTS check compares against
+        std::unordered_map<int, std::int64_t> latestReturnByBook;
+        PGresult *returnRows = runBulkQuery(connection,
+            "SELECT e.id_libro, (EXTRACT(EPOCH FROM MAX(e.fecha_operacion)) * 1000000)::bigint "
+            "FROM estados e "
+            "JOIN libros l ON l.id_libro = e.id_libro "
+            "WHERE e.tipo_operacion = 'devuelto' "
+            "AND l.codigo IN (SELECT DISTINCT code FROM bulk_staging) "
+            "GROUP BY e.id_libro");
+        for(int row = 0; row < PQntuples(returnRows); row++){
+            latestReturnByBook[std::atoi(PQgetvalue(returnRows, row, 0))] = std::atoll(PQgetvalue(returnRows, row, 1));
+        }
+        PQclear(returnRows);
+
+        PGresult *clockRows = runBulkQuery(connection,
+            "SELECT (EXTRACT(EPOCH FROM NOW()) * 1000000)::bigint, (NOW() + interval '14 days')::date");
+        std::int64_t nowMicros = std::atoll(PQgetvalue(clockRows, 0, 0));
+        std::string newLoanDueDate = PQgetvalue(clockRows, 0, 1);
+        PQclear(clockRows);
+        bulkResult.loanDueDate = newLoanDueDate;
+
+        //Waitlists of the books the batch returns, oldest reservation first
+        std::unordered_map<std::int64_t, std::deque<std::pair<std::int64_t, std::string>>> waitlists;
+        std::vector<std::int64_t> handedReservations;
+        if(!origin.replicated){
+            PGresult *waitlistRows = runBulkQuery(connection,
+                "SELECT r.id, r.codigo, r.sede, r.patron "
+                "FROM reservas r "
+                "WHERE r.codigo IN (SELECT DISTINCT code FROM bulk_staging WHERE request_type = 2) "
+                "ORDER BY r.id "
+                "FOR UPDATE");
+            for(int row = 0; row < PQntuples(waitlistRows); row++){
+                waitlists[bookSedeKey(std::atoi(PQgetvalue(waitlistRows, row, 1)), std::atoi(PQgetvalue(waitlistRows, row, 2)))]
+                    .emplace_back(std::atoll(PQgetvalue(waitlistRows, row, 0)), PQgetvalue(waitlistRows, row, 3));
+            }
+            PQclear(waitlistRows);
+        }
+
+        for(std::size_t position = 0; position < operationCount; position++){
+            const Request &operation = operations[position];
+            int sede = int(operation.location) + 1;
+            auto bookIterator = booksByCode.find(operation.code);
+            std::vector<std::size_t> &candidates = loansByBookSede[bookSedeKey(operation.code, sede)];
+            BulkOutcome outcome = BulkOutcome::FAILED;
+
+            if(sede < 1 || sede > 2){
+                outcome = BulkOutcome::FAILED;
+            } else if(operation.requestType == RequestType::LOAN){
+                if(bookIterator == booksByCode.end()){
+                    outcome = BulkOutcome::BOOK_NOT_FOUND;
+                } else if(bookIterator->second.availableCopies[sede - 1] <= 0){
+                    outcome = BulkOutcome::NO_COPIES;
+                } else {
+                    bookIterator->second.availableCopies[sede - 1]--;
+                    candidates.push_back(loans.size());
+                    loans.push_back(BulkLoan{0, bookIterator->second.bookId, operation.code, sede, 0, 0, nowMicros, newLoanDueDate, false, true});
+                    outcome = BulkOutcome::OK;
+                }
+            } else if(operation.requestType == RequestType::RENEWAL){
+                BulkLoan *chosenLoan = nullptr;
+                for(std::size_t loanIndex : candidates){
+                    BulkLoan &loan = loans[loanIndex];
+                    auto returnIterator = latestReturnByBook.find(loan.bookId);
+                    if(loan.returned || (returnIterator != latestReturnByBook.end() && returnIterator->second > loan.operationMicros)){
+                        continue;
+                    }
+                    if(!chosenLoan || loan.renewals < chosenLoan->renewals ||
+                       (loan.renewals == chosenLoan->renewals && loan.operationMicros < chosenLoan->operationMicros)){
+                        chosenLoan = &loan;
+                    }
+                }
+                if(!chosenLoan){
+                    outcome = BulkOutcome::NO_ACTIVE_LOAN;
+                } else if(chosenLoan->renewals >= 2){
+                    outcome = BulkOutcome::RENEWAL_LIMIT;
+                } else {
+                    chosenLoan->renewals++;
+                    chosenLoan->renewalsAdded++;
+                    outcome = BulkOutcome::OK;
+                }
+            } else if(operation.requestType == RequestType::RETURN){
+                BulkLoan *chosenLoan = nullptr;
+                for(std::size_t loanIndex : candidates){
+                    BulkLoan &loan = loans[loanIndex];
+                    if(loan.returned){
+                        continue;
+                    }
+                    if(!chosenLoan || loan.renewals > chosenLoan->renewals ||
+                       (loan.renewals == chosenLoan->renewals && loan.operationMicros > chosenLoan->operationMicros)){
+                        chosenLoan = &loan;
+                    }
+                }
+                if(!chosenLoan){
+                    outcome = BulkOutcome::NO_ACTIVE_LOAN;
+                } else {
+                    chosenLoan->returned = true;
+                    std::int64_t &latestReturn = latestReturnByBook[chosenLoan->bookId];
+                    latestReturn = std::max(latestReturn, chosenLoan->operationMicros);
+                    if(bookIterator != booksByCode.end()){
+                        bookIterator->second.availableCopies[sede - 1]++;
+                    }
+                    auto waitlist = waitlists.find(bookSedeKey(operation.code, sede));
+                    if(waitlist != waitlists.end() && !waitlist->second.empty() && bookIterator != booksByCode.end()){
+                        bookIterator->second.availableCopies[sede - 1]--;
+                        candidates.push_back(loans.size());
+                        loans.push_back(BulkLoan{0, bookIterator->second.bookId, operation.code, sede, 0, 0, nowMicros, newLoanDueDate, false, true});
+                        ReservationHandOff handOff;
+                        handOff.bookCode = operation.code;
+                        handOff.sede = sede;
+                        handOff.patron = waitlist->second.front().second;
+                        handOff.dueDate = newLoanDueDate;
+                        bulkResult.handOffs.push_back(handOff);
+                        handedReservations.push_back(waitlist->second.front().first);
+                        waitlist->second.pop_front();
+                    }
+                    outcome = BulkOutcome::OK;
+                }
+            }
+            bulkResult.outcomes[position] = char(outcome);
+        }
+
+        if(allOrNothing && bulkResult.outcomes.find_first_not_of(char(BulkOutcome::OK)) != std::string::npos){
+            runBulkCommand(connection, "ROLLBACK");
+            bulkResult.rolledBack = true;
+            bulkResult.handOffs.clear();
+            return bulkResult;
+        }
+
+        std::size_t newLoanCount = 0;
+        for(const BulkLoan &loan : loans){
+            newLoanCount += loan.isNew;
+        }
+        if(newLoanCount > 0){
+            PGresult *idRows = runBulkQuery(connection,
+                "SELECT nextval('estados_id_estado_seq') FROM generate_series(1, " + std::to_string(newLoanCount) + ")");
+            int idRow = 0;
+            for(BulkLoan &loan : loans){
+                if(loan.isNew){
+                    loan.stateId = std::atoi(PQgetvalue(idRows, idRow++, 0));
+                }
+            }
+            PQclear(idRows);
+        }
+
+        std::string loanRowsCopy, bookRowsCopy, outcomeRowsCopy;
+        for(const BulkLoan &loan : loans){
+            if(loan.isNew || loan.renewalsAdded > 0 || loan.returned){
+                loanRowsCopy += std::to_string(loan.stateId) + "\t" + std::to_string(loan.bookId) + "\t" + std::to_string(loan.sede) + "\t" +
+                                std::to_string(loan.renewals) + "\t" + std::to_string(loan.renewalsAdded) + "\t" +
+                                (loan.returned ? "t" : "f") + "\t" + (loan.isNew ? "t" : "f") + "\n";
+            }
+        }
+        for(const auto &bookEntry : booksByCode){
+            bookRowsCopy += std::to_string(bookEntry.second.bookId) + "\t" + std::to_string(bookEntry.second.availableCopies[0]) + "\t" +
+                            std::to_string(bookEntry.second.availableCopies[1]) + "\n";
+        }
+        for(std::size_t position = 0; position < operationCount; position++){
+            outcomeRowsCopy += std::to_string(position) + "\t" + std::to_string(int(bulkResult.outcomes[position])) + "\n";
+        }
+
+        runBulkCommand(connection, "CREATE TEMP TABLE bulk_loans (id_estado INT, id_libro INT, sede INT, renovaciones INT, renewals_added INT, returned BOOLEAN, is_new BOOLEAN) ON COMMIT DROP");
+        runBulkCommand(connection, "CREATE TEMP TABLE bulk_books (id_libro INT, ejemplares_sede1 INT, ejemplares_sede2 INT) ON COMMIT DROP");
+        runBulkCommand(connection, "CREATE TEMP TABLE bulk_outcomes (seq INT PRIMARY KEY, outcome INT) ON COMMIT DROP");
+        copyIntoTable(connection, "bulk_loans", loanRowsCopy);
+        copyIntoTable(connection, "bulk_books", bookRowsCopy);
+        copyIntoTable(connection, "bulk_outcomes", outcomeRowsCopy);
+
+        runBulkCommand(connection,
+            "INSERT INTO estados (id_estado, id_libro, tipo_operacion, fecha_operacion, fecha_devolucion_prevista, sede, renovaciones) "
+            "SELECT b.id_estado, b.id_libro, CASE WHEN b.returned THEN 'devuelto' ELSE 'prestamo' END, NOW(), "
+            "(NOW() + interval '14 days')::date + 7 * b.renewals_added, b.sede, b.renovaciones "
+            "FROM bulk_loans b "
+            "WHERE b.is_new "
+            "ORDER BY b.id_estado");
+        runBulkCommand(connection,
+            "UPDATE estados e "
+            "SET renovaciones = b.renovaciones, "
+            "    fecha_devolucion_prevista = e.fecha_devolucion_prevista + 7 * b.renewals_added, "
+            "    tipo_operacion = CASE WHEN b.returned THEN 'devuelto' ELSE e.tipo_operacion END "
+            "FROM bulk_loans b "
+            "WHERE NOT b.is_new AND e.id_estado = b.id_estado");
+        runBulkCommand(connection,
+            "UPDATE libros l "
+            "SET ejemplares_sede1 = b.ejemplares_sede1, ejemplares_sede2 = b.ejemplares_sede2 "
+            "FROM bulk_books b "
+            "WHERE l.id_libro = b.id_libro");
+
+        runBulkCommand(connection,
+            "INSERT INTO uso_diario (dia, codigo, sede, prestamos, renovaciones, devoluciones) "
+            "SELECT CURRENT_DATE, s.code, s.location + 1, "
+            "COUNT(*) FILTER (WHERE s.request_type = 0), COUNT(*) FILTER (WHERE s.request_type = 1), COUNT(*) FILTER (WHERE s.request_type = 2) "
+            "FROM bulk_staging s "
+            "JOIN bulk_outcomes o ON o.seq = s.seq "
+            "WHERE o.outcome = 0 "
+            "GROUP BY s.code, s.location "
+            "ORDER BY s.code, s.location "
+            "ON CONFLICT (dia, codigo, sede) DO UPDATE "
+            "SET prestamos = uso_diario.prestamos + EXCLUDED.prestamos, "
+            "    renovaciones = uso_diario.renovaciones + EXCLUDED.renovaciones, "
+            "    devoluciones = uso_diario.devoluciones + EXCLUDED.devoluciones");
+
+        PGresult *logRows = runBulkQuery(connection,
+            "WITH logged AS ( "
+            "    INSERT INTO operation_log (request_type, code, location, timestamp, origin_site, origin_id) "
+            "    SELECT s.request_type, s.code, s.location, NOW(), " + std::to_string(origin.site) + ", " + std::to_string(origin.operationId) + " "
+            "    FROM bulk_staging s "
+            "    JOIN bulk_outcomes o ON o.seq = s.seq "
+            "    WHERE o.outcome = 0 "
+            "    ORDER BY s.seq "
+            "    RETURNING id "
+            ") "
+            "SELECT COALESCE(MIN(id), 0), COALESCE(MAX(id), 0) FROM logged");
+        bulkResult.firstOperationId = std::atoll(PQgetvalue(logRows, 0, 0));
+        bulkResult.lastOperationId = std::atoll(PQgetvalue(logRows, 0, 1));
+        PQclear(logRows);
+
+        //The hand-off loans are logged after the batch, in the order they were made
+        if(!bulkResult.handOffs.empty()){
+            std::string handOffRowsCopy;
+            for(std::size_t handOffIndex = 0; handOffIndex < bulkResult.handOffs.size(); handOffIndex++){
+                const ReservationHandOff &handOff = bulkResult.handOffs[handOffIndex];
+                handOffRowsCopy += std::to_string(handOffIndex) + "\t" + std::to_string(handedReservations[handOffIndex]) + "\t" +
+                                   std::to_string(handOff.bookCode) + "\t" + std::to_string(handOff.sede - 1) + "\n";
+            }
+            runBulkCommand(connection, "CREATE TEMP TABLE bulk_hand_offs (seq INT PRIMARY KEY, reserva_id BIGINT, code INT, location INT) ON COMMIT DROP");
+            copyIntoTable(connection, "bulk_hand_offs", handOffRowsCopy);
+            runBulkCommand(connection, "DELETE FROM reservas WHERE id IN (SELECT reserva_id FROM bulk_hand_offs)");
+            runBulkCommand(connection,
+                "INSERT INTO uso_diario (dia, codigo, sede, prestamos) "
+                "SELECT CURRENT_DATE, h.code, h.location + 1, COUNT(*) "
+                "FROM bulk_hand_offs h "
+                "GROUP BY h.code, h.location "
+                "ORDER BY h.code, h.location "
+                "ON CONFLICT (dia, codigo, sede) DO UPDATE SET prestamos = uso_diario.prestamos + EXCLUDED.prestamos");
+            PGresult *handOffLogRows = runBulkQuery(connection,
+                "WITH logged AS ( "
+                "    INSERT INTO operation_log (request_type, code, location, timestamp, origin_site, origin_id) "
+                "    SELECT 0, h.code, h.location, NOW(), " + std::to_string(origin.site) + ", " + std::to_string(origin.operationId) + " "
+                "    FROM bulk_hand_offs h "
+                "    ORDER BY h.seq "
+                "    RETURNING id "
+                ") "
+                "SELECT id FROM logged ORDER BY id");
+            for(int row = 0; row < PQntuples(handOffLogRows) && std::size_t(row) < bulkResult.handOffs.size(); row++){
+                bulkResult.handOffs[row].loanOperationId = std::atoll(PQgetvalue(handOffLogRows, row, 0));
+            }
+            PQclear(handOffLogRows);
+        }
+
+        runBulkCommand(connection, "COMMIT");
+
+        for(const BulkLoan &loan : loans){
+            if(loan.returned){
+                tracker.release(loan.stateId);
+            } else if(loan.isNew){
+                tracker.track(loan.stateId, loan.bookCode, loan.sede, addDays(loan.dueDate, 7 * loan.renewalsAdded));
+            } else if(loan.renewalsAdded > 0){
+                tracker.reschedule(loan.stateId, addDays(loan.dueDate, 7 * loan.renewalsAdded));
+            }
+        }
+    } catch(const std::exception &error){
+        executeCommand(connection, "ROLLBACK");
+        bulkResult.outcomes.assign(operationCount, char(BulkOutcome::FAILED));
+        bulkResult.firstOperationId = bulkResult.lastOperationId = 0;
+        bulkResult.handOffs.clear();
+        std::cerr << "[GA-Bulk] Error: " << error.what() << "\n";
+    }
+    return bulkResult;
+}
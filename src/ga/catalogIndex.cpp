@@ -0,0 +1,272 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#include <iterator>
+#include <cctype>
+#include <cstdint>
+
+//Maximum books a search ranks; a very short prefix stops collecting here
+const std::size_t maxSearchCandidates = 5000;
+
+//One libros row as the search index needs it
+struct CatalogRecord{
+    int code;
+    std::string title;
+    std::string author;
+    int availableCopies[2];
+};
+
+//Lowercases and strips Latin-1 accents from UTF-8 text; anything that is not a
+//letter or a digit becomes a space
+std::string foldSearchText(const std::string &text){
+    //Base letters for the two-byte sequences 0xC3 0x80 to 0xC3 0xBF
+    static const char foldedLatin1[] = "aaaaaa ceeeeiiii nooooo ouuuuy  aaaaaa ceeeeiiii nooooo ouuuuy y";
+    std::string foldedText;
+    foldedText.reserve(text.size());
+    for(std::size_t position = 0; position < text.size(); position++){
+        unsigned char character = static_cast<unsigned char>(text[position]);
+        if(character < 0x80){
+            foldedText.push_back(std::isalnum(character) ? char(std::tolower(character)) : ' ');
+        } else if(character == 0xC3 && position + 1 < text.size()){
+            unsigned char nextByte = static_cast<unsigned char>(text[position + 1]);
+            foldedText.push_back(nextByte >= 0x80 && nextByte <= 0xBF ? foldedLatin1[nextByte - 0x80] : ' ');
+            position++;
+        } else if(character >= 0xC0){
+            foldedText.push_back(' ');
+        }
+    }
+    return foldedText;
+}
+
+std::vector<std::string> searchTokens(const std::string &text){
+    std::vector<std::string> tokens;
+    std::string foldedText = foldSearchText(text);
+    std::size_t tokenStart = foldedText.find_first_not_of(' ');
+    while(tokenStart != std::string::npos){
+        std::size_t tokenEnd = foldedText.find(' ', tokenStart);
+        tokens.push_back(foldedText.substr(tokenStart, tokenEnd - tokenStart));
+        tokenStart = foldedText.find_first_not_of(' ', tokenEnd);
+    }
+    return tokens;
+}
+
+//Inverted index over the folded title and author tokens of the catalog, with
+//each site's available copies kept alongside so a search needs no database.
+//The vocabulary is kept sorted, so every query word also matches as a prefix.
+class CatalogIndex{
+public:
+    void rebuild(const std::vector<CatalogRecord> &records){
+        std::unordered_map<std::string, std::vector<std::uint32_t>> postingsByToken;
+        std::vector<IndexedBook> indexedBooks;
+        std::unordered_map<int, std::uint32_t> indexedSlots;
+        indexedBooks.reserve(records.size());
+        for(const CatalogRecord &record : records){
+            std::uint32_t slot = std::uint32_t(indexedBooks.size());
+            IndexedBook indexedBook{record, searchTokens(record.title), searchTokens(record.author)};
+            for(const std::string &token : indexedBook.titleTokens){
+                addPosting(postingsByToken[token], slot << 1);
+            }
+            for(const std::string &token : indexedBook.authorTokens){
+                addPosting(postingsByToken[token], (slot << 1) | 1);
+            }
+            indexedSlots[record.code] = slot;
+            indexedBooks.push_back(std::move(indexedBook));
+        }
+
+        std::vector<std::pair<std::string, std::vector<std::uint32_t>>> sortedVocabulary(
+            std::make_move_iterator(postingsByToken.begin()), std::make_move_iterator(postingsByToken.end()));
+        std::sort(sortedVocabulary.begin(), sortedVocabulary.end(),
+            [](const std::pair<std::string, std::vector<std::uint32_t>> &left, const std::pair<std::string, std::vector<std::uint32_t>> &right){
+                return left.first < right.first;
+            });
+
+        std::lock_guard<std::mutex> lock(indexMutex);
+        books = std::move(indexedBooks);
+        slotByCode = std::move(indexedSlots);
+        vocabulary = std::move(sortedVocabulary);
+    }
+
+    //Keeps availability in step with applied loans (-1) and returns (+1)
+    void adjustAvailability(int bookCode, int sede, int delta){
+        std::lock_guard<std::mutex> lock(indexMutex);
+        auto slotEntry = slotByCode.find(bookCode);
+        if(slotEntry != slotByCode.end() && sede >= 1 && sede <= 2){
+            books[slotEntry->second].record.availableCopies[sede - 1] += delta;
+        }
+    }
+
+    //Copies on the shelf at sede, -1 for a code that is not in the catalog
+    int availableCopies(int bookCode, int sede){
+        std::lock_guard<std::mutex> lock(indexMutex);
+        auto slotEntry = slotByCode.find(bookCode);
+        if(slotEntry == slotByCode.end() || sede < 1 || sede > 2){
+            return -1;
+        }
+        return books[slotEntry->second].record.availableCopies[sede - 1];
+    }
+
+    //Title and author of bookCode, false for a code that is not in the catalog
+    bool bookText(int bookCode, std::string &title, std::string &author){
+        std::lock_guard<std::mutex> lock(indexMutex);
+        auto slotEntry = slotByCode.find(bookCode);
+        if(slotEntry == slotByCode.end()){
+            return false;
+        }
+        title = books[slotEntry->second].record.title;
+        author = books[slotEntry->second].record.author;
+        return true;
+    }
+
+    std::size_t size(){
+        std::lock_guard<std::mutex> lock(indexMutex);
+        return books.size();
+    }
+
+    //Books matching every word of the query, by title or author, best first:
+    //title words beat author words and whole words beat prefixes. Candidates
+    //come from the most selective word; only they are checked against the rest.
+    //withScores puts each result's score before its line, so the loan actor
+    //can merge the results of several shards in rank order
+    std::string search(const std::string &query, std::size_t resultLimit, bool withScores = false){
+        std::vector<std::string> queryTokens = searchTokens(query);
+        if(queryTokens.empty()){
+            return "Error: Empty search";
+        }
+        if(resultLimit == 0){
+            resultLimit = defaultSearchResults;
+        }
+        resultLimit = std::min(resultLimit, maxSearchResults);
+
+        std::lock_guard<std::mutex> lock(indexMutex);
+        std::size_t selectiveIndex = mostSelectiveToken(queryTokens);
+        std::vector<std::pair<std::uint32_t, int>> rankedSlots = scoredCandidates(queryTokens[selectiveIndex]);
+
+        if(queryTokens.size() > 1){
+            std::size_t keptCount = 0;
+            for(const std::pair<std::uint32_t, int> &candidate : rankedSlots){
+                int totalScore = candidate.second;
+                for(std::size_t tokenIndex = 0; tokenIndex < queryTokens.size() && totalScore > 0; tokenIndex++){
+                    if(tokenIndex != selectiveIndex){
+                        int score = scoreToken(books[candidate.first], queryTokens[tokenIndex]);
+                        totalScore = score == 0 ? 0 : totalScore + score;
+                    }
+                }
+                if(totalScore > 0){
+                    rankedSlots[keptCount++] = std::make_pair(candidate.first, totalScore);
+                }
+            }
+            rankedSlots.resize(keptCount);
+        }
+
+        std::size_t resultCount = std::min(resultLimit, rankedSlots.size());
+        std::partial_sort(rankedSlots.begin(), rankedSlots.begin() + resultCount, rankedSlots.end(),
+            [](const std::pair<std::uint32_t, int> &left, const std::pair<std::uint32_t, int> &right){
+                return left.second != right.second ? left.second > right.second : left.first < right.first;
+            });
+
+        std::string searchResult = "Search results: " + std::to_string(resultCount);
+        for(std::size_t position = 0; position < resultCount; position++){
+            const CatalogRecord &book = books[rankedSlots[position].first].record;
+            searchResult += "\n";
+            if(withScores){
+                searchResult += std::to_string(rankedSlots[position].second) + " ";
+            }
+            searchResult += std::to_string(book.code) + " | " + book.title + " | " + book.author +
+                            " | sede 1: " + std::to_string(book.availableCopies[0]) +
+                            " | sede 2: " + std::to_string(book.availableCopies[1]);
+        }
+        return searchResult;
+    }
+
+private:
+    struct IndexedBook{
+        CatalogRecord record;
+        std::vector<std::string> titleTokens;
+        std::vector<std::string> authorTokens;
+    };
+
+    typedef std::vector<std::pair<std::string, std::vector<std::uint32_t>>>::const_iterator VocabularyEntry;
+
+    //Postings are slot * 2 plus 1 for author words; slots only grow, so
+    //appending keeps every list sorted
+    static void addPosting(std::vector<std::uint32_t> &tokenPostings, std::uint32_t posting){
+        if(tokenPostings.empty() || tokenPostings.back() != posting){
+            tokenPostings.push_back(posting);
+        }
+    }
+
+    VocabularyEntry firstWithPrefix(const std::string &prefix) const{
+        return std::lower_bound(vocabulary.begin(), vocabulary.end(), prefix,
+            [](const std::pair<std::string, std::vector<std::uint32_t>> &entry, const std::string &value){ return entry.first < value; });
+    }
+
+    bool hasPrefix(VocabularyEntry entry, const std::string &prefix) const{
+        return entry != vocabulary.end() && entry->first.compare(0, prefix.size(), prefix) == 0;
+    }
+
+    static int matchScore(bool isAuthor, bool isExact){
+        return isAuthor ? (isExact ? 2 : 1) : (isExact ? 4 : 3);
+    }
+
+    //Index of the query word whose prefix range holds the fewest postings;
+    //counting stops once a word cannot beat the best so far
+    std::size_t mostSelectiveToken(const std::vector<std::string> &queryTokens) const{
+        std::size_t selectiveIndex = 0;
+        std::size_t fewestPostings = SIZE_MAX;
+        for(std::size_t tokenIndex = 0; tokenIndex < queryTokens.size(); tokenIndex++){
+            const std::string &token = queryTokens[tokenIndex];
+            std::size_t postingCount = 0;
+            for(VocabularyEntry entry = firstWithPrefix(token); hasPrefix(entry, token) && postingCount < fewestPostings; ++entry){
+                postingCount += entry->second.size();
+            }
+            if(postingCount < fewestPostings){
+                fewestPostings = postingCount;
+                selectiveIndex = tokenIndex;
+            }
+        }
+        return selectiveIndex;
+    }
+
+    //Books whose words match token, with the best score each gets from it,
+    //scored from the postings alone. The exact word comes first in its range.
+    std::vector<std::pair<std::uint32_t, int>> scoredCandidates(const std::string &token) const{
+        std::vector<std::pair<std::uint32_t, int>> candidates;
+        for(VocabularyEntry entry = firstWithPrefix(token); hasPrefix(entry, token) && candidates.size() < maxSearchCandidates; ++entry){
+            bool isExact = entry->first.size() == token.size();
+            for(std::uint32_t posting : entry->second){
+                candidates.emplace_back(posting >> 1, matchScore(posting & 1, isExact));
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        std::size_t uniqueCount = 0;
+        for(const std::pair<std::uint32_t, int> &candidate : candidates){
+            if(uniqueCount > 0 && candidates[uniqueCount - 1].first == candidate.first){
+                candidates[uniqueCount - 1].second = candidate.second;
+            } else {
+                candidates[uniqueCount++] = candidate;
+            }
+        }
+        candidates.resize(uniqueCount);
+        return candidates;
+    }
+
+    //Best score one query word gets from a book, 0 when it matches nothing
+    static int scoreToken(const IndexedBook &book, const std::string &queryToken){
+        int bestScore = 0;
+        for(int field = 0; field < 2; field++){
+            for(const std::string &bookToken : field == 0 ? book.titleTokens : book.authorTokens){
+                if(bookToken.compare(0, queryToken.size(), queryToken) == 0){
+                    bestScore = std::max(bestScore, matchScore(field == 1, bookToken.size() == queryToken.size()));
+                }
+            }
+        }
+        return bestScore;
+    }
+
+    std::mutex indexMutex;
+    std::vector<IndexedBook> books;
+    std::unordered_map<int, std::uint32_t> slotByCode;
+    std::vector<std::pair<std::string, std::vector<std::uint32_t>>> vocabulary;
+};
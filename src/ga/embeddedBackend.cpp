@@ -0,0 +1,1109 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//Records the operation log holds before it is folded into a snapshot
+const std::uint64_t embeddedLogCapacity = 1 << 20;
+//Appended records are flushed to disk together every this many milliseconds
+const int embeddedSyncIntervalMs = 2;
+const std::string embeddedStorePrefix = "../ga_store_";
+//Record type of a loan made to the head of a waitlist; applying it takes the
+//patron off the waitlist, so replay does too
+const std::int32_t embeddedHandOffRecord = 6;
+
+//One applied operation. Records carry everything needed to replay them
+//deterministically: the loan they touched and the due date they produced.
+struct EmbeddedLogRecord{
+    std::int64_t operationId;
+    std::int32_t requestType;
+    std::int32_t bookCode;
+    std::int32_t sede;
+    std::int32_t stateId;
+    std::int32_t dueDay;
+    std::uint8_t requestKey[16];
+    std::uint32_t checksum;
+};
+
+struct EmbeddedSnapshotHeader{
+    char magic[8];
+    std::int64_t lastOperationId;
+    std::int32_t nextStateId;
+    std::uint32_t bookCount;
+    std::uint32_t loanCount;
+    std::uint32_t appliedKeyCount;
+};
+
+struct EmbeddedBook{
+    std::int32_t code;
+    std::int32_t availableCopies[2];
+    //Newest loan of this book already returned; older loans cannot be renewed
+    std::int32_t latestReturnedLoan;
+};
+
+struct EmbeddedLoan{
+    std::int32_t stateId;
+    std::int32_t bookCode;
+    std::int32_t sede;
+    std::int32_t dueDay;
+    std::int32_t renewals;
+};
+
+//Header of usage.snapshot, the usage rollups as of a state snapshot
+struct EmbeddedUsageHeader{
+    char magic[8];
+    std::int64_t lastOperationId;
+    std::uint64_t rowCount;
+};
+
+struct EmbeddedAppliedKey{
+    std::uint8_t requestKey[16];
+    //Due day of a keyed loan, which its retry is answered with; the request
+    //type for the other operations
+    std::int32_t outcome;
+};
+
+//Single-node storage with no external dependencies. Every operation is
+//appended to a memory-mapped log and applied to in-memory hash indexes of
+//books and active loans. On startup the indexes are rebuilt from the latest
+//snapshot plus the log records after it; when the log fills up the state is
+//written to a new snapshot and the log starts over.
+//
+//Records land in a shared mapping, so a crash of the GA process loses
+//nothing. A background thread msyncs everything appended so far, at once
+//when a reply is waiting in awaitDurable and otherwise every
+//embeddedSyncIntervalMs; replies waiting together share one msync.
+//
+//Waitlists are saved whole to their own file on every reservation, tagged
+//with the last operation id; the hand-off records logged after that id take
+//their patrons off again when the log is replayed.
+class EmbeddedBackend : public StorageBackend{
+public:
+    explicit EmbeddedBackend(OverdueTracker &tracker) : overdueTracker(tracker){}
+
+    ~EmbeddedBackend(){
+        {
+            std::lock_guard<std::mutex> lock(storeMutex);
+            flusherRunning = false;
+        }
+        syncCondition.notify_all();
+        if(flusherThread.joinable()){
+            flusherThread.join();
+        }
+        if(logRecords){
+            msync(logRecords, logMappingSize, MS_SYNC);
+            munmap(logRecords, logMappingSize);
+        }
+        if(logFileDescriptor >= 0){
+            close(logFileDescriptor);
+        }
+    }
+
+    //Opens or creates the store in directory; a new store is seeded with the
+    //catalog found in seedPath
+    bool open(const std::string &directory, const std::string &seedPath){
+        std::lock_guard<std::mutex> lock(storeMutex);
+        std::filesystem::create_directories(directory);
+        snapshotPath = directory + "/state.snapshot";
+        usagePath = directory + "/usage.snapshot";
+        reservationsPath = directory + "/reservations";
+        catalogSeedPath = seedPath;
+        std::string logPath = directory + "/operations.log";
+
+        logMappingSize = embeddedLogCapacity * sizeof(EmbeddedLogRecord);
+        logFileDescriptor = ::open(logPath.c_str(), O_RDWR | O_CREAT, 0644);
+        if(logFileDescriptor < 0 || ftruncate(logFileDescriptor, off_t(logMappingSize)) != 0){
+            return false;
+        }
+        void *mappedFile = mmap(nullptr, logMappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, logFileDescriptor, 0);
+        if(mappedFile == MAP_FAILED){
+            return false;
+        }
+        logRecords = static_cast<EmbeddedLogRecord*>(mappedFile);
+
+        auto startTime = std::chrono::steady_clock::now();
+        bool snapshotLoaded = loadSnapshot();
+        loadReservations();
+        std::uint64_t replayedCount = replayLog();
+        if(!snapshotLoaded && lastOperationId == 0){
+            seedCatalog(seedPath);
+            if(!writeSnapshot()){
+                return false;
+            }
+        }
+        auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+        std::cout << "[GA-Store] " << books.size() << " books, " << activeLoans.size() << " active loans, "
+                  << replayedCount << " log records replayed in " << elapsedMs << " ms\n";
+
+        syncedRecordCount = logRecordCount;
+        syncedOperationId = lastOperationId;
+        flusherThread = std::thread(&EmbeddedBackend::flushLoop, this);
+        return true;
+    }
+
+    std::string loan(int bookCode, int locationId, const std::string &requestKey, const OperationOrigin &) override{
+        std::lock_guard<std::mutex> lock(storeMutex);
+        std::string returnDate;
+        BulkOutcome outcome = loanLocked(bookCode, locationId + 1, requestKey, returnDate);
+        return describeLoan(outcome, returnDate);
+    }
+
+    //A patron missing from the waitlist here, whose reservation never
+    //arrived, still gets the loan
+    std::string lendReserved(int bookCode, int locationId, const std::string &patron, const OperationOrigin &) override{
+        std::lock_guard<std::mutex> lock(storeMutex);
+        int sede = locationId + 1;
+        std::deque<std::string> &waitlist = waitlists[loanListKey(bookCode, sede)];
+        auto waitingPatron = std::find(waitlist.begin(), waitlist.end(), patron);
+        if(waitingPatron == waitlist.end()){
+            if(waitlist.empty()){
+                waitlists.erase(loanListKey(bookCode, sede));
+            }
+            std::string returnDate;
+            BulkOutcome outcome = loanLocked(bookCode, sede, "", returnDate);
+            return describeLoan(outcome, returnDate);
+        }
+        //The hand-off record takes the head, so the patron is moved there first
+        if(waitingPatron != waitlist.begin()){
+            waitlist.erase(waitingPatron);
+            waitlist.push_front(patron);
+            if(!writeReservations()){
+                return "Database error: embedded reservations are not writable";
+            }
+        }
+        ReservationHandOff handOff;
+        BulkOutcome outcome = lendToWaitlistHead(bookCode, sede, handOff);
+        return describeLoan(outcome, handOff.dueDate);
+    }
+
+    std::size_t reserve(int bookCode, int locationId, const std::string &patron) override{
+        std::lock_guard<std::mutex> lock(storeMutex);
+        std::deque<std::string> &waitlist = waitlists[loanListKey(bookCode, locationId + 1)];
+        auto waitingPatron = std::find(waitlist.begin(), waitlist.end(), patron);
+        if(waitingPatron != waitlist.end()){
+            return std::size_t(waitingPatron - waitlist.begin()) + 1;
+        }
+        if(waitlist.size() >= maxWaitingPatrons){
+            return 0;
+        }
+        waitlist.push_back(patron);
+        if(!writeReservations()){
+            waitlist.pop_back();
+            throw std::runtime_error("embedded reservations are not writable");
+        }
+        return waitlist.size();
+    }
+
+    std::string renew(int bookCode, int locationId, const std::string &requestKey, const OperationOrigin &) override{
+        std::lock_guard<std::mutex> lock(storeMutex);
+        switch(renewLocked(bookCode, locationId + 1, requestKey)){
+            case BulkOutcome::OK: return "Loan renewed successfully for 7 additional days";
+            case BulkOutcome::NO_ACTIVE_LOAN: return "Error: No active loan found for this book at this location";
+            case BulkOutcome::RENEWAL_LIMIT: return "Error: Maximum renewal limit reached (2)";
+            default: return "Database error: embedded log is not writable";
+        }
+    }
+
+    //The hand-off record is appended right behind the return's
+    std::string returnLoan(int bookCode, int locationId, const std::string &requestKey, const OperationOrigin &origin,
+                           ReservationHandOff &handOff) override{
+        std::lock_guard<std::mutex> lock(storeMutex);
+        std::int64_t operationBefore = lastOperationId;
+        switch(returnLocked(bookCode, locationId + 1, requestKey)){
+            case BulkOutcome::OK:
+                if(!origin.replicated && lastOperationId > operationBefore && hasWaitingPatron(bookCode, locationId + 1)){
+                    handOff.returnOperationId = lastOperationId;
+                    lendToWaitlistHead(bookCode, locationId + 1, handOff);
+                }
+                return "Return successful. Copy available again";
+            case BulkOutcome::NO_ACTIVE_LOAN: return "Error: No active loan found for this book at this location";
+            default: return "Database error: embedded log is not writable";
+        }
+    }
+
+    //A copy a return owes to a waiting patron is held back from the batch's
+    //later loans and lent once the batch is through, so the hand-off loans
+    //are logged after the batch's own operations as in PostgresBackend
+    BulkResult applyBulk(const Request *operations, std::size_t operationCount, const OperationOrigin &origin, bool allOrNothing) override{
+        std::lock_guard<std::mutex> lock(storeMutex);
+        BulkResult bulkResult;
+        bulkResult.outcomes.assign(operationCount, char(BulkOutcome::FAILED));
+        std::int64_t operationIdBefore = lastOperationId;
+        if(allOrNothing && !beginTrial(operations, operationCount)){
+            return bulkResult;
+        }
+
+        std::unordered_map<std::int64_t, std::size_t> heldCopies;
+        std::vector<std::pair<int, int>> pendingHandOffs;
+        for(std::size_t position = 0; position < operationCount; position++){
+            const Request &operation = operations[position];
+            int sede = operation.location + 1;
+            std::int64_t listKey = loanListKey(operation.code, sede);
+            auto held = heldCopies.find(listKey);
+            std::string returnDate;
+            BulkOutcome outcome = BulkOutcome::FAILED;
+            switch(int(operation.requestType)){
+                case 0:
+                    if(held != heldCopies.end() && books[operation.code].availableCopies[sede - 1] <= int(held->second)){
+                        outcome = BulkOutcome::NO_COPIES;
+                    } else {
+                        outcome = loanLocked(operation.code, sede, "", returnDate);
+                    }
+                    if(outcome == BulkOutcome::OK){
+                        bulkResult.loanDueDate = returnDate;
+                    }
+                    break;
+                case 1: outcome = renewLocked(operation.code, sede, ""); break;
+                case 2: {
+                    outcome = returnLocked(operation.code, sede, "");
+                    auto waitlist = waitlists.find(listKey);
+                    std::size_t alreadyHeld = held == heldCopies.end() ? 0 : held->second;
+                    if(outcome == BulkOutcome::OK && !origin.replicated && waitlist != waitlists.end() && waitlist->second.size() > alreadyHeld){
+                        heldCopies[listKey]++;
+                        pendingHandOffs.emplace_back(operation.code, sede);
+                    }
+                    break;
+                }
+            }
+            bulkResult.outcomes[position] = char(outcome);
+        }
+        if(allOrNothing){
+            bulkResult.rolledBack = bulkResult.outcomes.find_first_not_of(char(BulkOutcome::OK)) != std::string::npos;
+            finishTrial(!bulkResult.rolledBack);
+        }
+
+        if(lastOperationId > operationIdBefore){
+            bulkResult.firstOperationId = operationIdBefore + 1;
+            bulkResult.lastOperationId = lastOperationId;
+        }
+        for(std::size_t handOffIndex = 0; handOffIndex < pendingHandOffs.size() && !bulkResult.rolledBack; handOffIndex++){
+            ReservationHandOff handOff;
+            if(lendToWaitlistHead(pendingHandOffs[handOffIndex].first, pendingHandOffs[handOffIndex].second, handOff) == BulkOutcome::OK){
+                bulkResult.handOffs.push_back(handOff);
+            }
+        }
+        return bulkResult;
+    }
+
+    std::int64_t lastOperation() override{
+        std::lock_guard<std::mutex> lock(storeMutex);
+        return lastOperationId;
+    }
+
+    void awaitDurable(std::int64_t operationId) override{
+        std::unique_lock<std::mutex> lock(storeMutex);
+        if(syncedOperationId >= operationId){
+            return;
+        }
+        syncWaiters++;
+        syncCondition.notify_all();
+        syncCondition.wait(lock, [this, operationId]{ return syncedOperationId >= operationId || !flusherRunning; });
+        syncWaiters--;
+    }
+
+    std::int64_t lastStoredOperation() override{
+        return lastOperation();
+    }
+
+    //Only operations still in the log can be read back; older ones were
+    //folded into the snapshot
+    std::vector<OperationLogEntry> readOperations(std::int64_t afterId, std::size_t limit) override{
+        std::lock_guard<std::mutex> lock(storeMutex);
+        std::vector<OperationLogEntry> entries;
+        EmbeddedLogRecord *firstRecord = std::partition_point(logRecords, logRecords + logRecordCount,
+            [afterId](const EmbeddedLogRecord &record){ return record.operationId <= afterId; });
+        for(EmbeddedLogRecord *record = firstRecord; record < logRecords + logRecordCount && entries.size() < limit; record++){
+            entries.push_back(OperationLogEntry{record->operationId, countedType(*record), record->bookCode, record->sede - 1, 0});
+        }
+        return entries;
+    }
+
+    //The log records no origin, which is why GA refuses --site-local with an
+    //embedded store: every operation it holds counts as served here
+    std::vector<OperationLogEntry> readServedOperations(std::int64_t afterId, std::size_t limit) override{
+        return readOperations(afterId, limit);
+    }
+
+    std::int64_t lastReplicatedOperation(int) override{
+        return 0;
+    }
+
+    //Titles and authors are not kept in the store; they come from the same
+    //init.sql rows the catalog was seeded from
+    std::vector<CatalogRecord> readCatalog() override{
+        std::unordered_map<int, std::pair<std::string, std::string>> catalogText = readSeedText(catalogSeedPath);
+        std::lock_guard<std::mutex> lock(storeMutex);
+        std::vector<CatalogRecord> catalog;
+        catalog.reserve(books.size());
+        for(const auto &bookEntry : books){
+            const EmbeddedBook &book = bookEntry.second;
+            auto textEntry = catalogText.find(book.code);
+            catalog.push_back(CatalogRecord{
+                book.code,
+                textEntry != catalogText.end() ? textEntry->second.first : "",
+                textEntry != catalogText.end() ? textEntry->second.second : "",
+                {book.availableCopies[0], book.availableCopies[1]}
+            });
+        }
+        std::sort(catalog.begin(), catalog.end(), [](const CatalogRecord &left, const CatalogRecord &right){ return left.code < right.code; });
+        return catalog;
+    }
+
+    std::vector<UsageRow> readUsage(int fromDay, int toDay) override{
+        std::lock_guard<std::mutex> lock(storeMutex);
+        return usageRollup.read(fromDay, toDay);
+    }
+
+    void trackActiveLoans() override{
+        std::lock_guard<std::mutex> lock(storeMutex);
+        for(const auto &loanEntry : activeLoans){
+            const EmbeddedLoan &activeLoan = loanEntry.second;
+            overdueTracker.track(activeLoan.stateId, activeLoan.bookCode, activeLoan.sede, dateFromDayNumber(activeLoan.dueDay));
+        }
+        overdueTracker.advance(currentDayNumber());
+        std::cout << "[GA-Overdue] Tracking " << activeLoans.size() << " active loans\n";
+    }
+
+private:
+    static std::int64_t loanListKey(int bookCode, int sede){
+        return (std::int64_t(bookCode) << 8) | std::int64_t(sede);
+    }
+
+    static std::uint32_t recordChecksum(const EmbeddedLogRecord &record){
+        const unsigned char *recordBytes = reinterpret_cast<const unsigned char*>(&record);
+        std::uint32_t checksum = 2166136261u;
+        for(std::size_t position = 0; position < offsetof(EmbeddedLogRecord, checksum); position++){
+            checksum = (checksum ^ recordBytes[position]) * 16777619u;
+        }
+        return checksum == 0 ? 1 : checksum;
+    }
+
+    static void decodeRequestKey(const std::string &requestKey, std::uint8_t *keyBytes){
+        std::memset(keyBytes, 0, 16);
+        for(std::size_t position = 0; position + 1 < requestKey.size() && position / 2 < 16; position += 2){
+            keyBytes[position / 2] = std::uint8_t(std::stoi(requestKey.substr(position, 2), nullptr, 16));
+        }
+    }
+
+    static std::string encodeRequestKey(const std::uint8_t *keyBytes){
+        static const char hexDigits[] = "0123456789abcdef";
+        std::string requestKey;
+        bool isEmpty = true;
+        for(std::size_t position = 0; position < 16; position++){
+            requestKey.push_back(hexDigits[keyBytes[position] >> 4]);
+            requestKey.push_back(hexDigits[keyBytes[position] & 0x0F]);
+            isEmpty = isEmpty && keyBytes[position] == 0;
+        }
+        return isEmpty ? "" : requestKey;
+    }
+
+    //A hand-off is logged, replicated and counted as the loan it is
+    static std::int32_t countedType(const EmbeddedLogRecord &record){
+        return record.requestType == embeddedHandOffRecord ? 0 : record.requestType;
+    }
+
+    static std::string describeLoan(BulkOutcome outcome, const std::string &returnDate){
+        switch(outcome){
+            case BulkOutcome::OK: return "Loan successful. Return date: " + returnDate;
+            case BulkOutcome::BOOK_NOT_FOUND: return "Error: Book does not exist";
+            case BulkOutcome::NO_COPIES: return "Error: No available copies of this book";
+            default: return "Database error: embedded log is not writable";
+        }
+    }
+
+    bool hasWaitingPatron(int bookCode, int sede) const{
+        auto waitlist = waitlists.find(loanListKey(bookCode, sede));
+        return waitlist != waitlists.end() && !waitlist->second.empty();
+    }
+
+    //Lends a copy to the patron at the head of the book's waitlist, who the
+    //record takes off it when applied
+    BulkOutcome lendToWaitlistHead(int bookCode, int sede, ReservationHandOff &handOff){
+        auto bookIterator = books.find(bookCode);
+        if(bookIterator == books.end() || sede < 1 || sede > 2){
+            return BulkOutcome::BOOK_NOT_FOUND;
+        }
+        if(bookIterator->second.availableCopies[sede - 1] <= 0){
+            return BulkOutcome::NO_COPIES;
+        }
+        if(!hasWaitingPatron(bookCode, sede)){
+            return BulkOutcome::FAILED;
+        }
+        std::string patron = waitlists[loanListKey(bookCode, sede)].front();
+
+        EmbeddedLogRecord record{};
+        record.requestType = embeddedHandOffRecord;
+        record.bookCode = bookCode;
+        record.sede = sede;
+        record.stateId = nextStateId;
+        record.dueDay = currentDayNumber() + 14;
+        if(!appendAndApply(record)){
+            return BulkOutcome::FAILED;
+        }
+        handOff.bookCode = bookCode;
+        handOff.sede = sede;
+        handOff.patron = patron;
+        handOff.dueDate = dateFromDayNumber(record.dueDay);
+        handOff.loanOperationId = record.operationId;
+        return BulkOutcome::OK;
+    }
+
+    BulkOutcome loanLocked(int bookCode, int sede, const std::string &requestKey, std::string &returnDate){
+        auto appliedKey = requestKey.empty() ? appliedRequests.end() : appliedRequests.find(requestKey);
+        if(appliedKey != appliedRequests.end()){
+            returnDate = dateFromDayNumber(appliedKey->second);
+            return BulkOutcome::OK;
+        }
+        auto bookIterator = books.find(bookCode);
+        if(bookIterator == books.end() || sede < 1 || sede > 2){
+            return BulkOutcome::BOOK_NOT_FOUND;
+        }
+        if(bookIterator->second.availableCopies[sede - 1] <= 0){
+            return BulkOutcome::NO_COPIES;
+        }
+
+        EmbeddedLogRecord record{};
+        record.requestType = 0;
+        record.bookCode = bookCode;
+        record.sede = sede;
+        record.stateId = nextStateId;
+        record.dueDay = currentDayNumber() + 14;
+        decodeRequestKey(requestKey, record.requestKey);
+        if(!appendAndApply(record)){
+            return BulkOutcome::FAILED;
+        }
+        returnDate = dateFromDayNumber(record.dueDay);
+        return BulkOutcome::OK;
+    }
+
+    BulkOutcome renewLocked(int bookCode, int sede, const std::string &requestKey){
+        if(!requestKey.empty() && appliedRequests.count(requestKey)){
+            return BulkOutcome::OK;
+        }
+        auto bookIterator = books.find(bookCode);
+        auto loanListIterator = loansByBookSede.find(loanListKey(bookCode, sede));
+        if(bookIterator == books.end() || loanListIterator == loansByBookSede.end()){
+            return BulkOutcome::NO_ACTIVE_LOAN;
+        }
+
+        //Same choice as the SQL handler: fewest renewals first, then oldest,
+        //skipping loans older than one of the book already returned
+        EmbeddedLoan *chosenLoan = nullptr;
+        for(int stateId : loanListIterator->second){
+            EmbeddedLoan &candidate = activeLoans[stateId];
+            if(candidate.stateId <= bookIterator->second.latestReturnedLoan){
+                continue;
+            }
+            if(!chosenLoan || candidate.renewals < chosenLoan->renewals ||
+               (candidate.renewals == chosenLoan->renewals && candidate.stateId < chosenLoan->stateId)){
+                chosenLoan = &candidate;
+            }
+        }
+        if(!chosenLoan){
+            return BulkOutcome::NO_ACTIVE_LOAN;
+        }
+        if(chosenLoan->renewals >= 2){
+            return BulkOutcome::RENEWAL_LIMIT;
+        }
+
+        EmbeddedLogRecord record{};
+        record.requestType = 1;
+        record.bookCode = bookCode;
+        record.sede = sede;
+        record.stateId = chosenLoan->stateId;
+        record.dueDay = chosenLoan->dueDay + 7;
+        decodeRequestKey(requestKey, record.requestKey);
+        if(!appendAndApply(record)){
+            return BulkOutcome::FAILED;
+        }
+        return BulkOutcome::OK;
+    }
+
+    BulkOutcome returnLocked(int bookCode, int sede, const std::string &requestKey){
+        if(!requestKey.empty() && appliedRequests.count(requestKey)){
+            return BulkOutcome::OK;
+        }
+        auto loanListIterator = loansByBookSede.find(loanListKey(bookCode, sede));
+        if(loanListIterator == loansByBookSede.end()){
+            return BulkOutcome::NO_ACTIVE_LOAN;
+        }
+
+        //Most renewed first, then newest
+        EmbeddedLoan *chosenLoan = nullptr;
+        for(int stateId : loanListIterator->second){
+            EmbeddedLoan &candidate = activeLoans[stateId];
+            if(!chosenLoan || candidate.renewals > chosenLoan->renewals ||
+               (candidate.renewals == chosenLoan->renewals && candidate.stateId > chosenLoan->stateId)){
+                chosenLoan = &candidate;
+            }
+        }
+        if(!chosenLoan){
+            return BulkOutcome::NO_ACTIVE_LOAN;
+        }
+
+        EmbeddedLogRecord record{};
+        record.requestType = 2;
+        record.bookCode = bookCode;
+        record.sede = sede;
+        record.stateId = chosenLoan->stateId;
+        //A return has no due date; the field keeps the day it happened
+        record.dueDay = currentDayNumber();
+        decodeRequestKey(requestKey, record.requestKey);
+        if(!appendAndApply(record)){
+            return BulkOutcome::FAILED;
+        }
+        return BulkOutcome::OK;
+    }
+
+    bool appendAndApply(EmbeddedLogRecord &record){
+        if(inTrial){
+            record.operationId = lastOperationId + 1;
+            record.checksum = recordChecksum(record);
+            trialRecords.push_back(record);
+            applyRecord(record);
+            return true;
+        }
+        if(logRecordCount >= embeddedLogCapacity){
+            if(!writeSnapshot()){
+                return false;
+            }
+            startLogGeneration();
+        }
+        record.operationId = lastOperationId + 1;
+        record.checksum = recordChecksum(record);
+        logRecords[logRecordCount] = record;
+        logRecordCount++;
+        applyRecord(record);
+        trackRecord(record);
+        return true;
+    }
+
+    //Live operations only; replay registers active loans in trackActiveLoans
+    void trackRecord(const EmbeddedLogRecord &record){
+        switch(record.requestType){
+            case 0:
+            case embeddedHandOffRecord: overdueTracker.track(record.stateId, record.bookCode, record.sede, dateFromDayNumber(record.dueDay)); break;
+            case 1: overdueTracker.reschedule(record.stateId, dateFromDayNumber(record.dueDay)); break;
+            case 2: overdueTracker.release(record.stateId); break;
+        }
+    }
+
+    //An all-or-nothing batch is applied to the indexes first and only
+    //reaches the log, and the overdue tracker, once every operation has
+    //succeeded. What it can touch is saved here so a failed batch can be put
+    //back; the log is rolled over beforehand so the batch fits in it.
+    bool beginTrial(const Request *operations, std::size_t operationCount){
+        if(logRecordCount + operationCount > embeddedLogCapacity){
+            if(!writeSnapshot()){
+                return false;
+            }
+            startLogGeneration();
+        }
+        trialOperationId = lastOperationId;
+        trialNextStateId = nextStateId;
+        trialBooks.clear();
+        trialLoanLists.clear();
+        trialLoans.clear();
+        for(std::size_t position = 0; position < operationCount; position++){
+            int bookCode = operations[position].code;
+            auto bookIterator = books.find(bookCode);
+            if(bookIterator != books.end()){
+                trialBooks.emplace(bookCode, bookIterator->second);
+            }
+            std::int64_t listKey = loanListKey(bookCode, operations[position].location + 1);
+            auto loanListIterator = loansByBookSede.find(listKey);
+            if(loanListIterator == loansByBookSede.end() || trialLoanLists.count(listKey)){
+                continue;
+            }
+            trialLoanLists.emplace(listKey, loanListIterator->second);
+            for(int stateId : loanListIterator->second){
+                trialLoans.emplace(stateId, activeLoans[stateId]);
+            }
+        }
+        trialRecords.clear();
+        inTrial = true;
+        return true;
+    }
+
+    void finishTrial(bool commit){
+        inTrial = false;
+        if(commit){
+            for(const EmbeddedLogRecord &record : trialRecords){
+                logRecords[logRecordCount++] = record;
+                trackRecord(record);
+            }
+            return;
+        }
+        for(const EmbeddedLogRecord &record : trialRecords){
+            usageRollup.add(operationDay(record), record.bookCode, record.sede, countedType(record), -1);
+            if(record.requestType == 0){
+                activeLoans.erase(record.stateId);
+            }
+        }
+        for(const auto &bookEntry : trialBooks){
+            books[bookEntry.first] = bookEntry.second;
+        }
+        for(const auto &loanEntry : trialLoans){
+            activeLoans[loanEntry.first] = loanEntry.second;
+        }
+        for(const EmbeddedLogRecord &record : trialRecords){
+            std::int64_t listKey = loanListKey(record.bookCode, record.sede);
+            auto savedList = trialLoanLists.find(listKey);
+            if(savedList != trialLoanLists.end()){
+                loansByBookSede[listKey] = savedList->second;
+            } else {
+                loansByBookSede.erase(listKey);
+            }
+        }
+        lastOperationId = trialOperationId;
+        nextStateId = trialNextStateId;
+        trialRecords.clear();
+    }
+
+    //The only place the indexes change, shared by live operations and replay
+    void applyRecord(const EmbeddedLogRecord &record){
+        switch(record.requestType){
+            case 0:
+            case embeddedHandOffRecord: {
+                books[record.bookCode].availableCopies[record.sede - 1]--;
+                activeLoans[record.stateId] = EmbeddedLoan{record.stateId, record.bookCode, record.sede, record.dueDay, 0};
+                loansByBookSede[loanListKey(record.bookCode, record.sede)].push_back(record.stateId);
+                nextStateId = std::max(nextStateId, record.stateId + 1);
+                //Hand-offs up to waitlistsAsOf are already out of the saved waitlists
+                auto waitlist = waitlists.find(loanListKey(record.bookCode, record.sede));
+                if(record.requestType == embeddedHandOffRecord && record.operationId > waitlistsAsOf && waitlist != waitlists.end()){
+                    waitlist->second.pop_front();
+                    if(waitlist->second.empty()){
+                        waitlists.erase(waitlist);
+                    }
+                }
+                break;
+            }
+            case 1: {
+                EmbeddedLoan &renewedLoan = activeLoans[record.stateId];
+                renewedLoan.renewals++;
+                renewedLoan.dueDay = record.dueDay;
+                break;
+            }
+            case 2: {
+                EmbeddedBook &returnedBook = books[record.bookCode];
+                returnedBook.availableCopies[record.sede - 1]++;
+                returnedBook.latestReturnedLoan = std::max(returnedBook.latestReturnedLoan, record.stateId);
+                activeLoans.erase(record.stateId);
+                std::vector<int> &loanList = loansByBookSede[loanListKey(record.bookCode, record.sede)];
+                loanList.erase(std::remove(loanList.begin(), loanList.end(), record.stateId), loanList.end());
+                break;
+            }
+        }
+        usageRollup.add(operationDay(record), record.bookCode, record.sede, countedType(record));
+        std::string requestKey = encodeRequestKey(record.requestKey);
+        if(!requestKey.empty()){
+            //Lower sequences of the same writer and epoch are never sent again
+            std::string lowestKey = requestKey.substr(0, 2 * requestKeyPrefixSize);
+            lowestKey.resize(2 * requestKeySize, '0');
+            appliedRequests.erase(appliedRequests.lower_bound(lowestKey), appliedRequests.lower_bound(requestKey));
+            appliedRequests[requestKey] = record.requestType == 0 ? record.dueDay : record.requestType;
+        }
+        lastOperationId = record.operationId;
+    }
+
+    //Day a record was applied, for the usage rollups. Loans are due 14 days
+    //after they happen and returns keep their day; a renewal only keeps its
+    //new due date, so renewals replayed after a restart count on that day.
+    static int operationDay(const EmbeddedLogRecord &record){
+        if(countedType(record) == 0){
+            return record.dueDay - 14;
+        }
+        if(record.requestType == 2 && record.dueDay > 0){
+            return record.dueDay;
+        }
+        return currentDayNumber();
+    }
+
+    //Applies the log records newer than the snapshot. Ids only grow, so the
+    //first record that fails its checksum or goes backwards ends the log;
+    //anything past it is left over from before the last snapshot.
+    std::uint64_t replayLog(){
+        std::uint64_t replayedCount = 0;
+        std::int64_t previousId = 0;
+        logRecordCount = 0;
+        while(logRecordCount < embeddedLogCapacity){
+            const EmbeddedLogRecord &record = logRecords[logRecordCount];
+            if(record.checksum != recordChecksum(record) || record.operationId <= previousId){
+                break;
+            }
+            if(record.operationId > lastOperationId){
+                applyRecord(record);
+                replayedCount++;
+            }
+            previousId = record.operationId;
+            logRecordCount++;
+        }
+        return replayedCount;
+    }
+
+    bool loadSnapshot(){
+        std::FILE *snapshotFile = std::fopen(snapshotPath.c_str(), "rb");
+        if(!snapshotFile){
+            return false;
+        }
+        EmbeddedSnapshotHeader header{};
+        bool loaded = std::fread(&header, sizeof(header), 1, snapshotFile) == 1 && std::memcmp(header.magic, "GASNAP01", 8) == 0;
+
+        std::vector<EmbeddedBook> bookRows(loaded ? header.bookCount : 0);
+        std::vector<EmbeddedLoan> loanRows(loaded ? header.loanCount : 0);
+        std::vector<EmbeddedAppliedKey> keyRows(loaded ? header.appliedKeyCount : 0);
+        loaded = loaded &&
+                 std::fread(bookRows.data(), sizeof(EmbeddedBook), bookRows.size(), snapshotFile) == bookRows.size() &&
+                 std::fread(loanRows.data(), sizeof(EmbeddedLoan), loanRows.size(), snapshotFile) == loanRows.size() &&
+                 std::fread(keyRows.data(), sizeof(EmbeddedAppliedKey), keyRows.size(), snapshotFile) == keyRows.size();
+        std::fclose(snapshotFile);
+        if(!loaded){
+            std::cerr << "[GA-Store] Snapshot " << snapshotPath << " is unreadable, ignoring it\n";
+            return false;
+        }
+
+        for(const EmbeddedBook &book : bookRows){
+            books[book.code] = book;
+        }
+        for(const EmbeddedLoan &activeLoan : loanRows){
+            activeLoans[activeLoan.stateId] = activeLoan;
+            loansByBookSede[loanListKey(activeLoan.bookCode, activeLoan.sede)].push_back(activeLoan.stateId);
+        }
+        for(const EmbeddedAppliedKey &appliedKey : keyRows){
+            appliedRequests[encodeRequestKey(appliedKey.requestKey)] = appliedKey.outcome;
+        }
+        lastOperationId = header.lastOperationId;
+        nextStateId = header.nextStateId;
+        loadUsage();
+        return true;
+    }
+
+    //The rollups only count if they were written with the snapshot just loaded
+    void loadUsage(){
+        std::FILE *usageFile = std::fopen(usagePath.c_str(), "rb");
+        EmbeddedUsageHeader header{};
+        bool loaded = usageFile && std::fread(&header, sizeof(header), 1, usageFile) == 1 &&
+                      std::memcmp(header.magic, "GAUSE01", 8) == 0 && header.lastOperationId == lastOperationId;
+        std::vector<UsageRow> usageRows(loaded ? header.rowCount : 0);
+        loaded = loaded && std::fread(usageRows.data(), sizeof(UsageRow), usageRows.size(), usageFile) == usageRows.size();
+        if(usageFile){
+            std::fclose(usageFile);
+        }
+        if(!loaded){
+            std::cerr << "[GA-Store] No usage rollups for snapshot at operation #" << lastOperationId << ", counting from here\n";
+            return;
+        }
+        for(const UsageRow &usageRow : usageRows){
+            for(int requestType = 0; requestType < 3; requestType++){
+                usageRollup.add(usageRow.day, usageRow.bookCode, usageRow.sede, requestType, usageRow.counts[requestType]);
+            }
+        }
+    }
+
+    //Written next to every snapshot; a missing or stale file only loses the
+    //rollups, never state
+    void writeUsage(){
+        EmbeddedUsageHeader header{};
+        std::memcpy(header.magic, "GAUSE01", 8);
+        header.lastOperationId = lastOperationId;
+        std::vector<UsageRow> usageRows = usageRollup.all();
+        header.rowCount = usageRows.size();
+
+        std::string temporaryPath = usagePath + ".tmp";
+        std::FILE *usageFile = std::fopen(temporaryPath.c_str(), "wb");
+        if(!usageFile){
+            return;
+        }
+        bool written = std::fwrite(&header, sizeof(header), 1, usageFile) == 1 &&
+                       std::fwrite(usageRows.data(), sizeof(UsageRow), usageRows.size(), usageFile) == usageRows.size() &&
+                       std::fflush(usageFile) == 0 &&
+                       fsync(fileno(usageFile)) == 0;
+        std::fclose(usageFile);
+        if(!written || std::rename(temporaryPath.c_str(), usagePath.c_str()) != 0){
+            std::remove(temporaryPath.c_str());
+            std::cerr << "[GA-Store] Could not write usage rollups " << usagePath << "\n";
+        }
+    }
+
+    //Text, one "<code> <sede> <patron>" line per waiting patron in order
+    //after a "GARES01 <operation id>" header. Patron names hold no control
+    //characters, so a name runs to the end of its line.
+    void loadReservations(){
+        std::ifstream reservationsFile(reservationsPath);
+        std::string line;
+        if(!std::getline(reservationsFile, line) || line.rfind("GARES01 ", 0) != 0){
+            return;
+        }
+        waitlistsAsOf = std::stoll(line.substr(8));
+        while(std::getline(reservationsFile, line)){
+            std::size_t codeEnd = line.find(' ');
+            std::size_t sedeEnd = codeEnd == std::string::npos ? std::string::npos : line.find(' ', codeEnd + 1);
+            if(sedeEnd == std::string::npos){
+                break;
+            }
+            int bookCode = std::stoi(line.substr(0, codeEnd));
+            int sede = std::stoi(line.substr(codeEnd + 1, sedeEnd - codeEnd - 1));
+            waitlists[loanListKey(bookCode, sede)].push_back(line.substr(sedeEnd + 1));
+        }
+    }
+
+    //Small enough to be rewritten whole, through a renamed temporary file
+    bool writeReservations(){
+        std::string reservationsText = "GARES01 " + std::to_string(lastOperationId) + "\n";
+        for(const auto &waitlistEntry : waitlists){
+            for(const std::string &patron : waitlistEntry.second){
+                reservationsText += std::to_string(waitlistEntry.first >> 8) + " " + std::to_string(waitlistEntry.first & 0xFF) + " " + patron + "\n";
+            }
+        }
+        std::string temporaryPath = reservationsPath + ".tmp";
+        std::FILE *reservationsFile = std::fopen(temporaryPath.c_str(), "wb");
+        if(!reservationsFile){
+            return false;
+        }
+        bool written = std::fwrite(reservationsText.data(), 1, reservationsText.size(), reservationsFile) == reservationsText.size() &&
+                       std::fflush(reservationsFile) == 0 &&
+                       fsync(fileno(reservationsFile)) == 0;
+        std::fclose(reservationsFile);
+        if(!written || std::rename(temporaryPath.c_str(), reservationsPath.c_str()) != 0){
+            std::remove(temporaryPath.c_str());
+            std::cerr << "[GA-Store] Could not write reservations " << reservationsPath << "\n";
+            return false;
+        }
+        waitlistsAsOf = lastOperationId;
+        return true;
+    }
+
+    //The waitlists go first: the hand-offs in the log about to be dropped
+    //must already be out of them
+    bool writeSnapshot(){
+        if(!writeReservations()){
+            return false;
+        }
+        EmbeddedSnapshotHeader header{};
+        std::memcpy(header.magic, "GASNAP01", 8);
+        header.lastOperationId = lastOperationId;
+        header.nextStateId = nextStateId;
+        header.bookCount = std::uint32_t(books.size());
+        header.loanCount = std::uint32_t(activeLoans.size());
+        header.appliedKeyCount = std::uint32_t(appliedRequests.size());
+
+        std::vector<EmbeddedBook> bookRows;
+        for(const auto &bookEntry : books){
+            bookRows.push_back(bookEntry.second);
+        }
+        std::vector<EmbeddedLoan> loanRows;
+        for(const auto &loanEntry : activeLoans){
+            loanRows.push_back(loanEntry.second);
+        }
+        std::vector<EmbeddedAppliedKey> keyRows;
+        for(const auto &keyEntry : appliedRequests){
+            EmbeddedAppliedKey appliedKey{};
+            decodeRequestKey(keyEntry.first, appliedKey.requestKey);
+            appliedKey.outcome = keyEntry.second;
+            keyRows.push_back(appliedKey);
+        }
+
+        std::string temporaryPath = snapshotPath + ".tmp";
+        std::FILE *snapshotFile = std::fopen(temporaryPath.c_str(), "wb");
+        if(!snapshotFile){
+            return false;
+        }
+        bool written = std::fwrite(&header, sizeof(header), 1, snapshotFile) == 1 &&
+                       std::fwrite(bookRows.data(), sizeof(EmbeddedBook), bookRows.size(), snapshotFile) == bookRows.size() &&
+                       std::fwrite(loanRows.data(), sizeof(EmbeddedLoan), loanRows.size(), snapshotFile) == loanRows.size() &&
+                       std::fwrite(keyRows.data(), sizeof(EmbeddedAppliedKey), keyRows.size(), snapshotFile) == keyRows.size() &&
+                       std::fflush(snapshotFile) == 0 &&
+                       fsync(fileno(snapshotFile)) == 0;
+        std::fclose(snapshotFile);
+
+        if(!written || std::rename(temporaryPath.c_str(), snapshotPath.c_str()) != 0){
+            std::remove(temporaryPath.c_str());
+            std::cerr << "[GA-Store] Could not write snapshot " << snapshotPath << "\n";
+            return false;
+        }
+        writeUsage();
+        std::cout << "[GA-Store] Snapshot written at operation #" << lastOperationId << "\n";
+        return true;
+    }
+
+    //Reads the libros rows of init.sql: (codigo, 'titulo', 'autor', sede1, sede2, total1, total2)
+    void seedCatalog(const std::string &seedPath){
+        std::ifstream seedFile(seedPath);
+        std::string line;
+        bool inBookRows = false;
+        while(std::getline(seedFile, line)){
+            if(line.rfind("INSERT INTO libros", 0) == 0){
+                inBookRows = true;
+                continue;
+            }
+            if(!inBookRows){
+                continue;
+            }
+            std::size_t rowEnd = line.rfind(')');
+            if(line.empty() || line[0] != '(' || rowEnd == std::string::npos){
+                break;
+            }
+
+            int copyColumns[4];
+            std::size_t fieldEnd = rowEnd;
+            for(int column = 3; column >= 0; column--){
+                std::size_t fieldStart = line.rfind(',', fieldEnd - 1);
+                copyColumns[column] = std::stoi(line.substr(fieldStart + 1, fieldEnd - fieldStart - 1));
+                fieldEnd = fieldStart;
+            }
+            int bookCode = std::stoi(line.substr(1));
+            books[bookCode] = EmbeddedBook{bookCode, {copyColumns[0], copyColumns[1]}, 0};
+        }
+        if(books.empty()){
+            std::cerr << "[GA-Store] No catalog found in " << seedPath << ", starting empty\n";
+        }
+    }
+
+    //Reads a quoted SQL string starting at position, leaving position after it
+    static std::string readQuotedField(const std::string &line, std::size_t &position){
+        std::string field;
+        position = line.find('\'', position);
+        if(position == std::string::npos){
+            return field;
+        }
+        for(position++; position < line.size(); position++){
+            if(line[position] == '\'' && position + 1 < line.size() && line[position + 1] == '\''){
+                field.push_back('\'');
+                position++;
+            } else if(line[position] == '\''){
+                position++;
+                break;
+            } else {
+                field.push_back(line[position]);
+            }
+        }
+        return field;
+    }
+
+    //Title and author of every libros row of init.sql, by code
+    static std::unordered_map<int, std::pair<std::string, std::string>> readSeedText(const std::string &seedPath){
+        std::unordered_map<int, std::pair<std::string, std::string>> catalogText;
+        std::ifstream seedFile(seedPath);
+        std::string line;
+        bool inBookRows = false;
+        while(std::getline(seedFile, line)){
+            if(line.rfind("INSERT INTO libros", 0) == 0){
+                inBookRows = true;
+                continue;
+            }
+            if(!inBookRows){
+                continue;
+            }
+            if(line.empty() || line[0] != '('){
+                break;
+            }
+            std::size_t position = 1;
+            std::string title = readQuotedField(line, position);
+            std::string author = readQuotedField(line, position);
+            catalogText[std::stoi(line.substr(1))] = std::make_pair(title, author);
+        }
+        return catalogText;
+    }
+
+    //The snapshot that ends a log generation is fsynced, so everything up to
+    //it is durable
+    void startLogGeneration(){
+        logRecordCount = 0;
+        syncedRecordCount = 0;
+        logGeneration++;
+        syncedOperationId = lastOperationId;
+        syncCondition.notify_all();
+    }
+
+    //Group flush: one msync covers every record appended since the last one
+    void flushLoop(){
+        while(flusherRunning){
+            std::uint64_t firstRecord, lastRecord, generation;
+            std::int64_t coveredOperationId;
+            {
+                std::unique_lock<std::mutex> lock(storeMutex);
+                syncCondition.wait_for(lock, std::chrono::milliseconds(embeddedSyncIntervalMs),
+                                       [this]{ return syncWaiters > 0 || !flusherRunning; });
+                firstRecord = syncedRecordCount;
+                lastRecord = logRecordCount;
+                generation = logGeneration;
+                coveredOperationId = lastOperationId;
+            }
+
+            if(lastRecord > firstRecord){
+                std::uintptr_t pageSize = std::uintptr_t(sysconf(_SC_PAGESIZE));
+                std::uintptr_t start = reinterpret_cast<std::uintptr_t>(logRecords + firstRecord) & ~(pageSize - 1);
+                std::uintptr_t end = reinterpret_cast<std::uintptr_t>(logRecords + lastRecord);
+                msync(reinterpret_cast<void*>(start), end - start, MS_SYNC);
+            }
+
+            std::lock_guard<std::mutex> lock(storeMutex);
+            if(generation == logGeneration){
+                syncedRecordCount = std::max(syncedRecordCount, lastRecord);
+                syncedOperationId = std::max(syncedOperationId, coveredOperationId);
+            }
+            syncCondition.notify_all();
+        }
+    }
+
+    OverdueTracker &overdueTracker;
+    std::mutex storeMutex;
+    std::string snapshotPath;
+    std::string usagePath;
+    std::string reservationsPath;
+    std::string catalogSeedPath;
+
+    int logFileDescriptor = -1;
+    std::size_t logMappingSize = 0;
+    EmbeddedLogRecord *logRecords = nullptr;
+    std::uint64_t logRecordCount = 0;
+    std::uint64_t syncedRecordCount = 0;
+    std::uint64_t logGeneration = 0;
+    //Highest operation id known to be on disk, and the replies waiting for it
+    std::int64_t syncedOperationId = 0;
+    int syncWaiters = 0;
+    std::condition_variable syncCondition;
+    std::atomic<bool> flusherRunning{true};
+    std::thread flusherThread;
+
+    std::int64_t lastOperationId = 0;
+    std::int32_t nextStateId = 1;
+    std::unordered_map<int, EmbeddedBook> books;
+    std::unordered_map<int, EmbeddedLoan> activeLoans;
+    std::unordered_map<std::int64_t, std::vector<int>> loansByBookSede;
+    //Ordered so the keys a writer will not send again go in one range; the
+    //value is EmbeddedAppliedKey::outcome
+    std::map<std::string, int> appliedRequests;
+    UsageRollup usageRollup;
+    //Patrons waiting per (book, site), head first, and the operation id the
+    //reservations file was last written at
+    std::unordered_map<std::int64_t, std::deque<std::string>> waitlists;
+    std::int64_t waitlistsAsOf = 0;
+
+    bool inTrial = false;
+    std::vector<EmbeddedLogRecord> trialRecords;
+    std::int64_t trialOperationId = 0;
+    std::int32_t trialNextStateId = 0;
+    std::unordered_map<int, EmbeddedBook> trialBooks;
+    std::unordered_map<std::int64_t, std::vector<int>> trialLoanLists;
+    std::unordered_map<int, EmbeddedLoan> trialLoans;
+};
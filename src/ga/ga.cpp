@@ -2,18 +2,70 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <sstream>
 #include <pqxx/pqxx>
 #include <stdexcept>
 #include <thread>
 #include <chrono>
 #include <atomic>
 #include <mutex>
+#include <memory>
 #include "../../utils/structs.cpp"
+#include "../../utils/deadline.cpp"
+#include "../../utils/codeFilter.cpp"
+#include "../../utils/shardMap.cpp"
+#include "overdueTracker.cpp"
+#include "operationLogArchive.cpp"
+#include "snapshot.cpp"
+#include "reservationQueue.cpp"
+#include "bulkIngest.cpp"
+#include "catalogIndex.cpp"
+#include "usageRollup.cpp"
+#include "statementProfiler.cpp"
+#include "storageBackend.cpp"
+#include "postgresBackend.cpp"
+#include "embeddedBackend.cpp"
+#include "workerPool.cpp"
+#include "pipelineExecutor.cpp"
+#include "replicationDurability.cpp"
 
 std::atomic<bool> isRunning(true);
 std::atomic<bool> isPrimaryRole(false);
 std::atomic<int> lastOperationId(0);
+//Last operation id sent on the replication socket
+std::atomic<std::int64_t> lastPublishedOperationId(0);
+const std::size_t maxSyncBatch = 10000;
+//Threads serving client requests once a replica has been promoted
+const std::size_t failoverWorkerCount = 4;
+//Longest the replica reactor sleeps before noticing a promotion or demotion
+const int rolePollIntervalMs = 250;
 std::mutex databaseMutex;
+OverdueTracker overdueTracker;
+CatalogIndex catalogIndex;
+StatementProfiler statementProfiler;
+ReservationEvents reservationEvents;
+//Encoded BookCodeFilter of the current catalog, republished to GC
+std::mutex catalogFilterMutex;
+std::string catalogFilterMessage;
+//This GA serves the books shardOfBook gives to shardIndex (0-based) out of
+//shardCount; unsharded it is shard 0 of 1 and keeps the usual ports
+int shardIndex = 0;
+int shardCount = 1;
+//When writes are answered relative to the replica, and the acks it sends back
+DurabilityPolicy durabilityPolicy;
+ReplicaAckTracker replicaAckTracker;
+//Client requests dropped because their deadline passed before they started
+std::atomic<std::uint64_t> expiredRequestCount(0);
+
+//Endpoint of a GA port of this GA's shard at ipAddress
+std::string gaEndpoint(const std::string &ipAddress, int basePort){
+    return shardEndpoint(ipAddress, basePort, shardIndex);
+}
+
+//Appended to the stores and files of a shard, so shards can share hosts
+std::string shardSuffix(){
+    return shardCount == 1 ? "" : "_shard" + std::to_string(shardIndex + 1);
+}
 
 void obtainEnvData(std::vector<std::string> &environmentVariables){
     std::fstream configFile("../.env");
@@ -25,7 +77,7 @@ void obtainEnvData(std::vector<std::string> &environmentVariables){
 
 void heartbeatPublisher(zmq::context_t &context, const std::string &ipAddress){
     zmq::socket_t heartbeatSocket(context, zmq::socket_type::pub);
-    std::string heartbeatEndpoint = "tcp://" + ipAddress + ":5562";
+    std::string heartbeatEndpoint = gaEndpoint(ipAddress, 5562);
     heartbeatSocket.bind(heartbeatEndpoint);
     
     std::cout << "[GA-Heartbeat] Started on " << heartbeatEndpoint << std::endl;
@@ -43,9 +95,64 @@ void heartbeatPublisher(zmq::context_t &context, const std::string &ipAddress){
     }
 }
 
+//Overdue loans and copies lent to waiting patrons, on port 5564
+void eventPublisher(zmq::context_t &context, const std::string &ipAddress){
+    zmq::socket_t eventSocket(context, zmq::socket_type::pub);
+    std::string eventEndpoint = gaEndpoint(ipAddress, 5564);
+    eventSocket.bind(eventEndpoint);
+
+    std::cout << "[GA-Events] Publishing overdue and reservation events on " << eventEndpoint << std::endl;
+
+    while(isRunning){
+        try {
+            overdueTracker.advance(currentDayNumber());
+            for(const std::string &event : overdueTracker.drainEvents()){
+                eventSocket.send(zmq::buffer(std::string("overdue")), zmq::send_flags::sndmore);
+                eventSocket.send(zmq::buffer(event), zmq::send_flags::none);
+            }
+            for(const ReservationEvent &event : reservationEvents.drainEvents()){
+                eventSocket.send(zmq::buffer("reservation:" + event.patron + ":"), zmq::send_flags::sndmore);
+                eventSocket.send(zmq::buffer(event.message), zmq::send_flags::none);
+            }
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        } catch (const std::exception &error) {
+            std::cerr << "[GA-Events] Error: " << error.what() << std::endl;
+            break;
+        }
+    }
+}
+
+//Publishes the catalog's code filter every two seconds, so a GC that starts
+//or reconnects later has it within one period
+void catalogFilterPublisher(zmq::context_t &context, const std::string &ipAddress){
+    zmq::socket_t filterSocket(context, zmq::socket_type::pub);
+    std::string filterEndpoint = gaEndpoint(ipAddress, 5566);
+    filterSocket.bind(filterEndpoint);
+
+    std::cout << "[GA-Catalog] Publishing code filter on " << filterEndpoint << std::endl;
+
+    while(isRunning){
+        try {
+            std::string filterMessage;
+            {
+                std::lock_guard<std::mutex> lock(catalogFilterMutex);
+                filterMessage = catalogFilterMessage;
+            }
+            if(!filterMessage.empty()){
+                filterSocket.send(zmq::buffer(std::string("catalog")), zmq::send_flags::sndmore);
+                filterSocket.send(zmq::buffer(filterMessage), zmq::send_flags::none);
+            }
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+        } catch (const std::exception &error) {
+            std::cerr << "[GA-Catalog] Error: " << error.what() << std::endl;
+            break;
+        }
+    }
+}
+
 void primaryMonitor(zmq::context_t &context, const std::string &primaryIpAddress){
     zmq::socket_t monitorSocket(context, zmq::socket_type::sub);
-    std::string heartbeatEndpoint = "tcp://" + primaryIpAddress + ":5562";
+    std::string heartbeatEndpoint = gaEndpoint(primaryIpAddress, 5562);
     monitorSocket.connect(heartbeatEndpoint);
     monitorSocket.set(zmq::sockopt::subscribe, "");
     monitorSocket.set(zmq::sockopt::rcvtimeo, 5000);
@@ -78,220 +185,794 @@ void primaryMonitor(zmq::context_t &context, const std::string &primaryIpAddress
     }
 }
 
-void sendReplicationRequest(const std::string &topic, const Request &request, zmq::socket_t &replicationSocket){
+//Every replicated message carries the range of operation_log ids it produced
+//and the last id published before it, so a replica can skip what its snapshot
+//already holds and detect gaps even where the ids it gets are not contiguous
+void sendReplicationMessage(const std::string &topic, const void *payload, std::size_t payloadSize,
+                            std::int64_t firstOperationId, std::int64_t lastOperationIdInMessage, zmq::socket_t &replicationSocket){
     replicationSocket.send(zmq::buffer(topic), zmq::send_flags::sndmore);
-    zmq::message_t requestMessage(sizeof(Request));
-    memcpy(requestMessage.data(), &request, sizeof(Request));
-    replicationSocket.send(requestMessage, zmq::send_flags::none);
+    zmq::message_t requestMessage(payloadSize);
+    memcpy(requestMessage.data(), payload, payloadSize);
+    replicationSocket.send(requestMessage, zmq::send_flags::sndmore);
+    std::int64_t operationIdRange[3] = {firstOperationId, lastOperationIdInMessage, lastPublishedOperationId.load()};
+    zmq::message_t operationIdMessage(sizeof(operationIdRange));
+    memcpy(operationIdMessage.data(), operationIdRange, sizeof(operationIdRange));
+    replicationSocket.send(operationIdMessage, zmq::send_flags::none);
+    if(lastOperationIdInMessage > 0){
+        lastPublishedOperationId = lastOperationIdInMessage;
+    }
+}
+
+//Reads the id frame that follows a replicated request; publishers that predate
+//the preceding id leave it to be inferred from a contiguous log
+void receiveOperationIds(zmq::socket_t &replicationSocket, const zmq::message_t &dataMessage, std::int64_t &firstOperationId,
+                         std::int64_t &lastOperationIdInMessage, std::int64_t &precedingOperationId){
+    std::int64_t operationIdRange[3] = {0, 0, -1};
+    if(dataMessage.more()){
+        zmq::message_t operationIdMessage;
+        replicationSocket.recv(operationIdMessage, zmq::recv_flags::none);
+        memcpy(operationIdRange, operationIdMessage.data(), std::min(operationIdMessage.size(), sizeof(operationIdRange)));
+    }
+    firstOperationId = operationIdRange[0];
+    lastOperationIdInMessage = std::max(operationIdRange[0], operationIdRange[1]);
+    precedingOperationId = operationIdRange[2] >= 0 ? operationIdRange[2] : firstOperationId - 1;
+}
+
+//Times what a write just published and, unless its type is async, holds its
+//reply until the replica acknowledges all of it or the ack timeout passes
+void awaitDurability(int requestType, std::int64_t publishedBefore){
+    std::int64_t publishedUpTo = lastPublishedOperationId.load();
+    if(publishedUpTo <= publishedBefore){
+        return;
+    }
+    DurabilityMode mode = durabilityPolicy.modeFor(requestType);
+    replicaAckTracker.notePublished(publishedUpTo, mode);
+    replicaAckTracker.await(publishedUpTo, mode);
+}
+
+void sendReplicationRequest(const std::string &topic, const zmq::message_t &requestMessage, zmq::socket_t &replicationSocket){
+    std::int64_t operationId = lastOperationId.load();
+    sendReplicationMessage(topic, requestMessage.data(), requestMessage.size(), operationId, operationId, replicationSocket);
+}
+
+//A copy lent to a waiting patron replicates as a RESERVE carrying the patron
+//and the loan's operation id; the replica lends it with lendReserved, which
+//also takes the patron off its copy of the waitlist
+void sendHandOffReplication(const ReservationHandOff &handOff, zmq::socket_t &replicationSocket){
+    Request handOffHeader;
+    handOffHeader.requestType = RequestType::RESERVE;
+    handOffHeader.code = handOff.bookCode;
+    handOffHeader.location = std::int8_t(handOff.sede - 1);
+    std::string handOffMessage(reinterpret_cast<const char*>(&handOffHeader), sizeof(Request));
+    handOffMessage += handOff.patron;
+    sendReplicationMessage("replica", handOffMessage.data(), handOffMessage.size(), handOff.loanOperationId, handOff.loanOperationId, replicationSocket);
+}
+
+//A return whose copy was lent to a waiting patron replicates as the return
+//followed by that loan, each with its own operation id
+void sendReturnReplication(const zmq::message_t &returnMessage, const ReservationHandOff &handOff, zmq::socket_t &replicationSocket){
+    if(handOff.patron.empty()){
+        sendReplicationRequest("replica", returnMessage, replicationSocket);
+        return;
+    }
+    sendReplicationMessage("replica", returnMessage.data(), returnMessage.size(), handOff.returnOperationId, handOff.returnOperationId, replicationSocket);
+    sendHandOffReplication(handOff, replicationSocket);
+}
+
+//A batch replicates as one message over its own operations, then the loans
+//its returns made to waiting patrons, which were logged after them
+void sendBulkReplication(const void *bulkMessage, std::size_t bulkMessageSize, const BulkResult &bulkResult, zmq::socket_t &replicationSocket){
+    if(bulkResult.lastOperationId == 0){
+        return;
+    }
+    sendReplicationMessage("replica", bulkMessage, bulkMessageSize, bulkResult.firstOperationId, bulkResult.lastOperationId, replicationSocket);
+    for(const ReservationHandOff &handOff : bulkResult.handOffs){
+        sendHandOffReplication(handOff, replicationSocket);
+    }
 }
 
-void logDatabaseOperation(int requestType, int bookCode, int locationId, pqxx::connection &dbConnection){
+//A new place in a waitlist carries no operation id, so replicas apply it
+//whatever their cursor
+void sendReservationReplication(const zmq::message_t &reserveMessage, const std::string &operationResult, zmq::socket_t &replicationSocket){
+    if(operationResult.rfind("Reservation confirmed", 0) == 0){
+        sendReplicationMessage("replica", reserveMessage.data(), reserveMessage.size(), 0, 0, replicationSocket);
+    }
+}
+
+//Loans, and requests from an actor in journal mode, carry an idempotency key
+//after the Request; returns it hex encoded, or an empty string for plain requests. The
+//sequence is written most significant byte first, so the keys of one writer
+//and epoch sort in the order they were handed out.
+std::string requestKeyOf(const zmq::message_t &requestMessage){
+    if(requestMessage.size() != sizeof(Request) + requestKeySize){
+        return "";
+    }
+    static const char hexDigits[] = "0123456789abcdef";
+    const unsigned char *keyBytes = static_cast<const unsigned char*>(requestMessage.data()) + sizeof(Request);
+    std::string requestKey;
+    for(std::size_t position = 0; position < requestKeySize; position++){
+        std::size_t bytePosition = position < requestKeyPrefixSize ? position : requestKeySize - 1 - (position - requestKeyPrefixSize);
+        requestKey.push_back(hexDigits[keyBytes[bytePosition] >> 4]);
+        requestKey.push_back(hexDigits[keyBytes[bytePosition] & 0x0F]);
+    }
+    return requestKey;
+}
+
+std::string processOverdueQuery(int locationId){
+    int actualSede = locationId + 1;
+    std::vector<LoanDueEntry> overdueLoans = overdueTracker.overdueAt(actualSede);
+
+    std::string queryResult = "Overdue loans at location " + std::to_string(actualSede) + ": " + std::to_string(overdueLoans.size());
+    for(const LoanDueEntry &entry : overdueLoans){
+        queryResult += "\n" + std::to_string(entry.bookCode) + " due " + dateFromDayNumber(entry.dueDay);
+    }
+    return queryResult;
+}
+
+//Refuses a request naming a book of another shard before it reaches storage:
+//applied here it would change this shard's stale copy of the book
+std::string misroutedRequestError(const zmq::message_t &requestMessage){
+    if(shardCount == 1 || requestMessage.size() < sizeof(Request)){
+        return "";
+    }
+    Request header;
+    memcpy(&header, requestMessage.data(), sizeof(Request));
+    std::vector<int> bookCodes;
+    int requestType = int(header.requestType);
+    if(requestType <= 2 || requestType == 6){
+        bookCodes.push_back(header.code);
+    } else if((requestType == 4 || requestType == 7) && header.code > 0 &&
+              requestMessage.size() >= sizeof(Request) * (std::size_t(header.code) + 1)){
+        const char *operations = static_cast<const char*>(requestMessage.data()) + sizeof(Request);
+        for(std::int32_t position = 0; position < header.code; position++){
+            Request operation;
+            memcpy(&operation, operations + position * sizeof(Request), sizeof(Request));
+            bookCodes.push_back(operation.code);
+        }
+    }
+    for(int bookCode : bookCodes){
+        int ownerShard = shardOfBook(bookCode, shardCount);
+        if(ownerShard != shardIndex){
+            return "Error: Book " + std::to_string(bookCode) + " belongs to shard " + std::to_string(ownerShard + 1);
+        }
+    }
+    return "";
+}
+
+//True when the sender of a client request has already given up on it; the
+//request is then answered with expiredRequestResponse and never reaches
+//storage. Replicated and synced operations are never checked.
+bool dropIfExpired(const zmq::message_t &requestMessage){
+    if(!isExpiredMessage(requestMessage.data(), requestMessage.size())){
+        return false;
+    }
+    std::cout << "[GA-Deadline] Dropped an expired request (" << ++expiredRequestCount << " so far)\n";
+    return true;
+}
+
+//Keeps the copy counts of the search index in step with an applied operation
+void noteAppliedOperation(int requestType, int bookCode, int locationId){
+    if(requestType == 0){
+        catalogIndex.adjustAvailability(bookCode, locationId + 1, -1);
+    } else if(requestType == 2){
+        catalogIndex.adjustAvailability(bookCode, locationId + 1, 1);
+    }
+}
+
+//SEARCH carries the query text after the Request
+std::string processSearchRequest(const zmq::message_t &searchMessage){
+    Request searchHeader;
+    memcpy(&searchHeader, searchMessage.data(), sizeof(Request));
+    std::string query(static_cast<const char*>(searchMessage.data()) + sizeof(Request), searchMessage.size() - sizeof(Request));
+    return catalogIndex.search(query, std::size_t(std::max(searchHeader.code, 0)), shardCount > 1);
+}
+
+//Rebuilds the search index and the code filter GC gets from the catalog.
+//Every shard keeps all of libros, but only the copy counts of its own books
+//move, so the index holds those alone while the filter covers every code.
+void refreshCatalog(StorageBackend &storage, int site){
+    std::vector<CatalogRecord> catalog = storage.readCatalog();
+    std::vector<int> bookCodes;
+    bookCodes.reserve(catalog.size());
+    for(const CatalogRecord &record : catalog){
+        bookCodes.push_back(record.code);
+    }
+    if(shardCount > 1){
+        catalog.erase(std::remove_if(catalog.begin(), catalog.end(), [](const CatalogRecord &record){
+            return shardOfBook(record.code, shardCount) != shardIndex;
+        }), catalog.end());
+    }
+    catalogIndex.rebuild(catalog);
+    std::string filterMessage = BookCodeFilter::encode(site, bookCodes);
+    {
+        std::lock_guard<std::mutex> lock(catalogFilterMutex);
+        catalogFilterMessage = std::move(filterMessage);
+    }
+    std::cout << "[GA-Search] Indexed " << catalogIndex.size() << " books\n";
+}
+
+std::string processLoanRequest(int bookCode, int locationId, StorageBackend &storage, const std::string &requestKey = "",
+                               const OperationOrigin &origin = OperationOrigin()){
+    std::lock_guard<std::mutex> lock(databaseMutex);
+    std::int64_t operationBefore = storage.lastOperation();
+    std::string operationResult = storage.loan(bookCode, locationId, requestKey, origin);
+    if(storage.lastOperation() > 0){
+        lastOperationId = int(storage.lastOperation());
+    }
+    if(storage.lastOperation() > operationBefore){
+        noteAppliedOperation(0, bookCode, locationId);
+    }
+    return operationResult;
+}
+
+std::string processRenewalRequest(int bookCode, int locationId, StorageBackend &storage, const std::string &requestKey = "",
+                                  const OperationOrigin &origin = OperationOrigin()){
+    std::lock_guard<std::mutex> lock(databaseMutex);
+    std::string operationResult = storage.renew(bookCode, locationId, requestKey, origin);
+    if(storage.lastOperation() > 0){
+        lastOperationId = int(storage.lastOperation());
+    }
+    return operationResult;
+}
+
+//A copy the storage lent to a waiting patron as part of a return: it counts
+//against the search index and the patron is told on the events socket
+void announceHandOff(const ReservationHandOff &handOff){
+    noteAppliedOperation(0, handOff.bookCode, handOff.sede - 1);
+    reservationEvents.notify(handOff.patron, std::to_string(handOff.bookCode) + "|" + std::to_string(handOff.sede) +
+                                             "|Loan successful. Return date: " + handOff.dueDate);
+    std::cout << "[GA-Reserve] Returned copy of book " << handOff.bookCode << " lent to " << handOff.patron << "\n";
+}
+
+//Returns served to clients pass handOff to learn of the copy the storage
+//lent to a waiting patron, to replicate that loan; replicated returns set
+//origin.replicated and never hand off
+std::string processReturnRequest(int bookCode, int locationId, StorageBackend &storage, const std::string &requestKey = "",
+                                 const OperationOrigin &origin = OperationOrigin(), ReservationHandOff *handOff = nullptr){
+    std::lock_guard<std::mutex> lock(databaseMutex);
+    std::int64_t operationBefore = storage.lastOperation();
+    ReservationHandOff madeHandOff;
+    std::string operationResult = storage.returnLoan(bookCode, locationId, requestKey, origin, madeHandOff);
+    if(storage.lastOperation() > 0){
+        lastOperationId = int(storage.lastOperation());
+    }
+    if(storage.lastOperation() > operationBefore){
+        noteAppliedOperation(2, bookCode, locationId);
+    }
+    if(!madeHandOff.patron.empty()){
+        announceHandOff(madeHandOff);
+    }
+    if(handOff){
+        *handOff = madeHandOff;
+    }
+    return operationResult;
+}
+
+//A replicated RESERVE carries the patron after the Request: without an
+//operation id it is a place in a waitlist, with one it is the loan that
+//handed the book to that patron
+std::string applyReplicatedReservation(const zmq::message_t &reserveMessage, std::int64_t operationId, StorageBackend &storage,
+                                       const OperationOrigin &origin){
+    Request reserveHeader;
+    memcpy(&reserveHeader, reserveMessage.data(), sizeof(Request));
+    std::string patron(static_cast<const char*>(reserveMessage.data()) + sizeof(Request), reserveMessage.size() - sizeof(Request));
+
+    std::lock_guard<std::mutex> lock(databaseMutex);
+    if(operationId == 0){
+        try{
+            std::size_t position = storage.reserve(reserveHeader.code, reserveHeader.location, patron);
+            return position == 0 ? "Error: Waitlist for this book is full" : "Reservation copied at position " + std::to_string(position);
+        } catch (const std::exception &e){
+            return std::string("Error: Reservation could not be stored: ") + e.what();
+        }
+    }
+    std::int64_t operationBefore = storage.lastOperation();
+    std::string operationResult = storage.lendReserved(reserveHeader.code, reserveHeader.location, patron, origin);
+    if(storage.lastOperation() > 0){
+        lastOperationId = int(storage.lastOperation());
+    }
+    if(storage.lastOperation() > operationBefore){
+        noteAppliedOperation(0, reserveHeader.code, reserveHeader.location);
+    }
+    return operationResult;
+}
+
+std::string patronOf(const zmq::message_t &reserveMessage){
+    return std::string(static_cast<const char*>(reserveMessage.data()) + sizeof(Request), reserveMessage.size() - sizeof(Request));
+}
+
+//RESERVE: the patron's name follows the Request. Only a book with no copy
+//left at the site can be reserved; checked under databaseMutex, which every
+//return outside a pipeline takes, so none can free a copy between the check
+//and the insert. With a pipeline, reservations go through it instead and
+//check the copies in their own statement.
+std::string processReserveRequest(const zmq::message_t &reserveMessage, StorageBackend &storage){
+    Request reserveHeader;
+    memcpy(&reserveHeader, reserveMessage.data(), sizeof(Request));
+    std::string patron = patronOf(reserveMessage);
+    if(!isValidPatronName(patron)){
+        return "Error: Invalid patron name";
+    }
+
+    std::lock_guard<std::mutex> lock(databaseMutex);
+    int availableCopies = catalogIndex.availableCopies(reserveHeader.code, int(reserveHeader.location) + 1);
+    if(availableCopies < 0){
+        return "Error: Book does not exist";
+    }
+    if(availableCopies > 0){
+        return "Error: Copies are available, request a loan";
+    }
+    std::size_t position = 0;
+    try{
+        position = storage.reserve(reserveHeader.code, reserveHeader.location, patron);
+    } catch (const std::exception &e){
+        std::cerr << "[GA-Reserve] Could not store the reservation: " << e.what() << "\n";
+        return "Error: Reservation could not be stored";
+    }
+    if(position == 0){
+        return "Error: Waitlist for this book is full";
+    }
+    return "Reservation confirmed. Position in waitlist: " + std::to_string(position);
+}
+
+//Runs a BULK message under the write mutex; the reply is "BULK:" followed by
+//one BulkOutcome byte per operation, in request order
+std::string processBulkMessage(const zmq::message_t &bulkMessage, StorageBackend &storage, BulkResult &bulkResult,
+                               const OperationOrigin &origin = OperationOrigin()){
+    if(bulkMessage.size() < sizeof(Request)){
+        return "Error: Malformed bulk request";
+    }
+    Request bulkHeader;
+    memcpy(&bulkHeader, bulkMessage.data(), sizeof(Request));
+    std::size_t operationCount = (bulkMessage.size() - sizeof(Request)) / sizeof(Request);
+    if(bulkHeader.code < 0 || bulkHeader.code > maxBulkOperations || std::size_t(bulkHeader.code) != operationCount){
+        return "Error: Malformed bulk request";
+    }
+    
+    std::vector<Request> operations(operationCount);
+    memcpy(operations.data(), static_cast<const char*>(bulkMessage.data()) + sizeof(Request), operationCount * sizeof(Request));
+    
+    std::lock_guard<std::mutex> lock(databaseMutex);
+    bulkResult = storage.applyBulk(operations.data(), operationCount, origin, false);
+    
+    if(storage.lastOperation() > 0){
+        lastOperationId = int(storage.lastOperation());
+    }
+    for(std::size_t position = 0; position < operationCount && position < bulkResult.outcomes.size(); position++){
+        if(bulkResult.outcomes[position] == char(BulkOutcome::OK)){
+            noteAppliedOperation(int(operations[position].requestType), operations[position].code, operations[position].location);
+        }
+    }
+    for(const ReservationHandOff &handOff : bulkResult.handOffs){
+        announceHandOff(handOff);
+    }
+    return "BULK:" + bulkResult.outcomes;
+}
+
+//What the single-operation handler would have answered for one basket item
+std::string describeCheckoutItem(const Request &item, BulkOutcome outcome, const BulkResult &bulkResult){
+    if(outcome == BulkOutcome::OK && bulkResult.rolledBack){
+        return "Not applied";
+    }
+    switch(outcome){
+        case BulkOutcome::OK:
+            if(item.requestType == RequestType::LOAN){
+                return "Loan successful. Return date: " + bulkResult.loanDueDate;
+            }
+            return item.requestType == RequestType::RENEWAL ? "Loan renewed successfully for 7 additional days"
+                                                            : "Return successful. Copy available again";
+        case BulkOutcome::BOOK_NOT_FOUND: return "Error: Book does not exist";
+        case BulkOutcome::NO_COPIES: return "Error: No available copies of this book";
+        case BulkOutcome::NO_ACTIVE_LOAN: return "Error: No active loan found for this book at this location";
+        case BulkOutcome::RENEWAL_LIMIT: return "Error: Maximum renewal limit reached (2)";
+        default: return "Error: Could not be applied";
+    }
+}
+
+//CHECKOUT: a patron's basket of loans, renewals and returns at one site,
+//applied in one transaction like a BULK batch. The reply has a summary line
+//and one line per item, in basket order.
+std::string processCheckoutMessage(const zmq::message_t &checkoutMessage, StorageBackend &storage, BulkResult &bulkResult){
+    if(checkoutMessage.size() < sizeof(Request)){
+        return "Error: Malformed checkout request";
+    }
+    Request checkoutHeader;
+    memcpy(&checkoutHeader, checkoutMessage.data(), sizeof(Request));
+    std::size_t itemCount = (checkoutMessage.size() - sizeof(Request)) / sizeof(Request);
+    if(checkoutHeader.code <= 0 || checkoutHeader.code > maxCheckoutItems || std::size_t(checkoutHeader.code) != itemCount){
+        return "Error: Malformed checkout request";
+    }
+    std::vector<Request> items(itemCount);
+    memcpy(items.data(), static_cast<const char*>(checkoutMessage.data()) + sizeof(Request), itemCount * sizeof(Request));
+    for(const Request &item : items){
+        if(int(item.requestType) > 2 || item.location != checkoutHeader.location){
+            return "Error: Checkout items must be loans, renewals or returns at the checkout's location";
+        }
+    }
+    bool allOrNothing = checkoutHeader.checkoutMode == CheckoutMode::ALL_OR_NOTHING;
+
+    {
+        std::lock_guard<std::mutex> lock(databaseMutex);
+        bulkResult = storage.applyBulk(items.data(), itemCount, OperationOrigin(), allOrNothing);
+        if(storage.lastOperation() > 0){
+            lastOperationId = int(storage.lastOperation());
+        }
+        for(const ReservationHandOff &handOff : bulkResult.handOffs){
+            announceHandOff(handOff);
+        }
+    }
+
+    std::size_t appliedCount = 0;
+    std::string itemLines;
+    const char *itemTypeNames[] = {"LOAN", "RENEWAL", "RETURN"};
+    for(std::size_t position = 0; position < itemCount; position++){
+        BulkOutcome outcome = position < bulkResult.outcomes.size() ? BulkOutcome(bulkResult.outcomes[position]) : BulkOutcome::FAILED;
+        if(outcome == BulkOutcome::OK && !bulkResult.rolledBack){
+            noteAppliedOperation(int(items[position].requestType), items[position].code, items[position].location);
+            appliedCount++;
+        }
+        itemLines += "\n" + std::string(itemTypeNames[int(items[position].requestType)]) + " " + std::to_string(items[position].code) +
+                     ": " + describeCheckoutItem(items[position], outcome, bulkResult);
+    }
+    if(bulkResult.rolledBack){
+        return "Checkout rejected, no item was applied" + itemLines;
+    }
+    return "Checkout: " + std::to_string(appliedCount) + " of " + std::to_string(itemCount) + " items applied" + itemLines;
+}
+
+//A basket replicates as the BULK of its items; the replica re-resolves them
+//against the same state and gets the same outcomes
+void sendCheckoutReplication(const zmq::message_t &checkoutMessage, const BulkResult &bulkResult, zmq::socket_t &replicationSocket){
+    std::string bulkMessage(static_cast<const char*>(checkoutMessage.data()), checkoutMessage.size());
+    Request bulkHeader;
+    memcpy(&bulkHeader, bulkMessage.data(), sizeof(Request));
+    bulkHeader.requestType = RequestType::BULK;
+    memcpy(&bulkMessage[0], &bulkHeader, sizeof(Request));
+    sendBulkReplication(bulkMessage.data(), bulkMessage.size(), bulkResult, replicationSocket);
+}
+
+//USAGE <book|author|site|day> <from> <to> [rows], dates as YYYY-MM-DD
+std::string buildUsageReport(const std::string &requestData, StorageBackend &storage){
+    std::istringstream requestStream(requestData.substr(5));
+    std::string groupBy, fromDate, toDate;
+    std::size_t rowLimit = 0;
+    requestStream >> groupBy >> fromDate >> toDate >> rowLimit;
+    int fromDay = dayNumberFromDate(fromDate);
+    int toDay = dayNumberFromDate(toDate);
+    if((groupBy != "book" && groupBy != "author" && groupBy != "site" && groupBy != "day") || fromDay < 0 || toDay < 0 || fromDay > toDay){
+        return "Error: usage is USAGE <book|author|site|day> <from YYYY-MM-DD> <to YYYY-MM-DD> [rows]";
+    }
     try {
-        pqxx::work transaction(dbConnection);
-        transaction.exec(
-            "INSERT INTO operation_log (request_type, code, location, timestamp) "
-            "VALUES (" + 
-                transaction.quote(requestType) + ", " +
-                transaction.quote(bookCode) + ", " +
-                transaction.quote(locationId) + ", " +
-                "NOW()" +
-            ")"
-        );
-        pqxx::result queryResult = transaction.exec("SELECT lastval()");
-        lastOperationId = queryResult[0][0].as<int>();
-        transaction.commit();
+        return formatUsageReport(storage.readUsage(fromDay, toDay), groupBy, rowLimit, catalogIndex);
     } catch(const std::exception &error){
-        std::cerr << "[GA-Log] Error: " << error.what() << "\n";
+        return std::string("Database error: ") + error.what();
     }
 }
 
-void syncFromSecondaryGA(pqxx::connection &dbConnection, const std::string &secondaryIpAddress){
-    std::cout << "[GA-Sync] Starting synchronization from secondary\n";
+//Replies to SYNC:<id> with the operations logged after that id, read from the
+//archived segments and the live partitions alike. SYNC_SERVED:<id> returns only
+//the operations served here, each preceded by its id, for a site-local peer.
+std::string buildSyncResponse(const std::string &requestData, StorageBackend &storage){
+    //The statement profile and the usage reports are read over the same
+    //command sockets
+    if(requestData == "PROFILE"){
+        return statementProfiler.report();
+    }
+    if(requestData.rfind("USAGE", 0) == 0){
+        return buildUsageReport(requestData, storage);
+    }
+    if(requestData == "DURABILITY"){
+        return replicaAckTracker.report(durabilityPolicy);
+    }
+    bool servedOnly = requestData.rfind("SYNC_SERVED:", 0) == 0;
+    std::int64_t afterId = std::stoll(requestData.substr(requestData.find(':') + 1));
+    std::vector<OperationLogEntry> missingOperations = servedOnly ? storage.readServedOperations(afterId, maxSyncBatch)
+                                                                  : storage.readOperations(afterId, maxSyncBatch);
+    if(missingOperations.empty()){
+        return "NO_SYNC_NEEDED";
+    }
+
+    std::int64_t lastId = missingOperations.back().id;
+    std::string syncResponse(reinterpret_cast<const char*>(&lastId), sizeof(lastId));
+    for(const OperationLogEntry &entry : missingOperations){
+        Request missingRequest;
+        missingRequest.requestType = RequestType(entry.requestType);
+        missingRequest.code = entry.code;
+        missingRequest.location = std::int8_t(entry.location);
+        if(servedOnly){
+            syncResponse.append(reinterpret_cast<const char*>(&entry.id), sizeof(entry.id));
+        }
+        syncResponse.append(reinterpret_cast<const char*>(&missingRequest), sizeof(Request));
+    }
+    return syncResponse;
+}
+
+//Asks the GA at syncEndpoint for every operation after syncCursor and applies
+//them in order; returns the id of the last operation applied. With an
+//originSite only the operations that GA served are pulled, and they are logged
+//here as replicated from that site.
+std::int64_t pullMissingOperations(const std::string &syncEndpoint, std::int64_t syncCursor, StorageBackend &storage, int originSite = 0){
+    zmq::context_t syncContext(1);
+    zmq::socket_t syncSocket(syncContext, zmq::socket_type::req);
+    syncSocket.connect(syncEndpoint);
+    syncSocket.set(zmq::sockopt::rcvtimeo, 5000);
+    syncSocket.set(zmq::sockopt::linger, 0);
     
-    try {
-        pqxx::work transaction(dbConnection);
-        pqxx::result queryResult = transaction.exec("SELECT COALESCE(MAX(id), 0) FROM operation_log");
-        int myLastOperationId = queryResult[0][0].as<int>();
-        transaction.commit();
-        
-        zmq::context_t syncContext(1);
-        zmq::socket_t syncSocket(syncContext, zmq::socket_type::req);
-        syncSocket.connect("tcp://" + secondaryIpAddress + ":5563");
-        syncSocket.set(zmq::sockopt::rcvtimeo, 5000);
-        
-        std::string syncRequest = "SYNC:" + std::to_string(myLastOperationId);
+    while(true){
+        std::string syncRequest = (originSite == 0 ? "SYNC:" : "SYNC_SERVED:") + std::to_string(syncCursor);
         syncSocket.send(zmq::buffer(syncRequest), zmq::send_flags::none);
         
         zmq::message_t syncResponse;
-        if(syncSocket.recv(syncResponse, zmq::recv_flags::none)){
-            std::string responseData(static_cast<char*>(syncResponse.data()), syncResponse.size());
-            if(responseData != "NO_SYNC_NEEDED"){
-                std::cout << "[GA-Sync] Applying " << responseData << " missing operations\n";
+        if(!syncSocket.recv(syncResponse, zmq::recv_flags::none)){
+            break;
+        }
+        std::string responseData(static_cast<char*>(syncResponse.data()), syncResponse.size());
+        if(responseData == "NO_SYNC_NEEDED" || responseData.size() < sizeof(std::int64_t)){
+            break;
+        }
+        
+        memcpy(&syncCursor, responseData.data(), sizeof(syncCursor));
+        std::size_t entrySize = sizeof(Request) + (originSite == 0 ? 0 : sizeof(std::int64_t));
+        std::size_t operationCount = (responseData.size() - sizeof(std::int64_t)) / entrySize;
+        std::cout << "[GA-Sync] Applying " << operationCount << " missing operations\n";
+        
+        for(std::size_t position = 0; position < operationCount; position++){
+            const char *entryData = responseData.data() + sizeof(std::int64_t) + position * entrySize;
+            OperationOrigin origin;
+            if(originSite != 0){
+                origin.site = originSite;
+                memcpy(&origin.operationId, entryData, sizeof(origin.operationId));
+                entryData += sizeof(origin.operationId);
+            }
+            origin.replicated = true;
+            Request missingRequest;
+            memcpy(&missingRequest, entryData, sizeof(Request));
+            switch (int(missingRequest.requestType)){
+                case 0: processLoanRequest(missingRequest.code, missingRequest.location, storage, "", origin); break;
+                case 1: processRenewalRequest(missingRequest.code, missingRequest.location, storage, "", origin); break;
+                case 2: processReturnRequest(missingRequest.code, missingRequest.location, storage, "", origin); break;
             }
         }
+    }
+    return syncCursor;
+}
+
+void syncFromSecondaryGA(StorageBackend &storage, const std::string &secondaryIpAddress){
+    std::cout << "[GA-Sync] Starting synchronization from secondary\n";
+    
+    try {
+        pullMissingOperations(gaEndpoint(secondaryIpAddress, 5563), storage.lastStoredOperation(), storage);
         std::cout << "[GA-Sync] Synchronization complete\n";
     } catch(const std::exception &error){
         std::cerr << "[GA-Sync] Error: " << error.what() << "\n";
     }
 }
 
-std::string processLoanRequest(int bookCode, int locationId, pqxx::connection &dbConnection){
-    std::lock_guard<std::mutex> lock(databaseMutex);
-    int actualSede = locationId + 1;
-    std::string examplesColumn = (actualSede == 1) ? "ejemplares_sede1" : "ejemplares_sede2";
-
-    try{
-        pqxx::work transaction(dbConnection);
-        
-        pqxx::result bookQuery = transaction.exec(
-            "SELECT id_libro, " + examplesColumn + " "
-            "FROM libros "
-            "WHERE codigo = " + transaction.quote(bookCode)
-        );
-
-        if (bookQuery.empty()) {
-            transaction.abort();
-            return "Error: Book does not exist";
+//Serves replicas on port 5565: SNAPSHOT opens a snapshot tagged with its
+//operation id and SNAPSHOT_NEXT streams it a chunk per request (see
+//SnapshotSender), SYNC:<id> returns the operations logged after that id.
+//Snapshots are only available from the Postgres backend.
+void snapshotServer(zmq::context_t &context, const std::string &ipAddress, const std::string &dbConnectionString,
+                    StorageBackend &storage, bool snapshotsEnabled){
+    zmq::socket_t snapshotSocket(context, zmq::socket_type::rep);
+    std::string snapshotEndpoint = gaEndpoint(ipAddress, 5565);
+    snapshotSocket.bind(snapshotEndpoint);
+    snapshotSocket.set(zmq::sockopt::rcvtimeo, 1000);
+    SnapshotSender snapshotSender;
+    
+    std::cout << "[GA-Snapshot] Serving snapshots on " << snapshotEndpoint << std::endl;
+    
+    while(isRunning){
+        snapshotSender.expireIdle();
+        zmq::message_t snapshotRequest;
+        if(!snapshotSocket.recv(snapshotRequest, zmq::recv_flags::none)){
+            continue;
         }
+        std::string requestData(static_cast<char*>(snapshotRequest.data()), snapshotRequest.size());
+        bool isSnapshotRequest = requestData.rfind("SNAPSHOT", 0) == 0;
         
-        int bookId = bookQuery[0]["id_libro"].as<int>();
-        int availableExamples = bookQuery[0][examplesColumn].as<int>();
-
-        if (availableExamples <= 0) {
-            transaction.abort();
-            return "Error: No available copies of this book";
-        }
-
-        transaction.exec(
-            "UPDATE libros "
-            "SET " + examplesColumn + " = " + examplesColumn + " - 1 "
-            "WHERE id_libro = " + transaction.quote(bookId)
-        );
-
-        transaction.exec(
-            "INSERT INTO estados (id_libro, tipo_operacion, fecha_operacion, fecha_devolucion_prevista, sede, renovaciones) "
-            "VALUES (" +
-                transaction.quote(bookId) + ", " +
-                transaction.quote("prestamo") + ", " +
-                "NOW(), " +
-                "(NOW() + interval '14 days')::date, " +
-                transaction.quote(actualSede) + ", " +
-                "0" +
-            ")"
-        );
-
-        pqxx::result dateResult = transaction.exec("SELECT (NOW() + interval '14 days')::date");
-        std::string returnDate = dateResult[0][0].as<std::string>();
-        
-        transaction.commit();
-        logDatabaseOperation(0, bookCode, locationId, dbConnection);
-        return "Loan successful. Return date: " + returnDate;
+        try {
+            if(requestData == "SNAPSHOT" && !snapshotsEnabled){
+                snapshotSocket.send(zmq::buffer(std::string("UNSUPPORTED")), zmq::send_flags::none);
+            } else if(requestData == "SNAPSHOT"){
+                std::int64_t archivedUpTo = 0;
+                for(const std::string &path : listSegmentFiles()){
+                    archivedUpTo = std::max(archivedUpTo, segmentLastId(path));
+                }
+                std::string snapshotHeader = snapshotSender.open(dbConnectionString, databaseMutex, archivedUpTo);
+                std::cout << "[GA-Snapshot] Snapshot " << (snapshotHeader.empty() ? "failed" : "opened") << "\n";
+                snapshotSocket.send(zmq::buffer(snapshotHeader.empty() ? std::string("ABORT") : snapshotHeader), zmq::send_flags::none);
+            } else if(requestData.rfind("SNAPSHOT_NEXT:", 0) == 0){
+                if(!snapshotSender.sendNext(requestData.substr(14), snapshotSocket)){
+                    std::cout << "[GA-Snapshot] Snapshot " << requestData.substr(14) << " ended\n";
+                }
+            } else if(requestData.rfind("SNAPSHOT_CANCEL:", 0) == 0){
+                snapshotSender.close(requestData.substr(16));
+                snapshotSocket.send(zmq::buffer(std::string("CANCELLED")), zmq::send_flags::none);
+            } else {
+                snapshotSocket.send(zmq::buffer(buildSyncResponse(requestData, storage)), zmq::send_flags::none);
+            }
+        } catch(const std::exception &error){
+            std::cerr << "[GA-Snapshot] Error: " << error.what() << "\n";
+            //Every reply is a single frame, so this one always completes it;
+            //a replica reading a snapshot must not take it as finished
+            if(isSnapshotRequest){
+                std::size_t sessionStart = requestData.find(':');
+                if(sessionStart != std::string::npos){
+                    snapshotSender.close(requestData.substr(sessionStart + 1));
+                }
+            }
+            snapshotSocket.send(zmq::buffer(std::string(isSnapshotRequest ? "ABORT" : "NO_SYNC_NEEDED")), zmq::send_flags::none);
+        }
     }
-    catch (const std::exception &error){
-        return std::string("Database error: ") + error.what();
+}
+
+//Replaces the local catalog and active loans with the primary's snapshot;
+//returns the operation id replication has to resume after, or -1
+std::int64_t bootstrapFromPrimary(const std::string &primaryIpAddress, const std::string &dbConnectionString){
+    std::cout << "[GA-Bootstrap] Requesting snapshot from primary\n";
+    
+    zmq::context_t snapshotContext(1);
+    zmq::socket_t snapshotSocket(snapshotContext, zmq::socket_type::req);
+    snapshotSocket.connect(gaEndpoint(primaryIpAddress, 5565));
+    snapshotSocket.set(zmq::sockopt::rcvtimeo, 30000);
+    snapshotSocket.set(zmq::sockopt::linger, 0);
+    
+    auto startTime = std::chrono::steady_clock::now();
+    std::int64_t snapshotOperationId = receiveSnapshot(dbConnectionString, snapshotSocket);
+    auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+    
+    if(snapshotOperationId < 0){
+        std::cerr << "[GA-Bootstrap] Snapshot could not be loaded\n";
+    } else {
+        std::cout << "[GA-Bootstrap] Loaded snapshot at operation #" << snapshotOperationId << " in " << elapsedMs << " ms\n";
     }
+    return snapshotOperationId;
 }
 
-std::string processRenewalRequest(int bookCode, int locationId, pqxx::connection &dbConnection){
-    std::lock_guard<std::mutex> lock(databaseMutex);
-    int actualSede = locationId + 1;
-    try{
-        pqxx::work transaction(dbConnection);
-        
-        pqxx::result loanQuery = transaction.exec(
-            "SELECT e.id_estado, e.renovaciones "
-            "FROM estados e "
-            "JOIN libros l ON l.id_libro = e.id_libro "
-            "WHERE l.codigo = " + transaction.quote(bookCode) +
-            " AND e.sede = " + transaction.quote(actualSede) +
-            " AND e.tipo_operacion = 'prestamo' "
-            " AND NOT EXISTS ( "
-            "     SELECT 1 FROM estados e3 "
-            "     WHERE e3.id_libro = e.id_libro "
-            "     AND e3.tipo_operacion = 'devuelto' "
-            "     AND e3.fecha_operacion > e.fecha_operacion "
-            " )"
-            " ORDER BY e.renovaciones ASC, e.fecha_operacion ASC "
-            " LIMIT 1"
-        );
-            
-        if (loanQuery.empty()) {
-            transaction.abort();
-            return "Error: No active loan found for this book at this location";
+void operationLogArchiver(const std::string &dbConnectionString){
+    std::cout << "[GA-Archive] Archiving closed operation_log partitions to " << segmentDirectory << "\n";
+    
+    while(isRunning){
+        try {
+            pqxx::connection dbConnection(dbConnectionString);
+            archiveOperationLog(dbConnection);
+        } catch(const std::exception &error){
+            std::cerr << "[GA-Archive] Error: " << error.what() << "\n";
         }
-        
-        int stateId = loanQuery[0]["id_estado"].as<int>();
-        int renewalCount = loanQuery[0]["renovaciones"].as<int>();
-        
-        if (renewalCount >= 2){
-            transaction.abort();
-            return "Error: Maximum renewal limit reached (2)";
+        for(int elapsedSeconds = 0; elapsedSeconds < 30 && isRunning; elapsedSeconds++){
+            std::this_thread::sleep_for(std::chrono::seconds(1));
         }
+    }
+}
+
+//Applies one replicated message, first pulling from the primary whatever a gap
+//in operation ids shows was missed. Runs on a single thread so replicated
+//operations keep the primary's order. A site-local peer passes its site as
+//originSite and its operations are logged as replicated from it. Returns
+//false when the message could not be applied, so it is not acknowledged.
+bool applyReplicationMessage(const zmq::message_t &dataMessage, std::int64_t firstOperationId, std::int64_t lastOperationIdInMessage,
+                             std::int64_t precedingOperationId, std::int64_t &replicationCursor, const std::string &primaryIpAddress,
+                             StorageBackend &storage, int originSite = 0){
+    Request replicatedRequest;
+    memcpy(&replicatedRequest, dataMessage.data(), sizeof(Request));
+    
+    try{
+        std::string operationResult;
         
-        transaction.exec(
-            "UPDATE estados "
-            "SET renovaciones = renovaciones + 1, "
-            "    fecha_devolucion_prevista = fecha_devolucion_prevista + INTERVAL '7 days' "
-            "WHERE id_estado = " + transaction.quote(stateId)
-        );
+        if(precedingOperationId > replicationCursor){
+            std::cout << "[GA-Replica] Gap before operation #" << firstOperationId << ", catching up from #" << replicationCursor << "\n";
+            replicationCursor = pullMissingOperations(gaEndpoint(primaryIpAddress, 5565), replicationCursor, storage, originSite);
+        }
+        if(lastOperationIdInMessage == 0 || lastOperationIdInMessage > replicationCursor){
+            replicationCursor = std::max(replicationCursor, lastOperationIdInMessage);
             
-        transaction.commit();
-        logDatabaseOperation(1, bookCode, locationId, dbConnection);
-        return "Loan renewed successfully for 7 additional days";
+            OperationOrigin origin;
+            origin.replicated = true;
+            if(originSite != 0){
+                origin.site = originSite;
+                origin.operationId = lastOperationIdInMessage;
+            }
+            BulkResult bulkResult;
+            switch (int(replicatedRequest.requestType)){
+                case 0: operationResult = processLoanRequest(replicatedRequest.code, replicatedRequest.location, storage, requestKeyOf(dataMessage), origin); break;
+                case 1: operationResult = processRenewalRequest(replicatedRequest.code, replicatedRequest.location, storage, requestKeyOf(dataMessage), origin); break;
+                case 2: operationResult = processReturnRequest(replicatedRequest.code, replicatedRequest.location, storage, requestKeyOf(dataMessage), origin); break;
+                case 4: operationResult = processBulkMessage(dataMessage, storage, bulkResult, origin); break;
+                case 6: operationResult = applyReplicatedReservation(dataMessage, lastOperationIdInMessage, storage, origin); break;
+            }
+            std::cout << "[GA-Replica] Synced operation #" << lastOperationId.load() << "\n";
+        }
     }
     catch (const std::exception &error){
-        return std::string("Database error: ") + error.what();
+        std::cerr << "[GA-Replica] Error: " << error.what() << "\n";
+        return false;
     }
+    return true;
 }
 
-std::string processReturnRequest(int bookCode, int locationId, pqxx::connection &dbConnection){
-    std::lock_guard<std::mutex> lock(databaseMutex);
-    int actualSede = locationId + 1;
-
+//Site-local mode: subscribes to the other site's GA and applies what it
+//served, in order, logged as replicated from peerSite
+void peerReplicationListener(zmq::context_t &context, const std::string &peerIpAddress, int peerSite, StorageBackend &storage){
+    zmq::socket_t replicationSocket(context, zmq::socket_type::sub);
+    std::string replicationEndpoint = gaEndpoint(peerIpAddress, 5561);
+    replicationSocket.connect(replicationEndpoint);
+    replicationSocket.set(zmq::sockopt::subscribe, "replica");
+    replicationSocket.set(zmq::sockopt::rcvtimeo, 1000);
+    
+    std::int64_t replicationCursor = 0;
     try {
-        pqxx::work transaction(dbConnection);
+        replicationCursor = storage.lastReplicatedOperation(peerSite);
+    } catch(const std::exception &error){
+        std::cerr << "[GA-Peer] Could not read the replication cursor: " << error.what() << "\n";
+    }
+    std::cout << "[GA-Peer] Replicating location " << peerSite << " from " << replicationEndpoint
+              << " after operation #" << replicationCursor << "\n";
+    ReplicaAckSender ackSender(context, gaEndpoint(peerIpAddress, 5567));
+    
+    while(isRunning){
+        zmq::message_t topicMessage, dataMessage;
+        if(!replicationSocket.recv(topicMessage, zmq::recv_flags::none)){
+            continue;
+        }
+        replicationSocket.recv(dataMessage, zmq::recv_flags::none);
         
-        pqxx::result loanQuery = transaction.exec(
-            "SELECT e.id_estado, e.id_libro "
-            "FROM estados e "
-            "JOIN libros l ON l.id_libro = e.id_libro "
-            "WHERE l.codigo = " + transaction.quote(bookCode) + 
-            " AND e.sede = " + transaction.quote(actualSede) + 
-            " AND e.tipo_operacion = 'prestamo' "
-            "ORDER BY e.renovaciones DESC, e.fecha_operacion DESC "
-            "LIMIT 1"
-        );
-
-        if (loanQuery.empty()) {
-            transaction.abort();
-            return "Error: No active loan found for this book at this location";
-        }
-
-        int stateId = loanQuery[0]["id_estado"].as<int>();
-        int bookId = loanQuery[0]["id_libro"].as<int>();
-
-        transaction.exec(
-            "UPDATE estados "
-            "SET tipo_operacion = 'devuelto' "
-            "WHERE id_estado = " + transaction.quote(stateId)
-        );
-
-        std::string examplesColumn = (actualSede == 1) ? "ejemplares_sede1" : "ejemplares_sede2";
-        transaction.exec(
-            "UPDATE libros "
-            "SET " + examplesColumn + " = " + examplesColumn + " + 1 "
-            "WHERE id_libro = " + transaction.quote(bookId)
-        );
-
-        transaction.commit();
-        logDatabaseOperation(2, bookCode, locationId, dbConnection);
-        return "Return successful. Copy available again";
-    }
-    catch (const std::exception &error) {
-        return std::string("Database error: ") + error.what();
+        std::int64_t firstOperationId, lastOperationIdInMessage, precedingOperationId;
+        receiveOperationIds(replicationSocket, dataMessage, firstOperationId, lastOperationIdInMessage, precedingOperationId);
+        ackSender.send(lastOperationIdInMessage, ReplicaAckStage::RECEIVED);
+        if(applyReplicationMessage(dataMessage, firstOperationId, lastOperationIdInMessage, precedingOperationId,
+                                   replicationCursor, peerIpAddress, storage, peerSite)){
+            ackSender.send(lastOperationIdInMessage, ReplicaAckStage::COMMITTED);
+        }
     }
 }
 
+//Serves a client request on a promoted replica
+std::string processFailoverRequest(const zmq::message_t &failoverRequest, StorageBackend &storage){
+    Request parsedRequest;
+    memcpy(&parsedRequest, failoverRequest.data(), sizeof(Request));
+    
+    std::string operationResult = misroutedRequestError(failoverRequest);
+    if(!operationResult.empty()){
+        return operationResult;
+    }
+    //Checked again here, the request may have waited for a worker
+    if(dropIfExpired(failoverRequest)){
+        return expiredRequestResponse;
+    }
+    try{
+        switch (int(parsedRequest.requestType)){
+            case 0: operationResult = processLoanRequest(parsedRequest.code, parsedRequest.location, storage, requestKeyOf(failoverRequest)); break;
+            case 1: operationResult = processRenewalRequest(parsedRequest.code, parsedRequest.location, storage, requestKeyOf(failoverRequest)); break;
+            case 2: {
+                ReservationHandOff handOff;
+                operationResult = processReturnRequest(parsedRequest.code, parsedRequest.location, storage, requestKeyOf(failoverRequest),
+                                                       OperationOrigin(), &handOff);
+                break;
+            }
+            case 3: operationResult = processOverdueQuery(parsedRequest.location); break;
+            case 4: {
+                BulkResult bulkResult;
+                operationResult = processBulkMessage(failoverRequest, storage, bulkResult);
+                break;
+            }
+            case 5: operationResult = processSearchRequest(failoverRequest); break;
+            case 6: operationResult = processReserveRequest(failoverRequest, storage); break;
+            case 7: {
+                BulkResult bulkResult;
+                operationResult = processCheckoutMessage(failoverRequest, storage, bulkResult);
+                break;
+            }
+        }
+    }
+    catch (const std::exception &error){
+        operationResult = "Database error: " + std::string(error.what());
+    }
+    //Workers waiting here together share one flush of the embedded log
+    storage.awaitDurable(storage.lastOperation());
+    return operationResult;
+}
+
 void printRequestDetails(Request &request){
     int requestType = int(request.requestType);
     std::cout << "\n--------------------------";
@@ -302,18 +983,282 @@ void printRequestDetails(Request &request){
         std::cout << "RENEWAL";
     } else if(requestType == 2){
         std::cout << "RETURN";
+    } else if(requestType == 3){
+        std::cout << "OVERDUE";
+    } else if(requestType == 4){
+        std::cout << "BULK (" << request.code << " operations)";
+    } else if(requestType == 5){
+        std::cout << "SEARCH";
+    } else if(requestType == 6){
+        std::cout << "RESERVE";
+    } else if(requestType == 7){
+        std::cout << "CHECKOUT (" << request.code << " items)";
     }
     std::cout << "\n[GA-Request] Book code: " << request.code;
     std::cout << "\n[GA-Request] Location: " << int(request.location);
     std::cout << "\n--------------------------\n";
 }
 
+//Replies through a ROUTER socket: requestFrames holds the client envelope
+//followed by the request itself
+void sendEnvelopedReply(std::vector<zmq::message_t> &requestFrames, const std::string &operationResult, zmq::socket_t &replySocket){
+    for(std::size_t frameNumber = 0; frameNumber + 1 < requestFrames.size(); frameNumber++){
+        replySocket.send(requestFrames[frameNumber], zmq::send_flags::sndmore);
+    }
+    replySocket.send(zmq::buffer(operationResult), zmq::send_flags::none);
+}
+
+std::shared_ptr<std::vector<zmq::message_t>> receiveEnvelopedRequest(zmq::socket_t &requestSocket){
+    std::shared_ptr<std::vector<zmq::message_t>> requestFrames = std::make_shared<std::vector<zmq::message_t>>();
+    bool moreFrames = true;
+    while(moreFrames){
+        zmq::message_t requestFrame;
+        requestSocket.recv(requestFrame, zmq::recv_flags::none);
+        moreFrames = requestFrame.more();
+        requestFrames->push_back(std::move(requestFrame));
+    }
+    return requestFrames;
+}
+
+//A pipelined reply waiting for the replica to acknowledge its operation
+struct HeldReply{
+    std::int64_t operationId;
+    DurabilityMode mode;
+    std::chrono::steady_clock::time_point deadline;
+    std::vector<zmq::message_t> frames;
+};
+
+//Sends the held replies the replica has acknowledged or that ran out of time;
+//the rest keep waiting without holding up the pipeline
+void releaseHeldReplies(std::deque<HeldReply> &heldReplies, zmq::socket_t &requestSocket){
+    auto now = std::chrono::steady_clock::now();
+    for(auto heldReply = heldReplies.begin(); heldReply != heldReplies.end();){
+        bool acknowledged = replicaAckTracker.isAcknowledged(heldReply->operationId, heldReply->mode);
+        if(!acknowledged && now < heldReply->deadline){
+            ++heldReply;
+            continue;
+        }
+        if(!acknowledged){
+            replicaAckTracker.noteTimeout(heldReply->operationId, heldReply->mode);
+        }
+        for(std::size_t frameNumber = 0; frameNumber < heldReply->frames.size(); frameNumber++){
+            requestSocket.send(heldReply->frames[frameNumber], frameNumber + 1 < heldReply->frames.size() ? zmq::send_flags::sndmore
+                                                                                                          : zmq::send_flags::none);
+        }
+        heldReply = heldReplies.erase(heldReply);
+    }
+}
+
+//Primary loop for --pipeline. Loans, renewals and returns are handed to the
+//pipeline executor as they arrive and answered, and replicated, as their
+//results come back in order; so are reservations, whose statement checks the
+//copies itself. Overdue queries, searches and batches are served inline, a
+//batch only once the pipeline has drained. Replies that wait for the replica are held here, so the
+//pipeline keeps flowing while they do.
+void runPipelinedPrimary(zmq::context_t &context, const std::string &ipAddress, zmq::socket_t &replicationSocket,
+                         StorageBackend &storage, const std::string &dbConnectionString){
+    zmq::socket_t requestSocket(context, zmq::socket_type::router);
+    requestSocket.bind(gaEndpoint(ipAddress, 5560));
+    std::cout << "[GA] ROUTER socket on " << gaEndpoint(ipAddress, 5560) << " (pipeline mode)\n";
+    
+    std::string completionEndpoint = "inproc://ga-pipeline-completions";
+    zmq::socket_t completionSocket(context, zmq::socket_type::pull);
+    completionSocket.bind(completionEndpoint);
+    
+    PipelineExecutor pipeline(dbConnectionString, overdueTracker, context, completionEndpoint);
+    if(!pipeline.start()){
+        std::cerr << "[GA-Error] Pipeline mode needs a reachable database\n";
+        isRunning = false;
+        return;
+    }
+    
+    std::deque<HeldReply> heldReplies;
+    //One pipelined operation finished: replicate it, then answer or hold the reply
+    auto handleCompletion = [&](){
+        zmq::message_t operationIdFrame, handOffFrame, requestFrame;
+        completionSocket.recv(operationIdFrame, zmq::recv_flags::none);
+        completionSocket.recv(handOffFrame, zmq::recv_flags::none);
+        completionSocket.recv(requestFrame, zmq::recv_flags::none);
+        std::int64_t operationId = 0;
+        memcpy(&operationId, operationIdFrame.data(), std::min(operationIdFrame.size(), sizeof(operationId)));
+        ReservationHandOff handOff;
+        decodeHandOff(std::string(static_cast<const char*>(handOffFrame.data()), handOffFrame.size()), handOff);
+        bool holdReply = false;
+        DurabilityMode mode = DurabilityMode::ASYNC;
+        if(operationId > 0){
+            sendReplicationMessage("replica", requestFrame.data(), requestFrame.size(), operationId, operationId, replicationSocket);
+            Request appliedRequest;
+            memcpy(&appliedRequest, requestFrame.data(), sizeof(Request));
+            noteAppliedOperation(int(appliedRequest.requestType), appliedRequest.code, appliedRequest.location);
+            //A return that lent its copy on is acknowledged with that loan
+            if(!handOff.patron.empty()){
+                sendHandOffReplication(handOff, replicationSocket);
+                announceHandOff(handOff);
+                operationId = handOff.loanOperationId;
+            }
+            lastOperationId = int(operationId);
+            mode = durabilityPolicy.modeFor(int(appliedRequest.requestType));
+            replicaAckTracker.notePublished(operationId, mode);
+            holdReply = replicaAckTracker.mustWait(operationId, mode);
+        }
+        
+        std::vector<zmq::message_t> replyFrames;
+        bool moreFrames = true;
+        while(moreFrames){
+            zmq::message_t replyFrame;
+            completionSocket.recv(replyFrame, zmq::recv_flags::none);
+            moreFrames = replyFrame.more();
+            //A confirmed pipelined reservation is not logged; replicate it as the inline path does
+            if(!moreFrames && int(static_cast<const Request*>(requestFrame.data())->requestType) == 6){
+                sendReservationReplication(requestFrame, std::string(static_cast<const char*>(replyFrame.data()), replyFrame.size()),
+                                           replicationSocket);
+            }
+            if(holdReply){
+                replyFrames.push_back(std::move(replyFrame));
+            } else {
+                requestSocket.send(replyFrame, moreFrames ? zmq::send_flags::sndmore : zmq::send_flags::none);
+            }
+        }
+        if(holdReply){
+            heldReplies.push_back(HeldReply{operationId, mode, std::chrono::steady_clock::now() + replicaAckTracker.timeout(),
+                                            std::move(replyFrames)});
+        }
+    };
+    while(isRunning){
+        zmq::pollitem_t pollItems[] = {
+            {static_cast<void*>(requestSocket), 0, ZMQ_POLLIN, 0},
+            {static_cast<void*>(completionSocket), 0, ZMQ_POLLIN, 0}
+        };
+        zmq::poll(pollItems, 2, std::chrono::milliseconds(heldReplies.empty() ? rolePollIntervalMs : 1));
+        
+        if(pollItems[0].revents & ZMQ_POLLIN){
+            std::shared_ptr<std::vector<zmq::message_t>> requestFrames = receiveEnvelopedRequest(requestSocket);
+            zmq::message_t &incomingRequest = requestFrames->back();
+            Request parsedRequest;
+            memcpy(&parsedRequest, incomingRequest.data(), sizeof(Request));
+            printRequestDetails(parsedRequest);
+            
+            std::string misroutedError = misroutedRequestError(incomingRequest);
+            if(!misroutedError.empty()){
+                std::cout << "[GA-Shard] " << misroutedError << "\n";
+                sendEnvelopedReply(*requestFrames, misroutedError, requestSocket);
+                continue;
+            }
+            if(dropIfExpired(incomingRequest)){
+                sendEnvelopedReply(*requestFrames, expiredRequestResponse, requestSocket);
+                continue;
+            }
+            //Completion frames: operation id, the hand-off, the request, the client envelope, the reply
+            PipelineCallback forwardCompletion = [requestFrames](const std::string &operationResult, std::int64_t operationId,
+                                                                 const ReservationHandOff &handOff, zmq::socket_t &pipelineSocket){
+                std::string handOffFrame = encodeHandOff(handOff);
+                pipelineSocket.send(zmq::buffer(&operationId, sizeof(operationId)), zmq::send_flags::sndmore);
+                pipelineSocket.send(zmq::buffer(handOffFrame), zmq::send_flags::sndmore);
+                zmq::message_t requestCopy(requestFrames->back().data(), requestFrames->back().size());
+                pipelineSocket.send(requestCopy, zmq::send_flags::sndmore);
+                sendEnvelopedReply(*requestFrames, operationResult, pipelineSocket);
+            };
+            if(int(parsedRequest.requestType) <= 2){
+                pipeline.submit(int(parsedRequest.requestType), parsedRequest.code, parsedRequest.location, requestKeyOf(incomingRequest),
+                                forwardCompletion, localExpiry(parsedRequest));
+                continue;
+            }
+            if(int(parsedRequest.requestType) == 6){
+                if(!isValidPatronName(patronOf(incomingRequest))){
+                    sendEnvelopedReply(*requestFrames, "Error: Invalid patron name", requestSocket);
+                } else {
+                    pipeline.submitReservation(parsedRequest.code, parsedRequest.location, patronOf(incomingRequest),
+                                               forwardCompletion, localExpiry(parsedRequest));
+                }
+                continue;
+            }
+            //A batch logs on its own connection: everything pipelined before it
+            //is committed and replicated first, so operation_log ids reach the
+            //replica in order and none is committed after a higher one
+            if(int(parsedRequest.requestType) == 4 || int(parsedRequest.requestType) == 7){
+                pipeline.drain();
+                while(zmq::poll(&pollItems[1], 1, std::chrono::milliseconds(0)) > 0){
+                    handleCompletion();
+                }
+            }
+            
+            std::string operationResult;
+            std::int64_t publishedBefore = lastPublishedOperationId.load();
+            try{
+                if(int(parsedRequest.requestType) == 3){
+                    operationResult = processOverdueQuery(parsedRequest.location);
+                } else if(int(parsedRequest.requestType) == 5){
+                    operationResult = processSearchRequest(incomingRequest);
+                } else if(int(parsedRequest.requestType) == 7){
+                    BulkResult bulkResult;
+                    operationResult = processCheckoutMessage(incomingRequest, storage, bulkResult);
+                    sendCheckoutReplication(incomingRequest, bulkResult, replicationSocket);
+                } else {
+                    BulkResult bulkResult;
+                    operationResult = processBulkMessage(incomingRequest, storage, bulkResult);
+                    sendBulkReplication(incomingRequest.data(), incomingRequest.size(), bulkResult, replicationSocket);
+                }
+            }
+            catch (const std::exception &error){
+                operationResult = "Database error: " + std::string(error.what());
+            }
+            awaitDurability(int(parsedRequest.requestType), publishedBefore);
+            sendEnvelopedReply(*requestFrames, operationResult, requestSocket);
+        }
+        
+        if(pollItems[1].revents & ZMQ_POLLIN){
+            handleCompletion();
+        }
+        
+        releaseHeldReplies(heldReplies, requestSocket);
+    }
+}
+
 int main(int argc, char *argv[]){
     std::vector<std::string> ipAddressList;
     std::int8_t locationIndex;
+    bool forceBootstrap = false;
+    bool embeddedStorage = false;
+    bool pipelineMode = false;
+    bool siteLocal = false;
+    double slowStatementMs = defaultSlowStatementMs;
+    int durabilityTimeoutMs = defaultDurabilityTimeoutMs;
+    bool validArguments = argc >= 2;
     
-    if (argc != 2){
-        std::cerr << "[GA-Error] Run format: ./ga #Location\n";
+    for (int argumentIndex = 2; argumentIndex < argc; argumentIndex++){
+        std::string argument = argv[argumentIndex];
+        if (argument == "--bootstrap"){
+            forceBootstrap = true;
+        } else if (argument == "--embedded"){
+            embeddedStorage = true;
+        } else if (argument == "--pipeline"){
+            pipelineMode = true;
+        } else if (argument == "--site-local"){
+            siteLocal = true;
+        } else if (argument == "--shard" && argumentIndex + 1 < argc){
+            int shardNumber = 0;
+            char trailing;
+            validArguments = validArguments && std::sscanf(argv[++argumentIndex], "%d/%d%c", &shardNumber, &shardCount, &trailing) == 2 &&
+                             shardCount >= 1 && shardCount <= maxShardCount && shardNumber >= 1 && shardNumber <= shardCount;
+            shardIndex = shardNumber - 1;
+        } else if (argument == "--durability" && argumentIndex + 1 < argc){
+            validArguments = validArguments && durabilityPolicy.configure(argv[++argumentIndex]);
+        } else if (argument == "--durability-timeout-ms" && argumentIndex + 1 < argc){
+            durabilityTimeoutMs = std::atoi(argv[++argumentIndex]);
+            validArguments = validArguments && durabilityTimeoutMs > 0;
+        } else if (argument == "--slow-query-ms" && argumentIndex + 1 < argc){
+            slowStatementMs = std::atof(argv[++argumentIndex]);
+            validArguments = validArguments && slowStatementMs > 0;
+        } else {
+            validArguments = false;
+        }
+    }
+    //Site-local replication needs the origin the Postgres log keeps, and a
+    //site-local GA has no single primary to bootstrap from
+    if (!validArguments || (embeddedStorage && pipelineMode) || (siteLocal && (embeddedStorage || forceBootstrap))){
+        std::cerr << "[GA-Error] Run format: ./ga #Location [--bootstrap] [--embedded | --pipeline] [--site-local] [--shard i/K] [--slow-query-ms N]\n";
+        std::cerr << "[GA-Error]     [--durability <async|semi-sync|sync> | --durability <TYPE>=<mode>]... [--durability-timeout-ms N]\n";
+        std::cerr << "[GA-Error] --site-local cannot be combined with --embedded or --bootstrap\n";
         return 0;
     }
     
@@ -326,160 +1271,360 @@ int main(int argc, char *argv[]){
     }
     
     std::string dbConnectionString = "dbname=root user=root password=root host=localhost port=5434";
+    //A shard keeps its tables in its own schema, created from init.sql
+    if (shardCount > 1){
+        dbConnectionString += " options=-csearch_path=shard" + std::to_string(shardIndex + 1);
+        segmentDirectory += shardSuffix();
+        slowQueryLogPath = "ga_slow_queries" + shardSuffix() + ".log";
+        std::cout << "[GA] Shard " << shardIndex + 1 << " of " << shardCount << "\n";
+    }
+    
+    std::unique_ptr<StorageBackend> storage;
+    if (embeddedStorage){
+        std::unique_ptr<EmbeddedBackend> embeddedBackend(new EmbeddedBackend(overdueTracker));
+        if (!embeddedBackend->open(embeddedStorePrefix + std::to_string(int(locationIndex) + 1) + shardSuffix(), "../init.sql")){
+            std::cerr << "[GA-Error] Could not open the embedded store\n";
+            return 0;
+        }
+        storage = std::move(embeddedBackend);
+        std::cout << "[GA] Using embedded storage\n";
+    } else {
+        storage.reset(new PostgresBackend(dbConnectionString, overdueTracker, statementProfiler));
+        statementProfiler.start(dbConnectionString, slowStatementMs);
+    }
+    
+    //Site-local: every GA is the primary for the operations it serves, which
+    //are its own location's unless the other site's GA is down, and replicates
+    //the other site's GA as a peer
+    int peerIndex = 1 - int(locationIndex);
     
-    if (int(locationIndex) == 0){
+    if (siteLocal || int(locationIndex) == 0){
         std::cout << "========================================\n";
-        std::cout << "  PRIMARY GA - LOCATION 1\n";
+        if (siteLocal){
+            std::cout << "  SITE PRIMARY GA - LOCATION " << int(locationIndex) + 1 << "\n";
+        } else {
+            std::cout << "  PRIMARY GA - LOCATION 1\n";
+        }
         std::cout << "========================================\n";
         isPrimaryRole = true;
         
         try {
-            pqxx::connection dbConnection(dbConnectionString);
-            syncFromSecondaryGA(dbConnection, ipAddressList[1]);
+            if (siteLocal){
+                std::cout << "[GA-Sync] Catching up with location " << peerIndex + 1 << "\n";
+                pullMissingOperations(gaEndpoint(ipAddressList[peerIndex], 5565), storage->lastReplicatedOperation(peerIndex + 1),
+                                      *storage, peerIndex + 1);
+            } else {
+                syncFromSecondaryGA(*storage, ipAddressList[1]);
+            }
+            lastPublishedOperationId = storage->lastStoredOperation();
+            storage->trackActiveLoans();
+            refreshCatalog(*storage, int(locationIndex) + 1);
         } catch(const std::exception &error){
             std::cerr << "[GA-Init] Could not sync: " << error.what() << "\n";
         }
         
         zmq::context_t zmqContext(1);
         
-        zmq::socket_t requestSocket(zmqContext, zmq::socket_type::rep);
-        std::string requestEndpoint = "tcp://" + ipAddressList[locationIndex] + ":5560";
-        requestSocket.bind(requestEndpoint);
-        std::cout << "[GA] REP socket on port 5560\n";
-
         zmq::socket_t replicationSocket(zmqContext, zmq::socket_type::pub);
-        std::string replicationEndpoint = "tcp://" + ipAddressList[locationIndex] + ":5561";
+        std::string replicationEndpoint = gaEndpoint(ipAddressList[locationIndex], 5561);
         replicationSocket.bind(replicationEndpoint);
-        std::cout << "[GA] PUB socket on port 5561 (replication)\n";
+        std::cout << "[GA] PUB socket on " << replicationEndpoint << " (replication)\n";
+        replicaAckTracker.start(zmqContext, gaEndpoint(ipAddressList[locationIndex], 5567), durabilityTimeoutMs);
+        std::cout << "[GA] Durability: " << durabilityPolicy.describe() << "\n";
         
         std::thread heartbeatThread(heartbeatPublisher, std::ref(zmqContext), std::ref(ipAddressList[locationIndex]));
+        std::thread overdueThread(eventPublisher, std::ref(zmqContext), std::ref(ipAddressList[locationIndex]));
+        std::thread catalogFilterThread(catalogFilterPublisher, std::ref(zmqContext), std::ref(ipAddressList[locationIndex]));
+        std::thread archiveThread;
+        if (!embeddedStorage){
+            archiveThread = std::thread(operationLogArchiver, std::ref(dbConnectionString));
+        }
+        std::thread snapshotThread(snapshotServer, std::ref(zmqContext), std::ref(ipAddressList[locationIndex]), std::ref(dbConnectionString),
+                                   std::ref(*storage), !embeddedStorage);
+        std::thread peerThread;
+        if (siteLocal){
+            peerThread = std::thread(peerReplicationListener, std::ref(zmqContext), std::ref(ipAddressList[peerIndex]), peerIndex + 1,
+                                     std::ref(*storage));
+        }
         std::cout << "[GA] Ready\n\n";
 
-        while (isRunning){
-            zmq::message_t incomingRequest;
-            requestSocket.recv(incomingRequest, zmq::recv_flags::none);
+        if (pipelineMode){
+            runPipelinedPrimary(zmqContext, ipAddressList[locationIndex], replicationSocket, *storage, dbConnectionString);
+        } else {
+            zmq::socket_t requestSocket(zmqContext, zmq::socket_type::rep);
+            std::string requestEndpoint = gaEndpoint(ipAddressList[locationIndex], 5560);
+            requestSocket.bind(requestEndpoint);
+            std::cout << "[GA] REP socket on " << requestEndpoint << "\n";
+
+            while (isRunning){
+                zmq::message_t incomingRequest;
+                requestSocket.recv(incomingRequest, zmq::recv_flags::none);
             
-            Request parsedRequest;
-            memcpy(&parsedRequest, incomingRequest.data(), sizeof(Request));
-            printRequestDetails(parsedRequest);
+                Request parsedRequest;
+                memcpy(&parsedRequest, incomingRequest.data(), sizeof(Request));
+                printRequestDetails(parsedRequest);
 
-            std::string operationResult;
-            try{
-                pqxx::connection dbConnection(dbConnectionString);
-                
-                switch (int(parsedRequest.requestType)){
-                    case 0:
-                        operationResult = processLoanRequest(parsedRequest.code, parsedRequest.location, dbConnection);
-                        if (operationResult.find("Error") == std::string::npos) {
-                            sendReplicationRequest("replica", parsedRequest, replicationSocket);
+                std::string operationResult = misroutedRequestError(incomingRequest);
+                if (!operationResult.empty()){
+                    std::cout << "[GA-Shard] " << operationResult << "\n";
+                    requestSocket.send(zmq::buffer(operationResult), zmq::send_flags::none);
+                    continue;
+                }
+                if (dropIfExpired(incomingRequest)){
+                    requestSocket.send(zmq::buffer(expiredRequestResponse), zmq::send_flags::none);
+                    continue;
+                }
+                std::int64_t publishedBefore = lastPublishedOperationId.load();
+                try{
+                    switch (int(parsedRequest.requestType)){
+                        case 0:
+                            operationResult = processLoanRequest(parsedRequest.code, parsedRequest.location, *storage, requestKeyOf(incomingRequest));
+                            if (operationResult.find("Error") == std::string::npos) {
+                                sendReplicationRequest("replica", incomingRequest, replicationSocket);
+                            }
+                            break;
+                        case 1:
+                            operationResult = processRenewalRequest(parsedRequest.code, parsedRequest.location, *storage, requestKeyOf(incomingRequest));
+                            if (operationResult.find("Error") == std::string::npos) {
+                                sendReplicationRequest("replica", incomingRequest, replicationSocket);
+                            }
+                            break;
+                        case 2: {
+                            ReservationHandOff handOff;
+                            operationResult = processReturnRequest(parsedRequest.code, parsedRequest.location, *storage, requestKeyOf(incomingRequest),
+                                                                   OperationOrigin(), &handOff);
+                            if (operationResult.find("Error") == std::string::npos) {
+                                sendReturnReplication(incomingRequest, handOff, replicationSocket);
+                            }
+                            break;
                         }
-                        break;
-                    case 1:
-                        operationResult = processRenewalRequest(parsedRequest.code, parsedRequest.location, dbConnection);
-                        if (operationResult.find("Error") == std::string::npos) {
-                            sendReplicationRequest("replica", parsedRequest, replicationSocket);
+                        case 3:
+                            operationResult = processOverdueQuery(parsedRequest.location);
+                            break;
+                        case 4: {
+                            BulkResult bulkResult;
+                            operationResult = processBulkMessage(incomingRequest, *storage, bulkResult);
+                            sendBulkReplication(incomingRequest.data(), incomingRequest.size(), bulkResult, replicationSocket);
+                            break;
                         }
-                        break;
-                    case 2:
-                        operationResult = processReturnRequest(parsedRequest.code, parsedRequest.location, dbConnection);
-                        if (operationResult.find("Error") == std::string::npos) {
-                            sendReplicationRequest("replica", parsedRequest, replicationSocket);
+                        case 5:
+                            operationResult = processSearchRequest(incomingRequest);
+                            break;
+                        case 6:
+                            operationResult = processReserveRequest(incomingRequest, *storage);
+                            sendReservationReplication(incomingRequest, operationResult, replicationSocket);
+                            break;
+                        case 7: {
+                            BulkResult bulkResult;
+                            operationResult = processCheckoutMessage(incomingRequest, *storage, bulkResult);
+                            sendCheckoutReplication(incomingRequest, bulkResult, replicationSocket);
+                            break;
                         }
-                        break;
+                    }
                 }
+                catch (const std::exception &error){
+                    operationResult = "Database error: " + std::string(error.what());
+                }
+                storage->awaitDurable(storage->lastOperation());
+                awaitDurability(int(parsedRequest.requestType), publishedBefore);
+                requestSocket.send(zmq::buffer(operationResult), zmq::send_flags::none);
             }
-            catch (const std::exception &error){
-                operationResult = "Database error: " + std::string(error.what());
-            }
-            requestSocket.send(zmq::buffer(operationResult), zmq::send_flags::none);
         }
         
         isRunning = false;
+        replicaAckTracker.stop();
         heartbeatThread.join();
+        overdueThread.join();
+        catalogFilterThread.join();
+        if (archiveThread.joinable()){
+            archiveThread.join();
+        }
+        snapshotThread.join();
+        if (peerThread.joinable()){
+            peerThread.join();
+        }
     }
     else {
         std::cout << "========================================\n";
         std::cout << "  SECONDARY GA - LOCATION 2\n";
         std::cout << "========================================\n";
         
+        std::int64_t replicationCursor = 0;
+        try {
+            replicationCursor = storage->lastStoredOperation();
+            
+            //A snapshot loads into Postgres, so an embedded replica, fresh or
+            //not, always catches up through the log
+            if(embeddedStorage){
+                if(forceBootstrap){
+                    std::cout << "[GA-Bootstrap] Snapshots need the Postgres backend, catching up through the log instead\n";
+                }
+            } else if(forceBootstrap || replicationCursor == 0){
+                std::int64_t snapshotOperationId = bootstrapFromPrimary(ipAddressList[0], dbConnectionString);
+                if(snapshotOperationId >= 0){
+                    replicationCursor = snapshotOperationId;
+                    pqxx::connection dbConnection(dbConnectionString);
+                    archiveOperationLog(dbConnection);
+                }
+            }
+            storage->trackActiveLoans();
+            refreshCatalog(*storage, int(locationIndex) + 1);
+        } catch(const std::exception &error){
+            std::cerr << "[GA-Init] Could not prepare replica: " << error.what() << "\n";
+        }
+        
         zmq::context_t zmqContext(1);
         
         zmq::socket_t replicationSocket(zmqContext, zmq::socket_type::sub);
-        std::string replicationEndpoint = "tcp://" + ipAddressList[0] + ":5561";
+        std::string replicationEndpoint = gaEndpoint(ipAddressList[0], 5561);
         replicationSocket.connect(replicationEndpoint);
         replicationSocket.set(zmq::sockopt::subscribe, "replica");
-        replicationSocket.set(zmq::sockopt::rcvtimeo, 100);
+        ReplicaAckSender ackSender(zmqContext, gaEndpoint(ipAddressList[0], 5567));
         
-        zmq::socket_t failoverSocket(zmqContext, zmq::socket_type::rep);
-        std::string failoverEndpoint = "tcp://" + ipAddressList[locationIndex] + ":5560";
+        //ROUTER instead of REP so requests can be answered out of order by the workers
+        zmq::socket_t failoverSocket(zmqContext, zmq::socket_type::router);
+        std::string failoverEndpoint = gaEndpoint(ipAddressList[locationIndex], 5560);
         failoverSocket.bind(failoverEndpoint);
         
         zmq::socket_t syncSocket(zmqContext, zmq::socket_type::rep);
-        syncSocket.bind("tcp://" + ipAddressList[locationIndex] + ":5563");
-        syncSocket.set(zmq::sockopt::rcvtimeo, 100);
+        syncSocket.bind(gaEndpoint(ipAddressList[locationIndex], 5563));
+        
+        std::string workerReplyEndpoint = "inproc://ga-failover-replies";
+        zmq::socket_t workerReplySocket(zmqContext, zmq::socket_type::pull);
+        workerReplySocket.bind(workerReplyEndpoint);
         
         std::thread monitorThread(primaryMonitor, std::ref(zmqContext), std::ref(ipAddressList[0]));
+        std::thread overdueThread(eventPublisher, std::ref(zmqContext), std::ref(ipAddressList[locationIndex]));
+        std::thread catalogFilterThread(catalogFilterPublisher, std::ref(zmqContext), std::ref(ipAddressList[locationIndex]));
+        std::thread archiveThread;
+        if (!embeddedStorage){
+            archiveThread = std::thread(operationLogArchiver, std::ref(dbConnectionString));
+        }
+        
+        WorkerPool failoverWorkers(zmqContext, workerReplyEndpoint, failoverWorkerCount);
+        WorkerPool replicationLane(zmqContext, workerReplyEndpoint, 1);
+        std::unique_ptr<PipelineExecutor> failoverPipeline;
+        if (pipelineMode){
+            failoverPipeline.reset(new PipelineExecutor(dbConnectionString, overdueTracker, zmqContext, workerReplyEndpoint));
+            if (!failoverPipeline->start()){
+                std::cerr << "[GA-Pipeline] Falling back to the worker pool\n";
+                failoverPipeline.reset();
+            }
+        }
         
         std::cout << "[GA-Replica] Ready (Standby mode)\n\n";
 
         while (isRunning){
-            zmq::message_t topicMessage, dataMessage;
-            if (replicationSocket.recv(topicMessage, zmq::recv_flags::none)) {
-                replicationSocket.recv(dataMessage, zmq::recv_flags::none);
+            //The client socket is only watched while promoted; until then its
+            //requests stay queued
+            bool promoted = isPrimaryRole.load();
+            zmq::pollitem_t pollItems[] = {
+                {static_cast<void*>(replicationSocket), 0, ZMQ_POLLIN, 0},
+                {static_cast<void*>(syncSocket), 0, ZMQ_POLLIN, 0},
+                {static_cast<void*>(workerReplySocket), 0, ZMQ_POLLIN, 0},
+                {static_cast<void*>(failoverSocket), 0, ZMQ_POLLIN, 0}
+            };
+            zmq::poll(pollItems, promoted ? 4 : 3, std::chrono::milliseconds(rolePollIntervalMs));
+            
+            if (pollItems[0].revents & ZMQ_POLLIN) {
+                zmq::message_t topicMessage;
+                std::shared_ptr<zmq::message_t> dataMessage = std::make_shared<zmq::message_t>();
+                replicationSocket.recv(topicMessage, zmq::recv_flags::none);
+                replicationSocket.recv(*dataMessage, zmq::recv_flags::none);
                 
-                Request replicatedRequest;
-                memcpy(&replicatedRequest, dataMessage.data(), sizeof(Request));
+                std::int64_t firstOperationId, lastOperationIdInMessage, precedingOperationId;
+                receiveOperationIds(replicationSocket, *dataMessage, firstOperationId, lastOperationIdInMessage, precedingOperationId);
+                ackSender.send(lastOperationIdInMessage, ReplicaAckStage::RECEIVED);
                 
-                try{
-                    pqxx::connection dbConnection(dbConnectionString);
-                    std::string operationResult;
-                    
-                    switch (int(replicatedRequest.requestType)){
-                        case 0: operationResult = processLoanRequest(replicatedRequest.code, replicatedRequest.location, dbConnection); break;
-                        case 1: operationResult = processRenewalRequest(replicatedRequest.code, replicatedRequest.location, dbConnection); break;
-                        case 2: operationResult = processReturnRequest(replicatedRequest.code, replicatedRequest.location, dbConnection); break;
+                replicationLane.submit([&, dataMessage, firstOperationId, lastOperationIdInMessage, precedingOperationId](zmq::socket_t &){
+                    if(applyReplicationMessage(*dataMessage, firstOperationId, lastOperationIdInMessage, precedingOperationId,
+                                               replicationCursor, ipAddressList[0], *storage)){
+                        storage->awaitDurable(storage->lastOperation());
+                        ackSender.send(lastOperationIdInMessage, ReplicaAckStage::COMMITTED);
                     }
-                    std::cout << "[GA-Replica] Synced operation #" << lastOperationId.load() << "\n";
+                });
+            }
+            
+            if (pollItems[1].revents & ZMQ_POLLIN) {
+                zmq::message_t syncRequest;
+                syncSocket.recv(syncRequest, zmq::recv_flags::none);
+                std::string requestData(static_cast<char*>(syncRequest.data()), syncRequest.size());
+                std::cout << "[GA-Sync] Sync request: " << requestData << "\n";
+                
+                std::string syncResponse;
+                try{
+                    syncResponse = buildSyncResponse(requestData, *storage);
                 }
                 catch (const std::exception &error){
-                    std::cerr << "[GA-Replica] Error: " << error.what() << "\n";
+                    std::cerr << "[GA-Sync] Error: " << error.what() << "\n";
+                    syncResponse = "NO_SYNC_NEEDED";
                 }
+                syncSocket.send(zmq::buffer(syncResponse), zmq::send_flags::none);
             }
             
-            zmq::message_t syncRequest;
-            if(syncSocket.recv(syncRequest, zmq::recv_flags::none)){
-                std::string requestData(static_cast<char*>(syncRequest.data()), syncRequest.size());
-                std::cout << "[GA-Sync] Sync request: " << requestData << "\n";
-                syncSocket.send(zmq::buffer("NO_SYNC_NEEDED"), zmq::send_flags::none);
+            //Replies finished by the workers, still wrapped in the client envelope
+            if (pollItems[2].revents & ZMQ_POLLIN) {
+                bool moreFrames = true;
+                while(moreFrames){
+                    zmq::message_t replyFrame;
+                    workerReplySocket.recv(replyFrame, zmq::recv_flags::none);
+                    moreFrames = replyFrame.more();
+                    failoverSocket.send(replyFrame, moreFrames ? zmq::send_flags::sndmore : zmq::send_flags::none);
+                }
             }
             
-            if(isPrimaryRole.load()){
-                zmq::message_t failoverRequest;
-                if (failoverSocket.recv(failoverRequest, zmq::recv_flags::dontwait)) {
-                    std::cout << "\n[GA-Primary] Processing request\n";
-                    
-                    Request parsedRequest;
-                    memcpy(&parsedRequest, failoverRequest.data(), sizeof(Request));
-                    
-                    std::string operationResult;
-                    try{
-                        pqxx::connection dbConnection(dbConnectionString);
-                        switch (int(parsedRequest.requestType)){
-                            case 0: operationResult = processLoanRequest(parsedRequest.code, parsedRequest.location, dbConnection); break;
-                            case 1: operationResult = processRenewalRequest(parsedRequest.code, parsedRequest.location, dbConnection); break;
-                            case 2: operationResult = processReturnRequest(parsedRequest.code, parsedRequest.location, dbConnection); break;
-                        }
-                    }
-                    catch (const std::exception &error){
-                        operationResult = "Database error: " + std::string(error.what());
+            if (promoted && (pollItems[3].revents & ZMQ_POLLIN)) {
+                std::shared_ptr<std::vector<zmq::message_t>> requestFrames = receiveEnvelopedRequest(failoverSocket);
+                Request parsedRequest;
+                memcpy(&parsedRequest, requestFrames->back().data(), sizeof(Request));
+                std::cout << "\n[GA-Primary] Processing request\n";
+                
+                if (dropIfExpired(requestFrames->back())) {
+                    sendEnvelopedReply(*requestFrames, expiredRequestResponse, failoverSocket);
+                } else if (failoverPipeline && int(parsedRequest.requestType) <= 2 && misroutedRequestError(requestFrames->back()).empty()) {
+                    failoverPipeline->submit(int(parsedRequest.requestType), parsedRequest.code, parsedRequest.location, requestKeyOf(requestFrames->back()),
+                        [requestFrames](const std::string &operationResult, std::int64_t operationId, const ReservationHandOff &handOff,
+                                        zmq::socket_t &replySocket){
+                            if(operationId > 0){
+                                lastOperationId = int(std::max(operationId, handOff.loanOperationId));
+                                Request appliedRequest;
+                                memcpy(&appliedRequest, requestFrames->back().data(), sizeof(Request));
+                                noteAppliedOperation(int(appliedRequest.requestType), appliedRequest.code, appliedRequest.location);
+                            }
+                            if(!handOff.patron.empty()){
+                                announceHandOff(handOff);
+                            }
+                            sendEnvelopedReply(*requestFrames, operationResult, replySocket);
+                        }, localExpiry(parsedRequest));
+                } else if (failoverPipeline && int(parsedRequest.requestType) == 6 && misroutedRequestError(requestFrames->back()).empty()) {
+                    if (!isValidPatronName(patronOf(requestFrames->back()))) {
+                        sendEnvelopedReply(*requestFrames, "Error: Invalid patron name", failoverSocket);
+                    } else {
+                        failoverPipeline->submitReservation(parsedRequest.code, parsedRequest.location, patronOf(requestFrames->back()),
+                            [requestFrames](const std::string &operationResult, std::int64_t, const ReservationHandOff &, zmq::socket_t &replySocket){
+                                sendEnvelopedReply(*requestFrames, operationResult, replySocket);
+                            }, localExpiry(parsedRequest));
                     }
-                    failoverSocket.send(zmq::buffer(operationResult), zmq::send_flags::none);
+                } else if (failoverPipeline && (int(parsedRequest.requestType) == 4 || int(parsedRequest.requestType) == 7)) {
+                    //Batches wait for the pipeline and run here, so no pipelined
+                    //operation commits in between and the log ids stay in order
+                    failoverPipeline->drain();
+                    sendEnvelopedReply(*requestFrames, processFailoverRequest(requestFrames->back(), *storage), failoverSocket);
+                } else {
+                    failoverWorkers.submit([&, requestFrames](zmq::socket_t &replySocket){
+                        sendEnvelopedReply(*requestFrames, processFailoverRequest(requestFrames->back(), *storage), replySocket);
+                    });
                 }
             }
         }
         
         isRunning = false;
         monitorThread.join();
+        overdueThread.join();
+        catalogFilterThread.join();
+        if (archiveThread.joinable()){
+            archiveThread.join();
+        }
     }
     return 0;
 }
\ No newline at end of file
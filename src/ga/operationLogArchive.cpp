@@ -0,0 +1,358 @@
+#include <pqxx/pqxx>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <unistd.h>
+
+//operation_log is range partitioned by id in blocks of this many operations
+const std::int64_t operationLogPartitionSize = 100000;
+//Partitions kept in the database behind the one currently being written
+const std::int64_t operationLogHotPartitions = 1;
+//Records between two entries of a segment's sparse id index
+const std::uint64_t segmentIndexStride = 1024;
+//Shards of a sharded GA share the hosts, each archives to its own directory
+std::string segmentDirectory = "../oplog_segments";
+
+struct OperationLogEntry{
+    std::int64_t id;
+    std::int32_t requestType;
+    std::int32_t code;
+    std::int32_t location;
+    std::int64_t timestampMicros;
+};
+
+//Fixed header at the start of every segment file
+struct SegmentHeader{
+    char magic[4];
+    std::uint32_t version;
+    std::int64_t firstId;
+    std::int64_t lastId;
+    std::uint64_t recordCount;
+    std::uint64_t indexOffset;
+    std::uint64_t indexCount;
+};
+
+//Sparse index entry: first id of a block and the byte offset where it starts
+struct SegmentIndexEntry{
+    std::int64_t firstId;
+    std::uint64_t offset;
+};
+
+void appendVarint(std::string &buffer, std::uint64_t value){
+    while(value >= 0x80){
+        buffer.push_back(char((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(char(value));
+}
+
+void appendSignedVarint(std::string &buffer, std::int64_t value){
+    appendVarint(buffer, (std::uint64_t(value) << 1) ^ std::uint64_t(value >> 63));
+}
+
+bool readVarint(const std::string &buffer, std::size_t &position, std::uint64_t &value){
+    value = 0;
+    for(int shift = 0; shift < 64 && position < buffer.size(); shift += 7){
+        std::uint8_t byte = std::uint8_t(buffer[position++]);
+        value |= std::uint64_t(byte & 0x7F) << shift;
+        if(!(byte & 0x80)){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool readSignedVarint(const std::string &buffer, std::size_t &position, std::int64_t &value){
+    std::uint64_t encoded;
+    if(!readVarint(buffer, position, encoded)){
+        return false;
+    }
+    value = std::int64_t(encoded >> 1) ^ -std::int64_t(encoded & 1);
+    return true;
+}
+
+std::string segmentPath(std::int64_t firstId, std::int64_t lastId){
+    char fileName[64];
+    std::snprintf(fileName, sizeof(fileName), "oplog_%012lld_%012lld.seg", (long long)firstId, (long long)lastId);
+    return segmentDirectory + "/" + fileName;
+}
+
+//Records are delta + varint encoded; every block of segmentIndexStride records
+//restarts from absolute values so a reader can seek straight to it
+bool writeSegmentFile(const std::vector<OperationLogEntry> &entries){
+    if(entries.empty()){
+        return true;
+    }
+
+    std::string body;
+    std::vector<SegmentIndexEntry> sparseIndex;
+    OperationLogEntry previous{};
+    for(std::size_t position = 0; position < entries.size(); position++){
+        const OperationLogEntry &entry = entries[position];
+        if(position % segmentIndexStride == 0){
+            sparseIndex.push_back(SegmentIndexEntry{entry.id, std::uint64_t(sizeof(SegmentHeader) + body.size())});
+            previous = OperationLogEntry{};
+        }
+        appendVarint(body, std::uint64_t(entry.id - previous.id));
+        appendVarint(body, std::uint64_t(entry.requestType));
+        appendSignedVarint(body, std::int64_t(entry.code) - previous.code);
+        appendVarint(body, std::uint64_t(entry.location));
+        appendSignedVarint(body, entry.timestampMicros - previous.timestampMicros);
+        previous = entry;
+    }
+
+    SegmentHeader header{};
+    std::memcpy(header.magic, "OPSG", 4);
+    header.version = 1;
+    header.firstId = entries.front().id;
+    header.lastId = entries.back().id;
+    header.recordCount = entries.size();
+    header.indexOffset = sizeof(SegmentHeader) + body.size();
+    header.indexCount = sparseIndex.size();
+
+    std::filesystem::create_directories(segmentDirectory);
+    std::string finalPath = segmentPath(header.firstId, header.lastId);
+    std::string temporaryPath = finalPath + ".tmp";
+
+    std::FILE *segmentFile = std::fopen(temporaryPath.c_str(), "wb");
+    if(!segmentFile){
+        return false;
+    }
+    bool written = std::fwrite(&header, sizeof(header), 1, segmentFile) == 1 &&
+                   std::fwrite(body.data(), 1, body.size(), segmentFile) == body.size() &&
+                   std::fwrite(sparseIndex.data(), sizeof(SegmentIndexEntry), sparseIndex.size(), segmentFile) == sparseIndex.size() &&
+                   std::fflush(segmentFile) == 0 &&
+                   fsync(fileno(segmentFile)) == 0;
+    std::fclose(segmentFile);
+
+    if(!written){
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return std::rename(temporaryPath.c_str(), finalPath.c_str()) == 0;
+}
+
+//Reads the records of one segment with id > afterId, at most limit of them
+void readSegmentFile(const std::string &path, std::int64_t afterId, std::size_t limit, std::vector<OperationLogEntry> &entries){
+    std::FILE *segmentFile = std::fopen(path.c_str(), "rb");
+    if(!segmentFile){
+        return;
+    }
+
+    SegmentHeader header{};
+    std::string contents;
+    if(std::fread(&header, sizeof(header), 1, segmentFile) == 1 && std::memcmp(header.magic, "OPSG", 4) == 0){
+        std::fseek(segmentFile, 0, SEEK_END);
+        contents.resize(std::size_t(std::ftell(segmentFile)));
+        std::fseek(segmentFile, 0, SEEK_SET);
+        if(std::fread(&contents[0], 1, contents.size(), segmentFile) != contents.size()){
+            contents.clear();
+        }
+    }
+    std::fclose(segmentFile);
+
+    if(contents.empty() || header.indexCount == 0 ||
+       contents.size() < header.indexOffset + header.indexCount * sizeof(SegmentIndexEntry)){
+        return;
+    }
+
+    std::vector<SegmentIndexEntry> sparseIndex(header.indexCount);
+    std::memcpy(sparseIndex.data(), contents.data() + header.indexOffset, header.indexCount * sizeof(SegmentIndexEntry));
+
+    auto blockIterator = std::upper_bound(sparseIndex.begin(), sparseIndex.end(), afterId,
+        [](std::int64_t id, const SegmentIndexEntry &indexEntry){ return id < indexEntry.firstId; });
+    if(blockIterator != sparseIndex.begin()){
+        blockIterator--;
+    }
+
+    std::size_t blockNumber = std::size_t(blockIterator - sparseIndex.begin());
+    std::size_t position = std::size_t(blockIterator->offset);
+    std::uint64_t recordNumber = blockNumber * segmentIndexStride;
+    OperationLogEntry previous{};
+
+    while(recordNumber < header.recordCount && entries.size() < limit){
+        if(recordNumber % segmentIndexStride == 0){
+            previous = OperationLogEntry{};
+        }
+        std::uint64_t idDelta, requestType, location;
+        std::int64_t codeDelta, timestampDelta;
+        if(!readVarint(contents, position, idDelta) || !readVarint(contents, position, requestType) ||
+           !readSignedVarint(contents, position, codeDelta) || !readVarint(contents, position, location) ||
+           !readSignedVarint(contents, position, timestampDelta)){
+            return;
+        }
+        OperationLogEntry entry;
+        entry.id = previous.id + std::int64_t(idDelta);
+        entry.requestType = std::int32_t(requestType);
+        entry.code = std::int32_t(previous.code + codeDelta);
+        entry.location = std::int32_t(location);
+        entry.timestampMicros = previous.timestampMicros + timestampDelta;
+        previous = entry;
+        recordNumber++;
+
+        if(entry.id > afterId){
+            entries.push_back(entry);
+        }
+    }
+}
+
+//Segment files ordered by first id; the zero padded names sort correctly
+std::vector<std::string> listSegmentFiles(){
+    std::vector<std::string> segmentFiles;
+    std::error_code directoryError;
+    for(const auto &directoryEntry : std::filesystem::directory_iterator(segmentDirectory, directoryError)){
+        std::string path = directoryEntry.path().string();
+        if(directoryEntry.path().extension() == ".seg"){
+            segmentFiles.push_back(path);
+        }
+    }
+    std::sort(segmentFiles.begin(), segmentFiles.end());
+    return segmentFiles;
+}
+
+std::int64_t segmentLastId(const std::string &path){
+    long long firstId = 0, lastId = 0;
+    std::string fileName = std::filesystem::path(path).filename().string();
+    if(std::sscanf(fileName.c_str(), "oplog_%lld_%lld.seg", &firstId, &lastId) != 2){
+        return 0;
+    }
+    return lastId;
+}
+
+//Operations with id > afterId in id order, served from the archived segments
+//first and then from the live partitions
+std::vector<OperationLogEntry> readOperationLog(pqxx::connection &dbConnection, std::int64_t afterId, std::size_t limit){
+    std::vector<OperationLogEntry> entries;
+    std::int64_t archivedUpTo = 0;
+
+    for(const std::string &path : listSegmentFiles()){
+        std::int64_t lastId = segmentLastId(path);
+        archivedUpTo = std::max(archivedUpTo, lastId);
+        if(lastId > afterId && entries.size() < limit){
+            readSegmentFile(path, afterId, limit, entries);
+        }
+    }
+
+    if(entries.size() < limit){
+        std::int64_t databaseAfterId = std::max(afterId, archivedUpTo);
+        pqxx::work transaction(dbConnection);
+        pqxx::result logQuery = transaction.exec(
+            "SELECT id, request_type, code, location, "
+            "(EXTRACT(EPOCH FROM timestamp) * 1000000)::bigint "
+            "FROM operation_log "
+            "WHERE id > " + transaction.quote(databaseAfterId) + " "
+            "ORDER BY id "
+            "LIMIT " + transaction.quote(std::int64_t(limit - entries.size()))
+        );
+        transaction.commit();
+
+        for(const auto &logRow : logQuery){
+            entries.push_back(OperationLogEntry{
+                logRow[0].as<std::int64_t>(), logRow[1].as<std::int32_t>(), logRow[2].as<std::int32_t>(),
+                logRow[3].as<std::int32_t>(), logRow[4].as<std::int64_t>()
+            });
+        }
+
+        //A partition archived and dropped between the listing and the query
+        //was in neither; its segment was written before the drop, so it is
+        //listed now. Its rows go before the live ones, and a row also read
+        //from the database (archived after the query) is kept once.
+        std::size_t liveStart = entries.size() - logQuery.size();
+        std::vector<OperationLogEntry> archivedMeanwhile;
+        for(const std::string &path : listSegmentFiles()){
+            if(segmentLastId(path) > databaseAfterId){
+                readSegmentFile(path, databaseAfterId, limit - liveStart, archivedMeanwhile);
+            }
+        }
+        if(!archivedMeanwhile.empty()){
+            entries.insert(entries.end(), archivedMeanwhile.begin(), archivedMeanwhile.end());
+            std::sort(entries.begin() + std::ptrdiff_t(liveStart), entries.end(),
+                [](const OperationLogEntry &left, const OperationLogEntry &right){ return left.id < right.id; });
+            entries.erase(std::unique(entries.begin() + std::ptrdiff_t(liveStart), entries.end(),
+                [](const OperationLogEntry &left, const OperationLogEntry &right){ return left.id == right.id; }), entries.end());
+            entries.resize(std::min(entries.size(), limit));
+        }
+    }
+    return entries;
+}
+
+std::string partitionName(std::int64_t partitionNumber){
+    return "operation_log_p" + std::to_string(partitionNumber);
+}
+
+//Creates the partitions ahead of the id sequence and moves every partition
+//older than the hot window into a segment file before dropping it
+void archiveOperationLog(pqxx::connection &dbConnection){
+    std::int64_t currentPartition;
+    {
+        pqxx::work transaction(dbConnection);
+        pqxx::result sequenceQuery = transaction.exec("SELECT last_value FROM operation_log_id_seq");
+        currentPartition = (sequenceQuery[0][0].as<std::int64_t>() - 1) / operationLogPartitionSize;
+
+        for(std::int64_t partitionNumber = currentPartition; partitionNumber <= currentPartition + 1; partitionNumber++){
+            transaction.exec(
+                "CREATE TABLE IF NOT EXISTS " + partitionName(partitionNumber) + " "
+                "PARTITION OF operation_log "
+                "FOR VALUES FROM (" + std::to_string(partitionNumber * operationLogPartitionSize + 1) + ") "
+                "TO (" + std::to_string((partitionNumber + 1) * operationLogPartitionSize + 1) + ")"
+            );
+        }
+        transaction.commit();
+    }
+
+    std::vector<std::int64_t> closedPartitions;
+    {
+        pqxx::work transaction(dbConnection);
+        pqxx::result partitionQuery = transaction.exec(
+            "SELECT c.relname "
+            "FROM pg_inherits i "
+            "JOIN pg_class c ON c.oid = i.inhrelid "
+            "WHERE i.inhparent = 'operation_log'::regclass"
+        );
+        transaction.commit();
+
+        for(const auto &partitionRow : partitionQuery){
+            long long partitionNumber;
+            if(std::sscanf(partitionRow[0].c_str(), "operation_log_p%lld", &partitionNumber) == 1 &&
+               partitionNumber < currentPartition - operationLogHotPartitions + 1){
+                closedPartitions.push_back(partitionNumber);
+            }
+        }
+        std::sort(closedPartitions.begin(), closedPartitions.end());
+    }
+
+    for(std::int64_t partitionNumber : closedPartitions){
+        pqxx::work transaction(dbConnection);
+        pqxx::result partitionRows = transaction.exec(
+            "SELECT id, request_type, code, location, "
+            "(EXTRACT(EPOCH FROM timestamp) * 1000000)::bigint "
+            "FROM " + partitionName(partitionNumber) + " "
+            "ORDER BY id"
+        );
+
+        std::vector<OperationLogEntry> entries;
+        entries.reserve(partitionRows.size());
+        for(const auto &logRow : partitionRows){
+            entries.push_back(OperationLogEntry{
+                logRow[0].as<std::int64_t>(), logRow[1].as<std::int32_t>(), logRow[2].as<std::int32_t>(),
+                logRow[3].as<std::int32_t>(), logRow[4].as<std::int64_t>()
+            });
+        }
+
+        if(!writeSegmentFile(entries)){
+            transaction.abort();
+            std::cerr << "[GA-Archive] Could not write segment for " << partitionName(partitionNumber) << "\n";
+            return;
+        }
+
+        transaction.exec("ALTER TABLE operation_log DETACH PARTITION " + partitionName(partitionNumber));
+        transaction.exec("DROP TABLE " + partitionName(partitionNumber));
+        transaction.commit();
+        std::cout << "[GA-Archive] Archived " << partitionName(partitionNumber) << " (" << entries.size() << " operations)\n";
+    }
+}
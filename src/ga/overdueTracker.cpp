@@ -0,0 +1,194 @@
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <ctime>
+#include <cstdio>
+#include <algorithm>
+
+//Active loan as seen by the overdue tracker
+struct LoanDueEntry{
+    int stateId;
+    int bookCode;
+    int sede;
+    int dueDay;
+};
+
+//Days since 1970-01-01 for a civil date (proleptic gregorian)
+int dayNumberFromCivil(int year, int month, int day){
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+int dayNumberFromDate(const std::string &date){
+    int year = 0, month = 0, day = 0;
+    if(std::sscanf(date.c_str(), "%d-%d-%d", &year, &month, &day) != 3){
+        return -1;
+    }
+    return dayNumberFromCivil(year, month, day);
+}
+
+std::string dateFromDayNumber(int dayNumber){
+    dayNumber += 719468;
+    int era = (dayNumber >= 0 ? dayNumber : dayNumber - 146096) / 146097;
+    int dayOfEra = dayNumber - era * 146097;
+    int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int monthPrime = (5 * dayOfYear + 2) / 153;
+    int day = dayOfYear - (153 * monthPrime + 2) / 5 + 1;
+    int month = monthPrime + (monthPrime < 10 ? 3 : -9);
+    int year = yearOfEra + era * 400 + (month <= 2);
+
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d", year, month, day);
+    return std::string(buffer);
+}
+
+//Local date, matching the server-side NOW()::date used for due dates
+int currentDayNumber(){
+    std::time_t now = std::time(nullptr);
+    std::tm localDate{};
+    localtime_r(&now, &localDate);
+    return dayNumberFromCivil(localDate.tm_year + 1900, localDate.tm_mon + 1, localDate.tm_mday);
+}
+
+//Day-bucketed index of active loans. Loans wait in the bucket of their due
+//date and are only touched again when that day passes, so advancing the
+//clock costs the number of loans expiring, not the number of active loans.
+class OverdueTracker{
+public:
+    void track(int stateId, int bookCode, int sede, const std::string &dueDate){
+        int dueDay = dayNumberFromDate(dueDate);
+        if(dueDay < 0){
+            return;
+        }
+        std::lock_guard<std::mutex> lock(trackerMutex);
+        removeLocked(stateId);
+        pendingLoans[stateId] = LoanDueEntry{stateId, bookCode, sede, dueDay};
+        dueBuckets[dueDay].insert(stateId);
+    }
+
+    void reschedule(int stateId, const std::string &dueDate){
+        int dueDay = dayNumberFromDate(dueDate);
+        if(dueDay < 0){
+            return;
+        }
+        std::lock_guard<std::mutex> lock(trackerMutex);
+        LoanDueEntry entry;
+        bool wasOverdue = false;
+        if(!takeLocked(stateId, entry, wasOverdue)){
+            return;
+        }
+        entry.dueDay = dueDay;
+        //An overdue loan renewed to a day that has also passed stays overdue
+        //without a CLEARED and OVERDUE pair for it
+        if(wasOverdue && dueDay < lastAdvancedDay){
+            overdueBySede[entry.sede][stateId] = entry;
+            return;
+        }
+        if(wasOverdue){
+            pendingEvents.push_back("CLEARED " + describeEntry(entry));
+        }
+        pendingLoans[stateId] = entry;
+        dueBuckets[dueDay].insert(stateId);
+    }
+
+    void release(int stateId){
+        std::lock_guard<std::mutex> lock(trackerMutex);
+        removeLocked(stateId);
+    }
+
+    //Moves every bucket whose due date is before today into the overdue set
+    void advance(int today){
+        std::lock_guard<std::mutex> lock(trackerMutex);
+        lastAdvancedDay = std::max(lastAdvancedDay, today);
+        while(!dueBuckets.empty() && dueBuckets.begin()->first < today){
+            for(int stateId : dueBuckets.begin()->second){
+                auto pendingIterator = pendingLoans.find(stateId);
+                if(pendingIterator == pendingLoans.end()){
+                    continue;
+                }
+                LoanDueEntry entry = pendingIterator->second;
+                pendingLoans.erase(pendingIterator);
+                overdueBySede[entry.sede][stateId] = entry;
+                pendingEvents.push_back("OVERDUE " + describeEntry(entry));
+            }
+            dueBuckets.erase(dueBuckets.begin());
+        }
+    }
+
+    std::vector<LoanDueEntry> overdueAt(int sede){
+        std::lock_guard<std::mutex> lock(trackerMutex);
+        std::vector<LoanDueEntry> overdueLoans;
+        auto sedeIterator = overdueBySede.find(sede);
+        if(sedeIterator != overdueBySede.end()){
+            for(auto &stateEntry : sedeIterator->second){
+                overdueLoans.push_back(stateEntry.second);
+            }
+        }
+        return overdueLoans;
+    }
+
+    std::vector<std::string> drainEvents(){
+        std::lock_guard<std::mutex> lock(trackerMutex);
+        std::vector<std::string> events;
+        events.swap(pendingEvents);
+        return events;
+    }
+
+private:
+    std::string describeEntry(const LoanDueEntry &entry){
+        return std::to_string(entry.bookCode) + " " + std::to_string(entry.sede) + " " +
+               dateFromDayNumber(entry.dueDay) + " " + std::to_string(entry.stateId);
+    }
+
+    bool takeLocked(int stateId, LoanDueEntry &entry, bool &wasOverdue){
+        wasOverdue = false;
+        auto pendingIterator = pendingLoans.find(stateId);
+        if(pendingIterator != pendingLoans.end()){
+            entry = pendingIterator->second;
+            auto bucketIterator = dueBuckets.find(entry.dueDay);
+            if(bucketIterator != dueBuckets.end()){
+                bucketIterator->second.erase(stateId);
+                if(bucketIterator->second.empty()){
+                    dueBuckets.erase(bucketIterator);
+                }
+            }
+            pendingLoans.erase(pendingIterator);
+            return true;
+        }
+        for(auto &sedeEntry : overdueBySede){
+            auto overdueIterator = sedeEntry.second.find(stateId);
+            if(overdueIterator != sedeEntry.second.end()){
+                entry = overdueIterator->second;
+                sedeEntry.second.erase(overdueIterator);
+                wasOverdue = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //Only a removal reports CLEARED: the loan was returned or replaced
+    void removeLocked(int stateId){
+        LoanDueEntry entry;
+        bool wasOverdue = false;
+        if(takeLocked(stateId, entry, wasOverdue) && wasOverdue){
+            pendingEvents.push_back("CLEARED " + describeEntry(entry));
+        }
+    }
+
+    std::mutex trackerMutex;
+    std::unordered_map<int, LoanDueEntry> pendingLoans;
+    std::map<int, std::unordered_set<int>> dueBuckets;
+    std::unordered_map<int, std::unordered_map<int, LoanDueEntry>> overdueBySede;
+    std::vector<std::string> pendingEvents;
+    //Day of the latest advance; loans due before it are overdue
+    int lastAdvancedDay = 0;
+};
@@ -0,0 +1,499 @@
+#include <zmq.hpp>
+#include <postgresql/libpq-fe.h>
+#include <iostream>
+#include <string>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <chrono>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+//Operations sent to the server without waiting for earlier ones to finish
+const std::size_t maxPipelinedOperations = 256;
+
+//Each operation is one statement so independent operations can be pipelined;
+//the rules match PostgresBackend. $1 book code, $2 sede, $3 idempotency key.
+const char *pipelinedLoanStatement =
+    "WITH applied AS ( "
+    "    SELECT result FROM applied_requests WHERE request_key = $3 "
+    "), book AS ( "
+    "    SELECT id_libro FROM libros WHERE codigo = $1 FOR UPDATE "
+    "), taken AS ( "
+    "    UPDATE libros "
+    "    SET ejemplares_sede1 = ejemplares_sede1 - CASE WHEN $2 = 1 THEN 1 ELSE 0 END, "
+    "        ejemplares_sede2 = ejemplares_sede2 - CASE WHEN $2 = 2 THEN 1 ELSE 0 END "
+    "    WHERE id_libro = (SELECT id_libro FROM book) "
+    "    AND CASE WHEN $2 = 1 THEN ejemplares_sede1 ELSE ejemplares_sede2 END > 0 "
+    "    AND NOT EXISTS (SELECT 1 FROM applied) "
+    "    RETURNING id_libro "
+    "), loan AS ( "
+    "    INSERT INTO estados (id_libro, tipo_operacion, fecha_operacion, fecha_devolucion_prevista, sede, renovaciones) "
+    "    SELECT id_libro, 'prestamo', NOW(), (NOW() + interval '14 days')::date, $2, 0 FROM taken "
+    "    RETURNING id_estado, fecha_devolucion_prevista::text AS due "
+    "), recorded AS ( "
+    "    INSERT INTO applied_requests (request_key, result) "
+    "    SELECT $3, 'Loan successful. Return date: ' || due FROM loan WHERE $3 <> '' "
+    "), pruned AS ( "
+    "    DELETE FROM applied_requests "
+    "    WHERE request_key >= rpad(left($3, 16), 32, '0') AND request_key < $3 "
+    "    AND EXISTS (SELECT 1 FROM loan) AND $3 <> '' "
+    "), counted AS ( "
+    "    INSERT INTO uso_diario (dia, codigo, sede, prestamos) "
+    "    SELECT CURRENT_DATE, $1, $2, 1 FROM loan "
+    "    ON CONFLICT (dia, codigo, sede) DO UPDATE SET prestamos = uso_diario.prestamos + 1 "
+    "), logged AS ( "
+    "    INSERT INTO operation_log (request_type, code, location, timestamp) "
+    "    SELECT 0, $1, $2 - 1, NOW() FROM loan "
+    "    RETURNING id "
+    ") "
+    "SELECT (SELECT result FROM applied), (SELECT COUNT(*) FROM book), (SELECT id_estado FROM loan), "
+    "       (SELECT due FROM loan), (SELECT id FROM logged)";
+
+const char *pipelinedRenewalStatement =
+    "WITH applied AS ( "
+    "    SELECT result FROM applied_requests WHERE request_key = $3 "
+    "), loan AS ( "
+    "    SELECT e.id_estado, e.renovaciones "
+    "    FROM estados e "
+    "    JOIN libros l ON l.id_libro = e.id_libro "
+    "    WHERE l.codigo = $1 AND e.sede = $2 AND e.tipo_operacion = 'prestamo' "
+    "    AND NOT EXISTS ( "
+    "        SELECT 1 FROM estados e3 "
+    "        WHERE e3.id_libro = e.id_libro "
+    "        AND e3.tipo_operacion = 'devuelto' "
+    "        AND e3.fecha_operacion > e.fecha_operacion "
+    "    ) "
+    "    AND NOT EXISTS (SELECT 1 FROM applied) "
+    "    ORDER BY e.renovaciones ASC, e.fecha_operacion ASC "
+    "    LIMIT 1 "
+    "    FOR UPDATE OF e "
+    "), renewed AS ( "
+    "    UPDATE estados "
+    "    SET renovaciones = renovaciones + 1, "
+    "        fecha_devolucion_prevista = fecha_devolucion_prevista + INTERVAL '7 days' "
+    "    WHERE id_estado = (SELECT id_estado FROM loan WHERE renovaciones < 2) "
+    "    RETURNING id_estado, fecha_devolucion_prevista::date AS due "
+    "), recorded AS ( "
+    "    INSERT INTO applied_requests (request_key, result) "
+    "    SELECT $3, 'Loan renewed successfully for 7 additional days' FROM renewed WHERE $3 <> '' "
+    "), pruned AS ( "
+    "    DELETE FROM applied_requests "
+    "    WHERE request_key >= rpad(left($3, 16), 32, '0') AND request_key < $3 "
+    "    AND EXISTS (SELECT 1 FROM renewed) AND $3 <> '' "
+    "), counted AS ( "
+    "    INSERT INTO uso_diario (dia, codigo, sede, renovaciones) "
+    "    SELECT CURRENT_DATE, $1, $2, 1 FROM renewed "
+    "    ON CONFLICT (dia, codigo, sede) DO UPDATE SET renovaciones = uso_diario.renovaciones + 1 "
+    "), logged AS ( "
+    "    INSERT INTO operation_log (request_type, code, location, timestamp) "
+    "    SELECT 1, $1, $2 - 1, NOW() FROM renewed "
+    "    RETURNING id "
+    ") "
+    "SELECT (SELECT result FROM applied), (SELECT renovaciones FROM loan), "
+    "       (SELECT id_estado FROM renewed), (SELECT due FROM renewed), (SELECT id FROM logged)";
+
+const char *pipelinedReturnStatement =
+    "WITH applied AS ( "
+    "    SELECT result FROM applied_requests WHERE request_key = $3 "
+    "), loan AS ( "
+    "    SELECT e.id_estado, e.id_libro "
+    "    FROM estados e "
+    "    JOIN libros l ON l.id_libro = e.id_libro "
+    "    WHERE l.codigo = $1 AND e.sede = $2 AND e.tipo_operacion = 'prestamo' "
+    "    AND NOT EXISTS (SELECT 1 FROM applied) "
+    "    ORDER BY e.renovaciones DESC, e.fecha_operacion DESC "
+    "    LIMIT 1 "
+    "    FOR UPDATE OF e "
+    "), returned AS ( "
+    "    UPDATE estados SET tipo_operacion = 'devuelto' "
+    "    WHERE id_estado = (SELECT id_estado FROM loan) "
+    "    RETURNING id_estado, id_libro "
+    "), taken AS ( "
+    "    DELETE FROM reservas "
+    "    WHERE id = ( "
+    "        SELECT id FROM reservas WHERE codigo = $1 AND sede = $2 "
+    "        ORDER BY id LIMIT 1 FOR UPDATE "
+    "    ) "
+    "    AND EXISTS (SELECT 1 FROM returned) "
+    "    RETURNING patron "
+    "), handed AS ( "
+    "    INSERT INTO estados (id_libro, tipo_operacion, fecha_operacion, fecha_devolucion_prevista, sede, renovaciones) "
+    "    SELECT returned.id_libro, 'prestamo', NOW(), (NOW() + interval '14 days')::date, $2, 0 FROM returned, taken "
+    "    RETURNING id_estado, fecha_devolucion_prevista "
+    "), restocked AS ( "
+    "    UPDATE libros "
+    "    SET ejemplares_sede1 = ejemplares_sede1 + CASE WHEN $2 = 1 THEN 1 - (SELECT COUNT(*) FROM taken) ELSE 0 END, "
+    "        ejemplares_sede2 = ejemplares_sede2 + CASE WHEN $2 = 2 THEN 1 - (SELECT COUNT(*) FROM taken) ELSE 0 END "
+    "    WHERE id_libro = (SELECT id_libro FROM returned) "
+    "), recorded AS ( "
+    "    INSERT INTO applied_requests (request_key, result) "
+    "    SELECT $3, 'Return successful. Copy available again' FROM returned WHERE $3 <> '' "
+    "), pruned AS ( "
+    "    DELETE FROM applied_requests "
+    "    WHERE request_key >= rpad(left($3, 16), 32, '0') AND request_key < $3 "
+    "    AND EXISTS (SELECT 1 FROM returned) AND $3 <> '' "
+    "), counted AS ( "
+    "    INSERT INTO uso_diario (dia, codigo, sede, devoluciones, prestamos) "
+    "    SELECT CURRENT_DATE, $1, $2, 1, (SELECT COUNT(*) FROM taken) FROM returned "
+    "    ON CONFLICT (dia, codigo, sede) DO UPDATE "
+    "    SET devoluciones = uso_diario.devoluciones + 1, prestamos = uso_diario.prestamos + EXCLUDED.prestamos "
+    "), logged AS ( "
+    "    INSERT INTO operation_log (request_type, code, location, timestamp) "
+    "    SELECT steps.request_type, $1, $2 - 1, NOW() "
+    "    FROM (SELECT 1 AS step, 2 AS request_type FROM returned UNION ALL SELECT 2, 0 FROM handed) steps "
+    "    ORDER BY steps.step "
+    "    RETURNING id, request_type "
+    ") "
+    "SELECT (SELECT result FROM applied), (SELECT id_estado FROM returned), (SELECT id FROM logged WHERE request_type = 2), "
+    "       (SELECT patron FROM taken), (SELECT id_estado FROM handed), (SELECT fecha_devolucion_prevista FROM handed), "
+    "       (SELECT id FROM logged WHERE request_type = 0)";
+
+//A place in a waitlist, only while the site has no copy left; $3 is the
+//patron. The book's row is locked, so the copies counted are the ones
+//committed by the returns ahead of it. A patron already waiting keeps their
+//place.
+const std::string pipelinedReserveStatement =
+    "WITH book AS ( "
+    "    SELECT id_libro, CASE WHEN $2 = 1 THEN ejemplares_sede1 ELSE ejemplares_sede2 END AS available "
+    "    FROM libros WHERE codigo = $1 FOR UPDATE "
+    "), waiting AS ( "
+    "    SELECT patron, ROW_NUMBER() OVER (ORDER BY id) AS position "
+    "    FROM reservas WHERE codigo = $1 AND sede = $2 "
+    "), queued AS ( "
+    "    INSERT INTO reservas (codigo, sede, patron) "
+    "    SELECT $1, $2, $3 FROM book "
+    "    WHERE book.available = 0 "
+    "    AND NOT EXISTS (SELECT 1 FROM waiting WHERE patron = $3) "
+    "    AND (SELECT COUNT(*) FROM waiting) < " + std::to_string(maxWaitingPatrons) + " "
+    "    RETURNING id "
+    ") "
+    "SELECT (SELECT COUNT(*) FROM book), (SELECT available FROM book), "
+    "       (SELECT position FROM waiting WHERE patron = $3), (SELECT COUNT(*) FROM waiting), (SELECT COUNT(*) FROM queued)";
+
+//operationId is the operation_log id written, 0 when nothing was applied;
+//handOff names the patron a return lent its copy to, if any
+typedef std::function<void(const std::string &operationResult, std::int64_t operationId, const ReservationHandOff &handOff,
+                           zmq::socket_t &completionSocket)> PipelineCallback;
+
+struct PipelineOperation{
+    int requestType;
+    int bookCode;
+    int locationId;
+    std::string requestKey;
+    //Only for a reservation
+    std::string patron;
+    PipelineCallback onComplete;
+    //Past this the operation is answered as expired instead of being sent
+    std::chrono::steady_clock::time_point expiresAt;
+    std::string operationResult;
+    std::int64_t operationId = 0;
+    ReservationHandOff handOff;
+    bool resultReceived = false;
+};
+
+//Runs loans, renewals, returns and reservations over one non-blocking connection in libpq
+//pipeline mode. Every operation is a single statement followed by a sync
+//point, so it commits on its own while up to maxPipelinedOperations others
+//are already on the wire. A dedicated thread sends, reads completions in
+//order and hands each result to the operation's callback together with a
+//PUSH socket connected to completionEndpoint.
+class PipelineExecutor{
+public:
+    PipelineExecutor(const std::string &dbConnectionString, OverdueTracker &tracker, zmq::context_t &context, const std::string &completionEndpoint)
+        : connectionString(dbConnectionString), overdueTracker(tracker), zmqContext(context), completionEndpoint(completionEndpoint){}
+
+    ~PipelineExecutor(){
+        running = false;
+        wake();
+        if(executorThread.joinable()){
+            executorThread.join();
+        }
+        if(connection){
+            PQfinish(connection);
+        }
+        if(wakeDescriptor >= 0){
+            close(wakeDescriptor);
+        }
+    }
+
+    bool start(){
+        wakeDescriptor = eventfd(0, EFD_NONBLOCK);
+        if(wakeDescriptor < 0 || !connect()){
+            return false;
+        }
+        executorThread = std::thread(&PipelineExecutor::executorLoop, this);
+        return true;
+    }
+
+    void submit(int requestType, int bookCode, int locationId, const std::string &requestKey, PipelineCallback onComplete,
+                std::chrono::steady_clock::time_point expiresAt = std::chrono::steady_clock::time_point::max()){
+        enqueue(requestType, bookCode, locationId, requestKey, "", std::move(onComplete), expiresAt);
+    }
+
+    //The patron's name is checked by the caller
+    void submitReservation(int bookCode, int locationId, const std::string &patron, PipelineCallback onComplete,
+                           std::chrono::steady_clock::time_point expiresAt = std::chrono::steady_clock::time_point::max()){
+        enqueue(int(RequestType::RESERVE), bookCode, locationId, "", patron, std::move(onComplete), expiresAt);
+    }
+
+    //Returns once every operation submitted so far has completed and its
+    //callback has run. Work done on another connection waits for this, so
+    //its operation_log ids come after every pipelined one.
+    void drain(){
+        std::unique_lock<std::mutex> lock(drainMutex);
+        drainCondition.wait(lock, [this]{ return outstandingOperations == 0; });
+    }
+
+private:
+    void enqueue(int requestType, int bookCode, int locationId, const std::string &requestKey, const std::string &patron,
+                 PipelineCallback onComplete, std::chrono::steady_clock::time_point expiresAt){
+        {
+            std::lock_guard<std::mutex> lock(drainMutex);
+            outstandingOperations++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queuedOperations.emplace_back();
+            PipelineOperation &operation = queuedOperations.back();
+            operation.requestType = requestType;
+            operation.bookCode = bookCode;
+            operation.locationId = locationId;
+            operation.requestKey = requestKey;
+            operation.patron = patron;
+            operation.onComplete = std::move(onComplete);
+            operation.expiresAt = expiresAt;
+        }
+        wake();
+    }
+
+    void complete(PipelineOperation &operation, const std::string &operationResult, std::int64_t operationId,
+                  const ReservationHandOff &handOff, zmq::socket_t &completionSocket){
+        operation.onComplete(operationResult, operationId, handOff, completionSocket);
+        std::lock_guard<std::mutex> lock(drainMutex);
+        outstandingOperations--;
+        drainCondition.notify_all();
+    }
+
+    void wake(){
+        std::uint64_t increment = 1;
+        if(wakeDescriptor >= 0 && write(wakeDescriptor, &increment, sizeof(increment)) < 0){
+            std::cerr << "[GA-Pipeline] Could not wake executor\n";
+        }
+    }
+
+    bool connect(){
+        if(connection){
+            PQfinish(connection);
+        }
+        connection = PQconnectdb(connectionString.c_str());
+        bool prepared = PQstatus(connection) == CONNECTION_OK &&
+                        prepareStatement("pipelined_loan", pipelinedLoanStatement) &&
+                        prepareStatement("pipelined_renewal", pipelinedRenewalStatement) &&
+                        prepareStatement("pipelined_return", pipelinedReturnStatement) &&
+                        prepareStatement("pipelined_reserve", pipelinedReserveStatement.c_str());
+        if(!prepared || PQsetnonblocking(connection, 1) != 0 || PQenterPipelineMode(connection) != 1){
+            std::cerr << "[GA-Pipeline] Could not open pipeline connection: " << PQerrorMessage(connection) << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool prepareStatement(const char *name, const char *statement){
+        PGresult *prepareResult = PQprepare(connection, name, statement, 3, nullptr);
+        bool prepared = PQresultStatus(prepareResult) == PGRES_COMMAND_OK;
+        PQclear(prepareResult);
+        return prepared;
+    }
+
+    void executorLoop(){
+        zmq::socket_t completionSocket(zmqContext, zmq::socket_type::push);
+        completionSocket.set(zmq::sockopt::linger, 0);
+        //Never blocks, so drain cannot wait on a reader that is waiting on it
+        completionSocket.set(zmq::sockopt::sndhwm, 0);
+        completionSocket.connect(completionEndpoint);
+
+        while(running){
+            sendQueuedOperations(completionSocket);
+            bool flushPending = PQflush(connection) == 1;
+
+            pollfd descriptors[2] = {
+                {wakeDescriptor, POLLIN, 0},
+                {PQsocket(connection), short(POLLIN | (flushPending ? POLLOUT : 0)), 0}
+            };
+            ::poll(descriptors, inFlightOperations.empty() && !flushPending ? 1 : 2, 1000);
+
+            if(descriptors[0].revents & POLLIN){
+                std::uint64_t wakeCount;
+                while(read(wakeDescriptor, &wakeCount, sizeof(wakeCount)) > 0){}
+            }
+            if(!inFlightOperations.empty() && (descriptors[1].revents & (POLLIN | POLLERR | POLLHUP))){
+                if(PQconsumeInput(connection) != 1){
+                    failInFlight(std::string("Database error: ") + PQerrorMessage(connection), completionSocket);
+                    continue;
+                }
+                readCompletions(completionSocket);
+            }
+        }
+    }
+
+    void sendQueuedOperations(zmq::socket_t &completionSocket){
+        std::lock_guard<std::mutex> lock(queueMutex);
+        while(!queuedOperations.empty() && inFlightOperations.size() < maxPipelinedOperations){
+            if(PQstatus(connection) != CONNECTION_OK && !connect()){
+                PipelineOperation failedOperation = std::move(queuedOperations.front());
+                queuedOperations.pop_front();
+                complete(failedOperation, "Database error: pipeline connection unavailable", 0, ReservationHandOff(), completionSocket);
+                continue;
+            }
+
+            PipelineOperation &operation = queuedOperations.front();
+            if(std::chrono::steady_clock::now() >= operation.expiresAt){
+                std::cout << "[GA-Pipeline] Dropped an expired operation (" << ++expiredOperationCount << " so far)\n";
+                complete(operation, expiredRequestResponse, 0, ReservationHandOff(), completionSocket);
+                queuedOperations.pop_front();
+                continue;
+            }
+            std::string bookCode = std::to_string(operation.bookCode);
+            std::string sede = std::to_string(operation.locationId + 1);
+            bool isReservation = operation.requestType == int(RequestType::RESERVE);
+            const char *parameters[3] = {bookCode.c_str(), sede.c_str(), isReservation ? operation.patron.c_str() : operation.requestKey.c_str()};
+            const char *statementName = operation.requestType == 0 ? "pipelined_loan" :
+                                        operation.requestType == 1 ? "pipelined_renewal" :
+                                        isReservation ? "pipelined_reserve" : "pipelined_return";
+
+            if(PQsendQueryPrepared(connection, statementName, 3, parameters, nullptr, nullptr, 0) != 1 ||
+               PQpipelineSync(connection) != 1){
+                failInFlight(std::string("Database error: ") + PQerrorMessage(connection), completionSocket);
+                return;
+            }
+            inFlightOperations.push_back(std::move(operation));
+            queuedOperations.pop_front();
+        }
+    }
+
+    //Results arrive in submission order: the statement's result, a null
+    //marking its end, then the sync point that completes the operation
+    void readCompletions(zmq::socket_t &completionSocket){
+        while(!inFlightOperations.empty() && !PQisBusy(connection)){
+            PGresult *pipelineResult = PQgetResult(connection);
+            PipelineOperation &operation = inFlightOperations.front();
+            if(!pipelineResult){
+                if(!operation.resultReceived){
+                    break;
+                }
+                continue;
+            }
+
+            ExecStatusType status = PQresultStatus(pipelineResult);
+            if(status == PGRES_PIPELINE_SYNC){
+                PQclear(pipelineResult);
+                complete(operation, operation.operationResult, operation.operationId, operation.handOff, completionSocket);
+                inFlightOperations.pop_front();
+                continue;
+            }
+            if(status == PGRES_TUPLES_OK && PQntuples(pipelineResult) == 1){
+                interpretResult(operation, pipelineResult);
+            } else {
+                operation.operationResult = std::string("Database error: ") + PQresultErrorMessage(pipelineResult);
+            }
+            operation.resultReceived = true;
+            PQclear(pipelineResult);
+        }
+    }
+
+    void interpretResult(PipelineOperation &operation, PGresult *row){
+        int sede = operation.locationId + 1;
+        if(operation.requestType == 0){
+            if(!PQgetisnull(row, 0, 0)){
+                operation.operationResult = PQgetvalue(row, 0, 0);
+            } else if(std::stoi(PQgetvalue(row, 0, 1)) == 0){
+                operation.operationResult = "Error: Book does not exist";
+            } else if(PQgetisnull(row, 0, 2)){
+                operation.operationResult = "Error: No available copies of this book";
+            } else {
+                std::string returnDate = PQgetvalue(row, 0, 3);
+                overdueTracker.track(std::stoi(PQgetvalue(row, 0, 2)), operation.bookCode, sede, returnDate);
+                operation.operationId = std::stoll(PQgetvalue(row, 0, 4));
+                operation.operationResult = "Loan successful. Return date: " + returnDate;
+            }
+        } else if(operation.requestType == 1){
+            if(!PQgetisnull(row, 0, 0)){
+                operation.operationResult = PQgetvalue(row, 0, 0);
+            } else if(PQgetisnull(row, 0, 1)){
+                operation.operationResult = "Error: No active loan found for this book at this location";
+            } else if(PQgetisnull(row, 0, 2)){
+                operation.operationResult = "Error: Maximum renewal limit reached (2)";
+            } else {
+                overdueTracker.reschedule(std::stoi(PQgetvalue(row, 0, 2)), PQgetvalue(row, 0, 3));
+                operation.operationId = std::stoll(PQgetvalue(row, 0, 4));
+                operation.operationResult = "Loan renewed successfully for 7 additional days";
+            }
+        } else if(operation.requestType == int(RequestType::RESERVE)){
+            if(std::stoi(PQgetvalue(row, 0, 0)) == 0){
+                operation.operationResult = "Error: Book does not exist";
+            } else if(std::stoi(PQgetvalue(row, 0, 1)) > 0){
+                operation.operationResult = "Error: Copies are available, request a loan";
+            } else if(!PQgetisnull(row, 0, 2)){
+                operation.operationResult = "Reservation confirmed. Position in waitlist: " + std::string(PQgetvalue(row, 0, 2));
+            } else if(std::stoi(PQgetvalue(row, 0, 4)) == 1){
+                operation.operationResult = "Reservation confirmed. Position in waitlist: " + std::to_string(std::stoi(PQgetvalue(row, 0, 3)) + 1);
+            } else {
+                operation.operationResult = "Error: Waitlist for this book is full";
+            }
+        } else {
+            if(!PQgetisnull(row, 0, 0)){
+                operation.operationResult = PQgetvalue(row, 0, 0);
+            } else if(PQgetisnull(row, 0, 1)){
+                operation.operationResult = "Error: No active loan found for this book at this location";
+            } else {
+                overdueTracker.release(std::stoi(PQgetvalue(row, 0, 1)));
+                operation.operationId = std::stoll(PQgetvalue(row, 0, 2));
+                operation.operationResult = "Return successful. Copy available again";
+                if(!PQgetisnull(row, 0, 4)){
+                    operation.handOff.bookCode = operation.bookCode;
+                    operation.handOff.sede = sede;
+                    operation.handOff.patron = PQgetvalue(row, 0, 3);
+                    operation.handOff.dueDate = PQgetvalue(row, 0, 5);
+                    operation.handOff.returnOperationId = operation.operationId;
+                    operation.handOff.loanOperationId = std::stoll(PQgetvalue(row, 0, 6));
+                    overdueTracker.track(std::stoi(PQgetvalue(row, 0, 4)), operation.bookCode, sede, operation.handOff.dueDate);
+                }
+            }
+        }
+    }
+
+    //The connection is lost or out of sync: everything on the wire fails and
+    //the next submission reconnects
+    void failInFlight(const std::string &errorMessage, zmq::socket_t &completionSocket){
+        std::cerr << "[GA-Pipeline] " << errorMessage << "\n";
+        for(PipelineOperation &operation : inFlightOperations){
+            complete(operation, errorMessage, 0, ReservationHandOff(), completionSocket);
+        }
+        inFlightOperations.clear();
+        connect();
+    }
+
+    std::string connectionString;
+    OverdueTracker &overdueTracker;
+    zmq::context_t &zmqContext;
+    std::string completionEndpoint;
+
+    PGconn *connection = nullptr;
+    int wakeDescriptor = -1;
+    std::atomic<bool> running{true};
+    std::thread executorThread;
+
+    std::mutex queueMutex;
+    std::deque<PipelineOperation> queuedOperations;
+    std::mutex drainMutex;
+    std::condition_variable drainCondition;
+    std::size_t outstandingOperations = 0;
+    std::deque<PipelineOperation> inFlightOperations;
+    std::uint64_t expiredOperationCount = 0;
+};
@@ -0,0 +1,515 @@
+#include <pqxx/pqxx>
+#include <postgresql/libpq-fe.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+//The original GA storage: libros, estados, reservas and operation_log in Postgres, with
+//one connection opened per operation
+class PostgresBackend : public StorageBackend{
+public:
+    PostgresBackend(const std::string &dbConnectionString, OverdueTracker &tracker, StatementProfiler &statementProfiler)
+        : connectionString(dbConnectionString), overdueTracker(tracker), profiler(statementProfiler){}
+
+    std::string loan(int bookCode, int locationId, const std::string &requestKey, const OperationOrigin &origin) override{
+        return lendCopy(bookCode, locationId, "", requestKey, origin);
+    }
+
+    std::string lendReserved(int bookCode, int locationId, const std::string &patron, const OperationOrigin &origin) override{
+        return lendCopy(bookCode, locationId, patron, "", origin);
+    }
+
+    std::size_t reserve(int bookCode, int locationId, const std::string &patron) override{
+        int actualSede = locationId + 1;
+        pqxx::connection dbConnection(connectionString);
+        pqxx::work transaction(dbConnection);
+        pqxx::result waitlistQuery = profiledExec(profiler, transaction, "reserve.waitlist",
+            "SELECT patron FROM reservas "
+            "WHERE codigo = " + transaction.quote(bookCode) + " AND sede = " + transaction.quote(actualSede) + " "
+            "ORDER BY id "
+            "FOR UPDATE"
+        );
+        std::size_t waitingCount = std::size_t(waitlistQuery.size());
+        for(std::size_t position = 0; position < waitingCount; position++){
+            if(waitlistQuery[int(position)][0].as<std::string>() == patron){
+                transaction.abort();
+                return position + 1;
+            }
+        }
+        if(waitingCount >= maxWaitingPatrons){
+            transaction.abort();
+            return 0;
+        }
+        profiledExec(profiler, transaction, "reserve.insert",
+            "INSERT INTO reservas (codigo, sede, patron) "
+            "VALUES (" + transaction.quote(bookCode) + ", " + transaction.quote(actualSede) + ", " + transaction.quote(patron) + ")"
+        );
+        profiledCommit(profiler, transaction, "reserve.commit");
+        return waitingCount + 1;
+    }
+
+    std::string renew(int bookCode, int locationId, const std::string &requestKey, const OperationOrigin &origin) override{
+        int actualSede = locationId + 1;
+        try{
+            auto connectStart = std::chrono::steady_clock::now();
+            pqxx::connection dbConnection(connectionString);
+            profiler.record("connect", "", std::chrono::steady_clock::now() - connectStart);
+            pqxx::work transaction(dbConnection);
+
+            std::string appliedResult;
+            if (findAppliedRequest(transaction, requestKey, appliedResult)) {
+                transaction.abort();
+                return appliedResult;
+            }
+
+            pqxx::result loanQuery = profiledExec(profiler, transaction, "renewal.loan_lookup",
+                "SELECT e.id_estado, e.renovaciones "
+                "FROM estados e "
+                "JOIN libros l ON l.id_libro = e.id_libro "
+                "WHERE l.codigo = " + transaction.quote(bookCode) +
+                " AND e.sede = " + transaction.quote(actualSede) +
+                " AND e.tipo_operacion = 'prestamo' "
+                " AND NOT EXISTS ( "
+                "     SELECT 1 FROM estados e3 "
+                "     WHERE e3.id_libro = e.id_libro "
+                "     AND e3.tipo_operacion = 'devuelto' "
+                "     AND e3.fecha_operacion > e.fecha_operacion "
+                " )"
+                " ORDER BY e.renovaciones ASC, e.fecha_operacion ASC "
+                " LIMIT 1"
+            );
+
+            if (loanQuery.empty()) {
+                transaction.abort();
+                return "Error: No active loan found for this book at this location";
+            }
+
+            int stateId = loanQuery[0]["id_estado"].as<int>();
+            int renewalCount = loanQuery[0]["renovaciones"].as<int>();
+
+            if (renewalCount >= 2){
+                transaction.abort();
+                return "Error: Maximum renewal limit reached (2)";
+            }
+
+            pqxx::result renewalResult = profiledExec(profiler, transaction, "renewal.estados_update",
+                "UPDATE estados "
+                "SET renovaciones = renovaciones + 1, "
+                "    fecha_devolucion_prevista = fecha_devolucion_prevista + INTERVAL '7 days' "
+                "WHERE id_estado = " + transaction.quote(stateId) + " "
+                "RETURNING fecha_devolucion_prevista::date"
+            );
+
+            std::string operationResult = "Loan renewed successfully for 7 additional days";
+            recordAppliedRequest(transaction, requestKey, operationResult);
+            countUsage(transaction, bookCode, actualSede, "renovaciones", "renewal.usage_upsert");
+
+            profiledCommit(profiler, transaction, "renewal.commit");
+            overdueTracker.reschedule(stateId, renewalResult[0][0].as<std::string>());
+            logOperation(1, bookCode, locationId, origin, dbConnection);
+            return operationResult;
+        }
+        catch (const std::exception &error){
+            return std::string("Database error: ") + error.what();
+        }
+    }
+
+    std::string returnLoan(int bookCode, int locationId, const std::string &requestKey, const OperationOrigin &origin,
+                           ReservationHandOff &handOff) override{
+        int actualSede = locationId + 1;
+
+        try {
+            auto connectStart = std::chrono::steady_clock::now();
+            pqxx::connection dbConnection(connectionString);
+            profiler.record("connect", "", std::chrono::steady_clock::now() - connectStart);
+            pqxx::work transaction(dbConnection);
+
+            std::string appliedResult;
+            if (findAppliedRequest(transaction, requestKey, appliedResult)) {
+                transaction.abort();
+                return appliedResult;
+            }
+
+            pqxx::result loanQuery = profiledExec(profiler, transaction, "return.loan_lookup",
+                "SELECT e.id_estado, e.id_libro "
+                "FROM estados e "
+                "JOIN libros l ON l.id_libro = e.id_libro "
+                "WHERE l.codigo = " + transaction.quote(bookCode) +
+                " AND e.sede = " + transaction.quote(actualSede) +
+                " AND e.tipo_operacion = 'prestamo' "
+                "ORDER BY e.renovaciones DESC, e.fecha_operacion DESC "
+                "LIMIT 1"
+            );
+
+            if (loanQuery.empty()) {
+                transaction.abort();
+                return "Error: No active loan found for this book at this location";
+            }
+
+            int stateId = loanQuery[0]["id_estado"].as<int>();
+            int bookId = loanQuery[0]["id_libro"].as<int>();
+
+            profiledExec(profiler, transaction, "return.estados_update",
+                "UPDATE estados "
+                "SET tipo_operacion = 'devuelto' "
+                "WHERE id_estado = " + transaction.quote(stateId)
+            );
+
+            std::string examplesColumn = (actualSede == 1) ? "ejemplares_sede1" : "ejemplares_sede2";
+            profiledExec(profiler, transaction, "return.libros_update",
+                "UPDATE libros "
+                "SET " + examplesColumn + " = " + examplesColumn + " + 1 "
+                "WHERE id_libro = " + transaction.quote(bookId)
+            );
+
+            std::string operationResult = "Return successful. Copy available again";
+            recordAppliedRequest(transaction, requestKey, operationResult);
+            countUsage(transaction, bookCode, actualSede, "devoluciones", "return.usage_upsert");
+            int handOffStateId = origin.replicated ? 0 : lendToWaitlistHead(transaction, bookId, bookCode, actualSede, handOff);
+
+            profiledCommit(profiler, transaction, "return.commit");
+            overdueTracker.release(stateId);
+            logOperation(2, bookCode, locationId, origin, dbConnection);
+            if (handOffStateId != 0) {
+                handOff.returnOperationId = lastLoggedId;
+                overdueTracker.track(handOffStateId, bookCode, actualSede, handOff.dueDate);
+                logOperation(0, bookCode, locationId, origin, dbConnection);
+                handOff.loanOperationId = lastLoggedId;
+            }
+            return operationResult;
+        }
+        catch (const std::exception &error) {
+            return std::string("Database error: ") + error.what();
+        }
+    }
+
+    BulkResult applyBulk(const Request *operations, std::size_t operationCount, const OperationOrigin &origin, bool allOrNothing) override{
+        PGconn *connection = PQconnectdb(connectionString.c_str());
+        if(PQstatus(connection) != CONNECTION_OK){
+            std::string connectionError = PQerrorMessage(connection);
+            PQfinish(connection);
+            throw std::runtime_error(connectionError);
+        }
+        BulkResult bulkResult = processBulkRequest(operations, operationCount, connection, overdueTracker, origin, allOrNothing);
+        PQfinish(connection);
+
+        if(bulkResult.lastOperationId > 0){
+            lastLoggedId = bulkResult.lastOperationId;
+        }
+        if(!bulkResult.handOffs.empty()){
+            lastLoggedId = bulkResult.handOffs.back().loanOperationId;
+        }
+        return bulkResult;
+    }
+
+    std::int64_t lastOperation() override{
+        return lastLoggedId;
+    }
+
+    std::int64_t lastStoredOperation() override{
+        pqxx::connection dbConnection(connectionString);
+        pqxx::work transaction(dbConnection);
+        pqxx::result queryResult = transaction.exec("SELECT COALESCE(MAX(id), 0) FROM operation_log");
+        transaction.commit();
+
+        std::int64_t lastId = queryResult[0][0].as<std::int64_t>();
+        for(const std::string &path : listSegmentFiles()){
+            lastId = std::max(lastId, segmentLastId(path));
+        }
+        return lastId;
+    }
+
+    std::vector<OperationLogEntry> readOperations(std::int64_t afterId, std::size_t limit) override{
+        pqxx::connection dbConnection(connectionString);
+        return readOperationLog(dbConnection, afterId, limit);
+    }
+
+    //Only the live partitions are read: archived segments do not keep the
+    //origin, so a peer that fell behind the archive has to be bootstrapped
+    std::vector<OperationLogEntry> readServedOperations(std::int64_t afterId, std::size_t limit) override{
+        pqxx::connection dbConnection(connectionString);
+        pqxx::work transaction(dbConnection);
+        pqxx::result logQuery = transaction.exec(
+            "SELECT id, request_type, code, location, "
+            "(EXTRACT(EPOCH FROM timestamp) * 1000000)::bigint "
+            "FROM operation_log "
+            "WHERE origin_site = 0 AND id > " + transaction.quote(afterId) + " "
+            "ORDER BY id "
+            "LIMIT " + transaction.quote(std::int64_t(limit))
+        );
+        transaction.commit();
+
+        std::vector<OperationLogEntry> entries;
+        for(const auto &logRow : logQuery){
+            entries.push_back(OperationLogEntry{
+                logRow[0].as<std::int64_t>(), logRow[1].as<std::int32_t>(), logRow[2].as<std::int32_t>(),
+                logRow[3].as<std::int32_t>(), logRow[4].as<std::int64_t>()
+            });
+        }
+        return entries;
+    }
+
+    std::int64_t lastReplicatedOperation(int originSite) override{
+        pqxx::connection dbConnection(connectionString);
+        pqxx::work transaction(dbConnection);
+        pqxx::result queryResult = transaction.exec(
+            "SELECT COALESCE(MAX(origin_id), 0) FROM operation_log WHERE origin_site = " + transaction.quote(originSite)
+        );
+        transaction.commit();
+        return queryResult[0][0].as<std::int64_t>();
+    }
+
+    std::vector<CatalogRecord> readCatalog() override{
+        pqxx::connection dbConnection(connectionString);
+        pqxx::work transaction(dbConnection);
+        pqxx::result catalogQuery = transaction.exec(
+            "SELECT codigo, titulo, autor, ejemplares_sede1, ejemplares_sede2 FROM libros ORDER BY codigo"
+        );
+        transaction.commit();
+
+        std::vector<CatalogRecord> catalog;
+        catalog.reserve(catalogQuery.size());
+        for(const auto &bookRow : catalogQuery){
+            catalog.push_back(CatalogRecord{
+                bookRow[0].as<int>(), bookRow[1].as<std::string>(), bookRow[2].as<std::string>(),
+                {bookRow[3].as<int>(), bookRow[4].as<int>()}
+            });
+        }
+        return catalog;
+    }
+
+    //Reads uso_diario only; its primary key starts with dia, so the cost
+    //follows the rows in the range and not the size of estados
+    std::vector<UsageRow> readUsage(int fromDay, int toDay) override{
+        pqxx::connection dbConnection(connectionString);
+        pqxx::work transaction(dbConnection);
+        pqxx::result usageQuery = transaction.exec(
+            "SELECT dia::text, codigo, sede, prestamos, renovaciones, devoluciones "
+            "FROM uso_diario "
+            "WHERE dia BETWEEN " + transaction.quote(dateFromDayNumber(fromDay)) + " AND " + transaction.quote(dateFromDayNumber(toDay))
+        );
+        transaction.commit();
+
+        std::vector<UsageRow> usageRows;
+        usageRows.reserve(usageQuery.size());
+        for(const auto &usageRow : usageQuery){
+            usageRows.push_back(UsageRow{
+                dayNumberFromDate(usageRow[0].as<std::string>()), usageRow[1].as<int>(), usageRow[2].as<int>(),
+                {usageRow[3].as<std::int64_t>(), usageRow[4].as<std::int64_t>(), usageRow[5].as<std::int64_t>()}
+            });
+        }
+        return usageRows;
+    }
+
+    void trackActiveLoans() override{
+        try {
+            pqxx::connection dbConnection(connectionString);
+            pqxx::work transaction(dbConnection);
+            pqxx::result loanQuery = transaction.exec(
+                "SELECT e.id_estado, l.codigo, e.sede, e.fecha_devolucion_prevista "
+                "FROM estados e "
+                "JOIN libros l ON l.id_libro = e.id_libro "
+                "WHERE e.tipo_operacion = 'prestamo' "
+                "AND e.fecha_devolucion_prevista IS NOT NULL"
+            );
+            transaction.commit();
+
+            for(const auto &loanRow : loanQuery){
+                overdueTracker.track(loanRow[0].as<int>(), loanRow[1].as<int>(), loanRow[2].as<int>(), loanRow[3].as<std::string>());
+            }
+            overdueTracker.advance(currentDayNumber());
+            std::cout << "[GA-Overdue] Tracking " << loanQuery.size() << " active loans\n";
+        } catch(const std::exception &error){
+            std::cerr << "[GA-Overdue] Could not load active loans: " << error.what() << "\n";
+        }
+    }
+
+private:
+    //A loan, and with a patron also the removal of that patron's reservation
+    //in the same transaction
+    std::string lendCopy(int bookCode, int locationId, const std::string &patron, const std::string &requestKey, const OperationOrigin &origin){
+        int actualSede = locationId + 1;
+        std::string examplesColumn = (actualSede == 1) ? "ejemplares_sede1" : "ejemplares_sede2";
+
+        try{
+            auto connectStart = std::chrono::steady_clock::now();
+            pqxx::connection dbConnection(connectionString);
+            profiler.record("connect", "", std::chrono::steady_clock::now() - connectStart);
+            pqxx::work transaction(dbConnection);
+
+            std::string appliedResult;
+            if (findAppliedRequest(transaction, requestKey, appliedResult)) {
+                transaction.abort();
+                return appliedResult;
+            }
+
+            pqxx::result bookQuery = profiledExec(profiler, transaction, "loan.book_lookup",
+                "SELECT id_libro, " + examplesColumn + " "
+                "FROM libros "
+                "WHERE codigo = " + transaction.quote(bookCode)
+            );
+
+            if (bookQuery.empty()) {
+                transaction.abort();
+                return "Error: Book does not exist";
+            }
+
+            int bookId = bookQuery[0]["id_libro"].as<int>();
+            int availableExamples = bookQuery[0][examplesColumn].as<int>();
+
+            if (availableExamples <= 0) {
+                transaction.abort();
+                return "Error: No available copies of this book";
+            }
+
+            profiledExec(profiler, transaction, "loan.libros_update",
+                "UPDATE libros "
+                "SET " + examplesColumn + " = " + examplesColumn + " - 1 "
+                "WHERE id_libro = " + transaction.quote(bookId)
+            );
+
+            pqxx::result insertResult = profiledExec(profiler, transaction, "loan.estados_insert",
+                "INSERT INTO estados (id_libro, tipo_operacion, fecha_operacion, fecha_devolucion_prevista, sede, renovaciones) "
+                "VALUES (" +
+                    transaction.quote(bookId) + ", " +
+                    transaction.quote("prestamo") + ", " +
+                    "NOW(), " +
+                    "(NOW() + interval '14 days')::date, " +
+                    transaction.quote(actualSede) + ", " +
+                    "0" +
+                ") "
+                "RETURNING id_estado, fecha_devolucion_prevista"
+            );
+
+            int stateId = insertResult[0]["id_estado"].as<int>();
+            std::string returnDate = insertResult[0]["fecha_devolucion_prevista"].as<std::string>();
+
+            std::string operationResult = "Loan successful. Return date: " + returnDate;
+            recordAppliedRequest(transaction, requestKey, operationResult);
+            countUsage(transaction, bookCode, actualSede, "prestamos", "loan.usage_upsert");
+            if (!patron.empty()) {
+                profiledExec(profiler, transaction, "loan.reservation_delete",
+                    "DELETE FROM reservas "
+                    "WHERE codigo = " + transaction.quote(bookCode) +
+                    " AND sede = " + transaction.quote(actualSede) +
+                    " AND patron = " + transaction.quote(patron)
+                );
+            }
+            profiledCommit(profiler, transaction, "loan.commit");
+            overdueTracker.track(stateId, bookCode, actualSede, returnDate);
+            logOperation(0, bookCode, locationId, origin, dbConnection);
+            return operationResult;
+        }
+        catch (const std::exception &error){
+            return std::string("Database error: ") + error.what();
+        }
+    }
+
+    //Lends the copy a return just put back to the oldest reservation of the
+    //book at the site, inside the return's transaction. Returns the new
+    //loan's id_estado, 0 when nobody is waiting.
+    int lendToWaitlistHead(pqxx::work &transaction, int bookId, int bookCode, int sede, ReservationHandOff &handOff){
+        pqxx::result headQuery = profiledExec(profiler, transaction, "return.reservation_pop",
+            "DELETE FROM reservas "
+            "WHERE id = ( "
+            "    SELECT id FROM reservas "
+            "    WHERE codigo = " + transaction.quote(bookCode) + " AND sede = " + transaction.quote(sede) + " "
+            "    ORDER BY id "
+            "    LIMIT 1 "
+            "    FOR UPDATE "
+            ") "
+            "RETURNING patron"
+        );
+        if(headQuery.empty()){
+            return 0;
+        }
+
+        std::string examplesColumn = (sede == 1) ? "ejemplares_sede1" : "ejemplares_sede2";
+        profiledExec(profiler, transaction, "return.hand_off_libros_update",
+            "UPDATE libros "
+            "SET " + examplesColumn + " = " + examplesColumn + " - 1 "
+            "WHERE id_libro = " + transaction.quote(bookId)
+        );
+        pqxx::result insertResult = profiledExec(profiler, transaction, "return.hand_off_estados_insert",
+            "INSERT INTO estados (id_libro, tipo_operacion, fecha_operacion, fecha_devolucion_prevista, sede, renovaciones) "
+            "VALUES (" + transaction.quote(bookId) + ", 'prestamo', NOW(), (NOW() + interval '14 days')::date, " + transaction.quote(sede) + ", 0) "
+            "RETURNING id_estado, fecha_devolucion_prevista"
+        );
+        countUsage(transaction, bookCode, sede, "prestamos", "return.hand_off_usage_upsert");
+
+        handOff.bookCode = bookCode;
+        handOff.sede = sede;
+        handOff.patron = headQuery[0][0].as<std::string>();
+        handOff.dueDate = insertResult[0]["fecha_devolucion_prevista"].as<std::string>();
+        return insertResult[0]["id_estado"].as<int>();
+    }
+
+    bool findAppliedRequest(pqxx::work &transaction, const std::string &requestKey, std::string &appliedResult){
+        if(requestKey.empty()){
+            return false;
+        }
+        pqxx::result appliedQuery = profiledExec(profiler, transaction, "applied.lookup",
+            "SELECT result FROM applied_requests WHERE request_key = " + transaction.quote(requestKey)
+        );
+        if(appliedQuery.empty()){
+            return false;
+        }
+        appliedResult = appliedQuery[0][0].as<std::string>();
+        return true;
+    }
+
+    //Adds the operation to today's rollup inside the operation's transaction,
+    //so the counters never disagree with what was committed
+    void countUsage(pqxx::work &transaction, int bookCode, int sede, const std::string &counterColumn, const char *statementName){
+        profiledExec(profiler, transaction, statementName,
+            "INSERT INTO uso_diario (dia, codigo, sede, " + counterColumn + ") "
+            "VALUES (CURRENT_DATE, " + transaction.quote(bookCode) + ", " + transaction.quote(sede) + ", 1) "
+            "ON CONFLICT (dia, codigo, sede) DO UPDATE SET " + counterColumn + " = uso_diario." + counterColumn + " + 1"
+        );
+    }
+
+    void recordAppliedRequest(pqxx::work &transaction, const std::string &requestKey, const std::string &operationResult){
+        if(requestKey.empty()){
+            return;
+        }
+        profiledExec(profiler, transaction, "applied.insert",
+            "INSERT INTO applied_requests (request_key, result) "
+            "VALUES (" + transaction.quote(requestKey) + ", " + transaction.quote(operationResult) + ")"
+        );
+        //A writer sends a key only once every lower sequence of its epoch was
+        //answered, so those are never asked about again
+        profiledExec(profiler, transaction, "applied.prune",
+            "DELETE FROM applied_requests "
+            "WHERE request_key >= rpad(left(" + transaction.quote(requestKey) + ", 16), 32, '0') "
+            "AND request_key < " + transaction.quote(requestKey)
+        );
+    }
+
+    void logOperation(int requestType, int bookCode, int locationId, const OperationOrigin &origin, pqxx::connection &dbConnection){
+        try {
+            pqxx::work transaction(dbConnection);
+            profiledExec(profiler, transaction, "log.insert",
+                "INSERT INTO operation_log (request_type, code, location, timestamp, origin_site, origin_id) "
+                "VALUES (" +
+                    transaction.quote(requestType) + ", " +
+                    transaction.quote(bookCode) + ", " +
+                    transaction.quote(locationId) + ", " +
+                    "NOW(), " +
+                    transaction.quote(origin.site) + ", " +
+                    transaction.quote(origin.operationId) +
+                ")"
+            );
+            pqxx::result queryResult = profiledExec(profiler, transaction, "log.lastval", "SELECT lastval()");
+            lastLoggedId = queryResult[0][0].as<std::int64_t>();
+            profiledCommit(profiler, transaction, "log.commit");
+        } catch(const std::exception &error){
+            std::cerr << "[GA-Log] Error: " << error.what() << "\n";
+        }
+    }
+
+    std::string connectionString;
+    OverdueTracker &overdueTracker;
+    StatementProfiler &profiler;
+    std::int64_t lastLoggedId = 0;
+};
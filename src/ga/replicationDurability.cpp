@@ -0,0 +1,357 @@
+#include <zmq.hpp>
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+//When the primary answers a write: right after its own commit, once the
+//replica has received the operation, or once the replica has committed it
+enum struct DurabilityMode{
+    ASYNC,
+    SEMI_SYNC,
+    SYNC
+};
+
+//What a replica acknowledges, pushed to port 5567 of the GA it replicates
+enum struct ReplicaAckStage : std::uint8_t{
+    RECEIVED,
+    COMMITTED
+};
+
+struct ReplicaAck{
+    std::int64_t operationId;
+    ReplicaAckStage stage;
+};
+
+const int durabilityModeCount = 3;
+const int defaultDurabilityTimeoutMs = 1000;
+//Published operations kept for latency until the replica acknowledges them;
+//older ones are forgotten while the replica is away
+const std::size_t maxTrackedOperations = 100000;
+//Same buckets as the statement profiler: 2^(i+1) microseconds
+const int ackBucketCount = 25;
+
+const char *durabilityModeName(DurabilityMode mode){
+    switch(mode){
+        case DurabilityMode::SEMI_SYNC: return "semi-sync";
+        case DurabilityMode::SYNC: return "sync";
+        default: return "async";
+    }
+}
+
+bool parseDurabilityMode(const std::string &text, DurabilityMode &mode){
+    for(int modeIndex = 0; modeIndex < durabilityModeCount; modeIndex++){
+        if(text == durabilityModeName(DurabilityMode(modeIndex))){
+            mode = DurabilityMode(modeIndex);
+            return true;
+        }
+    }
+    return false;
+}
+
+//Mode of each request type; "--durability sync" sets every write,
+//"--durability RETURN=semi-sync" a single one, later arguments win
+class DurabilityPolicy{
+public:
+    bool configure(const std::string &argument){
+        std::size_t separator = argument.find('=');
+        DurabilityMode mode;
+        if(separator == std::string::npos){
+            if(!parseDurabilityMode(argument, mode)){
+                return false;
+            }
+            for(DurabilityMode &typeMode : modeByType){
+                typeMode = mode;
+            }
+            return true;
+        }
+        static const char *writeTypeNames[] = {"LOAN", "RENEWAL", "RETURN", "", "BULK", "", "", "CHECKOUT"};
+        std::string typeName = argument.substr(0, separator);
+        for(int requestType = 0; requestType < 8; requestType++){
+            if(!typeName.empty() && typeName == writeTypeNames[requestType]){
+                return parseDurabilityMode(argument.substr(separator + 1), modeByType[requestType]);
+            }
+        }
+        return false;
+    }
+
+    DurabilityMode modeFor(int requestType) const{
+        return requestType >= 0 && requestType < 8 ? modeByType[requestType] : DurabilityMode::ASYNC;
+    }
+
+    std::string describe() const{
+        static const char *writeTypeNames[] = {"LOAN", "RENEWAL", "RETURN", "BULK", "CHECKOUT"};
+        static const int writeTypes[] = {0, 1, 2, 4, 7};
+        std::string description;
+        for(int position = 0; position < 5; position++){
+            description += std::string(position == 0 ? "" : " ") + writeTypeNames[position] + "=" +
+                           durabilityModeName(modeByType[writeTypes[position]]);
+        }
+        return description;
+    }
+
+private:
+    DurabilityMode modeByType[8] = {DurabilityMode::ASYNC, DurabilityMode::ASYNC, DurabilityMode::ASYNC, DurabilityMode::ASYNC,
+                                    DurabilityMode::ASYNC, DurabilityMode::ASYNC, DurabilityMode::ASYNC, DurabilityMode::ASYNC};
+};
+
+struct AckLatencyStats{
+    std::uint64_t count = 0;
+    std::uint64_t totalMicros = 0;
+    std::uint64_t maxMicros = 0;
+    std::uint64_t buckets[ackBucketCount] = {};
+};
+
+struct DurabilityStats{
+    std::uint64_t published = 0;
+    std::uint64_t waited = 0;
+    std::uint64_t timedOut = 0;
+    //Answered without waiting because the replica was already behind
+    std::uint64_t degraded = 0;
+    AckLatencyStats received;
+    AckLatencyStats committed;
+};
+
+//Collects the replica's acknowledgements on the primary. Every published
+//operation is timed from the local commit to the replica's receive and
+//commit acks, whatever its mode, so the report shows what each mode costs
+//and how far behind an async reply the replica is. A write that waits and
+//times out is answered anyway and the GA stops waiting until the replica
+//catches up with it, rather than stalling every client on a dead replica.
+class ReplicaAckTracker{
+public:
+    ~ReplicaAckTracker(){
+        stop();
+    }
+
+    void start(zmq::context_t &context, const std::string &ackEndpoint, int timeoutMs){
+        ackTimeout = std::chrono::milliseconds(timeoutMs);
+        collecting = true;
+        collectorThread = std::thread(&ReplicaAckTracker::collectLoop, this, std::ref(context), ackEndpoint);
+    }
+
+    void stop(){
+        collecting = false;
+        if(collectorThread.joinable()){
+            collectorThread.join();
+        }
+    }
+
+    //Called after operationId has gone out on the replication socket
+    void notePublished(std::int64_t operationId, DurabilityMode mode){
+        std::lock_guard<std::mutex> lock(ackMutex);
+        statsByMode[int(mode)].published++;
+        if(!trackedOperations.empty() && trackedOperations.back().operationId >= operationId){
+            return;
+        }
+        if(trackedOperations.size() == maxTrackedOperations){
+            trackedOperations.pop_front();
+        }
+        trackedOperations.push_back(TrackedOperation{operationId, mode, std::chrono::steady_clock::now(), false});
+    }
+
+    bool isAcknowledged(std::int64_t operationId, DurabilityMode mode){
+        std::lock_guard<std::mutex> lock(ackMutex);
+        return acknowledgedLocked(operationId, mode);
+    }
+
+    //True when a reply for operationId has to be held back for the replica
+    bool mustWait(std::int64_t operationId, DurabilityMode mode){
+        std::lock_guard<std::mutex> lock(ackMutex);
+        if(mode == DurabilityMode::ASYNC || acknowledgedLocked(operationId, mode)){
+            return false;
+        }
+        if(degradedUntil > 0){
+            statsByMode[int(mode)].degraded++;
+            return false;
+        }
+        statsByMode[int(mode)].waited++;
+        return true;
+    }
+
+    //A held-back reply went out without its ack
+    void noteTimeout(std::int64_t operationId, DurabilityMode mode){
+        std::lock_guard<std::mutex> lock(ackMutex);
+        statsByMode[int(mode)].timedOut++;
+        if(degradedUntil == 0){
+            std::cerr << "[GA-Durability] No " << (mode == DurabilityMode::SYNC ? "commit" : "receive") << " ack for operation #"
+                      << operationId << " in " << ackTimeout.count() << " ms, answering without the replica until it catches up\n";
+        }
+        degradedUntil = std::max(degradedUntil, operationId);
+    }
+
+    //Blocks the caller until the replica acknowledges operationId at the
+    //stage mode needs, or the timeout passes
+    void await(std::int64_t operationId, DurabilityMode mode){
+        if(!mustWait(operationId, mode)){
+            return;
+        }
+        std::unique_lock<std::mutex> lock(ackMutex);
+        bool acknowledged = ackSignal.wait_for(lock, ackTimeout, [&]{ return acknowledgedLocked(operationId, mode); });
+        lock.unlock();
+        if(!acknowledged){
+            noteTimeout(operationId, mode);
+        }
+    }
+
+    std::chrono::milliseconds timeout() const{
+        return ackTimeout;
+    }
+
+    //One line per mode: operations published, replies that waited, timeouts,
+    //and the commit-to-ack latency of the receive and commit acks
+    std::string report(const DurabilityPolicy &policy){
+        std::lock_guard<std::mutex> lock(ackMutex);
+        std::string durabilityReport = "DURABILITY " + policy.describe() + ", timeout " + std::to_string(ackTimeout.count()) +
+                                       " ms, replica received #" + std::to_string(receivedUpTo) + " committed #" +
+                                       std::to_string(committedUpTo) + (degradedUntil > 0 ? ", degraded to async" : "");
+        for(int modeIndex = 0; modeIndex < durabilityModeCount; modeIndex++){
+            const DurabilityStats &stats = statsByMode[modeIndex];
+            char line[320];
+            std::snprintf(line, sizeof(line), "\n%-9s published %llu  waited %llu  timed out %llu  degraded %llu",
+                          durabilityModeName(DurabilityMode(modeIndex)), (unsigned long long)stats.published,
+                          (unsigned long long)stats.waited, (unsigned long long)stats.timedOut, (unsigned long long)stats.degraded);
+            durabilityReport += line + formatLatency("received", stats.received) + formatLatency("committed", stats.committed);
+        }
+        return durabilityReport;
+    }
+
+private:
+    struct TrackedOperation{
+        std::int64_t operationId;
+        DurabilityMode mode;
+        std::chrono::steady_clock::time_point publishedAt;
+        bool receivedTimed;
+    };
+
+    bool acknowledgedLocked(std::int64_t operationId, DurabilityMode mode) const{
+        return mode == DurabilityMode::ASYNC || (mode == DurabilityMode::SEMI_SYNC ? receivedUpTo : committedUpTo) >= operationId;
+    }
+
+    static void recordLatency(AckLatencyStats &stats, std::chrono::steady_clock::duration elapsed){
+        std::uint64_t micros = std::uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        int bucket = 0;
+        while(bucket < ackBucketCount - 1 && micros >= (std::uint64_t(2) << bucket)){
+            bucket++;
+        }
+        stats.count++;
+        stats.totalMicros += micros;
+        stats.maxMicros = std::max(stats.maxMicros, micros);
+        stats.buckets[bucket]++;
+    }
+
+    static double percentileMs(const AckLatencyStats &stats, double fraction){
+        std::uint64_t rank = std::uint64_t(fraction * (stats.count - 1)) + 1;
+        std::uint64_t seen = 0;
+        for(int bucket = 0; bucket < ackBucketCount; bucket++){
+            seen += stats.buckets[bucket];
+            if(seen >= rank){
+                return std::min(double(std::uint64_t(2) << bucket), double(stats.maxMicros)) / 1000.0;
+            }
+        }
+        return stats.maxMicros / 1000.0;
+    }
+
+    static std::string formatLatency(const char *stageName, const AckLatencyStats &stats){
+        if(stats.count == 0){
+            return std::string("\n    ") + stageName + ": no acks";
+        }
+        char line[256];
+        std::snprintf(line, sizeof(line), "\n    %-9s acks %llu  mean %.2f ms  p50 %.2f ms  p99 %.2f ms  max %.2f ms", stageName,
+                      (unsigned long long)stats.count, stats.totalMicros / 1000.0 / stats.count, percentileMs(stats, 0.50),
+                      percentileMs(stats, 0.99), stats.maxMicros / 1000.0);
+        return line;
+    }
+
+    //Acks only move forward: the replica applies in the primary's order, so
+    //an ack for an id covers every id before it
+    void applyAck(const ReplicaAck &ack){
+        std::lock_guard<std::mutex> lock(ackMutex);
+        auto now = std::chrono::steady_clock::now();
+        if(ack.stage == ReplicaAckStage::RECEIVED){
+            receivedUpTo = std::max(receivedUpTo, ack.operationId);
+        } else {
+            committedUpTo = std::max(committedUpTo, ack.operationId);
+            receivedUpTo = std::max(receivedUpTo, ack.operationId);
+        }
+        for(TrackedOperation &operation : trackedOperations){
+            if(operation.operationId > receivedUpTo){
+                break;
+            }
+            if(!operation.receivedTimed){
+                recordLatency(statsByMode[int(operation.mode)].received, now - operation.publishedAt);
+                operation.receivedTimed = true;
+            }
+        }
+        while(!trackedOperations.empty() && trackedOperations.front().operationId <= committedUpTo){
+            recordLatency(statsByMode[int(trackedOperations.front().mode)].committed, now - trackedOperations.front().publishedAt);
+            trackedOperations.pop_front();
+        }
+        if(degradedUntil > 0 && committedUpTo >= degradedUntil){
+            std::cout << "[GA-Durability] Replica caught up at operation #" << committedUpTo << ", waiting for acks again\n";
+            degradedUntil = 0;
+        }
+    }
+
+    void collectLoop(zmq::context_t &context, const std::string ackEndpoint){
+        zmq::socket_t ackSocket(context, zmq::socket_type::pull);
+        ackSocket.set(zmq::sockopt::rcvtimeo, 250);
+        ackSocket.bind(ackEndpoint);
+        std::cout << "[GA-Durability] Collecting replica acks on " << ackEndpoint << std::endl;
+
+        while(collecting){
+            zmq::message_t ackMessage;
+            if(!ackSocket.recv(ackMessage, zmq::recv_flags::none) || ackMessage.size() != sizeof(ReplicaAck)){
+                continue;
+            }
+            ReplicaAck ack;
+            memcpy(&ack, ackMessage.data(), sizeof(ack));
+            applyAck(ack);
+            ackSignal.notify_all();
+        }
+    }
+
+    std::mutex ackMutex;
+    std::condition_variable ackSignal;
+    std::deque<TrackedOperation> trackedOperations;
+    DurabilityStats statsByMode[durabilityModeCount];
+    std::int64_t receivedUpTo = 0;
+    std::int64_t committedUpTo = 0;
+    //Id of the last write that timed out; 0 while the replica keeps up
+    std::int64_t degradedUntil = 0;
+    std::chrono::milliseconds ackTimeout{defaultDurabilityTimeoutMs};
+    std::atomic<bool> collecting{false};
+    std::thread collectorThread;
+};
+
+//Replica side: pushes receive and commit acks to the GA it replicates. The
+//reactor acks on receipt and the replication lane on commit, so the socket
+//is shared behind a mutex.
+class ReplicaAckSender{
+public:
+    ReplicaAckSender(zmq::context_t &context, const std::string &ackEndpoint) : ackSocket(context, zmq::socket_type::push){
+        ackSocket.set(zmq::sockopt::linger, 0);
+        //Acks are cumulative, a later one stands for any dropped while the
+        //primary is away
+        ackSocket.set(zmq::sockopt::sndhwm, 1000);
+        ackSocket.connect(ackEndpoint);
+    }
+
+    void send(std::int64_t operationId, ReplicaAckStage stage){
+        if(operationId <= 0){
+            return;
+        }
+        ReplicaAck ack{operationId, stage};
+        std::lock_guard<std::mutex> lock(sendMutex);
+        ackSocket.send(zmq::buffer(&ack, sizeof(ack)), zmq::send_flags::dontwait);
+    }
+
+private:
+    std::mutex sendMutex;
+    zmq::socket_t ackSocket;
+};
@@ -0,0 +1,89 @@
+#include <string>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+
+const std::size_t maxWaitingPatrons = 100;
+const std::size_t maxPatronNameLength = 64;
+
+//A copy lent to a waiting patron, published on the events socket under the
+//topic "reservation:<patron>:"
+struct ReservationEvent{
+    std::string patron;
+    std::string message;
+};
+
+//A copy freed by a return and lent, in the return's own transaction, to the
+//patron at the head of the book's waitlist at the site
+struct ReservationHandOff{
+    int bookCode = 0;
+    int sede = 0;
+    std::string patron;
+    std::string dueDate;
+    //Log id of the return, when it was a single operation; a batch
+    //replicates its returns together
+    std::int64_t returnOperationId = 0;
+    std::int64_t loanOperationId = 0;
+};
+
+//Patron names travel inside a PUB topic, so ':' (the topic terminator) and
+//control characters are not allowed
+bool isValidPatronName(const std::string &patron){
+    if(patron.empty() || patron.size() > maxPatronNameLength){
+        return false;
+    }
+    return std::all_of(patron.begin(), patron.end(), [](char character){
+        return character != ':' && static_cast<unsigned char>(character) >= 0x20;
+    });
+}
+
+//A hand-off as one frame, "<loan id>|<return id>|<book>|<sede>|<due date>|<patron>",
+//for passing it between threads; empty when there is none. The patron goes
+//last, it may contain '|'.
+std::string encodeHandOff(const ReservationHandOff &handOff){
+    if(handOff.patron.empty()){
+        return "";
+    }
+    return std::to_string(handOff.loanOperationId) + "|" + std::to_string(handOff.returnOperationId) + "|" +
+           std::to_string(handOff.bookCode) + "|" + std::to_string(handOff.sede) + "|" + handOff.dueDate + "|" + handOff.patron;
+}
+
+bool decodeHandOff(const std::string &encoded, ReservationHandOff &handOff){
+    std::size_t fieldStarts[6] = {0};
+    for(int field = 1; field < 6; field++){
+        std::size_t separator = encoded.find('|', fieldStarts[field - 1]);
+        if(separator == std::string::npos){
+            return false;
+        }
+        fieldStarts[field] = separator + 1;
+    }
+    handOff.loanOperationId = std::stoll(encoded.substr(fieldStarts[0], fieldStarts[1] - fieldStarts[0] - 1));
+    handOff.returnOperationId = std::stoll(encoded.substr(fieldStarts[1], fieldStarts[2] - fieldStarts[1] - 1));
+    handOff.bookCode = std::stoi(encoded.substr(fieldStarts[2], fieldStarts[3] - fieldStarts[2] - 1));
+    handOff.sede = std::stoi(encoded.substr(fieldStarts[3], fieldStarts[4] - fieldStarts[3] - 1));
+    handOff.dueDate = encoded.substr(fieldStarts[4], fieldStarts[5] - fieldStarts[4] - 1);
+    handOff.patron = encoded.substr(fieldStarts[5]);
+    return !handOff.patron.empty();
+}
+
+//Hand-off notices waiting for the events publisher. The waitlists themselves
+//live in the storage backend, next to the loans they turn into.
+class ReservationEvents{
+public:
+    void notify(const std::string &patron, const std::string &message){
+        std::lock_guard<std::mutex> lock(eventMutex);
+        pendingEvents.push_back(ReservationEvent{patron, message});
+    }
+
+    std::vector<ReservationEvent> drainEvents(){
+        std::lock_guard<std::mutex> lock(eventMutex);
+        std::vector<ReservationEvent> drainedEvents;
+        drainedEvents.swap(pendingEvents);
+        return drainedEvents;
+    }
+
+private:
+    std::mutex eventMutex;
+    std::vector<ReservationEvent> pendingEvents;
+};
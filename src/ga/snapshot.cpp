@@ -0,0 +1,285 @@
+#include <zmq.hpp>
+#include <postgresql/libpq-fe.h>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <mutex>
+#include <map>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+//Tables shipped in a snapshot, in load order, with the columns copied
+const std::vector<std::pair<std::string, std::string>> snapshotTables = {
+    {"libros", "id_libro, codigo, titulo, autor, ejemplares_sede1, ejemplares_sede2, ejemplares_totales_sede1, ejemplares_totales_sede2"},
+    {"estados", "id_estado, id_libro, tipo_operacion, fecha_operacion, fecha_devolucion_prevista, sede, renovaciones"},
+    {"uso_diario", "dia, codigo, sede, prestamos, renovaciones, devoluciones"},
+    {"reservas", "id, codigo, sede, patron, creado"}
+};
+//Only active loans travel; returned ones are history and live in operation_log
+const std::vector<std::string> snapshotFilters = {"", "WHERE tipo_operacion = 'prestamo'", "", ""};
+const std::size_t snapshotChunkBytes = 1 << 20;
+
+bool executeCommand(PGconn *connection, const std::string &command){
+    PGresult *commandResult = PQexec(connection, command.c_str());
+    ExecStatusType status = PQresultStatus(commandResult);
+    PQclear(commandResult);
+    return status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK;
+}
+
+//A snapshot being served: its repeatable read transaction, the table being
+//copied and whether that table's COPY is still open
+struct SnapshotSession{
+    PGconn *connection = nullptr;
+    std::size_t tableNumber = 0;
+    bool copyOpen = false;
+    std::chrono::steady_clock::time_point lastRequest;
+};
+
+//A replica that stops asking for chunks for this long has given up
+const int snapshotSessionIdleSeconds = 60;
+
+//Streams snapshots one reply per replica request, so a replica takes each
+//chunk only when it has loaded the previous one and the primary holds one
+//chunk per snapshot in memory. The replica opens a snapshot with SNAPSHOT,
+//answered with SNAPSHOT:<operation id>:<session>, then sends
+//SNAPSHOT_NEXT:<session> for each reply: TABLE:<name>, DATA:<COPY rows>,
+//END once every table is sent, or ABORT when the snapshot failed.
+class SnapshotSender{
+public:
+    SnapshotSender() : randomEngine(std::random_device{}()){}
+
+    ~SnapshotSender(){
+        for(auto &session : sessions){
+            PQfinish(session.second.connection);
+        }
+    }
+
+    SnapshotSender(const SnapshotSender&) = delete;
+    SnapshotSender &operator=(const SnapshotSender&) = delete;
+
+    //writeMutex is held only until the repeatable read snapshot is
+    //established, so the tagged id matches the data. Empty when the snapshot
+    //could not be taken.
+    std::string open(const std::string &dbConnectionString, std::mutex &writeMutex, std::int64_t archivedUpTo){
+        PGconn *connection = PQconnectdb(dbConnectionString.c_str());
+        if(PQstatus(connection) != CONNECTION_OK){
+            PQfinish(connection);
+            return "";
+        }
+
+        std::int64_t snapshotOperationId = 0;
+        bool snapshotTaken;
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            snapshotTaken = executeCommand(connection, "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY");
+            PGresult *idResult = PQexec(connection, "SELECT COALESCE(MAX(id), 0) FROM operation_log");
+            snapshotTaken = snapshotTaken && PQresultStatus(idResult) == PGRES_TUPLES_OK;
+            if(snapshotTaken){
+                snapshotOperationId = std::max(std::int64_t(std::stoll(PQgetvalue(idResult, 0, 0))), archivedUpTo);
+            }
+            PQclear(idResult);
+        }
+        if(!snapshotTaken){
+            PQfinish(connection);
+            return "";
+        }
+
+        std::string sessionId = std::to_string(randomEngine());
+        SnapshotSession &session = sessions[sessionId];
+        session.connection = connection;
+        session.lastRequest = std::chrono::steady_clock::now();
+        return "SNAPSHOT:" + std::to_string(snapshotOperationId) + ":" + sessionId;
+    }
+
+    //Sends the next reply of the session; false once it has ended, sent or not
+    bool sendNext(const std::string &sessionId, zmq::socket_t &snapshotSocket){
+        auto sessionIterator = sessions.find(sessionId);
+        if(sessionIterator == sessions.end()){
+            snapshotSocket.send(zmq::buffer(std::string("ABORT")), zmq::send_flags::none);
+            return false;
+        }
+        SnapshotSession &session = sessionIterator->second;
+        session.lastRequest = std::chrono::steady_clock::now();
+
+        while(session.tableNumber < snapshotTables.size()){
+            const auto &table = snapshotTables[session.tableNumber];
+            if(!session.copyOpen){
+                PGresult *copyResult = PQexec(session.connection,
+                    ("COPY (SELECT " + table.second + " FROM " + table.first + " " + snapshotFilters[session.tableNumber] + ") TO STDOUT").c_str());
+                session.copyOpen = PQresultStatus(copyResult) == PGRES_COPY_OUT;
+                PQclear(copyResult);
+                if(!session.copyOpen){
+                    return abort(sessionId, snapshotSocket);
+                }
+                snapshotSocket.send(zmq::buffer("TABLE:" + table.first), zmq::send_flags::none);
+                return true;
+            }
+
+            std::string chunk("DATA:");
+            chunk.reserve(snapshotChunkBytes + 5);
+            char *rowBuffer = nullptr;
+            int rowLength = 0;
+            while(chunk.size() < snapshotChunkBytes && (rowLength = PQgetCopyData(session.connection, &rowBuffer, 0)) > 0){
+                chunk.append(rowBuffer, std::size_t(rowLength));
+                PQfreemem(rowBuffer);
+            }
+            if(rowLength < 0){
+                PGresult *finalResult = PQgetResult(session.connection);
+                bool copyFinished = rowLength == -1 && PQresultStatus(finalResult) == PGRES_COMMAND_OK;
+                PQclear(finalResult);
+                if(!copyFinished){
+                    return abort(sessionId, snapshotSocket);
+                }
+                session.copyOpen = false;
+                session.tableNumber++;
+            }
+            if(chunk.size() > 5){
+                snapshotSocket.send(zmq::buffer(chunk), zmq::send_flags::none);
+                return true;
+            }
+        }
+
+        executeCommand(session.connection, "COMMIT");
+        close(sessionId);
+        snapshotSocket.send(zmq::buffer(std::string("END")), zmq::send_flags::none);
+        return false;
+    }
+
+    //Ends the session and tells the replica
+    bool abort(const std::string &sessionId, zmq::socket_t &snapshotSocket){
+        close(sessionId);
+        snapshotSocket.send(zmq::buffer(std::string("ABORT")), zmq::send_flags::none);
+        return false;
+    }
+
+    //Ends the session without a reply; closing the connection rolls back
+    void close(const std::string &sessionId){
+        auto sessionIterator = sessions.find(sessionId);
+        if(sessionIterator != sessions.end()){
+            PQfinish(sessionIterator->second.connection);
+            sessions.erase(sessionIterator);
+        }
+    }
+
+    //Drops the snapshots whose replica stopped asking
+    void expireIdle(){
+        auto idleSince = std::chrono::steady_clock::now() - std::chrono::seconds(snapshotSessionIdleSeconds);
+        for(auto sessionIterator = sessions.begin(); sessionIterator != sessions.end();){
+            if(sessionIterator->second.lastRequest < idleSince){
+                std::cerr << "[GA-Snapshot] Replica stopped asking for snapshot " << sessionIterator->first << ", dropping it\n";
+                PQfinish(sessionIterator->second.connection);
+                sessionIterator = sessions.erase(sessionIterator);
+            } else {
+                ++sessionIterator;
+            }
+        }
+    }
+
+private:
+    std::map<std::string, SnapshotSession> sessions;
+    std::mt19937_64 randomEngine;
+};
+
+bool finishCopyIn(PGconn *connection, const char *abortMessage = nullptr){
+    if(PQputCopyEnd(connection, abortMessage) != 1){
+        return false;
+    }
+    PGresult *copyResult = PQgetResult(connection);
+    bool copied = PQresultStatus(copyResult) == PGRES_COMMAND_OK;
+    PQclear(copyResult);
+    while((copyResult = PQgetResult(connection)) != nullptr){
+        PQclear(copyResult);
+    }
+    return copied;
+}
+
+//Asks for a snapshot from SnapshotSender chunk by chunk and replaces the
+//local libros, estados, uso_diario and reservas with it in one transaction,
+//dropping any local log past it and feeding each chunk straight into
+//COPY ... FROM STDIN. Returns the operation id the
+//snapshot corresponds to, or -1 if nothing was loaded.
+std::int64_t receiveSnapshot(const std::string &dbConnectionString, zmq::socket_t &snapshotSocket){
+    snapshotSocket.send(zmq::buffer(std::string("SNAPSHOT")), zmq::send_flags::none);
+    zmq::message_t headerFrame;
+    if(!snapshotSocket.recv(headerFrame, zmq::recv_flags::none)){
+        return -1;
+    }
+    std::string header(static_cast<char*>(headerFrame.data()), headerFrame.size());
+    std::size_t sessionStart = header.find(':', 9);
+    if(header.rfind("SNAPSHOT:", 0) != 0 || sessionStart == std::string::npos){
+        return -1;
+    }
+    std::int64_t snapshotOperationId = std::stoll(header.substr(9, sessionStart - 9));
+    std::string sessionId = header.substr(sessionStart + 1);
+
+    PGconn *connection = PQconnectdb(dbConnectionString.c_str());
+    bool loaded = PQstatus(connection) == CONNECTION_OK &&
+                  executeCommand(connection, "BEGIN") &&
+                  executeCommand(connection, "TRUNCATE estados, libros, uso_diario, reservas") &&
+                  //Log rows past the snapshot describe a state it replaces; left
+                  //in place they would be served to catch-up and collide with the
+                  //sequence reset below
+                  executeCommand(connection, "DELETE FROM operation_log WHERE id > " + std::to_string(snapshotOperationId));
+    bool copyOpen = false;
+    bool finished = false;
+    //A REQ socket whose reply never came cannot send again
+    bool replyReceived = true;
+
+    while(loaded && !finished){
+        snapshotSocket.send(zmq::buffer("SNAPSHOT_NEXT:" + sessionId), zmq::send_flags::none);
+        zmq::message_t frame;
+        if(!snapshotSocket.recv(frame, zmq::recv_flags::none)){
+            loaded = false;
+            replyReceived = false;
+            break;
+        }
+        std::string marker(static_cast<char*>(frame.data()), std::min<std::size_t>(frame.size(), 6));
+
+        if(marker.rfind("DATA:", 0) == 0){
+            loaded = copyOpen && PQputCopyData(connection, static_cast<char*>(frame.data()) + 5, int(frame.size() - 5)) == 1;
+            continue;
+        }
+        if(copyOpen){
+            loaded = finishCopyIn(connection);
+            copyOpen = false;
+        }
+        if(marker == "TABLE:"){
+            std::string tableName(static_cast<char*>(frame.data()) + 6, frame.size() - 6);
+            loaded = false;
+            for(const auto &table : snapshotTables){
+                if(table.first == tableName){
+                    PGresult *copyResult = PQexec(connection, ("COPY " + table.first + " (" + table.second + ") FROM STDIN").c_str());
+                    copyOpen = PQresultStatus(copyResult) == PGRES_COPY_IN;
+                    loaded = copyOpen;
+                    PQclear(copyResult);
+                }
+            }
+        } else {
+            finished = true;
+            loaded = loaded && frame.to_string_view() == "END";
+        }
+    }
+    //The primary keeps the snapshot open until told or until it times out
+    if(!finished && replyReceived){
+        zmq::message_t cancelReply;
+        snapshotSocket.send(zmq::buffer("SNAPSHOT_CANCEL:" + sessionId), zmq::send_flags::none);
+        snapshotSocket.recv(cancelReply, zmq::recv_flags::none);
+    }
+
+    loaded = loaded &&
+        executeCommand(connection, "SELECT setval('libros_id_libro_seq', COALESCE((SELECT MAX(id_libro) FROM libros), 0) + 1, false)") &&
+        executeCommand(connection, "SELECT setval('estados_id_estado_seq', COALESCE((SELECT MAX(id_estado) FROM estados), 0) + 1, false)") &&
+        executeCommand(connection, "SELECT setval('reservas_id_seq', COALESCE((SELECT MAX(id) FROM reservas), 0) + 1, false)") &&
+        executeCommand(connection, "SELECT setval('operation_log_id_seq', " + std::to_string(snapshotOperationId + 1) + ", false)") &&
+        executeCommand(connection, "COMMIT");
+    if(!loaded){
+        if(copyOpen){
+            finishCopyIn(connection, "snapshot transfer failed");
+        }
+        executeCommand(connection, "ROLLBACK");
+    }
+    PQfinish(connection);
+    return loaded ? snapshotOperationId : -1;
+}
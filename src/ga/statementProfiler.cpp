@@ -0,0 +1,256 @@
+#include <pqxx/pqxx>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+
+//Latency histogram buckets: bucket i counts statements that took less than
+//2^(i+1) microseconds, the last one everything slower
+const int statementBucketCount = 25;
+const double defaultSlowStatementMs = 50;
+//Slow statements waiting for their EXPLAIN; more are counted but not sampled
+const std::size_t maxPendingExplains = 64;
+//At most one EXPLAIN per statement in this period
+const int explainCooldownSeconds = 60;
+//Each shard of a sharded GA gets its own log
+std::string slowQueryLogPath = "ga_slow_queries.log";
+const std::streamoff slowQueryLogMaxBytes = 4 * 1024 * 1024;
+const int slowQueryLogKeptFiles = 3;
+
+struct StatementStats{
+    std::uint64_t count = 0;
+    std::uint64_t slowCount = 0;
+    std::uint64_t totalMicros = 0;
+    std::uint64_t maxMicros = 0;
+    std::uint64_t buckets[statementBucketCount] = {};
+};
+
+//A statement over the threshold, with its parameters already inlined in sql;
+//connects and commits are timed too and have no sql
+struct SlowStatement{
+    std::string name;
+    std::string sql;
+    std::uint64_t micros;
+    std::time_t capturedAt;
+};
+
+//Times every statement the Postgres handlers run, by name. Statements over
+//the threshold are queued and a background thread explains them (queries
+//under ANALYZE in a read-only transaction it rolls back), writing the plan to
+//a rotating log.
+class StatementProfiler{
+public:
+    ~StatementProfiler(){
+        stop();
+    }
+
+    void start(const std::string &dbConnectionString, double thresholdMs){
+        connectionString = dbConnectionString;
+        slowThresholdMicros = std::uint64_t(thresholdMs * 1000);
+        explainerRunning = true;
+        explainerThread = std::thread(&StatementProfiler::explainLoop, this);
+        std::cout << "[GA-Profile] Sampling statements slower than " << thresholdMs << " ms into " << slowQueryLogPath << "\n";
+    }
+
+    void stop(){
+        {
+            std::lock_guard<std::mutex> lock(explainMutex);
+            explainerRunning = false;
+        }
+        explainReady.notify_all();
+        if(explainerThread.joinable()){
+            explainerThread.join();
+        }
+    }
+
+    void record(const char *statementName, const std::string &sql, std::chrono::steady_clock::duration elapsed){
+        std::uint64_t micros = std::uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        int bucket = 0;
+        while(bucket < statementBucketCount - 1 && micros >= (std::uint64_t(2) << bucket)){
+            bucket++;
+        }
+        bool isSlow = slowThresholdMicros > 0 && micros >= slowThresholdMicros;
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            StatementStats &stats = statsByName[statementName];
+            stats.count++;
+            stats.totalMicros += micros;
+            stats.maxMicros = std::max(stats.maxMicros, micros);
+            stats.buckets[bucket]++;
+            stats.slowCount += isSlow;
+        }
+        if(isSlow){
+            std::lock_guard<std::mutex> lock(explainMutex);
+            if(pendingExplains.size() < maxPendingExplains){
+                pendingExplains.push_back(SlowStatement{statementName, sql, micros, std::time(nullptr)});
+                explainReady.notify_one();
+            }
+        }
+    }
+
+    //One line per statement: count, mean, p50/p95/p99 (bucket upper bounds),
+    //max and how many went over the threshold
+    std::string report(){
+        std::lock_guard<std::mutex> lock(statsMutex);
+        std::string profileReport = "PROFILE " + std::to_string(statsByName.size()) + " statements, slow >= " +
+                                    std::to_string(slowThresholdMicros / 1000) + " ms";
+        for(const auto &statsEntry : statsByName){
+            const StatementStats &stats = statsEntry.second;
+            char line[256];
+            std::snprintf(line, sizeof(line), "\n%-24s count %llu  mean %.2f ms  p50 %.2f ms  p95 %.2f ms  p99 %.2f ms  max %.2f ms  slow %llu",
+                          statsEntry.first.c_str(), (unsigned long long)stats.count, stats.totalMicros / 1000.0 / stats.count,
+                          percentileMs(stats, 0.50), percentileMs(stats, 0.95), percentileMs(stats, 0.99),
+                          stats.maxMicros / 1000.0, (unsigned long long)stats.slowCount);
+            profileReport += line;
+        }
+        return profileReport;
+    }
+
+private:
+    static double percentileMs(const StatementStats &stats, double fraction){
+        std::uint64_t rank = std::uint64_t(fraction * (stats.count - 1)) + 1;
+        std::uint64_t seen = 0;
+        for(int bucket = 0; bucket < statementBucketCount; bucket++){
+            seen += stats.buckets[bucket];
+            if(seen >= rank){
+                return std::min(double(std::uint64_t(2) << bucket), double(stats.maxMicros)) / 1000.0;
+            }
+        }
+        return stats.maxMicros / 1000.0;
+    }
+
+    void explainLoop(){
+        std::map<std::string, std::chrono::steady_clock::time_point> lastExplainByName;
+        while(true){
+            SlowStatement slowStatement;
+            {
+                std::unique_lock<std::mutex> lock(explainMutex);
+                explainReady.wait(lock, [this]{ return !explainerRunning || !pendingExplains.empty(); });
+                if(!explainerRunning){
+                    return;
+                }
+                slowStatement = std::move(pendingExplains.front());
+                pendingExplains.pop_front();
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            auto lastExplain = lastExplainByName.find(slowStatement.name);
+            bool explainDue = lastExplain == lastExplainByName.end() || now - lastExplain->second >= std::chrono::seconds(explainCooldownSeconds);
+            std::string plan = "(plan skipped, sampled in the last " + std::to_string(explainCooldownSeconds) + " s)";
+            if(slowStatement.sql.empty()){
+                plan = "";
+            } else if(explainDue){
+                lastExplainByName[slowStatement.name] = now;
+                plan = explainStatement(slowStatement.sql);
+            }
+            writeSlowStatement(slowStatement, plan);
+        }
+    }
+
+    //EXPLAIN ANALYZE executes the statement, and rolling back does not give
+    //back the ids an INSERT takes from a sequence. Only queries are analyzed,
+    //in a read-only transaction that refuses any write they would make; other
+    //statements, and queries refused that way, get the estimated plan.
+    std::string explainStatement(const std::string &sql){
+        std::size_t firstWord = sql.find_first_not_of(" \t\n(");
+        bool isQuery = firstWord != std::string::npos && sql.compare(firstWord, 6, "SELECT") == 0;
+        if(isQuery){
+            try {
+                return runExplain("EXPLAIN (ANALYZE, BUFFERS) " + sql, true);
+            } catch(const pqxx::sql_error &error){
+                if(error.sqlstate() != "25006"){
+                    return std::string("(explain failed: ") + error.what() + ")";
+                }
+            } catch(const std::exception &error){
+                return std::string("(explain failed: ") + error.what() + ")";
+            }
+        }
+        try {
+            return "    (not executed, estimated plan)\n" + runExplain("EXPLAIN " + sql, false);
+        } catch(const std::exception &error){
+            return std::string("(explain failed: ") + error.what() + ")";
+        }
+    }
+
+    //Runs in a transaction that is rolled back and gives up quickly on locks
+    //the handlers hold
+    std::string runExplain(const std::string &explainSql, bool readOnly){
+        pqxx::connection dbConnection(connectionString);
+        pqxx::work transaction(dbConnection);
+        if(readOnly){
+            transaction.exec("SET TRANSACTION READ ONLY");
+        }
+        transaction.exec("SET LOCAL lock_timeout = '200ms'");
+        transaction.exec("SET LOCAL statement_timeout = '5s'");
+        pqxx::result planRows = transaction.exec(explainSql);
+        transaction.abort();
+
+        std::string plan;
+        for(const auto &planRow : planRows){
+            plan += "    " + planRow[0].as<std::string>() + "\n";
+        }
+        return plan;
+    }
+
+    void writeSlowStatement(const SlowStatement &slowStatement, const std::string &plan){
+        rotateLogIfFull();
+        std::ofstream logFile(slowQueryLogPath, std::ios::app);
+        char capturedAt[32];
+        std::strftime(capturedAt, sizeof(capturedAt), "%Y-%m-%d %H:%M:%S", std::localtime(&slowStatement.capturedAt));
+        logFile << capturedAt << " " << slowStatement.name << " " << (slowStatement.micros / 1000.0) << " ms\n";
+        if(!slowStatement.sql.empty()){
+            logFile << "    " << slowStatement.sql << "\n" << plan;
+        }
+        if(!plan.empty() && plan.back() != '\n'){
+            logFile << "\n";
+        }
+    }
+
+    //ga_slow_queries.log moves to .1, .1 to .2 and so on; the oldest is dropped
+    void rotateLogIfFull(){
+        std::ifstream currentLog(slowQueryLogPath, std::ios::ate | std::ios::binary);
+        if(!currentLog || currentLog.tellg() < slowQueryLogMaxBytes){
+            return;
+        }
+        currentLog.close();
+        std::remove((slowQueryLogPath + "." + std::to_string(slowQueryLogKeptFiles)).c_str());
+        for(int fileIndex = slowQueryLogKeptFiles - 1; fileIndex >= 1; fileIndex--){
+            std::rename((slowQueryLogPath + "." + std::to_string(fileIndex)).c_str(),
+                        (slowQueryLogPath + "." + std::to_string(fileIndex + 1)).c_str());
+        }
+        std::rename(slowQueryLogPath.c_str(), (slowQueryLogPath + ".1").c_str());
+    }
+
+    std::mutex statsMutex;
+    std::map<std::string, StatementStats> statsByName;
+    std::uint64_t slowThresholdMicros = 0;
+
+    std::string connectionString;
+    std::mutex explainMutex;
+    std::condition_variable explainReady;
+    std::deque<SlowStatement> pendingExplains;
+    bool explainerRunning = false;
+    std::thread explainerThread;
+};
+
+//Runs one statement of a handler and charges its time to statementName
+pqxx::result profiledExec(StatementProfiler &profiler, pqxx::work &transaction, const char *statementName, const std::string &sql){
+    auto startTime = std::chrono::steady_clock::now();
+    pqxx::result statementResult = transaction.exec(sql);
+    profiler.record(statementName, sql, std::chrono::steady_clock::now() - startTime);
+    return statementResult;
+}
+
+void profiledCommit(StatementProfiler &profiler, pqxx::work &transaction, const char *statementName){
+    auto startTime = std::chrono::steady_clock::now();
+    transaction.commit();
+    profiler.record(statementName, "", std::chrono::steady_clock::now() - startTime);
+}
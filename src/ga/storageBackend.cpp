@@ -0,0 +1,51 @@
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//Storage used by the GA request handlers. Each call is one operation and is
+//made with databaseMutex held, so implementations only guard what their own
+//background threads share with them.
+class StorageBackend{
+public:
+    virtual ~StorageBackend() = default;
+
+    //A requestKey already applied answers with its first result and changes nothing
+    virtual std::string loan(int bookCode, int locationId, const std::string &requestKey, const OperationOrigin &origin) = 0;
+    virtual std::string renew(int bookCode, int locationId, const std::string &requestKey, const OperationOrigin &origin) = 0;
+    //A return served here lends the copy to the head of the book's waitlist
+    //in the same transaction and describes that loan in handOff
+    virtual std::string returnLoan(int bookCode, int locationId, const std::string &requestKey, const OperationOrigin &origin,
+                                   ReservationHandOff &handOff) = 0;
+    //With allOrNothing nothing is applied unless every operation succeeds
+    virtual BulkResult applyBulk(const Request *operations, std::size_t operationCount, const OperationOrigin &origin,
+                                 bool allOrNothing) = 0;
+
+    //Adds patron to the end of the book's waitlist at the location and
+    //returns their position, 1 for the head; a patron already waiting keeps
+    //their place. 0 when the waitlist is full.
+    virtual std::size_t reserve(int bookCode, int locationId, const std::string &patron) = 0;
+    //Applies a hand-off replicated from the GA that made it: lends the book
+    //and takes patron off its waitlist in one transaction
+    virtual std::string lendReserved(int bookCode, int locationId, const std::string &patron, const OperationOrigin &origin) = 0;
+
+    //Id of the last operation this backend logged, 0 if it has not logged any
+    virtual std::int64_t lastOperation() = 0;
+    //Returns once operations up to operationId would survive a power loss.
+    //Called without databaseMutex, before the reply goes out; a backend that
+    //commits durably has nothing to wait for.
+    virtual void awaitDurable(std::int64_t){}
+    //Highest operation id stored, archived history included
+    virtual std::int64_t lastStoredOperation() = 0;
+    //Operations logged after afterId, oldest first, at most limit of them
+    virtual std::vector<OperationLogEntry> readOperations(std::int64_t afterId, std::size_t limit) = 0;
+    //Like readOperations, leaving out the operations replicated from another site
+    virtual std::vector<OperationLogEntry> readServedOperations(std::int64_t afterId, std::size_t limit) = 0;
+    //Highest id, in originSite's own log, of the operations replicated from it
+    virtual std::int64_t lastReplicatedOperation(int originSite) = 0;
+    //Every book with its title, author and available copies, for the search index
+    virtual std::vector<CatalogRecord> readCatalog() = 0;
+    //Usage rollups of the days from fromDay to toDay, both included
+    virtual std::vector<UsageRow> readUsage(int fromDay, int toDay) = 0;
+    //Registers every active loan with the overdue tracker
+    virtual void trackActiveLoans() = 0;
+};
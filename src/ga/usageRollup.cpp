@@ -0,0 +1,110 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <tuple>
+#include <array>
+#include <limits>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+
+//Rows a book or author report lists when USAGE does not say how many
+const std::size_t defaultUsageReportRows = 20;
+const std::size_t maxUsageReportRows = 1000;
+
+//Applied loans, renewals and returns of one book at one site on one day,
+//indexed by request type
+struct UsageRow{
+    int day;
+    int bookCode;
+    int sede;
+    std::int64_t counts[3];
+};
+
+//Counters per (day, book, site), for a store without a summary table. Kept
+//ordered by day so a date range is one contiguous walk.
+class UsageRollup{
+public:
+    void add(int day, int bookCode, int sede, int requestType, std::int64_t amount = 1){
+        if(requestType < 0 || requestType > 2){
+            return;
+        }
+        rows[std::make_tuple(day, bookCode, sede)][requestType] += amount;
+    }
+
+    std::vector<UsageRow> read(int fromDay, int toDay) const{
+        std::vector<UsageRow> usageRows;
+        auto rowEntry = rows.lower_bound(std::make_tuple(fromDay, std::numeric_limits<int>::min(), std::numeric_limits<int>::min()));
+        for(; rowEntry != rows.end() && std::get<0>(rowEntry->first) <= toDay; ++rowEntry){
+            usageRows.push_back(UsageRow{std::get<0>(rowEntry->first), std::get<1>(rowEntry->first), std::get<2>(rowEntry->first),
+                                         {rowEntry->second[0], rowEntry->second[1], rowEntry->second[2]}});
+        }
+        return usageRows;
+    }
+
+    std::vector<UsageRow> all() const{
+        return read(std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+    }
+
+    void clear(){
+        rows.clear();
+    }
+
+private:
+    std::map<std::tuple<int, int, int>, std::array<std::int64_t, 3>> rows;
+};
+
+//USAGE <book|author|site|day> <from YYYY-MM-DD> <to YYYY-MM-DD> [rows]: sums
+//the rollups in the range by the chosen key. Titles and authors come from the
+//search index, so a report never reads libros or estados.
+std::string formatUsageReport(const std::vector<UsageRow> &usageRows, const std::string &groupBy, std::size_t rowLimit,
+                              CatalogIndex &catalog){
+    struct UsageTotals{
+        std::int64_t counts[3] = {0, 0, 0};
+    };
+    std::unordered_map<std::string, UsageTotals> totalsByKey;
+    for(const UsageRow &usageRow : usageRows){
+        std::string key;
+        if(groupBy == "site"){
+            key = "sede " + std::to_string(usageRow.sede);
+        } else if(groupBy == "day"){
+            key = dateFromDayNumber(usageRow.day);
+        } else if(groupBy == "author"){
+            std::string title, author;
+            key = catalog.bookText(usageRow.bookCode, title, author) ? author : "(unknown author)";
+        } else {
+            std::string title, author;
+            key = std::to_string(usageRow.bookCode) + (catalog.bookText(usageRow.bookCode, title, author) ? " | " + title : "");
+        }
+        UsageTotals &totals = totalsByKey[key];
+        for(int requestType = 0; requestType < 3; requestType++){
+            totals.counts[requestType] += usageRow.counts[requestType];
+        }
+    }
+
+    std::vector<std::pair<std::string, UsageTotals>> rankedTotals(totalsByKey.begin(), totalsByKey.end());
+    //Sites and days read in order; books and authors busiest first
+    bool byKey = groupBy == "site" || groupBy == "day";
+    std::sort(rankedTotals.begin(), rankedTotals.end(),
+        [byKey](const std::pair<std::string, UsageTotals> &left, const std::pair<std::string, UsageTotals> &right){
+            if(!byKey && left.second.counts[0] != right.second.counts[0]){
+                return left.second.counts[0] > right.second.counts[0];
+            }
+            return left.first < right.first;
+        });
+    if(!byKey){
+        rankedTotals.resize(std::min(rankedTotals.size(), rowLimit == 0 ? defaultUsageReportRows : std::min(rowLimit, maxUsageReportRows)));
+    }
+
+    std::string usageReport = "USAGE by " + groupBy + ": " + std::to_string(rankedTotals.size()) + " rows";
+    for(const auto &totalsEntry : rankedTotals){
+        const UsageTotals &totals = totalsEntry.second;
+        char line[96];
+        std::snprintf(line, sizeof(line), " | loans %lld | renewals %lld | returns %lld | renewal rate %.1f%%",
+                      (long long)totals.counts[0], (long long)totals.counts[1], (long long)totals.counts[2],
+                      totals.counts[0] > 0 ? 100.0 * totals.counts[1] / totals.counts[0] : 0.0);
+        usageReport += "\n" + totalsEntry.first + line;
+    }
+    return usageReport;
+}
@@ -0,0 +1,66 @@
+#include <zmq.hpp>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//Fixed set of threads running queued tasks in submission order. Each worker
+//owns a PUSH socket connected to replyEndpoint, handed to every task it runs,
+//so replies can travel back to the thread that owns the client socket.
+class WorkerPool{
+public:
+    WorkerPool(zmq::context_t &context, const std::string &replyEndpoint, std::size_t workerCount){
+        for(std::size_t workerNumber = 0; workerNumber < workerCount; workerNumber++){
+            workers.emplace_back(&WorkerPool::workerLoop, this, std::ref(context), replyEndpoint);
+        }
+    }
+
+    ~WorkerPool(){
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueSignal.notify_all();
+        for(std::thread &worker : workers){
+            worker.join();
+        }
+    }
+
+    void submit(std::function<void(zmq::socket_t&)> task){
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            pendingTasks.push_back(std::move(task));
+        }
+        queueSignal.notify_one();
+    }
+
+private:
+    void workerLoop(zmq::context_t &context, const std::string replyEndpoint){
+        zmq::socket_t replySocket(context, zmq::socket_type::push);
+        replySocket.set(zmq::sockopt::linger, 0);
+        replySocket.connect(replyEndpoint);
+
+        while(true){
+            std::function<void(zmq::socket_t&)> task;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueSignal.wait(lock, [this]{ return stopping || !pendingTasks.empty(); });
+                if(pendingTasks.empty()){
+                    return;
+                }
+                task = std::move(pendingTasks.front());
+                pendingTasks.pop_front();
+            }
+            task(replySocket);
+        }
+    }
+
+    std::mutex queueMutex;
+    std::condition_variable queueSignal;
+    std::deque<std::function<void(zmq::socket_t&)>> pendingTasks;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
@@ -1,9 +1,98 @@
 #include <zmq.hpp>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <cstring>
+#include <cstdio>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
 #include "../../utils/structs.cpp"
+#include "../../utils/deadline.cpp"
+#include "../../utils/codeFilter.cpp"
+#include "../../utils/trafficCapture.cpp"
+#include "../../utils/messagePool.cpp"
+
+//Every actor has one lane per kind of sender; its idle time is shared between
+//them by deficit round robin
+enum LaneKind{
+    INTERACTIVE_LANE,
+    BATCH_LANE,
+    BULK_LANE,
+    LANE_KIND_COUNT
+};
+const char *laneKindNames[LANE_KIND_COUNT] = {"interactive", "batch", "bulk"};
+
+//Operations a lane may send per round and unit of weight
+const long laneQuantum = 100;
+//BULK messages are split into chunks of this many operations so a batch never
+//holds the loan actor for long
+const std::int32_t bulkChunkOperations = 500;
+//Latency percentiles are taken over the last this many requests of a lane
+const std::size_t latencySampleCount = 1024;
+const int laneReportIntervalSeconds = 10;
+
+//A BULK request answered chunk by chunk; the client gets one reply at the end
+struct BulkAssembly{
+    std::vector<zmq::message_t> envelope;
+    std::uint64_t captureId;
+    //"BULK:" and one outcome per operation, filled in place as chunks return
+    zmq::message_t reply;
+    std::size_t pendingChunks;
+};
+
+struct PendingRequest{
+    //ROUTER envelope of the client, empty for bulk chunks
+    std::vector<zmq::message_t> envelope;
+    zmq::message_t payload;
+    std::uint64_t captureId = 0;
+    //Operations the request carries, charged against the lane's deficit
+    long cost = 1;
+    std::chrono::steady_clock::time_point enqueuedAt;
+    std::shared_ptr<BulkAssembly> bulkAssembly;
+    //Positions in the client's batch of the operations in this chunk
+    std::vector<std::uint32_t> chunkPositions;
+};
+
+struct Lane{
+    std::deque<PendingRequest> queue;
+    long weight = 1;
+    long deficit = 0;
+    std::vector<double> latencySamplesMs;
+    std::size_t nextSample = 0;
+    std::uint64_t servedSinceReport = 0;
+    //Dropped at the head of the lane because their deadline had passed
+    std::uint64_t expiredSinceReport = 0;
+};
+
+//An actor takes one request at a time over its REQ socket; every GC of the
+//location has its own link, and the actor's REP socket serves them in turn
+struct ActorLink{
+    ActorLink(zmq::context_t &context, const std::string &actorName, const std::string &endpoint, const long laneWeights[LANE_KIND_COUNT])
+        : name(actorName), socket(context, zmq::socket_type::req){
+        socket.connect(endpoint);
+        for(int laneIndex = 0; laneIndex < LANE_KIND_COUNT; laneIndex++){
+            lanes[laneIndex].weight = laneWeights[laneIndex];
+        }
+    }
+
+    std::string name;
+    zmq::socket_t socket;
+    Lane lanes[LANE_KIND_COUNT];
+    int currentLane = 0;
+    bool currentLaneCredited = false;
+    bool busy = false;
+    PendingRequest inFlight;
+    int inFlightLane = 0;
+};
+
+//Inactive unless GC runs with --capture
+TrafficCapture trafficCapture;
+//Buffers of the bulk chunks and replies GC builds itself
+MessagePool messagePool;
 
 void obtainEnvData(std::vector<std::string> &environmentVariables){
     std::fstream configFile("../.env");
@@ -13,112 +102,455 @@ void obtainEnvData(std::vector<std::string> &environmentVariables){
     }
 }
 
-std::string sendSynchronousRequest(Request &request, zmq::socket_t &actorSocket){
-    zmq::message_t requestMessage(sizeof(Request));
-    memcpy(requestMessage.data(), &request, sizeof(Request));
-    actorSocket.send(requestMessage, zmq::send_flags::none);
-    
+bool parseLaneWeights(const std::string &weightList, long laneWeights[LANE_KIND_COUNT]){
+    long parsedWeights[LANE_KIND_COUNT];
+    char trailing;
+    if(std::sscanf(weightList.c_str(), "%ld,%ld,%ld%c", &parsedWeights[0], &parsedWeights[1], &parsedWeights[2], &trailing) != 3){
+        return false;
+    }
+    for(int laneIndex = 0; laneIndex < LANE_KIND_COUNT; laneIndex++){
+        if(parsedWeights[laneIndex] < 1){
+            return false;
+        }
+        laneWeights[laneIndex] = parsedWeights[laneIndex];
+    }
+    return true;
+}
+
+std::vector<zmq::message_t> receiveClientRequest(zmq::socket_t &clientSocket, zmq::message_t &payload){
+    std::vector<zmq::message_t> envelope;
+    while(true){
+        zmq::message_t frame;
+        clientSocket.recv(frame, zmq::recv_flags::none);
+        if(!frame.more()){
+            payload = std::move(frame);
+            return envelope;
+        }
+        envelope.push_back(std::move(frame));
+    }
+}
+
+//Sends the reply frame itself, so an actor's reply reaches the client
+//without being copied
+void replyToClient(std::vector<zmq::message_t> &envelope, zmq::message_t &response, zmq::socket_t &clientSocket, std::uint64_t captureId){
+    trafficCapture.recordReply(captureId, response.data(), response.size());
+    std::string_view responseText = response.to_string_view();
+    if(responseText.compare(0, 5, "BULK:") == 0){
+        std::cout << "[GC] Sending bulk results to PS (" << (responseText.size() - 5) << " operations)\n\n";
+    } else {
+        std::cout << "[GC] Sending response to PS: " << responseText << "\n\n";
+    }
+    for(zmq::message_t &frame : envelope){
+        clientSocket.send(frame, zmq::send_flags::sndmore);
+    }
+    clientSocket.send(response, zmq::send_flags::none);
+}
+
+void replyToClient(std::vector<zmq::message_t> &envelope, const std::string &response, zmq::socket_t &clientSocket, std::uint64_t captureId){
+    zmq::message_t responseMessage(response.data(), response.size());
+    replyToClient(envelope, responseMessage, clientSocket, captureId);
+}
+
+//Takes the filter published by one GA; GC keeps one per GA location
+void receiveCatalogFilter(zmq::socket_t &catalogSocket, std::vector<BookCodeFilter> &catalogFilters){
+    zmq::message_t topicMessage, filterMessage;
+    catalogSocket.recv(topicMessage, zmq::recv_flags::none);
+    catalogSocket.recv(filterMessage, zmq::recv_flags::none);
+
+    BookCodeFilter receivedFilter;
+    if(!receivedFilter.load(filterMessage.data(), filterMessage.size()) ||
+       receivedFilter.sourceSite() < 1 || std::size_t(receivedFilter.sourceSite()) > catalogFilters.size()){
+        std::cerr << "[GC-Filter] Ignoring malformed catalog filter\n";
+        return;
+    }
+    BookCodeFilter &currentFilter = catalogFilters[receivedFilter.sourceSite() - 1];
+    if(!currentFilter.isLoaded() || currentFilter.books() != receivedFilter.books()){
+        std::cout << "[GC-Filter] Catalog filter from GA " << receivedFilter.sourceSite() << ": " << receivedFilter.books() << " books\n";
+    }
+    currentFilter = std::move(receivedFilter);
+}
+
+//True when every GA that has published a filter says the code does not exist;
+//with no filter yet everything goes through
+bool isUnknownBook(const std::vector<BookCodeFilter> &catalogFilters, int bookCode){
+    bool anyFilterLoaded = false;
+    for(const BookCodeFilter &catalogFilter : catalogFilters){
+        if(catalogFilter.isLoaded()){
+            anyFilterLoaded = true;
+            if(catalogFilter.mayContain(bookCode)){
+                return false;
+            }
+        }
+    }
+    return anyFilterLoaded;
+}
+
+//What GA itself answers for a code that is not in libros
+std::string unknownBookResponse(RequestType requestType){
+    bool needsActiveLoan = requestType == RequestType::RENEWAL || requestType == RequestType::RETURN;
+    return needsActiveLoan ? "Error: No active loan found for this book at this location" : "Error: Book does not exist";
+}
+
+BulkOutcome unknownBookOutcome(RequestType requestType){
+    return requestType == RequestType::LOAN ? BulkOutcome::BOOK_NOT_FOUND : BulkOutcome::NO_ACTIVE_LOAN;
+}
+
+//Queues the chunks of a BULK message on the loan actor's bulk lane. Operations
+//on unknown codes get their outcome here and never reach the actor; a batch
+//left with nothing to forward is answered at once.
+void enqueueBulkRequest(std::vector<zmq::message_t> &envelope, const zmq::message_t &bulkMessage, ActorLink &loanActor,
+                        const std::vector<BookCodeFilter> &catalogFilters, std::uint64_t captureId, zmq::socket_t &clientSocket){
+    Request bulkHeader;
+    memcpy(&bulkHeader, bulkMessage.data(), sizeof(Request));
+    std::size_t operationCount = (bulkMessage.size() - sizeof(Request)) / sizeof(Request);
+    if(bulkHeader.code < 0 || bulkHeader.code > maxBulkOperations || std::size_t(bulkHeader.code) != operationCount){
+        replyToClient(envelope, "Error: Malformed bulk request", clientSocket, captureId);
+        return;
+    }
+
+    //Every operation starts FAILED and is overwritten as it is resolved
+    zmq::message_t reply = messagePool.acquire(5 + operationCount);
+    memcpy(reply.data(), "BULK:", 5);
+    char *outcomes = static_cast<char*>(reply.data()) + 5;
+    memset(outcomes, char(BulkOutcome::FAILED), operationCount);
+
+    const Request *operations = reinterpret_cast<const Request*>(static_cast<const char*>(bulkMessage.data()) + sizeof(Request));
+    std::vector<std::uint32_t> forwardedPositions;
+    forwardedPositions.reserve(operationCount);
+    for(std::size_t position = 0; position < operationCount; position++){
+        Request operation;
+        memcpy(&operation, &operations[position], sizeof(Request));
+        //Out-of-range locations are left to GA, which fails them before looking the book up
+        if(int(operation.requestType) <= 2 && operation.location >= 0 && operation.location <= 1 &&
+           isUnknownBook(catalogFilters, operation.code)){
+            outcomes[position] = char(unknownBookOutcome(operation.requestType));
+        } else {
+            forwardedPositions.push_back(std::uint32_t(position));
+        }
+    }
+    if(forwardedPositions.size() < operationCount){
+        std::cout << "[GC-Filter] " << (operationCount - forwardedPositions.size()) << " of " << operationCount
+                  << " bulk operations are for unknown books\n";
+    }
+    if(forwardedPositions.empty()){
+        replyToClient(envelope, reply, clientSocket, captureId);
+        return;
+    }
+
+    std::shared_ptr<BulkAssembly> assembly = std::make_shared<BulkAssembly>();
+    assembly->envelope = std::move(envelope);
+    assembly->captureId = captureId;
+    assembly->reply = std::move(reply);
+    assembly->pendingChunks = (forwardedPositions.size() + bulkChunkOperations - 1) / bulkChunkOperations;
+
+    for(std::size_t chunkOffset = 0; chunkOffset < forwardedPositions.size(); chunkOffset += bulkChunkOperations){
+        std::size_t chunkSize = std::min(forwardedPositions.size() - chunkOffset, std::size_t(bulkChunkOperations));
+        Request chunkHeader = bulkHeader;
+        chunkHeader.code = std::int32_t(chunkSize);
+
+        PendingRequest chunk;
+        chunk.payload = messagePool.acquire(sizeof(Request) * (chunkSize + 1));
+        memcpy(chunk.payload.data(), &chunkHeader, sizeof(Request));
+        char *chunkOperations = static_cast<char*>(chunk.payload.data()) + sizeof(Request);
+        for(std::size_t chunkIndex = 0; chunkIndex < chunkSize; chunkIndex++){
+            memcpy(chunkOperations + chunkIndex * sizeof(Request), &operations[forwardedPositions[chunkOffset + chunkIndex]], sizeof(Request));
+        }
+        chunk.cost = long(chunkSize);
+        chunk.enqueuedAt = std::chrono::steady_clock::now();
+        chunk.bulkAssembly = assembly;
+        chunk.chunkPositions.assign(forwardedPositions.begin() + chunkOffset, forwardedPositions.begin() + chunkOffset + chunkSize);
+        loanActor.lanes[BULK_LANE].queue.push_back(std::move(chunk));
+    }
+    std::cout << "[GC] Queued BULK request (" << forwardedPositions.size() << " operations) in "
+              << assembly->pendingChunks << " chunks for " << loanActor.name << "\n";
+}
+
+//Deficit round robin: a lane is credited weight * laneQuantum once per visit
+//and keeps the actor while its credit covers the request at its head. Empty
+//lanes lose their credit. Returns -1 when nothing is queued.
+int selectLane(ActorLink &actor){
+    bool anyQueued = false;
+    for(const Lane &lane : actor.lanes){
+        anyQueued = anyQueued || !lane.queue.empty();
+    }
+    if(!anyQueued){
+        return -1;
+    }
+
+    while(true){
+        Lane &lane = actor.lanes[actor.currentLane];
+        if(lane.queue.empty()){
+            lane.deficit = 0;
+        } else {
+            if(!actor.currentLaneCredited){
+                lane.deficit += lane.weight * laneQuantum;
+                actor.currentLaneCredited = true;
+            }
+            if(lane.deficit >= lane.queue.front().cost){
+                lane.deficit -= lane.queue.front().cost;
+                return actor.currentLane;
+            }
+        }
+        actor.currentLane = (actor.currentLane + 1) % LANE_KIND_COUNT;
+        actor.currentLaneCredited = false;
+    }
+}
+
+//Takes an actor's reply to a BULK chunk into its batch; the client gets the
+//batch once its last chunk is back. A chunk that did not come back as BULK
+//keeps its operations marked FAILED, or EXPIRED if it was dropped for its deadline.
+void completeBulkChunk(PendingRequest &chunk, std::string_view actorResponse, zmq::socket_t &clientSocket){
+    BulkAssembly &assembly = *chunk.bulkAssembly;
+    char *outcomes = static_cast<char*>(assembly.reply.data()) + 5;
+    if(actorResponse.compare(0, 5, "BULK:") == 0 && actorResponse.size() - 5 == chunk.chunkPositions.size()){
+        for(std::size_t chunkIndex = 0; chunkIndex < chunk.chunkPositions.size(); chunkIndex++){
+            outcomes[chunk.chunkPositions[chunkIndex]] = actorResponse[5 + chunkIndex];
+        }
+    } else if(actorResponse == expiredRequestResponse){
+        for(std::uint32_t position : chunk.chunkPositions){
+            outcomes[position] = char(BulkOutcome::EXPIRED);
+        }
+    }
+    if(--assembly.pendingChunks == 0){
+        replyToClient(assembly.envelope, assembly.reply, clientSocket, assembly.captureId);
+    }
+}
+
+//Requests whose sender has given up are answered here as they reach the head
+//of their lane, and the actor takes the next one instead
+void dispatchToActor(ActorLink &actor, zmq::socket_t &clientSocket){
+    while(!actor.busy){
+        int laneIndex = selectLane(actor);
+        if(laneIndex < 0){
+            return;
+        }
+        Lane &lane = actor.lanes[laneIndex];
+        PendingRequest next = std::move(lane.queue.front());
+        lane.queue.pop_front();
+        if(isExpiredMessage(next.payload.data(), next.payload.size())){
+            lane.expiredSinceReport++;
+            if(next.bulkAssembly){
+                completeBulkChunk(next, expiredRequestResponse, clientSocket);
+            } else {
+                replyToClient(next.envelope, expiredRequestResponse, clientSocket, next.captureId);
+            }
+            continue;
+        }
+        actor.inFlight = std::move(next);
+        actor.inFlightLane = laneIndex;
+        actor.socket.send(actor.inFlight.payload, zmq::send_flags::none);
+        actor.busy = true;
+    }
+}
+
+void recordLatency(Lane &lane, double latencyMs){
+    if(lane.latencySamplesMs.size() < latencySampleCount){
+        lane.latencySamplesMs.push_back(latencyMs);
+    } else {
+        lane.latencySamplesMs[lane.nextSample] = latencyMs;
+    }
+    lane.nextSample = (lane.nextSample + 1) % latencySampleCount;
+    lane.servedSinceReport++;
+}
+
+void completeActorRequest(ActorLink &actor, zmq::socket_t &clientSocket){
     zmq::message_t responseMessage;
-    actorSocket.recv(responseMessage, zmq::recv_flags::none);
-    
-    return std::string(static_cast<char*>(responseMessage.data()), responseMessage.size());
+    actor.socket.recv(responseMessage, zmq::recv_flags::none);
+    actor.busy = false;
+
+    PendingRequest &finished = actor.inFlight;
+    recordLatency(actor.lanes[actor.inFlightLane],
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - finished.enqueuedAt).count());
+
+    //Chunk replies are read where they are; any other reply frame is passed on
+    if(finished.bulkAssembly){
+        completeBulkChunk(finished, responseMessage.to_string_view(), clientSocket);
+    } else {
+        replyToClient(finished.envelope, responseMessage, clientSocket, finished.captureId);
+    }
+    finished = PendingRequest();
+}
+
+void reportLanes(std::vector<std::unique_ptr<ActorLink>> &actors){
+    for(std::unique_ptr<ActorLink> &actor : actors){
+        for(int laneIndex = 0; laneIndex < LANE_KIND_COUNT; laneIndex++){
+            Lane &lane = actor->lanes[laneIndex];
+            if(lane.servedSinceReport == 0 && lane.expiredSinceReport == 0 && lane.queue.empty()){
+                continue;
+            }
+            std::vector<double> sortedSamples = lane.latencySamplesMs;
+            std::sort(sortedSamples.begin(), sortedSamples.end());
+            double p50 = sortedSamples.empty() ? 0 : sortedSamples[sortedSamples.size() / 2];
+            double p99 = sortedSamples.empty() ? 0 : sortedSamples[std::min(sortedSamples.size() - 1, sortedSamples.size() * 99 / 100)];
+            std::printf("[GC-Lanes] %s %s: %llu served, %llu expired, %zu queued, p50 %.2f ms, p99 %.2f ms\n", actor->name.c_str(),
+                        laneKindNames[laneIndex], (unsigned long long)lane.servedSinceReport, (unsigned long long)lane.expiredSinceReport,
+                        lane.queue.size(), p50, p99);
+            lane.servedSinceReport = 0;
+            lane.expiredSinceReport = 0;
+        }
+    }
+    std::fflush(stdout);
 }
 
 int main(int argc, char* argv[]){
     std::vector<std::string> ipAddressList;
     std::int8_t locationIndex;
-    
+    //Interactive, batch and bulk lane weights
+    long laneWeights[LANE_KIND_COUNT] = {16, 4, 1};
+
+    std::string capturePath;
+    //Several GCs may serve one location, each on its own port, sharing its actors
+    int clientPort = 5555;
+
     if (argc == 1){
         std::cout << "[GC-Error] Cannot establish connection without IP\n";
         return 0;
-    } else if (argc == 2){
-        obtainEnvData(ipAddressList);
-        locationIndex = std::int8_t(std::stoi(argv[1])) - 1;
-        
-        if (locationIndex >= std::int8_t(ipAddressList.size())){
-            std::cout << "[GC-Error] This location does not exist\n";
-            return 0;
+    }
+    bool validArguments = true;
+    for (int argumentIndex = 2; argumentIndex < argc; argumentIndex++){
+        std::string argument = argv[argumentIndex];
+        if (argument == "--weights" && argumentIndex + 1 < argc){
+            validArguments = validArguments && parseLaneWeights(argv[++argumentIndex], laneWeights);
+        } else if (argument == "--capture" && argumentIndex + 1 < argc){
+            capturePath = argv[++argumentIndex];
+        } else if (argument == "--port" && argumentIndex + 1 < argc){
+            char trailing;
+            validArguments = validArguments && std::sscanf(argv[++argumentIndex], "%d%c", &clientPort, &trailing) == 1 &&
+                             clientPort >= 1 && clientPort <= 65535;
+        } else {
+            validArguments = false;
         }
     }
-    
+    if (!validArguments){
+        std::cout << "[GC-Error] Run format: ./gc #Location [--weights interactive,batch,bulk] [--capture file] [--port P]\n";
+        return 0;
+    }
+
+    obtainEnvData(ipAddressList);
+    locationIndex = std::int8_t(std::stoi(argv[1])) - 1;
+
+    if (locationIndex >= std::int8_t(ipAddressList.size())){
+        std::cout << "[GC-Error] This location does not exist\n";
+        return 0;
+    }
+
     std::cout << "========================================\n";
     std::cout << "  LOAD MANAGER (GC) - STARTING\n";
     std::cout << "========================================\n";
 
     zmq::context_t zmqContext(1);
-    
-    zmq::socket_t clientSocket(zmqContext, zmq::socket_type::rep);
+
+    //ROUTER so requests from many PS can wait in the lanes at once
+    zmq::socket_t clientSocket(zmqContext, zmq::socket_type::router);
     std::string clientEndpoint = "tcp://";
     clientEndpoint.append(ipAddressList[locationIndex]);
-    clientEndpoint.append(":5555");
+    clientEndpoint.append(":" + std::to_string(clientPort));
     clientSocket.bind(clientEndpoint);
     std::cout << "[GC] Listening for PS on " << clientEndpoint << "\n";
 
-    zmq::socket_t loanActorSocket(zmqContext, zmq::socket_type::req);
-    std::string loanActorEndpoint = "tcp://";
-    loanActorEndpoint.append(ipAddressList[locationIndex]);
-    loanActorEndpoint.append(":5556");
-    loanActorSocket.connect(loanActorEndpoint);
+    std::vector<std::unique_ptr<ActorLink>> actors;
+    actors.emplace_back(new ActorLink(zmqContext, "AP", "tcp://" + ipAddressList[locationIndex] + ":5556", laneWeights));
     std::cout << "[GC] Connected to Loan Actor on port 5556\n";
-
-    zmq::socket_t renewalActorSocket(zmqContext, zmq::socket_type::req);
-    std::string renewalActorEndpoint = "tcp://";
-    renewalActorEndpoint.append(ipAddressList[locationIndex]);
-    renewalActorEndpoint.append(":5558");
-    renewalActorSocket.connect(renewalActorEndpoint);
+    actors.emplace_back(new ActorLink(zmqContext, "AR", "tcp://" + ipAddressList[locationIndex] + ":5558", laneWeights));
     std::cout << "[GC] Connected to Renewal Actor on port 5558\n";
-
-    zmq::socket_t returnActorSocket(zmqContext, zmq::socket_type::req);
-    std::string returnActorEndpoint = "tcp://";
-    returnActorEndpoint.append(ipAddressList[locationIndex]);
-    returnActorEndpoint.append(":5557");
-    returnActorSocket.connect(returnActorEndpoint);
+    actors.emplace_back(new ActorLink(zmqContext, "AD", "tcp://" + ipAddressList[locationIndex] + ":5557", laneWeights));
     std::cout << "[GC] Connected to Return Actor on port 5557\n";
+    ActorLink &loanActor = *actors[0];
 
+    //Both GAs publish the code filter of their catalog on port 5566
+    zmq::socket_t catalogSocket(zmqContext, zmq::socket_type::sub);
+    for(const std::string &gaIpAddress : ipAddressList){
+        catalogSocket.connect("tcp://" + gaIpAddress + ":5566");
+    }
+    catalogSocket.set(zmq::sockopt::subscribe, "catalog");
+    std::vector<BookCodeFilter> catalogFilters(ipAddressList.size());
+
+    std::cout << "[GC] Lane weights: interactive " << laneWeights[INTERACTIVE_LANE] << ", batch " << laneWeights[BATCH_LANE]
+              << ", bulk " << laneWeights[BULK_LANE] << "\n";
+    if (!capturePath.empty()){
+        if (!trafficCapture.open(capturePath)){
+            std::cout << "[GC-Error] Cannot open capture file " << capturePath << "\n";
+            return 0;
+        }
+        std::cout << "[GC] Capturing traffic to " << capturePath << "\n";
+    }
     std::cout << "[GC] Ready to process requests\n\n";
 
+    auto lastReport = std::chrono::steady_clock::now();
+    auto lastCaptureFlush = lastReport;
     while(true){
-        zmq::message_t clientRequest;
-        zmq::recv_result_t receiveResult = clientSocket.recv(clientRequest, zmq::recv_flags::none);
-        
-        if(!receiveResult || clientRequest.size() == 0){
-            continue;
+        zmq::pollitem_t pollItems[] = {
+            {static_cast<void*>(clientSocket), 0, ZMQ_POLLIN, 0},
+            {static_cast<void*>(actors[0]->socket), 0, ZMQ_POLLIN, 0},
+            {static_cast<void*>(actors[1]->socket), 0, ZMQ_POLLIN, 0},
+            {static_cast<void*>(actors[2]->socket), 0, ZMQ_POLLIN, 0},
+            {static_cast<void*>(catalogSocket), 0, ZMQ_POLLIN, 0}
+        };
+        zmq::poll(pollItems, 5, std::chrono::milliseconds(1000));
+
+        if(pollItems[4].revents & ZMQ_POLLIN){
+            receiveCatalogFilter(catalogSocket, catalogFilters);
         }
-        
-        Request parsedRequest;
-        memcpy(&parsedRequest, clientRequest.data(), sizeof(Request));
-        
-        std::cout << "[GC] Request received from PS:\n";
-        std::cout << "[GC] Type: " << int(parsedRequest.requestType) << "\n";
-        std::cout << "[GC] Code: " << parsedRequest.code << "\n";
-        std::cout << "[GC] Location: " << int(parsedRequest.location) << "\n\n";
-        
-        std::string actorResponse;
-        
-        switch(int(parsedRequest.requestType)){
-            case 0:
-                std::cout << "[GC] Routing LOAN request to actor\n";
-                actorResponse = sendSynchronousRequest(parsedRequest, loanActorSocket);
-                break;
-                
-            case 1:
-                std::cout << "[GC] Routing RENEWAL request to actor\n";
-                actorResponse = sendSynchronousRequest(parsedRequest, renewalActorSocket);
-                break;
-                
-            case 2:
-                std::cout << "[GC] Routing RETURN request to actor\n";
-                actorResponse = sendSynchronousRequest(parsedRequest, returnActorSocket);
-                break;
-                
-            default:
-                actorResponse = "Error: Unknown request type";
-                break;
-        }
-        
-        std::cout << "[GC] Sending response to PS: " << actorResponse << "\n\n";
-        clientSocket.send(zmq::buffer(actorResponse), zmq::send_flags::none);
-    }
-    
+
+        if(pollItems[0].revents & ZMQ_POLLIN){
+            zmq::message_t clientRequest;
+            std::vector<zmq::message_t> envelope = receiveClientRequest(clientSocket, clientRequest);
+            std::uint64_t captureId = trafficCapture.recordRequest(clientRequest.data(), clientRequest.size());
+
+            if(clientRequest.size() < sizeof(Request)){
+                replyToClient(envelope, "Error: Malformed request", clientSocket, captureId);
+            } else {
+                Request parsedRequest;
+                memcpy(&parsedRequest, clientRequest.data(), sizeof(Request));
+
+                std::cout << "[GC] Request received from PS:\n";
+                std::cout << "[GC] Type: " << int(parsedRequest.requestType) << "\n";
+                std::cout << "[GC] Code: " << parsedRequest.code << "\n";
+                std::cout << "[GC] Location: " << int(parsedRequest.location) << "\n\n";
+
+                int requestType = int(parsedRequest.requestType);
+                if(requestType == 4){
+                    //The loan actor forwards whole batches; GA resolves each operation by its own type
+                    enqueueBulkRequest(envelope, clientRequest, loanActor, catalogFilters, captureId, clientSocket);
+                } else if(((requestType >= 0 && requestType <= 2) || requestType == 6) && isUnknownBook(catalogFilters, parsedRequest.code)){
+                    std::cout << "[GC-Filter] Book " << parsedRequest.code << " is not in the catalog, answering without the actors\n";
+                    replyToClient(envelope, unknownBookResponse(parsedRequest.requestType), clientSocket, captureId);
+                } else if(requestType >= 0 && requestType <= 7){
+                    //Overdue queries, searches, reservations and checkouts travel with the loan actor's traffic
+                    ActorLink &actor = requestType >= 3 ? loanActor : *actors[requestType];
+                    int laneIndex = parsedRequest.source == RequestSource::BATCH ? BATCH_LANE : INTERACTIVE_LANE;
+                    PendingRequest pending;
+                    pending.envelope = std::move(envelope);
+                    pending.payload = std::move(clientRequest);
+                    pending.captureId = captureId;
+                    pending.enqueuedAt = std::chrono::steady_clock::now();
+                    actor.lanes[laneIndex].queue.push_back(std::move(pending));
+                    std::cout << "[GC] Routing request to " << actor.name << " (" << laneKindNames[laneIndex] << " lane)\n";
+                } else {
+                    replyToClient(envelope, "Error: Unknown request type", clientSocket, captureId);
+                }
+            }
+        }
+
+        for(std::size_t actorIndex = 0; actorIndex < actors.size(); actorIndex++){
+            if(pollItems[actorIndex + 1].revents & ZMQ_POLLIN){
+                completeActorRequest(*actors[actorIndex], clientSocket);
+            }
+        }
+        for(std::unique_ptr<ActorLink> &actor : actors){
+            dispatchToActor(*actor, clientSocket);
+        }
+
+        if(std::chrono::steady_clock::now() - lastReport >= std::chrono::seconds(laneReportIntervalSeconds)){
+            reportLanes(actors);
+            lastReport = std::chrono::steady_clock::now();
+        }
+        //GC is stopped with a signal, so at most a second of capture is lost
+        if(trafficCapture.isActive() && std::chrono::steady_clock::now() - lastCaptureFlush >= std::chrono::seconds(1)){
+            trafficCapture.flush();
+            lastCaptureFlush = std::chrono::steady_clock::now();
+        }
+    }
+
     return 0;
-}
\ No newline at end of file
+}
@@ -5,7 +5,22 @@
 #include <cstdint>
 #include <fstream>
 #include <vector>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <limits>
+#include <cstdio>
+#include <algorithm>
 #include "../../utils/structs.cpp"
+#include "../../utils/deadline.cpp"
+#include "../../utils/shardMap.cpp"
+#include "../../utils/requestFile.cpp"
+#include "../../utils/gcPool.cpp"
+
+std::atomic<bool> isRunning(true);
+//How long a request may take before GC, the actors and GA stop working on
+//it; 0 sends requests without a deadline
+int requestDeadlineMs = defaultRequestDeadlineMs;
 
 void obtainEnvData(std::vector<std::string> &environmentVariables){
     std::fstream configFile("../.env");
@@ -25,123 +40,298 @@ void displayMenu(){
     std::cout << "1. Loan a book\n";
     std::cout << "2. Renew a loan\n";
     std::cout << "3. Return a book\n";
-    std::cout << "4. Exit\n";
+    std::cout << "4. Search the catalog\n";
+    std::cout << "5. Reserve a book\n";
+    std::cout << "6. Checkout several books\n";
+    std::cout << "7. Overdue loans at this location\n";
+    std::cout << "8. Exit\n";
     std::cout << "========================================\n";
     std::cout << "Option: ";
 }
 
-void sendRequestToGc(const Request& clientRequest, zmq::socket_t& gcSocket){
-    zmq::message_t requestMessage(sizeof(Request));
-    memcpy(requestMessage.data(), &clientRequest, sizeof(Request));
-    gcSocket.send(requestMessage, zmq::send_flags::none);
-    std::cout << "[PS] Request sent to GC\n";
-}
-
-void receiveResponseFromGc(zmq::socket_t& gcSocket){
+//Returns the reply, empty when none came
+std::string exchangeWithGc(zmq::message_t &requestMessage, GcPool &gcPool){
+    std::cout << "[PS] Sending request to GC\n";
     zmq::message_t gcResponse;
-    zmq::recv_result_t receiveResult = gcSocket.recv(gcResponse, zmq::recv_flags::none);
-    
-    if(!receiveResult){
+    if(!gcPool.exchange(requestMessage, gcResponse)){
         std::cerr << "[PS-Error] No successful response from GC\n";
-        return;
+        return "";
     }
     
     std::string responseContent(static_cast<char*>(gcResponse.data()), gcResponse.size());
     std::cout << "[PS-Response] " << responseContent << "\n";
+    return responseContent;
+}
+
+std::string sendRequestToGc(const Request& clientRequest, GcPool& gcPool){
+    Request stampedRequest = clientRequest;
+    setRequestDeadline(stampedRequest, requestDeadlineMs);
+    zmq::message_t requestMessage(sizeof(Request));
+    memcpy(requestMessage.data(), &stampedRequest, sizeof(Request));
+    return exchangeWithGc(requestMessage, gcPool);
+}
+
+//SEARCH and RESERVE are a Request header followed by text: the query, or the patron's name
+std::string sendTextRequestToGc(const Request &requestHeader, const std::string &requestText, GcPool& gcPool){
+    Request stampedHeader = requestHeader;
+    setRequestDeadline(stampedHeader, requestDeadlineMs);
+    zmq::message_t requestMessage(sizeof(Request) + requestText.size());
+    memcpy(requestMessage.data(), &stampedHeader, sizeof(Request));
+    memcpy(static_cast<char*>(requestMessage.data()) + sizeof(Request), requestText.data(), requestText.size());
+    return exchangeWithGc(requestMessage, gcPool);
+}
+
+//CHECKOUT is a Request header with the item count followed by the items, so
+//the whole basket is one round trip and one transaction in GA
+std::string sendCheckoutToGc(const std::vector<Request> &items, std::int8_t currentLocation, CheckoutMode checkoutMode, GcPool& gcPool){
+    Request checkoutHeader;
+    checkoutHeader.requestType = RequestType::CHECKOUT;
+    checkoutHeader.code = std::int32_t(items.size());
+    checkoutHeader.location = currentLocation;
+    checkoutHeader.checkoutMode = checkoutMode;
+    setRequestDeadline(checkoutHeader, requestDeadlineMs);
+
+    zmq::message_t checkoutMessage(sizeof(Request) * (items.size() + 1));
+    memcpy(checkoutMessage.data(), &checkoutHeader, sizeof(Request));
+    memcpy(static_cast<char*>(checkoutMessage.data()) + sizeof(Request), items.data(), sizeof(Request) * items.size());
+    return exchangeWithGc(checkoutMessage, gcPool);
+}
+
+//Reads basket items, one "<LOAN|RENEWAL|RETURN> <code>" per line, until END
+std::vector<Request> readCheckoutItems(std::int8_t currentLocation){
+    std::vector<Request> items;
+    std::string itemType;
+    std::cout << "\n[PS] Enter one item per line as LOAN, RENEWAL or RETURN followed by the book code, END to finish\n";
+    while(items.size() < std::size_t(maxCheckoutItems) && std::cin >> itemType && itemType != "END"){
+        Request item;
+        item.location = currentLocation;
+        if(itemType == "LOAN"){
+            item.requestType = RequestType::LOAN;
+        } else if(itemType == "RENEWAL"){
+            item.requestType = RequestType::RENEWAL;
+        } else if(itemType == "RETURN"){
+            item.requestType = RequestType::RETURN;
+        } else {
+            std::cout << "[PS-Error] Unknown item type: " << itemType << "\n";
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            continue;
+        }
+        if(!(std::cin >> item.code)){
+            std::cin.clear();
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            std::cout << "[PS-Error] Book code must be a number\n";
+            continue;
+        }
+        items.push_back(item);
+    }
+    if(items.size() == std::size_t(maxCheckoutItems)){
+        std::cout << "[PS] A checkout holds at most " << maxCheckoutItems << " items\n";
+    }
+    return items;
 }
 
-void processFileRequests(const std::string &filePath, std::int8_t currentLocation, zmq::socket_t& gcSocket){
-    std::string requestTypeStr, bookCodeStr, locationStr;
-    std::fstream requestFile(filePath);
+//Waits for the GAs to announce that a reserved copy was lent to patron. Events
+//come from whichever GA served the return, so both are watched, on the ports
+//of every shard there may be; ZeroMQ keeps quietly retrying the unused ones.
+void listenForReservations(zmq::context_t &context, const std::vector<std::string> &ipAddressList, const std::string &patron){
+    zmq::socket_t eventSocket(context, zmq::socket_type::sub);
+    for(const std::string &gaIpAddress : ipAddressList){
+        for(int shard = 0; shard < maxShardCount; shard++){
+            eventSocket.connect(shardEndpoint(gaIpAddress, 5564, shard));
+        }
+    }
+    eventSocket.set(zmq::sockopt::subscribe, "reservation:" + patron + ":");
+    eventSocket.set(zmq::sockopt::rcvtimeo, 500);
+
+    while(isRunning){
+        zmq::message_t topicMessage, eventMessage;
+        if(!eventSocket.recv(topicMessage, zmq::recv_flags::none) || !topicMessage.more()){
+            continue;
+        }
+        eventSocket.recv(eventMessage, zmq::recv_flags::none);
+        //Event: code|sede|result of the loan made for the patron
+        std::string event(static_cast<char*>(eventMessage.data()), eventMessage.size());
+        std::size_t codeEnd = event.find('|');
+        std::size_t sedeEnd = event.find('|', codeEnd + 1);
+        std::cout << "\n[PS-Reservation] " << patron << ", book " << event.substr(0, codeEnd) << " at location "
+                  << event.substr(codeEnd + 1, sedeEnd - codeEnd - 1) << ": " << event.substr(sedeEnd + 1) << "\n";
+    }
+}
+
+void processFileRequests(const std::string &filePath, std::int8_t currentLocation, GcPool& gcPool){
+    RequestFileReader requestFile;
     
-    if(!requestFile.is_open()){
+    if(!requestFile.open(filePath)){
         std::cerr << "[PS-Error] Cannot open file: " << filePath << "\n";
         return;
     }
     
     Request clientRequest;
     int requestCounter = 1;
+    int expiredRequests = 0;
+    const char *requestTypeNames[] = {"LOAN", "RENEWAL", "RETURN"};
     
-    std::cout << "[PS] Processing requests from file...\n\n";
+    std::cout << "[PS] Processing requests from " << (requestFile.isCompiled() ? "compiled " : "") << "file...\n\n";
     
-    while(requestFile >> requestTypeStr >> bookCodeStr >> locationStr){
+    for(RequestLine line = requestFile.next(clientRequest); line != RequestLine::END; line = requestFile.next(clientRequest)){
         std::cout << "[PS] Processing request #" << requestCounter << "\n";
         
-        clientRequest.code = std::int32_t(std::stoi(bookCodeStr));
-        std::int8_t requestedLocation = std::int8_t(std::stoi(locationStr)) - 1;
-        
-        if(requestedLocation != currentLocation){
-            std::cout << "[PS-Warning] Request location mismatch. You must be at location " 
-                      << (requestedLocation + 1) << "\n\n";
+        if(line == RequestLine::MALFORMED || int(clientRequest.requestType) > 2){
+            std::cout << "[PS-Error] Not a LOAN, RENEWAL or RETURN request with a code and a location\n\n";
             requestCounter++;
             continue;
         }
-        
-        clientRequest.location = requestedLocation;
-        
-        if(requestTypeStr == "LOAN"){
-            clientRequest.requestType = RequestType::LOAN;
-            std::cout << "[PS] Type: LOAN\n";
-        } else if(requestTypeStr == "RENEWAL"){
-            clientRequest.requestType = RequestType::RENEWAL;
-            std::cout << "[PS] Type: RENEWAL\n";
-        } else if(requestTypeStr == "RETURN"){
-            clientRequest.requestType = RequestType::RETURN;
-            std::cout << "[PS] Type: RETURN\n";
-        } else {
-            std::cout << "[PS-Error] Unknown request type: " << requestTypeStr << "\n\n";
+        if(clientRequest.location != currentLocation){
+            std::cout << "[PS-Warning] Request location mismatch. You must be at location " 
+                      << (clientRequest.location + 1) << "\n\n";
             requestCounter++;
             continue;
         }
         
+        std::cout << "[PS] Type: " << requestTypeNames[int(clientRequest.requestType)] << "\n";
         std::cout << "[PS] Book code: " << clientRequest.code << "\n";
         std::cout << "[PS] Location: " << (int(clientRequest.location) + 1) << "\n";
         
-        sendRequestToGc(clientRequest, gcSocket);
-        receiveResponseFromGc(gcSocket);
+        if(sendRequestToGc(clientRequest, gcPool) == expiredRequestResponse){
+            expiredRequests++;
+        }
         
         std::cout << "\n";
         requestCounter++;
     }
     
-    requestFile.close();
     std::cout << "[PS] Finished processing " << (requestCounter - 1) << " requests from file\n";
+    std::cout << "[PS] Expired before being processed: " << expiredRequests << "\n";
+}
+
+//Sends one BULK message and tallies the per-operation outcome bytes GA returns
+void sendBulkChunk(const std::vector<Request> &bulkOperations, std::int8_t currentLocation, GcPool& gcPool, std::vector<int> &outcomeCounts){
+    Request bulkHeader;
+    bulkHeader.requestType = RequestType::BULK;
+    bulkHeader.code = std::int32_t(bulkOperations.size());
+    bulkHeader.location = currentLocation;
+    //A batch waits behind interactive traffic, so it gets longer than one request
+    setRequestDeadline(bulkHeader, requestDeadlineMs > 0 ? std::max(requestDeadlineMs, bulkRequestDeadlineMs) : 0);
+    
+    zmq::message_t bulkMessage(sizeof(Request) * (bulkOperations.size() + 1));
+    memcpy(bulkMessage.data(), &bulkHeader, sizeof(Request));
+    memcpy(static_cast<char*>(bulkMessage.data()) + sizeof(Request), bulkOperations.data(), sizeof(Request) * bulkOperations.size());
+    
+    zmq::message_t gcResponse;
+    if(!gcPool.exchange(bulkMessage, gcResponse)){
+        std::cerr << "[PS-Error] No successful response from GC\n";
+        outcomeCounts[int(BulkOutcome::FAILED)] += bulkOperations.size();
+        return;
+    }
+    
+    std::string responseContent(static_cast<char*>(gcResponse.data()), gcResponse.size());
+    if(responseContent.rfind("BULK:", 0) != 0 || responseContent.size() - 5 != bulkOperations.size()){
+        std::cout << "[PS-Response] " << responseContent << "\n";
+        outcomeCounts[int(BulkOutcome::FAILED)] += bulkOperations.size();
+        return;
+    }
+    for(std::size_t position = 5; position < responseContent.size(); position++){
+        std::uint8_t outcome = std::uint8_t(responseContent[position]);
+        outcomeCounts[outcome <= std::uint8_t(BulkOutcome::EXPIRED) ? outcome : int(BulkOutcome::FAILED)]++;
+    }
+}
+
+void processBulkFileRequests(const std::string &filePath, std::int8_t currentLocation, GcPool& gcPool){
+    RequestFileReader requestFile;
+    
+    if(!requestFile.open(filePath)){
+        std::cerr << "[PS-Error] Cannot open file: " << filePath << "\n";
+        return;
+    }
+    
+    std::vector<Request> bulkOperations;
+    bulkOperations.reserve(maxBulkOperations);
+    std::vector<int> outcomeCounts(int(BulkOutcome::EXPIRED) + 1, 0);
+    int skippedRequests = 0;
+    int sentRequests = 0;
+    
+    std::cout << "[PS] Processing requests from " << (requestFile.isCompiled() ? "compiled " : "") << "file in bulk mode...\n\n";
+    
+    Request clientRequest;
+    for(RequestLine line = requestFile.next(clientRequest); line != RequestLine::END; line = requestFile.next(clientRequest)){
+        if(line == RequestLine::MALFORMED || int(clientRequest.requestType) > 2 || clientRequest.location != currentLocation){
+            skippedRequests++;
+            continue;
+        }
+        
+        bulkOperations.push_back(clientRequest);
+        if(bulkOperations.size() == std::size_t(maxBulkOperations)){
+            sendBulkChunk(bulkOperations, currentLocation, gcPool, outcomeCounts);
+            sentRequests += bulkOperations.size();
+            std::cout << "[PS] Sent " << sentRequests << " requests\n";
+            bulkOperations.clear();
+        }
+    }
+    if(!bulkOperations.empty()){
+        sendBulkChunk(bulkOperations, currentLocation, gcPool, outcomeCounts);
+        sentRequests += bulkOperations.size();
+    }
+    
+    std::cout << "[PS] Finished processing " << sentRequests << " requests in bulk mode\n";
+    std::cout << "[PS] Successful: " << outcomeCounts[int(BulkOutcome::OK)] << "\n";
+    std::cout << "[PS] Book does not exist: " << outcomeCounts[int(BulkOutcome::BOOK_NOT_FOUND)] << "\n";
+    std::cout << "[PS] No available copies: " << outcomeCounts[int(BulkOutcome::NO_COPIES)] << "\n";
+    std::cout << "[PS] No active loan: " << outcomeCounts[int(BulkOutcome::NO_ACTIVE_LOAN)] << "\n";
+    std::cout << "[PS] Renewal limit reached: " << outcomeCounts[int(BulkOutcome::RENEWAL_LIMIT)] << "\n";
+    std::cout << "[PS] Failed: " << outcomeCounts[int(BulkOutcome::FAILED)] << "\n";
+    std::cout << "[PS] Expired before being applied: " << outcomeCounts[int(BulkOutcome::EXPIRED)] << "\n";
+    std::cout << "[PS] Skipped (location mismatch or malformed line): " << skippedRequests << "\n";
 }
 
 int main(int argc, char* argv[]){
     std::vector<std::string> ipAddressList;
     std::int8_t locationIndex;
     bool useFileMode = false;
+    bool useBulkMode = false;
     std::string inputFilePath;
     
     if(argc == 1){
         std::cerr << "[PS-Error] Cannot establish connection without library location\n";
-        std::cerr << "[PS-Error] Usage: ./ps <location> [-f <file>]\n";
+        std::cerr << "[PS-Error] Usage: ./ps <location> [-f <file> [--bulk]] [--deadline-ms N] [--gc host:port,...]\n";
         return 0;
-    } else if(argc == 2){
-        obtainEnvData(ipAddressList);
-        locationIndex = std::int8_t(std::stoi(argv[1])) - 1;
-        
-        if(locationIndex >= std::int8_t(ipAddressList.size())){
-            std::cerr << "[PS-Error] Location does not exist\n";
-            return 0;
-        }
-    } else if((argc == 4) && (std::string(argv[2]) == "-f")){
-        obtainEnvData(ipAddressList);
-        locationIndex = std::int8_t(std::stoi(argv[1])) - 1;
-        
-        if(locationIndex >= std::int8_t(ipAddressList.size())){
-            std::cerr << "[PS-Error] Location does not exist\n";
-            return 0;
+    }
+    //The location's GC on 5555 unless a list is given
+    std::string gcList = "5555";
+    bool validArguments = true;
+    for(int argumentIndex = 2; argumentIndex < argc; argumentIndex++){
+        std::string argument = argv[argumentIndex];
+        if(argument == "-f" && argumentIndex + 1 < argc && !useFileMode){
+            inputFilePath = "../";
+            inputFilePath.append(argv[++argumentIndex]);
+            std::cout << "[PS] File mode enabled: " << argv[argumentIndex] << "\n";
+            useFileMode = true;
+        } else if(argument == "--bulk"){
+            useBulkMode = true;
+        } else if(argument == "--deadline-ms" && argumentIndex + 1 < argc){
+            char trailing;
+            validArguments = validArguments && std::sscanf(argv[++argumentIndex], "%d%c", &requestDeadlineMs, &trailing) == 1 &&
+                             requestDeadlineMs >= 0 && requestDeadlineMs <= 3600000;
+        } else if(argument == "--gc" && argumentIndex + 1 < argc){
+            gcList = argv[++argumentIndex];
+        } else {
+            validArguments = false;
         }
-        
-        inputFilePath = "../";
-        inputFilePath.append(argv[3]);
-        std::cout << "[PS] File mode enabled: " << argv[3] << "\n";
-        useFileMode = true;
-    } else {
+    }
+    if(!validArguments || (useBulkMode && !useFileMode)){
         std::cerr << "[PS-Error] Invalid arguments\n";
-        std::cerr << "[PS-Error] Usage: ./ps <location> [-f <file>]\n";
+        std::cerr << "[PS-Error] Usage: ./ps <location> [-f <file> [--bulk]] [--deadline-ms N] [--gc host:port,...]\n";
+        return 0;
+    }
+    obtainEnvData(ipAddressList);
+    locationIndex = std::int8_t(std::stoi(argv[1])) - 1;
+    
+    if(locationIndex >= std::int8_t(ipAddressList.size())){
+        std::cerr << "[PS-Error] Location does not exist\n";
+        return 0;
+    }
+    std::vector<std::string> gcEndpoints;
+    if(!parseGcEndpoints(gcList, ipAddressList[locationIndex], gcEndpoints)){
+        std::cerr << "[PS-Error] Invalid GC list: " << gcList << "\n";
         return 0;
     }
 
@@ -150,25 +340,29 @@ int main(int argc, char* argv[]){
     std::cout << "========================================\n";
 
     zmq::context_t zmqContext(1);
-    zmq::socket_t gcSocket(zmqContext, zmq::socket_type::req);
-    std::string gcEndpoint = "tcp://";
-    gcEndpoint.append(ipAddressList[locationIndex]);
-    gcEndpoint.append(":5555");
-    gcSocket.connect(gcEndpoint);
-    
-    std::cout << "[PS] Connected to GC at: " << gcEndpoint << "\n";
+    GcPool gcPool(zmqContext);
+    for(const std::string &gcEndpoint : gcEndpoints){
+        gcPool.addEndpoint(gcEndpoint);
+        std::cout << "[PS] Connecting to GC at: " << gcEndpoint << "\n";
+    }
     std::cout << "[PS] Current location: " << (int(locationIndex) + 1) << "\n\n";
 
     if(useFileMode){
-        processFileRequests(inputFilePath, locationIndex, gcSocket);
-        gcSocket.disconnect(gcEndpoint);
-        gcSocket.close();
+        if(useBulkMode){
+            processBulkFileRequests(inputFilePath, locationIndex, gcPool);
+        } else {
+            processFileRequests(inputFilePath, locationIndex, gcPool);
+        }
+        gcPool.close();
         return 0;
     }
 
     int selectedOption;
     Request clientRequest;
     clientRequest.location = locationIndex;
+    //One subscriber per patron who reserved from this PS
+    std::set<std::string> listeningPatrons;
+    std::vector<std::thread> reservationListeners;
     
     while(true){
         displayMenu();
@@ -180,8 +374,7 @@ int main(int argc, char* argv[]){
                 std::cout << "\n[PS] Enter the book code you wish to loan: ";
                 std::cin >> clientRequest.code;
                 std::cout << "\n[PS] Sending LOAN request...\n";
-                sendRequestToGc(clientRequest, gcSocket);
-                receiveResponseFromGc(gcSocket);
+                sendRequestToGc(clientRequest, gcPool);
                 break;
                 
             case 2:
@@ -189,8 +382,7 @@ int main(int argc, char* argv[]){
                 std::cout << "\n[PS] Enter the book code you wish to renew: ";
                 std::cin >> clientRequest.code;
                 std::cout << "\n[PS] Sending RENEWAL request...\n";
-                sendRequestToGc(clientRequest, gcSocket);
-                receiveResponseFromGc(gcSocket);
+                sendRequestToGc(clientRequest, gcPool);
                 break;
                 
             case 3:
@@ -198,19 +390,75 @@ int main(int argc, char* argv[]){
                 std::cout << "\n[PS] Enter the book code you wish to return: ";
                 std::cin >> clientRequest.code;
                 std::cout << "\n[PS] Sending RETURN request...\n";
-                sendRequestToGc(clientRequest, gcSocket);
-                receiveResponseFromGc(gcSocket);
+                sendRequestToGc(clientRequest, gcPool);
+                break;
+                
+            case 4: {
+                std::string searchQuery;
+                std::cout << "\n[PS] Enter words from the title or author: ";
+                std::getline(std::cin >> std::ws, searchQuery);
+                std::cout << "\n[PS] Sending SEARCH request...\n";
+                Request searchHeader;
+                searchHeader.requestType = RequestType::SEARCH;
+                searchHeader.code = 0;
+                searchHeader.location = locationIndex;
+                sendTextRequestToGc(searchHeader, searchQuery, gcPool);
                 break;
+            }
                 
-            case 4:
+            case 5: {
+                std::string patron;
+                clientRequest.requestType = RequestType::RESERVE;
+                std::cout << "\n[PS] Enter the book code you wish to reserve: ";
+                std::cin >> clientRequest.code;
+                std::cout << "[PS] Enter your name: ";
+                std::getline(std::cin >> std::ws, patron);
+                //Subscribe before asking, so a copy lent right away is not missed
+                if(listeningPatrons.insert(patron).second){
+                    reservationListeners.emplace_back(listenForReservations, std::ref(zmqContext), std::cref(ipAddressList), patron);
+                }
+                std::cout << "\n[PS] Sending RESERVE request...\n";
+                sendTextRequestToGc(clientRequest, patron, gcPool);
+                break;
+            }
+                
+            case 6: {
+                std::vector<Request> items = readCheckoutItems(locationIndex);
+                if(items.empty()){
+                    std::cout << "[PS] Nothing to check out\n";
+                    break;
+                }
+                std::string answer;
+                std::cout << "[PS] Apply all items or none of them? (y/n): ";
+                std::cin >> answer;
+                CheckoutMode checkoutMode = answer == "y" ? CheckoutMode::ALL_OR_NOTHING : CheckoutMode::PER_ITEM;
+                std::cout << "\n[PS] Sending CHECKOUT request (" << items.size() << " items)...\n";
+                sendCheckoutToGc(items, locationIndex, checkoutMode, gcPool);
+                break;
+            }
+
+            case 7: {
+                Request overdueRequest;
+                overdueRequest.requestType = RequestType::OVERDUE;
+                overdueRequest.code = 0;
+                overdueRequest.location = locationIndex;
+                std::cout << "\n[PS] Sending OVERDUE request...\n";
+                sendRequestToGc(overdueRequest, gcPool);
+                break;
+            }
+
+            case 8:
                 std::cout << "\n[PS] Disconnecting from system...\n";
-                gcSocket.disconnect(gcEndpoint);
-                gcSocket.close();
+                isRunning = false;
+                for(std::thread &listener : reservationListeners){
+                    listener.join();
+                }
+                gcPool.close();
                 std::cout << "[PS] Goodbye!\n";
                 return 0;
                 
             default:
-                std::cout << "\n[PS-Error] Invalid option. Please select 1-4.\n";
+                std::cout << "\n[PS-Error] Invalid option. Please select 1-8.\n";
                 break;
         }
     }
@@ -0,0 +1,411 @@
+#include <zmq.hpp>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../../utils/structs.cpp"
+#include "../../utils/deadline.cpp"
+#include "../../utils/trafficCapture.cpp"
+#include "../../utils/gcPool.cpp"
+
+//A request still unanswered this long after it was sent (past its deadline,
+//for one that has one) is counted as failed and releases its book
+const int replayReplyTimeoutSeconds = 30;
+
+struct CapturedRequest{
+    std::int64_t arrivalNs;
+    std::string payload;
+    //From the reply record, -1 when GC never answered during the capture
+    std::int64_t originalLatencyNs = -1;
+    std::string originalResponse;
+    //Requests with the same key are replayed one at a time, in capture order
+    bool ordered = false;
+    std::int64_t orderKey = 0;
+    //Sent alone: waits for every key in flight and holds back what follows
+    bool barrier = false;
+
+    std::chrono::steady_clock::time_point issuedAt;
+    std::chrono::steady_clock::time_point timesOutAt;
+    bool failed = false;
+    std::int64_t replayLatencyNs = -1;
+    std::string replayResponse;
+};
+
+void obtainEnvData(std::vector<std::string> &environmentVariables){
+    std::fstream configFile("../.env");
+    std::string key, value;
+    while (std::getline(configFile, key, '=') && std::getline(configFile, value)) {
+        environmentVariables.push_back(value);
+    }
+}
+
+//Loans, renewals, returns and reservations are ordered by book; BULK batches
+//and checkouts touch many books, so each is a barrier against all of them;
+//searches are free
+void assignOrderKey(CapturedRequest &captured){
+    if(captured.payload.size() < sizeof(Request)){
+        return;
+    }
+    Request parsedRequest;
+    memcpy(&parsedRequest, captured.payload.data(), sizeof(Request));
+    switch(parsedRequest.requestType){
+        case RequestType::LOAN:
+        case RequestType::RENEWAL:
+        case RequestType::RETURN:
+        case RequestType::RESERVE:
+            captured.ordered = true;
+            captured.orderKey = parsedRequest.code;
+            break;
+        case RequestType::BULK:
+        case RequestType::CHECKOUT:
+            captured.barrier = true;
+            break;
+        default:
+            break;
+    }
+}
+
+bool loadCapture(const std::string &path, std::vector<CapturedRequest> &capturedRequests){
+    std::ifstream captureFile(path, std::ios::binary);
+    char magic[sizeof(captureMagic)];
+    if(!captureFile.read(magic, sizeof(magic)) || memcmp(magic, captureMagic, sizeof(magic)) != 0){
+        return false;
+    }
+    std::unordered_map<std::uint64_t, std::size_t> requestById;
+    CaptureRecordHeader header;
+    while(captureFile.read(reinterpret_cast<char*>(&header), sizeof(header))){
+        std::string payload(header.payloadSize, '\0');
+        if(!captureFile.read(&payload[0], header.payloadSize)){
+            break;
+        }
+        if(header.kind == CaptureRecordKind::REQUEST){
+            requestById[header.requestId] = capturedRequests.size();
+            CapturedRequest captured;
+            captured.arrivalNs = header.elapsedNs;
+            captured.payload = std::move(payload);
+            assignOrderKey(captured);
+            capturedRequests.push_back(std::move(captured));
+        } else {
+            auto requestEntry = requestById.find(header.requestId);
+            if(requestEntry != requestById.end()){
+                CapturedRequest &captured = capturedRequests[requestEntry->second];
+                captured.originalLatencyNs = header.elapsedNs - captured.arrivalNs;
+                captured.originalResponse = std::move(payload);
+            }
+        }
+    }
+    return true;
+}
+
+//What a reply says, without the parts that change from run to run
+std::string responseOutcome(const std::string &response){
+    if(response.rfind("BULK:", 0) == 0){
+        return response;
+    }
+    std::string outcome = response.substr(0, response.find('\n'));
+    return outcome.substr(0, outcome.find(". Return date"));
+}
+
+//Frames: request index, empty delimiter, payload. GC echoes the first two back
+//as part of the envelope, which is how replies find their request. Captured
+//deadlines are long past, so a request that had one gets a fresh deadline of
+//the length PS gives when it is sent again.
+void issueRequest(std::vector<CapturedRequest> &capturedRequests, std::size_t requestIndex, zmq::socket_t &gcSocket){
+    std::string &payload = capturedRequests[requestIndex].payload;
+    if(payload.size() >= sizeof(Request)){
+        Request header;
+        memcpy(&header, payload.data(), sizeof(Request));
+        if(requestDeadline(header) != 0){
+            setRequestDeadline(header, header.requestType == RequestType::BULK ? bulkRequestDeadlineMs : defaultRequestDeadlineMs);
+            memcpy(&payload[0], &header, sizeof(Request));
+        }
+    }
+    std::uint64_t requestTag = requestIndex;
+    gcSocket.send(zmq::buffer(&requestTag, sizeof(requestTag)), zmq::send_flags::sndmore);
+    gcSocket.send(zmq::message_t(), zmq::send_flags::sndmore);
+    gcSocket.send(zmq::buffer(capturedRequests[requestIndex].payload), zmq::send_flags::none);
+    CapturedRequest &issued = capturedRequests[requestIndex];
+    issued.issuedAt = std::chrono::steady_clock::now();
+    int replyTimeoutMs = replayReplyTimeoutSeconds * 1000;
+    if(payload.size() >= sizeof(Request)){
+        Request header;
+        memcpy(&header, payload.data(), sizeof(Request));
+        if(requestDeadline(header) != 0){
+            replyTimeoutMs += std::max(0, remainingDeadlineMs(header));
+        }
+    }
+    issued.timesOutAt = issued.issuedAt + std::chrono::milliseconds(replyTimeoutMs);
+}
+
+//Keeps the capture's order where it matters: one request per book in flight,
+//and a barrier alone on the wire. Requests that have to wait are held back
+//and sent as soon as what they wait for is answered or times out.
+class ReplayScheduler{
+public:
+    ReplayScheduler(std::vector<CapturedRequest> &requests, zmq::socket_t &socket) : capturedRequests(requests), gcSocket(socket){}
+
+    //Called in capture order
+    void dispatch(std::size_t requestIndex){
+        CapturedRequest &captured = capturedRequests[requestIndex];
+        if(!captured.ordered && !captured.barrier){
+            send(requestIndex);
+            return;
+        }
+        if(barrierInFlight || !heldBehindBarrier.empty() || (captured.barrier && keysInFlight > 0)){
+            heldBehindBarrier.push_back(requestIndex);
+            heldBackCount++;
+            return;
+        }
+        admit(requestIndex);
+    }
+
+    //A reply came, or the request timed out
+    void complete(std::size_t requestIndex){
+        CapturedRequest &captured = capturedRequests[requestIndex];
+        if(captured.barrier){
+            barrierInFlight = false;
+        } else if(captured.ordered){
+            std::deque<std::size_t> &heldBack = heldBackByKey[captured.orderKey];
+            if(heldBack.empty()){
+                keyInFlight[captured.orderKey] = false;
+                keysInFlight--;
+            } else {
+                std::size_t nextIndex = heldBack.front();
+                heldBack.pop_front();
+                send(nextIndex);
+            }
+        }
+        while(!heldBehindBarrier.empty() && !barrierInFlight){
+            std::size_t nextIndex = heldBehindBarrier.front();
+            if(capturedRequests[nextIndex].barrier && keysInFlight > 0){
+                break;
+            }
+            heldBehindBarrier.pop_front();
+            admit(nextIndex);
+        }
+    }
+
+    //Fails every request sent before now that has run out of time
+    std::size_t expire(std::chrono::steady_clock::time_point now){
+        std::vector<std::size_t> expired;
+        for(std::size_t position = 0; position < inFlight.size();){
+            CapturedRequest &captured = capturedRequests[inFlight[position]];
+            if(captured.replayLatencyNs >= 0){
+                inFlight[position] = inFlight.back();
+                inFlight.pop_back();
+            } else if(captured.timesOutAt <= now){
+                captured.failed = true;
+                expired.push_back(inFlight[position]);
+                inFlight[position] = inFlight.back();
+                inFlight.pop_back();
+            } else {
+                position++;
+            }
+        }
+        //In send order, so a book's held-back requests still go out in capture order
+        std::sort(expired.begin(), expired.end());
+        for(std::size_t requestIndex : expired){
+            complete(requestIndex);
+        }
+        return expired.size();
+    }
+
+    std::size_t heldBack() const{
+        return heldBackCount;
+    }
+
+private:
+    void admit(std::size_t requestIndex){
+        CapturedRequest &captured = capturedRequests[requestIndex];
+        if(captured.barrier){
+            barrierInFlight = true;
+        } else if(keyInFlight[captured.orderKey]){
+            heldBackByKey[captured.orderKey].push_back(requestIndex);
+            heldBackCount++;
+            return;
+        } else {
+            keyInFlight[captured.orderKey] = true;
+            keysInFlight++;
+        }
+        send(requestIndex);
+    }
+
+    void send(std::size_t requestIndex){
+        issueRequest(capturedRequests, requestIndex, gcSocket);
+        inFlight.push_back(requestIndex);
+    }
+
+    std::vector<CapturedRequest> &capturedRequests;
+    zmq::socket_t &gcSocket;
+    std::unordered_map<std::int64_t, std::deque<std::size_t>> heldBackByKey;
+    std::unordered_map<std::int64_t, bool> keyInFlight;
+    std::size_t keysInFlight = 0;
+    bool barrierInFlight = false;
+    std::deque<std::size_t> heldBehindBarrier;
+    std::vector<std::size_t> inFlight;
+    std::size_t heldBackCount = 0;
+};
+
+double percentileMs(std::vector<std::int64_t> &latenciesNs, double fraction){
+    if(latenciesNs.empty()){
+        return 0;
+    }
+    std::size_t rank = std::min(latenciesNs.size() - 1, std::size_t(fraction * latenciesNs.size()));
+    std::nth_element(latenciesNs.begin(), latenciesNs.begin() + rank, latenciesNs.end());
+    return latenciesNs[rank] / 1e6;
+}
+
+//The original latency is what GC measured between taking the request and
+//sending its reply; the replay latency is measured here, so it also holds
+//the network round trip to GC and is biased upwards by it
+void printLatencyComparison(std::vector<CapturedRequest> &capturedRequests){
+    std::vector<std::int64_t> originalLatencies, replayLatencies;
+    for(const CapturedRequest &captured : capturedRequests){
+        if(captured.originalLatencyNs >= 0 && captured.replayLatencyNs >= 0){
+            originalLatencies.push_back(captured.originalLatencyNs);
+            replayLatencies.push_back(captured.replayLatencyNs);
+        }
+    }
+    std::printf("[Replay] Latency over %zu requests answered in both runs\n", replayLatencies.size());
+    std::printf("[Replay]        original(GC) replay(client)    delta\n");
+    const char *percentileNames[] = {"p50", "p95", "p99", "max"};
+    const double percentileFractions[] = {0.50, 0.95, 0.99, 1.0};
+    for(int percentileIndex = 0; percentileIndex < 4; percentileIndex++){
+        double originalMs = percentileMs(originalLatencies, percentileFractions[percentileIndex]);
+        double replayMs = percentileMs(replayLatencies, percentileFractions[percentileIndex]);
+        std::printf("[Replay] %-4s %9.2f ms %9.2f ms %+9.2f ms\n", percentileNames[percentileIndex], originalMs, replayMs, replayMs - originalMs);
+    }
+    std::printf("[Replay] Replay latencies include the round trip to GC, the original ones do not: deltas lean positive by it\n");
+}
+
+int main(int argc, char* argv[]){
+    std::vector<std::string> ipAddressList;
+    double replaySpeed = 1;
+    std::string gcItem = "5555";
+
+    bool validArguments = argc >= 3;
+    for(int argumentIndex = 3; argumentIndex < argc && validArguments; argumentIndex++){
+        std::string argument = argv[argumentIndex];
+        if(argument == "--speed" && argumentIndex + 1 < argc){
+            validArguments = (replaySpeed = std::atof(argv[++argumentIndex])) > 0;
+        } else if(argument == "--gc" && argumentIndex + 1 < argc){
+            gcItem = argv[++argumentIndex];
+        } else {
+            validArguments = false;
+        }
+    }
+    if(!validArguments){
+        std::cerr << "[Replay-Error] Usage: ./replay <location> <capture file> [--speed N] [--gc host:port]\n";
+        return 0;
+    }
+    obtainEnvData(ipAddressList);
+    std::int8_t locationIndex = std::int8_t(std::stoi(argv[1])) - 1;
+    if(locationIndex < 0 || locationIndex >= std::int8_t(ipAddressList.size())){
+        std::cerr << "[Replay-Error] Location does not exist\n";
+        return 0;
+    }
+    //A single GC, since replies are matched to requests on one socket; a GC
+    //started with --port is not on the default 5555
+    std::vector<std::string> gcEndpoints;
+    if(!parseGcEndpoints(gcItem, ipAddressList[locationIndex], gcEndpoints) || gcEndpoints.size() != 1){
+        std::cerr << "[Replay-Error] Usage: ./replay <location> <capture file> [--speed N] [--gc host:port]\n";
+        return 0;
+    }
+    const std::string &gcAddress = gcEndpoints.front();
+
+    std::vector<CapturedRequest> capturedRequests;
+    if(!loadCapture(argv[2], capturedRequests)){
+        std::cerr << "[Replay-Error] " << argv[2] << " is not a GC capture\n";
+        return 0;
+    }
+    if(capturedRequests.empty()){
+        std::cout << "[Replay] Capture is empty\n";
+        return 0;
+    }
+    double captureSeconds = (capturedRequests.back().arrivalNs - capturedRequests.front().arrivalNs) / 1e9;
+    std::cout << "[Replay] " << capturedRequests.size() << " requests over " << captureSeconds << " s, replaying at "
+              << replaySpeed << "x\n";
+
+    zmq::context_t zmqContext(1);
+    //DEALER so requests for different books are in flight together
+    zmq::socket_t gcSocket(zmqContext, zmq::socket_type::dealer);
+    gcSocket.connect(gcAddress);
+    std::cout << "[Replay] Sending to GC at " << gcAddress << "\n";
+
+    ReplayScheduler scheduler(capturedRequests, gcSocket);
+    std::size_t nextRequest = 0;
+    std::size_t answeredCount = 0;
+    std::size_t failedCount = 0;
+    double maxScheduleLagMs = 0;
+    std::int64_t firstArrivalNs = capturedRequests.front().arrivalNs;
+    auto replayStart = std::chrono::steady_clock::now();
+
+    while(answeredCount + failedCount < capturedRequests.size()){
+        auto now = std::chrono::steady_clock::now();
+        failedCount += scheduler.expire(now);
+        while(nextRequest < capturedRequests.size()){
+            CapturedRequest &captured = capturedRequests[nextRequest];
+            auto dueAt = replayStart + std::chrono::nanoseconds(std::int64_t((captured.arrivalNs - firstArrivalNs) / replaySpeed));
+            if(dueAt > now){
+                break;
+            }
+            maxScheduleLagMs = std::max(maxScheduleLagMs, std::chrono::duration<double, std::milli>(now - dueAt).count());
+            scheduler.dispatch(nextRequest);
+            nextRequest++;
+        }
+
+        long waitMs = 100;
+        if(nextRequest < capturedRequests.size()){
+            auto dueAt = replayStart + std::chrono::nanoseconds(std::int64_t((capturedRequests[nextRequest].arrivalNs - firstArrivalNs) / replaySpeed));
+            waitMs = std::max(0L, std::min(waitMs, long(std::chrono::duration_cast<std::chrono::milliseconds>(dueAt - now).count())));
+        }
+        zmq::pollitem_t pollItems[] = {{static_cast<void*>(gcSocket), 0, ZMQ_POLLIN, 0}};
+        zmq::poll(pollItems, 1, std::chrono::milliseconds(waitMs));
+        if(!(pollItems[0].revents & ZMQ_POLLIN)){
+            continue;
+        }
+
+        zmq::message_t tagFrame, delimiterFrame, responseFrame;
+        gcSocket.recv(tagFrame, zmq::recv_flags::none);
+        gcSocket.recv(delimiterFrame, zmq::recv_flags::none);
+        gcSocket.recv(responseFrame, zmq::recv_flags::none);
+        auto repliedAt = std::chrono::steady_clock::now();
+        std::uint64_t requestTag = 0;
+        memcpy(&requestTag, tagFrame.data(), std::min(tagFrame.size(), sizeof(requestTag)));
+        //A reply that comes after its request was given up on is dropped
+        if(requestTag >= capturedRequests.size() || capturedRequests[requestTag].replayLatencyNs >= 0 || capturedRequests[requestTag].failed){
+            continue;
+        }
+
+        CapturedRequest &answered = capturedRequests[requestTag];
+        answered.replayLatencyNs = std::chrono::duration_cast<std::chrono::nanoseconds>(repliedAt - answered.issuedAt).count();
+        answered.replayResponse.assign(static_cast<char*>(responseFrame.data()), responseFrame.size());
+        answeredCount++;
+        scheduler.complete(requestTag);
+    }
+
+    double replaySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - replayStart).count();
+    std::size_t differentOutcomes = 0;
+    for(const CapturedRequest &captured : capturedRequests){
+        if(captured.replayLatencyNs >= 0 && captured.originalLatencyNs >= 0 &&
+           responseOutcome(captured.replayResponse) != responseOutcome(captured.originalResponse)){
+            differentOutcomes++;
+        }
+    }
+
+    std::cout << "\n[Replay] Replayed " << nextRequest << " requests in " << replaySeconds << " s (capture scaled to "
+              << captureSeconds / replaySpeed << " s)\n";
+    std::cout << "[Replay] Held back to keep per-book order: " << scheduler.heldBack() << "\n";
+    std::cout << "[Replay] Max lag behind schedule: " << maxScheduleLagMs << " ms\n";
+    printLatencyComparison(capturedRequests);
+    std::cout << "[Replay] Outcomes that differ from the original run: " << differentOutcomes << "\n";
+    std::cout << "[Replay] Failed (no reply within " << replayReplyTimeoutSeconds << " s of the deadline): " << failedCount << "\n";
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+#include "expect.cpp"
+#include "../../utils/structs.cpp"
+#include "../ga/overdueTracker.cpp"
+#include "../ga/operationLogArchive.cpp"
+#include "../ga/snapshot.cpp"
+#include "../ga/reservationQueue.cpp"
+#include "../ga/bulkIngest.cpp"
+#include "../ga/catalogIndex.cpp"
+#include "../ga/usageRollup.cpp"
+#include "../ga/storageBackend.cpp"
+#include "../ga/embeddedBackend.cpp"
+
+const std::string storeDirectory = "/tmp/embeddedBackendTest_" + std::to_string(getpid());
+const std::string seedPath = storeDirectory + ".sql";
+//Sede 1 (location 0) has one copy of 100001 and two of 100002
+const std::string seedCatalog =
+    "INSERT INTO libros (codigo, titulo, autor, ejemplares_sede1, ejemplares_sede2, ejemplares_totales_sede1, ejemplares_totales_sede2) VALUES\n"
+    "(100001, 'Libro uno', 'Autor', 1, 0, 1, 0),\n"
+    "(100002, 'Libro dos', 'Autor', 2, 2, 2, 2);\n";
+//Hex keys as GA passes them: writer AP-1, epoch 1, sequences 1 and 2
+const std::string firstLoanKey = "41502d31010000000000000000000001";
+const std::string secondLoanKey = "41502d31010000000000000000000002";
+
+Request makeOperation(RequestType requestType, int bookCode){
+    Request operation{};
+    operation.requestType = requestType;
+    operation.code = bookCode;
+    operation.location = 0;
+    return operation;
+}
+
+//An all-or-nothing batch with one failing operation leaves no trace: no
+//copies taken, no operations logged
+void testAllOrNothingRollback(EmbeddedBackend &store){
+    std::int64_t operationBefore = store.lastOperation();
+    Request operations[] = {makeOperation(RequestType::LOAN, 100002), makeOperation(RequestType::LOAN, 100001),
+                            makeOperation(RequestType::LOAN, 100001)};
+    BulkResult bulkResult = store.applyBulk(operations, 3, OperationOrigin(), true);
+    expect(bulkResult.rolledBack, "the batch is rolled back");
+    expect(bulkResult.outcomes.size() == 3 && bulkResult.outcomes[2] == char(BulkOutcome::NO_COPIES), "the failing operation is reported");
+    expect(store.lastOperation() == operationBefore, "nothing was logged");
+    expect(bulkResult.firstOperationId == 0 && bulkResult.lastOperationId == 0, "the batch reports no operations");
+
+    expect(store.loan(100001, 0, "", OperationOrigin()).rfind("Loan successful", 0) == 0, "the copy the batch took is back");
+    expect(store.loan(100002, 0, "", OperationOrigin()).rfind("Loan successful", 0) == 0, "so is the other book's");
+    expect(store.lastOperation() == operationBefore + 2, "later operations are logged after the rollback");
+
+    Request partialOperations[] = {makeOperation(RequestType::LOAN, 100002), makeOperation(RequestType::LOAN, 100001)};
+    bulkResult = store.applyBulk(partialOperations, 2, OperationOrigin(), false);
+    expect(!bulkResult.rolledBack && bulkResult.outcomes[0] == char(BulkOutcome::OK) && bulkResult.outcomes[1] == char(BulkOutcome::NO_COPIES),
+           "a per-item batch keeps what succeeded");
+}
+
+//A loan sent again under its key is answered without lending another copy
+void testKeyedLoan(EmbeddedBackend &store){
+    ReservationHandOff handOff;
+    store.returnLoan(100002, 0, "", OperationOrigin(), handOff);
+    std::int64_t operationBefore = store.lastOperation();
+    std::string firstResult = store.loan(100002, 0, firstLoanKey, OperationOrigin());
+    expect(firstResult.rfind("Loan successful", 0) == 0, "the keyed loan is applied");
+    expect(store.loan(100002, 0, firstLoanKey, OperationOrigin()) == firstResult, "its retry gets the same answer");
+    expect(store.lastOperation() == operationBefore + 1, "and is not applied again");
+    expect(store.loan(100002, 0, secondLoanKey, OperationOrigin()).rfind("Error: No available copies", 0) == 0,
+           "a new key is a new loan");
+}
+
+//Reopening rebuilds the same state from the log
+void testReopen(OverdueTracker &tracker, std::int64_t operationBefore, const std::string &firstResult){
+    EmbeddedBackend store(tracker);
+    expect(store.open(storeDirectory, seedPath), "the store opens again");
+    expect(store.lastOperation() == operationBefore, "every operation is replayed");
+    expect(store.loan(100001, 0, "", OperationOrigin()).rfind("Error: No available copies", 0) == 0, "taken copies stay taken");
+    expect(store.loan(100002, 0, firstLoanKey, OperationOrigin()) == firstResult, "applied keys survive the restart");
+}
+
+int main(){
+    std::filesystem::remove_all(storeDirectory);
+    {
+        std::ofstream seedFile(seedPath);
+        seedFile << seedCatalog;
+    }
+    OverdueTracker tracker;
+    std::int64_t operationAfter = 0;
+    std::string firstResult;
+    {
+        EmbeddedBackend store(tracker);
+        expect(store.open(storeDirectory, seedPath), "a new store opens");
+        testAllOrNothingRollback(store);
+        testKeyedLoan(store);
+        operationAfter = store.lastOperation();
+        firstResult = store.loan(100002, 0, firstLoanKey, OperationOrigin());
+    }
+    testReopen(tracker, operationAfter, firstResult);
+    std::filesystem::remove_all(storeDirectory);
+    std::filesystem::remove(seedPath);
+    return finishTests("embeddedBackend");
+}
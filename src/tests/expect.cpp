@@ -0,0 +1,21 @@
+#include <iostream>
+#include <string>
+
+//Expectations that did not hold; a test program exits with 1 if there are any
+int failedExpectations = 0;
+
+void expect(bool condition, const std::string &description){
+    if(!condition){
+        failedExpectations++;
+        std::cerr << "[Test] FAILED: " << description << "\n";
+    }
+}
+
+int finishTests(const std::string &testName){
+    if(failedExpectations > 0){
+        std::cerr << "[Test] " << testName << ": " << failedExpectations << " expectations failed\n";
+        return 1;
+    }
+    std::cout << "[Test] " << testName << ": passed\n";
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include <zmq.hpp>
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include "expect.cpp"
+#include "../../utils/structs.cpp"
+#include "../../utils/deadline.cpp"
+#include "../../utils/shardMap.cpp"
+#include "../../utils/gaRouter.cpp"
+#include "../../utils/journal.cpp"
+
+const std::string journalPath = "/tmp/journalTest_" + std::to_string(getpid()) + ".journal";
+
+Request makeRequest(RequestType requestType, int bookCode){
+    Request request{};
+    request.requestType = requestType;
+    request.code = bookCode;
+    request.location = 1;
+    return request;
+}
+
+std::uint64_t sequenceOf(const std::string &keyedRequest){
+    std::uint64_t sequence = 0;
+    std::memcpy(&sequence, keyedRequest.data() + sizeof(Request) + requestKeyPrefixSize, sizeof(sequence));
+    return sequence;
+}
+
+//Pending requests come back oldest first, with the key they were sent under
+void testAppendAndPeek(){
+    RequestJournal journal;
+    expect(journal.open(journalPath, "AD-1", 2), "a new journal opens");
+    expect(!journal.hasPending(), "a new journal is empty");
+
+    std::uint64_t firstSequence = journal.reserveSequence();
+    std::uint64_t secondSequence = journal.reserveSequence();
+    expect(secondSequence == firstSequence + 1, "sequences are handed out in order");
+    expect(journal.append(makeRequest(RequestType::RETURN, 100001), firstSequence), "first append fits");
+    expect(journal.append(makeRequest(RequestType::RETURN, 100002), secondSequence), "second append fits");
+    expect(!journal.append(makeRequest(RequestType::RETURN, 100003), journal.reserveSequence()), "a full journal refuses more");
+
+    std::string keyedRequest;
+    expect(journal.peek(keyedRequest) && keyedRequest.size() == sizeof(Request) + requestKeySize, "the head has its key");
+    Request head;
+    std::memcpy(&head, keyedRequest.data(), sizeof(Request));
+    expect(head.code == 100001 && sequenceOf(keyedRequest) == firstSequence, "the head is the oldest request");
+    expect(std::memcmp(keyedRequest.data() + sizeof(Request), "AD-1", 4) == 0, "the key names its writer");
+    expect(requestDeadline(head) == 0, "a journaled request keeps no deadline");
+
+    std::string rebuiltRequest;
+    journal.buildKeyedRequest(head, firstSequence, rebuiltRequest);
+    expect(rebuiltRequest == keyedRequest, "the first attempt and the replay share the key");
+
+    journal.popHead();
+    expect(journal.peek(keyedRequest) && sequenceOf(keyedRequest) == secondSequence, "popping moves to the next request");
+    expect(journal.pendingCount() == 1, "one request is left");
+}
+
+//A restarted actor replays what was pending under the same keys and never
+//hands out a sequence it may have used before
+void testReopen(){
+    std::string epochBefore;
+    {
+        RequestJournal journal;
+        journal.open(journalPath, "AD-1", 2);
+        std::string keyedRequest;
+        journal.peek(keyedRequest);
+        epochBefore = keyedRequest.substr(sizeof(Request), requestKeyPrefixSize);
+    }
+    RequestJournal journal;
+    expect(journal.open(journalPath, "AD-1", 2), "the journal opens again");
+    expect(journal.pendingCount() == 1, "the pending request survived");
+    std::string keyedRequest;
+    journal.peek(keyedRequest);
+    expect(keyedRequest.substr(sizeof(Request), requestKeyPrefixSize) == epochBefore, "the epoch is kept");
+    expect(journal.reserveSequence() >= journalSequenceBlock, "sequences resume past the reserved block");
+    journal.popHead();
+    expect(!journal.hasPending(), "nothing is left once the head is popped");
+}
+
+//A file that is not a journal of this format is started over with a new epoch
+void testForeignFile(){
+    std::remove(journalPath.c_str());
+    {
+        std::ofstream foreignFile(journalPath, std::ios::binary);
+        foreignFile << "REQJRNL1 and some records of an older format";
+    }
+    RequestJournal journal;
+    expect(journal.open(journalPath, "AR-2", 4), "the journal opens over a foreign file");
+    expect(!journal.hasPending(), "nothing is replayed from it");
+    expect(journal.reserveSequence() == 0, "sequences start over");
+}
+
+//Keys of requests that are not journaled only grow within one process
+void testKeySource(){
+    RequestKeySource keySource("AP-1");
+    Request loan = makeRequest(RequestType::LOAN, 100001);
+    std::string firstKeyed, secondKeyed;
+    keySource.buildKeyedRequest(loan, firstKeyed);
+    keySource.buildKeyedRequest(loan, secondKeyed);
+    expect(firstKeyed.size() == sizeof(Request) + requestKeySize, "a loan carries a whole key");
+    expect(firstKeyed.compare(sizeof(Request), requestKeyPrefixSize, secondKeyed, sizeof(Request), requestKeyPrefixSize) == 0,
+           "one process keeps its epoch");
+    expect(sequenceOf(secondKeyed) == sequenceOf(firstKeyed) + 1, "each loan takes the next sequence");
+}
+
+int main(){
+    std::remove(journalPath.c_str());
+    testAppendAndPeek();
+    testReopen();
+    testForeignFile();
+    testKeySource();
+    std::remove(journalPath.c_str());
+    return finishTests("journal");
+}
@@ -0,0 +1,85 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "expect.cpp"
+#include "../ga/overdueTracker.cpp"
+
+bool hasEvent(const std::vector<std::string> &events, const std::string &prefix){
+    return std::any_of(events.begin(), events.end(), [&prefix](const std::string &event){ return event.rfind(prefix, 0) == 0; });
+}
+
+void testDayNumbers(){
+    expect(dayNumberFromDate("1970-01-01") == 0, "day 0 is 1970-01-01");
+    expect(dateFromDayNumber(dayNumberFromDate("2024-02-29")) == "2024-02-29", "leap day round trips");
+    expect(dayNumberFromDate("2025-03-01") - dayNumberFromDate("2025-02-28") == 1, "February 2025 has 28 days");
+    expect(dayNumberFromDate("not a date") == -1, "an unparsable date is rejected");
+}
+
+//Loans move to the overdue set only once their due day has passed, a bucket at a time
+void testBucketing(){
+    OverdueTracker tracker;
+    int dueDay = dayNumberFromDate("2026-10-10");
+    tracker.track(1, 100001, 1, dateFromDayNumber(dueDay));
+    tracker.track(2, 100002, 1, dateFromDayNumber(dueDay + 1));
+    tracker.track(3, 100003, 2, dateFromDayNumber(dueDay + 5));
+
+    tracker.advance(dueDay);
+    expect(tracker.overdueAt(1).empty(), "a loan due today is not overdue");
+
+    tracker.advance(dueDay + 1);
+    std::vector<LoanDueEntry> overdueLoans = tracker.overdueAt(1);
+    expect(overdueLoans.size() == 1 && overdueLoans[0].stateId == 1, "the loan due yesterday is overdue");
+    std::vector<std::string> events = tracker.drainEvents();
+    expect(events.size() == 1 && hasEvent(events, "OVERDUE 100001 1 2026-10-10 1"), "one OVERDUE event for it");
+
+    tracker.advance(dueDay + 2);
+    expect(tracker.overdueAt(1).size() == 2, "the next bucket follows a day later");
+    expect(tracker.overdueAt(2).empty(), "other sites are kept apart");
+    tracker.drainEvents();
+}
+
+//Renewing and returning report CLEARED only when the loan stops being overdue
+void testRescheduling(){
+    OverdueTracker tracker;
+    int dueDay = dayNumberFromDate("2026-10-10");
+    tracker.track(1, 100001, 1, dateFromDayNumber(dueDay));
+    tracker.track(2, 100002, 1, dateFromDayNumber(dueDay));
+    tracker.track(3, 100003, 1, dateFromDayNumber(dueDay + 5));
+    tracker.advance(dueDay + 3);
+    tracker.drainEvents();
+
+    tracker.reschedule(1, dateFromDayNumber(dueDay + 1));
+    expect(tracker.drainEvents().empty(), "renewed to a day already past: no events");
+    std::vector<LoanDueEntry> overdueLoans = tracker.overdueAt(1);
+    auto renewedLoan = std::find_if(overdueLoans.begin(), overdueLoans.end(), [](const LoanDueEntry &entry){ return entry.stateId == 1; });
+    expect(renewedLoan != overdueLoans.end() && renewedLoan->dueDay == dueDay + 1, "it stays overdue with the new due day");
+
+    tracker.reschedule(2, dateFromDayNumber(dueDay + 10));
+    std::vector<std::string> events = tracker.drainEvents();
+    expect(events.size() == 1 && hasEvent(events, "CLEARED 100002"), "renewed into the future: CLEARED");
+    expect(tracker.overdueAt(1).size() == 1, "and it leaves the overdue set");
+    tracker.advance(dueDay + 4);
+    expect(tracker.drainEvents().empty(), "nothing falls due again before the new day");
+
+    tracker.reschedule(3, dateFromDayNumber(dueDay + 7));
+    expect(tracker.drainEvents().empty(), "renewing a loan that is not overdue reports nothing");
+
+    tracker.release(3);
+    expect(tracker.drainEvents().empty(), "returning a loan that is not overdue reports nothing");
+    tracker.release(1);
+    events = tracker.drainEvents();
+    expect(events.size() == 1 && hasEvent(events, "CLEARED 100001"), "returning an overdue loan reports CLEARED");
+    expect(tracker.overdueAt(1).empty(), "no loan is left overdue");
+
+    tracker.advance(dueDay + 20);
+    events = tracker.drainEvents();
+    expect(events.size() == 1 && hasEvent(events, "OVERDUE 100002"), "only the loans still out fall due");
+}
+
+int main(){
+    testDayNumbers();
+    testBucketing();
+    testRescheduling();
+    return finishTests("overdueTracker");
+}
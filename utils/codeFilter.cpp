@@ -0,0 +1,90 @@
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+//Widest code range a filter covers (8 MB of bitmap); a sparser catalog is
+//published as an empty filter that lets every code through
+const std::int64_t maxFilterCodeSpan = std::int64_t(1) << 26;
+
+//Header of a published filter, followed by one bit per code from firstCode
+struct CodeFilterHeader{
+    //Location of the GA that built it, so GC can keep one filter per GA
+    std::int32_t site;
+    std::int32_t firstCode;
+    std::int32_t codeSpan;
+    std::uint32_t bookCount;
+};
+
+//Exact membership bitmap of the catalog's book codes. GA builds it from libros
+//and GC uses it to answer requests for codes that do not exist without a
+//round trip to the actors and the database.
+class BookCodeFilter{
+public:
+    static std::string encode(int site, std::vector<int> bookCodes){
+        CodeFilterHeader header{site, 0, 0, std::uint32_t(bookCodes.size())};
+        std::string filterMessage;
+        if(!bookCodes.empty()){
+            auto codeRange = std::minmax_element(bookCodes.begin(), bookCodes.end());
+            std::int64_t codeSpan = std::int64_t(*codeRange.second) - *codeRange.first + 1;
+            if(codeSpan <= maxFilterCodeSpan){
+                header.firstCode = *codeRange.first;
+                header.codeSpan = std::int32_t(codeSpan);
+            }
+        }
+        filterMessage.assign(sizeof(CodeFilterHeader) + (std::size_t(header.codeSpan) + 7) / 8, '\0');
+        memcpy(&filterMessage[0], &header, sizeof(CodeFilterHeader));
+        if(header.codeSpan > 0){
+            char *bits = &filterMessage[sizeof(CodeFilterHeader)];
+            for(int code : bookCodes){
+                std::uint32_t offset = std::uint32_t(code - header.firstCode);
+                bits[offset / 8] |= char(1 << (offset % 8));
+            }
+        }
+        return filterMessage;
+    }
+
+    bool load(const void *filterData, std::size_t filterSize){
+        CodeFilterHeader header;
+        if(filterSize < sizeof(CodeFilterHeader)){
+            return false;
+        }
+        memcpy(&header, filterData, sizeof(CodeFilterHeader));
+        if(header.codeSpan < 0 || filterSize != sizeof(CodeFilterHeader) + (std::size_t(header.codeSpan) + 7) / 8){
+            return false;
+        }
+        const std::uint8_t *bitData = static_cast<const std::uint8_t*>(filterData) + sizeof(CodeFilterHeader);
+        bits.assign(bitData, bitData + (filterSize - sizeof(CodeFilterHeader)));
+        site = header.site;
+        firstCode = header.firstCode;
+        codeSpan = header.codeSpan;
+        bookCount = header.bookCount;
+        loaded = true;
+        return true;
+    }
+
+    //False only when the catalog certainly has no book with this code
+    bool mayContain(int bookCode) const{
+        if(!loaded || codeSpan == 0){
+            return true;
+        }
+        std::int64_t offset = std::int64_t(bookCode) - firstCode;
+        if(offset < 0 || offset >= codeSpan){
+            return false;
+        }
+        return (bits[std::size_t(offset) / 8] >> (offset % 8)) & 1;
+    }
+
+    bool isLoaded() const{ return loaded; }
+    int sourceSite() const{ return site; }
+    std::uint32_t books() const{ return bookCount; }
+
+private:
+    bool loaded = false;
+    int site = 0;
+    std::int32_t firstCode = 0;
+    std::int32_t codeSpan = 0;
+    std::uint32_t bookCount = 0;
+    std::vector<std::uint8_t> bits;
+};
@@ -0,0 +1,66 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+//A request's deadline is the low 24 bits of the wall-clock millisecond at
+//which its sender stops waiting. Every host compares it against its own
+//clock, so the hosts have to be kept in time (NTP); the field wraps every
+//4.6 hours, and a deadline is read as whichever instant within 2.3 hours of
+//now it names. 0 means no deadline.
+const std::uint32_t deadlineClockMask = 0xFFFFFF;
+//What PS gives an interactive or file request, the same the Locust clients
+//wait for, and a whole BULK message
+const int defaultRequestDeadlineMs = 10000;
+const int bulkRequestDeadlineMs = 120000;
+//Reply of every stage that drops a request whose deadline has passed
+const std::string expiredRequestResponse = "Expired: Deadline passed before the request was processed";
+
+std::uint32_t deadlineClockMs(){
+    auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+    return std::uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(sinceEpoch).count()) & deadlineClockMask;
+}
+
+std::uint32_t requestDeadline(const Request &request){
+    return std::uint32_t(request.deadline[0]) | std::uint32_t(request.deadline[1]) << 8 | std::uint32_t(request.deadline[2]) << 16;
+}
+
+//budgetMs 0 leaves the request without a deadline
+void setRequestDeadline(Request &request, int budgetMs){
+    std::uint32_t deadline = budgetMs > 0 ? (deadlineClockMs() + std::uint32_t(budgetMs)) & deadlineClockMask : 0;
+    if(budgetMs > 0 && deadline == 0){
+        deadline = 1;
+    }
+    request.deadline[0] = std::uint8_t(deadline);
+    request.deadline[1] = std::uint8_t(deadline >> 8);
+    request.deadline[2] = std::uint8_t(deadline >> 16);
+}
+
+//Milliseconds left before the deadline, negative once it has passed
+int remainingDeadlineMs(const Request &request){
+    std::int32_t difference = std::int32_t((requestDeadline(request) - deadlineClockMs()) & deadlineClockMask);
+    return difference >= 0x800000 ? difference - 0x1000000 : difference;
+}
+
+bool isExpired(const Request &request){
+    return requestDeadline(request) != 0 && remainingDeadlineMs(request) < 0;
+}
+
+//The deadline on this host's steady clock, for code that waits on one;
+//time_point::max() when there is none
+std::chrono::steady_clock::time_point localExpiry(const Request &request){
+    if(requestDeadline(request) == 0){
+        return std::chrono::steady_clock::time_point::max();
+    }
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(remainingDeadlineMs(request));
+}
+
+//Reads the header of a raw message; anything too short to hold one has no deadline
+bool isExpiredMessage(const void *messageData, std::size_t messageSize){
+    if(messageSize < sizeof(Request)){
+        return false;
+    }
+    Request header;
+    memcpy(&header, messageData, sizeof(Request));
+    return isExpired(header);
+}
@@ -0,0 +1,327 @@
+#include <zmq.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <cstring>
+
+//Latencies kept per GA to derive its timeout
+const std::size_t gaLatencySampleCount = 256;
+//Below this many samples the fixed ceiling is used
+const std::size_t gaTimeoutMinSamples = 20;
+//Timeout is this many times the observed p99, between the floor and the
+//ceiling; the ceiling is the fixed timeout actors used before
+const double gaTimeoutP99Multiplier = 3;
+const int gaTimeoutFloorMs = 250;
+const int gaTimeoutCeilingMs = 2000;
+//Consecutive failures that open a GA's breaker, and how long it stays open
+//before one probe request is let through
+const int breakerFailureThreshold = 3;
+const int breakerOpenMs = 5000;
+const int maxGaAttempts = 3;
+const int gaRetryBaseDelayMs = 200;
+const int gaRetryMaxDelayMs = 1000;
+
+//Appends the idempotency key to a request: the writer's tag, its epoch and
+//the sequence
+void appendRequestKey(std::string &keyedRequest, const char *writerId, std::uint32_t epoch, std::uint64_t sequence){
+    keyedRequest.append(writerId, 4);
+    keyedRequest.append(reinterpret_cast<const char*>(&epoch), sizeof(epoch));
+    keyedRequest.append(reinterpret_cast<const char*>(&sequence), sizeof(sequence));
+}
+
+//Keys for requests that are not journaled. The epoch is drawn at random when
+//the process starts, so a restarted writer never reuses a key, and the
+//sequence only grows. A writer takes a new key only once the previous
+//request was answered, which is what lets the GA prune the lower ones.
+class RequestKeySource{
+public:
+    explicit RequestKeySource(const std::string &writerTag){
+        std::memset(writerId, 0, sizeof(writerId));
+        std::memcpy(writerId, writerTag.data(), std::min(writerTag.size(), sizeof(writerId)));
+        std::random_device randomSource;
+        epoch = randomSource();
+    }
+
+    void buildKeyedRequest(const Request &request, std::string &keyedRequest){
+        keyedRequest.assign(reinterpret_cast<const char*>(&request), sizeof(Request));
+        appendRequestKey(keyedRequest, writerId, epoch, nextSequence++);
+    }
+
+private:
+    char writerId[4];
+    std::uint32_t epoch;
+    std::uint64_t nextSequence = 0;
+};
+
+//How a request forwarded to a GA ended; only ANSWERED fills the reply
+enum struct GaReply{
+    ANSWERED,
+    EXPIRED,
+    FAILED
+};
+
+enum struct BreakerState{
+    CLOSED,
+    OPEN,
+    HALF_OPEN
+};
+
+struct GaEndpoint{
+    std::string address;
+    std::vector<double> latencySamplesMs;
+    std::size_t nextSample = 0;
+    int consecutiveFailures = 0;
+    BreakerState breaker = BreakerState::CLOSED;
+    std::chrono::steady_clock::time_point openedAt;
+    bool probeInFlight = false;
+};
+
+//Chooses the GA for each attempt of an actor's request. The heartbeat
+//monitor says which GA is preferred; each GA also has its own breaker, so
+//once a GA keeps failing requests go straight to the other one without
+//waiting for three heartbeats, and come back after a successful probe.
+class GaRouter{
+public:
+    explicit GaRouter(const std::string &actorTag) : logTag(actorTag){}
+
+    void configure(const std::string &primaryAddress, const std::string &secondaryAddress){
+        std::lock_guard<std::mutex> lock(routerMutex);
+        endpoints[0].address = primaryAddress;
+        endpoints[1].address = secondaryAddress;
+    }
+
+    void setPrimaryReachable(bool reachable){
+        std::lock_guard<std::mutex> lock(routerMutex);
+        preferredIndex = reachable ? 0 : 1;
+    }
+
+    //fixedTimeoutMs 0 uses the GA's adaptive timeout; batches that take far
+    //longer than a single operation pass their own and are not sampled.
+    //Keyed requests, which the GA applies once however often they arrive, and
+    //those that are safe to repeat are retried, on the other GA once the
+    //heartbeat or the breaker says so; batches and baskets get a single
+    //attempt, since a timed out attempt may still be applied. No
+    //attempt starts past the request's deadline nor waits beyond it, and one
+    //cut short by the deadline is not held against the GA. Every attempt
+    //sends a reference to the request's buffer, and the GA's reply frame is
+    //handed back as it was received.
+    GaReply forward(zmq::message_t &requestMessage, zmq::context_t &context, int fixedTimeoutMs, zmq::message_t &reply){
+        Request header;
+        memcpy(&header, requestMessage.data(), std::min(requestMessage.size(), sizeof(Request)));
+        bool hasDeadline = requestMessage.size() >= sizeof(Request) && requestDeadline(header) != 0;
+        bool keyed = requestMessage.size() == sizeof(Request) + requestKeySize;
+        bool repeatable = keyed || header.requestType == RequestType::SEARCH || header.requestType == RequestType::OVERDUE ||
+                          header.requestType == RequestType::RESERVE;
+        int attempts = repeatable ? maxGaAttempts : 1;
+        int previousIndex = -1;
+        for(int attemptNumber = 0; attemptNumber < attempts; attemptNumber++){
+            bool isProbe = false;
+            int gaIndex = chooseEndpoint(isProbe);
+            if(gaIndex == previousIndex && attemptNumber > 0){
+                int delayMs = std::min(gaRetryBaseDelayMs * (1 << (attemptNumber - 1)), gaRetryMaxDelayMs);
+                std::cout << "[" << logTag << "-Retry] Request failed, retrying in " << delayMs << " ms\n";
+                std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+            }
+            previousIndex = gaIndex;
+            if(hasDeadline && isExpired(header)){
+                releaseProbe(gaIndex, isProbe);
+                std::cout << "[" << logTag << "-Deadline] Deadline passed before attempt " << (attemptNumber + 1) << "\n";
+                return GaReply::EXPIRED;
+            }
+
+            std::string address;
+            int timeoutMs;
+            {
+                std::lock_guard<std::mutex> lock(routerMutex);
+                address = endpoints[gaIndex].address;
+                if(fixedTimeoutMs > 0){
+                    timeoutMs = fixedTimeoutMs;
+                } else {
+                    timeoutMs = isProbe ? gaTimeoutCeilingMs : adaptiveTimeoutMs(endpoints[gaIndex]);
+                }
+            }
+            bool cutByDeadline = hasDeadline && remainingDeadlineMs(header) < timeoutMs;
+            if(cutByDeadline){
+                timeoutMs = std::max(1, remainingDeadlineMs(header));
+            }
+
+            auto startTime = std::chrono::steady_clock::now();
+            try {
+                zmq::socket_t gaSocket(context, zmq::socket_type::req);
+                gaSocket.set(zmq::sockopt::rcvtimeo, timeoutMs);
+                gaSocket.set(zmq::sockopt::sndtimeo, timeoutMs);
+                gaSocket.set(zmq::sockopt::linger, 0);
+                gaSocket.connect(address);
+
+                //Sending consumes the message; the shared copy leaves the
+                //original for the next attempt without duplicating its bytes
+                zmq::message_t requestReference;
+                requestReference.copy(requestMessage);
+                gaSocket.send(requestReference, zmq::send_flags::none);
+
+                zmq::recv_result_t receiveResult = gaSocket.recv(reply, zmq::recv_flags::none);
+                if(receiveResult && reply.size() > 0){
+                    double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+                    recordSuccess(gaIndex, latencyMs, fixedTimeoutMs == 0);
+                    return GaReply::ANSWERED;
+                }
+                if(cutByDeadline){
+                    releaseProbe(gaIndex, isProbe);
+                    std::cout << "[" << logTag << "-Deadline] No answer from " << address << " before the deadline\n";
+                    return GaReply::EXPIRED;
+                }
+                std::cerr << "[" << logTag << "-Error] No answer from " << address << " within " << timeoutMs << " ms\n";
+            } catch (const zmq::error_t& error) {
+                std::cerr << "[" << logTag << "-Error] ZMQ error on attempt " << (attemptNumber + 1) << ": " << error.what() << "\n";
+            }
+            recordFailure(gaIndex, isProbe);
+        }
+        std::cerr << "[" << logTag << "-Error] All " << attempts << " attempts failed\n";
+        return GaReply::FAILED;
+    }
+
+    //The reply as text, for callers that take it apart: "ERROR" when no GA
+    //answered and the expired response when the deadline passed
+    std::string send(zmq::message_t &requestMessage, zmq::context_t &context, int fixedTimeoutMs){
+        zmq::message_t reply;
+        GaReply outcome = forward(requestMessage, context, fixedTimeoutMs, reply);
+        if(outcome == GaReply::ANSWERED){
+            return reply.to_string();
+        }
+        return outcome == GaReply::EXPIRED ? expiredRequestResponse : "ERROR";
+    }
+
+private:
+    //Preferred GA unless its breaker is open, then the other one. An open
+    //breaker past its wait becomes half-open and lets one probe through.
+    int chooseEndpoint(bool &isProbe){
+        std::lock_guard<std::mutex> lock(routerMutex);
+        int candidates[2] = {preferredIndex, 1 - preferredIndex};
+        for(int gaIndex : candidates){
+            GaEndpoint &endpoint = endpoints[gaIndex];
+            if(endpoint.breaker == BreakerState::OPEN &&
+               std::chrono::steady_clock::now() - endpoint.openedAt >= std::chrono::milliseconds(breakerOpenMs)){
+                endpoint.breaker = BreakerState::HALF_OPEN;
+                endpoint.probeInFlight = false;
+                std::cout << "[" << logTag << "-Breaker] Probing " << endpoint.address << "\n";
+            }
+            if(endpoint.breaker == BreakerState::CLOSED){
+                return gaIndex;
+            }
+            if(endpoint.breaker == BreakerState::HALF_OPEN && !endpoint.probeInFlight){
+                endpoint.probeInFlight = true;
+                isProbe = true;
+                return gaIndex;
+            }
+        }
+        //Both open: try the preferred one rather than failing without trying
+        return preferredIndex;
+    }
+
+    //A probe that was never sent leaves the breaker half-open for the next one
+    void releaseProbe(int gaIndex, bool isProbe){
+        if(isProbe){
+            std::lock_guard<std::mutex> lock(routerMutex);
+            endpoints[gaIndex].probeInFlight = false;
+        }
+    }
+
+    int adaptiveTimeoutMs(const GaEndpoint &endpoint) const{
+        if(endpoint.latencySamplesMs.size() < gaTimeoutMinSamples){
+            return gaTimeoutCeilingMs;
+        }
+        std::vector<double> sortedSamples = endpoint.latencySamplesMs;
+        std::size_t p99Rank = std::min(sortedSamples.size() - 1, sortedSamples.size() * 99 / 100);
+        std::nth_element(sortedSamples.begin(), sortedSamples.begin() + p99Rank, sortedSamples.end());
+        int timeoutMs = int(sortedSamples[p99Rank] * gaTimeoutP99Multiplier);
+        return std::max(gaTimeoutFloorMs, std::min(gaTimeoutCeilingMs, timeoutMs));
+    }
+
+    void recordSuccess(int gaIndex, double latencyMs, bool sampleLatency){
+        std::lock_guard<std::mutex> lock(routerMutex);
+        GaEndpoint &endpoint = endpoints[gaIndex];
+        if(sampleLatency){
+            if(endpoint.latencySamplesMs.size() < gaLatencySampleCount){
+                endpoint.latencySamplesMs.push_back(latencyMs);
+            } else {
+                endpoint.latencySamplesMs[endpoint.nextSample] = latencyMs;
+            }
+            endpoint.nextSample = (endpoint.nextSample + 1) % gaLatencySampleCount;
+        }
+        endpoint.consecutiveFailures = 0;
+        if(endpoint.breaker != BreakerState::CLOSED){
+            std::cout << "[" << logTag << "-Breaker] " << endpoint.address << " answered, closing breaker\n";
+        }
+        endpoint.breaker = BreakerState::CLOSED;
+        endpoint.probeInFlight = false;
+    }
+
+    void recordFailure(int gaIndex, bool isProbe){
+        std::lock_guard<std::mutex> lock(routerMutex);
+        GaEndpoint &endpoint = endpoints[gaIndex];
+        endpoint.consecutiveFailures++;
+        bool reopen = isProbe || endpoint.breaker == BreakerState::HALF_OPEN;
+        if(reopen || (endpoint.breaker == BreakerState::CLOSED && endpoint.consecutiveFailures >= breakerFailureThreshold)){
+            endpoint.breaker = BreakerState::OPEN;
+            endpoint.openedAt = std::chrono::steady_clock::now();
+            endpoint.probeInFlight = false;
+            std::cout << "[" << logTag << "-Breaker] Opened for " << endpoint.address << " after "
+                      << endpoint.consecutiveFailures << " consecutive failures\n";
+            //Old samples describe a GA that was answering (or a timeout that
+            //was too tight); it gets the ceiling until it proves fast again
+            endpoint.latencySamplesMs.clear();
+            endpoint.nextSample = 0;
+        }
+    }
+
+    std::string logTag;
+    std::mutex routerMutex;
+    GaEndpoint endpoints[2];
+    int preferredIndex = 0;
+};
+
+//The GA pair of every shard, each behind its own GaRouter; a request naming
+//one book goes to the pair of the shard that owns it
+class ShardRouter{
+public:
+    explicit ShardRouter(const std::string &actorTag) : logTag(actorTag){}
+
+    void configure(const std::string &primaryIp, const std::string &secondaryIp, int shardCount){
+        for(int shard = 0; shard < shardCount; shard++){
+            routers.emplace_back(new GaRouter(logTag));
+            routers.back()->configure(shardEndpoint(primaryIp, 5560, shard), shardEndpoint(secondaryIp, 5560, shard));
+        }
+    }
+
+    int shards() const{
+        return int(routers.size());
+    }
+
+    GaRouter &shard(int shard){
+        return *routers[shard];
+    }
+
+    GaReply forward(zmq::message_t &requestMessage, zmq::context_t &context, int fixedTimeoutMs, zmq::message_t &reply){
+        return routerFor(requestMessage).forward(requestMessage, context, fixedTimeoutMs, reply);
+    }
+
+    std::string send(zmq::message_t &requestMessage, zmq::context_t &context, int fixedTimeoutMs){
+        return routerFor(requestMessage).send(requestMessage, context, fixedTimeoutMs);
+    }
+
+private:
+    GaRouter &routerFor(const zmq::message_t &requestMessage){
+        Request header;
+        memcpy(&header, requestMessage.data(), sizeof(Request));
+        return *routers[shardOfBook(header.code, shards())];
+    }
+
+    std::string logTag;
+    std::vector<std::unique_ptr<GaRouter>> routers;
+};
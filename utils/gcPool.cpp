@@ -0,0 +1,164 @@
+#include <zmq.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+//A GC has this long to take a request (connecting first if needed) before
+//PS tries the next one
+const int gcAcceptTimeoutMs = 1000;
+//Waited past the request's deadline, time for GC to send back its Expired reply
+const int gcReplyGraceMs = 2000;
+//A GC that failed is skipped this long, doubling up to the maximum
+const int gcRetryBaseMs = 1000;
+const int gcRetryMaxMs = 30000;
+
+//A comma separated list of GCs, each host:port or a bare port on this
+//location's address
+bool parseGcEndpoints(const std::string &gcList, const std::string &siteAddress, std::vector<std::string> &gcEndpoints){
+    std::size_t itemStart = 0;
+    while(itemStart <= gcList.size()){
+        std::size_t itemEnd = std::min(gcList.find(',', itemStart), gcList.size());
+        std::string item = gcList.substr(itemStart, itemEnd - itemStart);
+        std::size_t portStart = item.rfind(':') == std::string::npos ? 0 : item.rfind(':') + 1;
+        int port;
+        char trailing;
+        if(portStart == 1 || std::sscanf(item.c_str() + portStart, "%d%c", &port, &trailing) != 1 || port < 1 || port > 65535){
+            return false;
+        }
+        gcEndpoints.push_back("tcp://" + (portStart == 0 ? siteAddress + ":" + item : item));
+        itemStart = itemEnd + 1;
+    }
+    return true;
+}
+
+struct GcEndpoint{
+    std::string address;
+    std::unique_ptr<zmq::socket_t> socket;
+    int consecutiveFailures = 0;
+    std::chrono::steady_clock::time_point retryAt;
+};
+
+//Spreads a PS's requests over a list of GCs in turn. A GC that does not take
+//a request or does not answer it is skipped until its backoff runs out, and
+//its socket is dropped so the next attempt reconnects. Requests are not
+//idempotent, so one goes to another GC only when the first never received it.
+class GcPool{
+public:
+    explicit GcPool(zmq::context_t &zmqContext) : context(zmqContext), nextIndex(std::size_t(getpid())){}
+
+    void addEndpoint(const std::string &address){
+        endpoints.emplace_back();
+        endpoints.back().address = address;
+    }
+
+    std::size_t size() const{
+        return endpoints.size();
+    }
+
+    const std::string &address(std::size_t index) const{
+        return endpoints[index].address;
+    }
+
+    //Waits for the reply up to the request's deadline and the grace period;
+    //one without a deadline waits as long as one with the deadline PS gives
+    //its kind, and a GC silent past that is taken for dead. False when no GC
+    //answered.
+    bool exchange(zmq::message_t &requestMessage, zmq::message_t &reply){
+        int replyTimeoutMs = defaultRequestDeadlineMs + gcReplyGraceMs;
+        if(requestMessage.size() >= sizeof(Request)){
+            Request header;
+            memcpy(&header, requestMessage.data(), sizeof(Request));
+            if(requestDeadline(header) != 0){
+                replyTimeoutMs = std::max(0, remainingDeadlineMs(header)) + gcReplyGraceMs;
+            } else if(header.requestType == RequestType::BULK){
+                replyTimeoutMs = bulkRequestDeadlineMs + gcReplyGraceMs;
+            }
+        }
+        for(std::size_t attempt = 0; attempt < endpoints.size(); attempt++){
+            GcEndpoint &endpoint = chooseEndpoint();
+            zmq::socket_t &socket = connectedSocket(endpoint);
+            //Sending consumes the message; the original is kept for another GC
+            zmq::message_t requestReference;
+            requestReference.copy(requestMessage);
+            if(!socket.send(requestReference, zmq::send_flags::none)){
+                markDown(endpoint, "did not take the request");
+                continue;
+            }
+            socket.set(zmq::sockopt::rcvtimeo, replyTimeoutMs);
+            if(socket.recv(reply, zmq::recv_flags::none)){
+                markUp(endpoint);
+                return true;
+            }
+            //It may have been applied, so it is not sent again
+            markDown(endpoint, "did not answer");
+            return false;
+        }
+        return false;
+    }
+
+    void close(){
+        for(GcEndpoint &endpoint : endpoints){
+            endpoint.socket.reset();
+        }
+    }
+
+private:
+    //Next GC in turn that is not being skipped; when all are, the one whose
+    //backoff ends first, rather than failing without trying
+    GcEndpoint &chooseEndpoint(){
+        auto now = std::chrono::steady_clock::now();
+        std::size_t soonestIndex = nextIndex % endpoints.size();
+        for(std::size_t offset = 0; offset < endpoints.size(); offset++){
+            std::size_t index = (nextIndex + offset) % endpoints.size();
+            if(endpoints[index].retryAt <= now){
+                nextIndex = index + 1;
+                return endpoints[index];
+            }
+            if(endpoints[index].retryAt < endpoints[soonestIndex].retryAt){
+                soonestIndex = index;
+            }
+        }
+        nextIndex = soonestIndex + 1;
+        return endpoints[soonestIndex];
+    }
+
+    //With immediate set a request only queues on a finished connection, so a
+    //send that times out never reached the GC
+    zmq::socket_t &connectedSocket(GcEndpoint &endpoint){
+        if(!endpoint.socket){
+            endpoint.socket.reset(new zmq::socket_t(context, zmq::socket_type::req));
+            endpoint.socket->set(zmq::sockopt::immediate, true);
+            endpoint.socket->set(zmq::sockopt::sndtimeo, gcAcceptTimeoutMs);
+            endpoint.socket->set(zmq::sockopt::linger, 0);
+            endpoint.socket->connect(endpoint.address);
+        }
+        return *endpoint.socket;
+    }
+
+    void markDown(GcEndpoint &endpoint, const std::string &reason){
+        endpoint.consecutiveFailures++;
+        int backoffMs = std::min(gcRetryBaseMs << std::min(endpoint.consecutiveFailures - 1, 5), gcRetryMaxMs);
+        endpoint.retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoffMs);
+        //A REQ socket left waiting for a reply cannot send again
+        endpoint.socket.reset();
+        std::cerr << "[PS-GC] " << endpoint.address << " " << reason << ", skipping it for " << backoffMs << " ms\n";
+    }
+
+    void markUp(GcEndpoint &endpoint){
+        if(endpoint.consecutiveFailures > 0){
+            std::cout << "[PS-GC] " << endpoint.address << " is answering again\n";
+        }
+        endpoint.consecutiveFailures = 0;
+        endpoint.retryAt = std::chrono::steady_clock::time_point();
+    }
+
+    zmq::context_t &context;
+    std::vector<GcEndpoint> endpoints;
+    std::size_t nextIndex;
+};
@@ -0,0 +1,247 @@
+#include <zmq.hpp>
+#include <iostream>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct JournalHeader{
+    char magic[8];
+    //Positions only grow; a record lives at position % capacity
+    std::uint64_t head;
+    std::uint64_t tail;
+    //Sequences below this may have been handed out, so a restart resumes here
+    std::uint64_t reservedSequence;
+    //Chosen at random when the file is created, so a recreated journal never
+    //hands out the keys of an earlier one
+    std::uint32_t epoch;
+    std::uint32_t padding;
+};
+
+struct JournalRecord{
+    Request request;
+    std::uint64_t sequence;
+};
+
+//Sequences reserved on disk at a time; the unused rest of a block is skipped
+//after a restart
+const std::uint64_t journalSequenceBlock = 1024;
+
+//Fixed-capacity, memory-mapped ring of requests kept on local disk. Every
+//append is flushed with msync before it is acknowledged, so an accepted
+//request survives a crash of the actor.
+class RequestJournal{
+public:
+    ~RequestJournal(){
+        if(mapping){
+            munmap(mapping, mappingSize);
+        }
+        if(fileDescriptor >= 0){
+            close(fileDescriptor);
+        }
+    }
+
+    bool open(const std::string &path, const std::string &writerTag, std::uint64_t recordCapacity){
+        std::lock_guard<std::mutex> lock(journalMutex);
+        capacity = recordCapacity;
+        mappingSize = sizeof(JournalHeader) + capacity * sizeof(JournalRecord);
+        std::memset(writerId, 0, sizeof(writerId));
+        std::memcpy(writerId, writerTag.data(), std::min(writerTag.size(), sizeof(writerId)));
+
+        fileDescriptor = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if(fileDescriptor < 0 || ftruncate(fileDescriptor, off_t(mappingSize)) != 0){
+            return false;
+        }
+        void *mappedFile = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+        if(mappedFile == MAP_FAILED){
+            return false;
+        }
+        mapping = static_cast<char*>(mappedFile);
+
+        JournalHeader *header = journalHeader();
+        if(std::memcmp(header->magic, "REQJRNL2", 8) != 0){
+            std::memset(header, 0, sizeof(JournalHeader));
+            std::memcpy(header->magic, "REQJRNL2", 8);
+            std::random_device randomSource;
+            header->epoch = randomSource();
+            flush(header, sizeof(JournalHeader));
+        }
+        nextSequence = header->reservedSequence;
+        return true;
+    }
+
+    bool isOpen(){
+        return mapping != nullptr;
+    }
+
+    bool hasPending(){
+        std::lock_guard<std::mutex> lock(journalMutex);
+        return mapping && journalHeader()->head < journalHeader()->tail;
+    }
+
+    std::uint64_t pendingCount(){
+        std::lock_guard<std::mutex> lock(journalMutex);
+        return mapping ? journalHeader()->tail - journalHeader()->head : 0;
+    }
+
+    //Hands out the sequence of a request before its first attempt, so one
+    //that times out (and may have been applied) is journaled under the key
+    //it was sent with
+    std::uint64_t reserveSequence(){
+        std::lock_guard<std::mutex> lock(journalMutex);
+        JournalHeader *header = mapping ? journalHeader() : nullptr;
+        if(header && nextSequence >= header->reservedSequence){
+            header->reservedSequence = nextSequence + journalSequenceBlock;
+            flush(header, sizeof(JournalHeader));
+        }
+        return nextSequence++;
+    }
+
+    //The request followed by its idempotency key: the writer's tag, the
+    //journal's epoch and the sequence
+    void buildKeyedRequest(const Request &request, std::uint64_t sequence, std::string &keyedRequest){
+        std::lock_guard<std::mutex> lock(journalMutex);
+        buildKeyedRequestLocked(request, sequence, keyedRequest);
+    }
+
+    //Returns false when the journal is full or not open
+    bool append(const Request &request, std::uint64_t sequence){
+        std::lock_guard<std::mutex> lock(journalMutex);
+        JournalHeader *header = mapping ? journalHeader() : nullptr;
+        if(!header || header->tail - header->head >= capacity){
+            return false;
+        }
+        JournalRecord *record = journalRecord(header->tail);
+        record->request = request;
+        //Replayed long after its sender stopped waiting, and already
+        //acknowledged, so a journaled request keeps no deadline
+        std::memset(record->request.deadline, 0, sizeof(record->request.deadline));
+        record->sequence = sequence;
+        flush(record, sizeof(JournalRecord));
+
+        header->tail++;
+        flush(header, sizeof(JournalHeader));
+        return true;
+    }
+
+    //Builds the oldest pending request followed by its idempotency key
+    bool peek(std::string &keyedRequest){
+        std::lock_guard<std::mutex> lock(journalMutex);
+        JournalHeader *header = mapping ? journalHeader() : nullptr;
+        if(!header || header->head >= header->tail){
+            return false;
+        }
+        JournalRecord *record = journalRecord(header->head);
+        buildKeyedRequestLocked(record->request, record->sequence, keyedRequest);
+        return true;
+    }
+
+    //Drops the oldest pending request once GA has answered it
+    void popHead(){
+        std::lock_guard<std::mutex> lock(journalMutex);
+        JournalHeader *header = mapping ? journalHeader() : nullptr;
+        if(!header || header->head >= header->tail){
+            return;
+        }
+        header->head++;
+        flush(header, sizeof(JournalHeader));
+    }
+
+private:
+    JournalHeader *journalHeader(){
+        return reinterpret_cast<JournalHeader*>(mapping);
+    }
+
+    JournalRecord *journalRecord(std::uint64_t position){
+        return reinterpret_cast<JournalRecord*>(mapping + sizeof(JournalHeader)) + position % capacity;
+    }
+
+    void buildKeyedRequestLocked(const Request &request, std::uint64_t sequence, std::string &keyedRequest){
+        std::uint32_t epoch = mapping ? journalHeader()->epoch : 0;
+        keyedRequest.assign(reinterpret_cast<const char*>(&request), sizeof(Request));
+        appendRequestKey(keyedRequest, writerId, epoch, sequence);
+    }
+
+    void flush(void *address, std::size_t length){
+        std::uintptr_t pageSize = std::uintptr_t(sysconf(_SC_PAGESIZE));
+        std::uintptr_t start = reinterpret_cast<std::uintptr_t>(address) & ~(pageSize - 1);
+        std::uintptr_t end = reinterpret_cast<std::uintptr_t>(address) + length;
+        msync(reinterpret_cast<void*>(start), end - start, MS_SYNC);
+    }
+
+    std::mutex journalMutex;
+    int fileDescriptor = -1;
+    char *mapping = nullptr;
+    std::size_t mappingSize = 0;
+    std::uint64_t capacity = 0;
+    std::uint64_t nextSequence = 0;
+    char writerId[4];
+};
+
+//Replays the journal of an actor in order, one request at a time; the head
+//is dropped only once a GA has answered it, so a request whose answer was
+//lost is sent again under the same key
+void drainJournal(RequestJournal &journal, ShardRouter &router, zmq::context_t &context, std::atomic<bool> &running,
+                  const std::string &logTag){
+    while(running){
+        std::string keyedRequest;
+        if(!journal.peek(keyedRequest)){
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            continue;
+        }
+
+        zmq::message_t journaledMessage(keyedRequest.data(), keyedRequest.size());
+        std::string gaResponse = router.send(journaledMessage, context, 0);
+        if(gaResponse == "ERROR"){
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+
+        journal.popHead();
+        std::cout << "[" << logTag << "-Journal] Replayed journaled request: " << gaResponse
+                  << " (" << journal.pendingCount() << " pending)\n";
+    }
+}
+
+//Forwards a request from GC and leaves in gaReply what goes back to it. In
+//journal mode the request carries its journal key from the first attempt:
+//one that timed out may have been applied, and its replay under the same
+//key is then answered without applying it again. Once anything is
+//journaled, later requests queue behind it to keep order, and a request no
+//GA answered is journaled and acknowledged. operationName goes in the
+//replies ("return", "renewal").
+void forwardJournaled(RequestJournal &journal, bool journalMode, ShardRouter &router, zmq::context_t &context,
+                      zmq::message_t &gcRequest, const Request &parsedRequest, const std::string &operationName,
+                      zmq::message_t &gaReply){
+    std::uint64_t journalSequence = 0;
+    if(journalMode){
+        std::string keyedRequest;
+        journalSequence = journal.reserveSequence();
+        journal.buildKeyedRequest(parsedRequest, journalSequence, keyedRequest);
+        gcRequest.rebuild(keyedRequest.data(), keyedRequest.size());
+    }
+
+    GaReply outcome = GaReply::FAILED;
+    bool journalBacklog = journalMode && journal.hasPending();
+    if(!journalBacklog){
+        outcome = router.forward(gcRequest, context, 0, gaReply);
+    }
+
+    if(outcome == GaReply::FAILED){
+        std::string fallbackResponse = journalMode && journal.append(parsedRequest, journalSequence) ?
+            "Accepted: " + operationName + " queued and will be applied when the library system is reachable" :
+            "Error: Could not process " + operationName + " operation";
+        gaReply.rebuild(fallbackResponse.data(), fallbackResponse.size());
+    } else if(outcome == GaReply::EXPIRED){
+        gaReply.rebuild(expiredRequestResponse.data(), expiredRequestResponse.size());
+    }
+}
@@ -0,0 +1,92 @@
+#include <zmq.hpp>
+#include <cstdlib>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+//Size classes are powers of two from the smallest up; larger messages are
+//allocated on their own
+const std::size_t poolSmallestBuffer = 256;
+const int poolClassCount = 13;
+//Free buffers kept per class; the rest go back to the allocator
+const std::size_t poolBuffersPerClass = 64;
+
+//Hands out messages whose buffers come from a free list per size class.
+//ZMQ returns a buffer once the last reference to its message is gone, from
+//whichever thread dropped it, so the lists are guarded by a mutex.
+class MessagePool{
+public:
+    MessagePool(){
+        for(int sizeClass = 0; sizeClass < poolClassCount; sizeClass++){
+            classes[sizeClass].pool = this;
+            classes[sizeClass].capacity = poolSmallestBuffer << sizeClass;
+            classes[sizeClass].freeBuffers.reserve(poolBuffersPerClass);
+        }
+    }
+
+    ~MessagePool(){
+        for(SizeClass &sizeClass : classes){
+            for(void *buffer : sizeClass.freeBuffers){
+                std::free(buffer);
+            }
+        }
+    }
+
+    MessagePool(const MessagePool&) = delete;
+    MessagePool &operator=(const MessagePool&) = delete;
+
+    //A message of exactly size bytes; its contents are left to the caller
+    zmq::message_t acquire(std::size_t size){
+        int sizeClassIndex = classFor(size);
+        if(sizeClassIndex < 0){
+            return zmq::message_t(size);
+        }
+        SizeClass &sizeClass = classes[sizeClassIndex];
+        void *buffer = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            if(!sizeClass.freeBuffers.empty()){
+                buffer = sizeClass.freeBuffers.back();
+                sizeClass.freeBuffers.pop_back();
+            }
+        }
+        if(!buffer){
+            buffer = std::malloc(sizeClass.capacity);
+            if(!buffer){
+                return zmq::message_t(size);
+            }
+        }
+        return zmq::message_t(buffer, size, &MessagePool::release, &sizeClass);
+    }
+
+private:
+    struct SizeClass{
+        MessagePool *pool = nullptr;
+        std::size_t capacity = 0;
+        std::vector<void*> freeBuffers;
+    };
+
+    static int classFor(std::size_t size){
+        for(int sizeClass = 0; sizeClass < poolClassCount; sizeClass++){
+            if(size <= poolSmallestBuffer << sizeClass){
+                return sizeClass;
+            }
+        }
+        return -1;
+    }
+
+    static void release(void *buffer, void *hint){
+        SizeClass &sizeClass = *static_cast<SizeClass*>(hint);
+        {
+            std::lock_guard<std::mutex> lock(sizeClass.pool->poolMutex);
+            if(sizeClass.freeBuffers.size() < poolBuffersPerClass){
+                sizeClass.freeBuffers.push_back(buffer);
+                return;
+            }
+        }
+        std::free(buffer);
+    }
+
+    std::mutex poolMutex;
+    SizeClass classes[poolClassCount];
+};
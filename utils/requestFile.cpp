@@ -0,0 +1,172 @@
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const char compiledRequestMagic[8] = {'P', 'S', 'R', 'E', 'Q', '0', '1', '\0'};
+
+//A compiled request file is this header followed by requestCount packed
+//Request records, already in wire format
+struct CompiledRequestHeader{
+    char magic[8];
+    std::uint64_t requestCount;
+};
+
+enum struct RequestLine{
+    PARSED,
+    MALFORMED,
+    END
+};
+
+//Reads a request file through a read-only mapping. Text files hold one
+//"<LOAN|RENEWAL|RETURN> <code> <location>" per line; lines are found with
+//memchr, which libc vectorises, and each is tokenized in a single pass with
+//no allocation. Compiled files are handed out record by record as they are.
+class RequestFileReader{
+public:
+    ~RequestFileReader(){
+        if(mapping){
+            munmap(mapping, mappingSize);
+        }
+        if(fileDescriptor >= 0){
+            close(fileDescriptor);
+        }
+    }
+
+    bool open(const std::string &path){
+        fileDescriptor = ::open(path.c_str(), O_RDONLY);
+        struct stat fileStatus;
+        if(fileDescriptor < 0 || fstat(fileDescriptor, &fileStatus) != 0){
+            return false;
+        }
+        mappingSize = std::size_t(fileStatus.st_size);
+        if(mappingSize == 0){
+            return true;
+        }
+        void *mappedFile = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        if(mappedFile == MAP_FAILED){
+            mappingSize = 0;
+            return false;
+        }
+        mapping = static_cast<char*>(mappedFile);
+        madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+        position = mapping;
+        end = mapping + mappingSize;
+
+        CompiledRequestHeader header;
+        if(mappingSize >= sizeof(header)){
+            memcpy(&header, mapping, sizeof(header));
+            if(memcmp(header.magic, compiledRequestMagic, sizeof(header.magic)) == 0){
+                //A truncated file keeps the records it holds in full
+                compiled = true;
+                compiledCount = std::min<std::uint64_t>(header.requestCount, (mappingSize - sizeof(header)) / sizeof(Request));
+                position = mapping + sizeof(header);
+            }
+        }
+        return true;
+    }
+
+    bool isCompiled() const{ return compiled; }
+
+    RequestLine next(Request &request){
+        if(compiled){
+            if(compiledRead == compiledCount){
+                return RequestLine::END;
+            }
+            memcpy(&request, position, sizeof(Request));
+            position += sizeof(Request);
+            compiledRead++;
+            return RequestLine::PARSED;
+        }
+
+        while(position < end){
+            const char *lineEnd = static_cast<const char*>(memchr(position, '\n', std::size_t(end - position)));
+            if(!lineEnd){
+                lineEnd = end;
+            }
+            const char *lineStart = position;
+            position = lineEnd < end ? lineEnd + 1 : end;
+            if(isBlank(lineStart, lineEnd)){
+                continue;
+            }
+            return parseLine(lineStart, lineEnd, request) ? RequestLine::PARSED : RequestLine::MALFORMED;
+        }
+        return RequestLine::END;
+    }
+
+private:
+    static bool isSpace(char character){
+        return character == ' ' || character == '\t' || character == '\r';
+    }
+
+    static bool isBlank(const char *cursor, const char *lineEnd){
+        while(cursor < lineEnd && isSpace(*cursor)){
+            cursor++;
+        }
+        return cursor == lineEnd;
+    }
+
+    //Reads an optionally signed decimal field, leaving cursor after it
+    static bool parseNumber(const char *&cursor, const char *lineEnd, std::int64_t &value){
+        while(cursor < lineEnd && isSpace(*cursor)){
+            cursor++;
+        }
+        bool negative = cursor < lineEnd && *cursor == '-';
+        if(negative){
+            cursor++;
+        }
+        const char *digitsStart = cursor;
+        value = 0;
+        while(cursor < lineEnd && *cursor >= '0' && *cursor <= '9' && cursor - digitsStart < 10){
+            value = value * 10 + (*cursor - '0');
+            cursor++;
+        }
+        if(negative){
+            value = -value;
+        }
+        return cursor > digitsStart && (cursor == lineEnd || isSpace(*cursor));
+    }
+
+    static bool parseLine(const char *cursor, const char *lineEnd, Request &request){
+        while(isSpace(*cursor)){
+            cursor++;
+        }
+        const char *typeStart = cursor;
+        while(cursor < lineEnd && !isSpace(*cursor)){
+            cursor++;
+        }
+        std::size_t typeLength = std::size_t(cursor - typeStart);
+        if(typeLength == 4 && memcmp(typeStart, "LOAN", 4) == 0){
+            request.requestType = RequestType::LOAN;
+        } else if(typeLength == 7 && memcmp(typeStart, "RENEWAL", 7) == 0){
+            request.requestType = RequestType::RENEWAL;
+        } else if(typeLength == 6 && memcmp(typeStart, "RETURN", 6) == 0){
+            request.requestType = RequestType::RETURN;
+        } else {
+            return false;
+        }
+
+        std::int64_t bookCode, location;
+        if(!parseNumber(cursor, lineEnd, bookCode) || !parseNumber(cursor, lineEnd, location) || !isBlank(cursor, lineEnd) ||
+           bookCode < INT32_MIN || bookCode > INT32_MAX || location < 1 || location > 127){
+            return false;
+        }
+        request.code = std::int32_t(bookCode);
+        request.location = std::int8_t(location - 1);
+        request.source = RequestSource::BATCH;
+        return true;
+    }
+
+    int fileDescriptor = -1;
+    char *mapping = nullptr;
+    std::size_t mappingSize = 0;
+    const char *position = nullptr;
+    const char *end = nullptr;
+    bool compiled = false;
+    std::uint64_t compiledCount = 0;
+    std::uint64_t compiledRead = 0;
+};
@@ -0,0 +1,23 @@
+#include <string>
+#include <cstdio>
+
+//Every shard of a site runs on the site's GA hosts with the GA ports moved up
+//by this much per shard: shard 1 on 5560-5567, shard 2 on 5570-5577...
+const int shardPortStride = 10;
+const int maxShardCount = 8;
+
+//Shard (0-based) that owns a book. Codes are split by remainder, so a run of
+//new consecutive codes spreads over every shard instead of filling one.
+int shardOfBook(int bookCode, int shardCount){
+    int shard = bookCode % shardCount;
+    return shard < 0 ? shard + shardCount : shard;
+}
+
+std::string shardEndpoint(const std::string &ipAddress, int basePort, int shard){
+    return "tcp://" + ipAddress + ":" + std::to_string(basePort + shard * shardPortStride);
+}
+
+bool parseShardCount(const std::string &text, int &shardCount){
+    char trailing;
+    return std::sscanf(text.c_str(), "%d%c", &shardCount, &trailing) == 1 && shardCount >= 1 && shardCount <= maxShardCount;
+}
@@ -2,16 +2,78 @@
 #include <cstdint>
 
 
-//enum for the request type
-enum struct RequestType{
+//enum for the request type; one byte, which on the little-endian hosts we
+//run on is where the low byte of the old int-sized field was
+enum struct RequestType : std::uint8_t{
     LOAN,
     RENEWAL,
-    RETURN
+    RETURN,
+    OVERDUE,
+    BULK,
+    //Catalog search: the query text follows the Request, code holds the
+    //number of results wanted (0 for the default)
+    SEARCH,
+    //Joins the waitlist of a book with no copies left at the site: the
+    //patron's name follows the Request
+    RESERVE,
+    //A patron's basket: code holds the number of items, which follow as
+    //packed Request records, and checkoutMode says how failures are handled
+    CHECKOUT
+};
+
+//Who sent a request, so GC can schedule file replays behind people at the counter
+enum struct RequestSource : std::uint8_t{
+    INTERACTIVE,
+    BATCH
+};
+
+//CHECKOUT applies what it can and reports every item, or applies every item
+//or none of them
+enum struct CheckoutMode : std::uint8_t{
+    PER_ITEM,
+    ALL_OR_NOTHING
 };
 
 //Structure for handling requests
 struct Request{
     RequestType requestType;
+    //The three bytes the type gave up: when the sender stops waiting, see
+    //utils/deadline.cpp; all zero is no deadline
+    std::uint8_t deadline[3] = {0, 0, 0};
     std::int32_t code;
     std::int8_t location;
-};
\ No newline at end of file
+    //Takes a byte of what was padding, the wire size stays at 12
+    RequestSource source = RequestSource::INTERACTIVE;
+    //Another byte of padding, only read on CHECKOUT
+    CheckoutMode checkoutMode = CheckoutMode::PER_ITEM;
+};
+static_assert(sizeof(Request) == 12, "Request is sent and stored as 12 raw bytes");
+
+//Per-row result of a BULK request, one byte per operation in the reply
+enum struct BulkOutcome : std::uint8_t{
+    OK,
+    BOOK_NOT_FOUND,
+    NO_COPIES,
+    NO_ACTIVE_LOAN,
+    RENEWAL_LIMIT,
+    FAILED,
+    //Dropped unapplied because the request's deadline passed first
+    EXPIRED
+};
+
+//A BULK message is a Request header whose code holds the number of
+//operations, followed by that many packed Request records
+const std::int32_t maxBulkOperations = 20000;
+//A CHECKOUT is laid out like BULK but is a patron at the desk, not a batch
+const std::int32_t maxCheckoutItems = 50;
+
+//Results a SEARCH returns when its code is 0, and the most it may ask for
+const std::size_t defaultSearchResults = 10;
+const std::size_t maxSearchResults = 50;
+
+//Keyed requests travel with a 16-byte idempotency key after the Request: 4
+//bytes naming the writer, its 4-byte epoch (of the journal, or of the
+//process for loans) and an 8-byte sequence number
+const std::size_t requestKeySize = 16;
+//Writer and epoch, the part of the key shared by all of one journal's requests
+const std::size_t requestKeyPrefixSize = 8;
\ No newline at end of file
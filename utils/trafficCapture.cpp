@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <chrono>
+
+const char captureMagic[8] = {'G', 'C', 'C', 'A', 'P', '0', '1', '\0'};
+//stdio buffer of the capture file; the GC loop only copies into it
+const std::size_t captureBufferBytes = 1 << 20;
+
+enum struct CaptureRecordKind : std::uint8_t{
+    REQUEST,
+    REPLY
+};
+
+//Every record is this header followed by payloadSize bytes: the request as
+//the PS sent it, or the text GC answered with
+struct CaptureRecordHeader{
+    CaptureRecordKind kind;
+    std::uint8_t reserved[3];
+    std::uint32_t payloadSize;
+    //Pairs a reply with its request
+    std::uint64_t requestId;
+    //Nanoseconds since the capture started, at arrival or at reply
+    std::int64_t elapsedNs;
+};
+
+//Records what reaches GC from the PS and when it was answered. Writes go
+//through a large stdio buffer, so the cost on the GC loop is a memcpy; the
+//buffer is flushed every few seconds and on close.
+class TrafficCapture{
+public:
+    ~TrafficCapture(){
+        close();
+    }
+
+    bool open(const std::string &path){
+        captureFile = std::fopen(path.c_str(), "wb");
+        if(!captureFile){
+            return false;
+        }
+        std::setvbuf(captureFile, nullptr, _IOFBF, captureBufferBytes);
+        std::fwrite(captureMagic, 1, sizeof(captureMagic), captureFile);
+        startTime = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    bool isActive() const{
+        return captureFile != nullptr;
+    }
+
+    //Id for the reply record, 0 when not capturing
+    std::uint64_t recordRequest(const void *payload, std::size_t payloadSize){
+        if(!captureFile){
+            return 0;
+        }
+        writeRecord(CaptureRecordKind::REQUEST, ++lastRequestId, payload, payloadSize);
+        return lastRequestId;
+    }
+
+    void recordReply(std::uint64_t requestId, const void *response, std::size_t responseSize){
+        if(captureFile && requestId != 0){
+            writeRecord(CaptureRecordKind::REPLY, requestId, response, responseSize);
+        }
+    }
+
+    void flush(){
+        if(captureFile){
+            std::fflush(captureFile);
+        }
+    }
+
+    void close(){
+        if(captureFile){
+            std::fclose(captureFile);
+            captureFile = nullptr;
+        }
+    }
+
+private:
+    void writeRecord(CaptureRecordKind kind, std::uint64_t requestId, const void *payload, std::size_t payloadSize){
+        CaptureRecordHeader header{};
+        header.kind = kind;
+        header.payloadSize = std::uint32_t(payloadSize);
+        header.requestId = requestId;
+        header.elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+        std::fwrite(&header, sizeof(header), 1, captureFile);
+        std::fwrite(payload, 1, payloadSize, captureFile);
+    }
+
+    std::FILE *captureFile = nullptr;
+    std::chrono::steady_clock::time_point startTime;
+    std::uint64_t lastRequestId = 0;
+};